@@ -0,0 +1,298 @@
+/**
+    * @author Dyakonov Oleg <o.u.dyakonov@gmail.com>
+    *
+    * @brief bench_coro - coroutine flows of ToneIotCoro over a memory client on a Linux host
+*/
+
+/**************************************************************
+ *
+ * Build with env bench_coro (platform native, C++20):
+ *   pio run -e bench_coro
+ *   .pio/build/bench_coro/program --requests 2000
+ *
+ * The socket is a memory client, it acknowledges every function and
+ * answers function BENCH_FUNCTION with a frame of BENCH_FUNCTION_RX, so
+ * the flows run without network:
+ *
+ *   request - co_await send() until ACK, then co_await receive() of
+ *             the answer, time of one round trip
+ *   nested  - the same round trip in a flow awaited by other flow
+ *   sleep   - co_await sleep(1), time until resumed by millis()
+ *
+ * Every flow must end with 0 and return its frame to the pool, else the
+ * program exits with 1. Results are printed as lines
+ *   BENCH {"scenario": ..., ...}
+ *
+ **************************************************************/
+
+#include <Arduino.h>
+#include <Client.h>
+#include <ToneIotCoro.h>
+
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include <algorithm>
+#include <vector>
+
+#if !defined(TOCO_ENABLED)
+#error "bench_coro needs -std=gnu++20 -fcoroutines"
+#endif
+
+// BENCH_FUNCTION : function acknowledged and answered by memory client
+#define BENCH_FUNCTION 20
+
+// BENCH_FUNCTION_RX : answer of BENCH_FUNCTION
+#define BENCH_FUNCTION_RX 21
+
+// BENCH_PAYLOAD : bytes of frames
+#define BENCH_PAYLOAD 16
+
+// BENCH_REQUESTS : round trips of every scenario. Override with --requests
+#define BENCH_REQUESTS 1000
+
+// BENCH_RX_SIZE : bytes of frames waiting in memory client
+#define BENCH_RX_SIZE 1024
+
+static uint64_t clockUs() {
+
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+unsigned long millis() {
+    return clockUs() / 1000ULL;
+}
+
+unsigned long micros() {
+    return clockUs();
+}
+
+void delay(unsigned long ms) {
+    usleep(ms * 1000);
+}
+
+void yield() {}
+
+/**
+ * @brief socket in memory: INIT and DISCONNECT are answered, every user
+ * function is acknowledged, BENCH_FUNCTION is answered by BENCH_FUNCTION_RX
+ * with the same data
+ *
+ */
+class BenchClient : public Client {
+
+public:
+
+   BenchClient() : online(false), rxPos(0), rxLen(0) {}
+
+   int connect(IPAddress ip, uint16_t port) { return connect("", port); }
+
+   int connect(const char* host, uint16_t port) {
+      this->online = true;
+      this->rxPos = this->rxLen = 0;
+      return 1;
+   }
+
+   size_t write(uint8_t b) { return write(&b, 1); }
+
+   size_t write(const uint8_t* buf, size_t size) {
+
+      ToneIotPacketView packet((uint8_t*)buf);
+      uint16_t function = 0;
+
+      if (size < ToneIotPacketView::HEADER_SIZE) return size;
+      memcpy(this->id, packet.getId(), ToneIotPacketView::ID_SIZE);
+      function = packet.getFunction() & TOIC_FUNCTION_MASK;
+      // empty INIT answer: all functions enabled, no flow control
+      if (function == TOIC_FUNCTION_SYS_INIT) push(TOIC_FUNCTION_SYS_INIT, 0, NULL, 0);
+      else if (function == TOIC_FUNCTION_SYS_DISCONNECT || function >= BENCH_FUNCTION) push(TOIC_FUNCTION_SYS_ACK, packet.getMsgId(), NULL, 0);
+      if (function == BENCH_FUNCTION) push(BENCH_FUNCTION_RX, packet.getMsgId(), packet.getData(), packet.getDataLen());
+      return size;
+   }
+
+   int available() { return this->rxLen - this->rxPos; }
+   int read() { return available() ? this->rx[this->rxPos++] : -1; }
+
+   int read(uint8_t* buf, size_t size) {
+
+      int n = std::min((int)size, available());
+
+      memcpy(buf, &this->rx[this->rxPos], n);
+      this->rxPos += n;
+      return n;
+   }
+
+   int peek() { return available() ? this->rx[this->rxPos] : -1; }
+   void flush() {}
+   void stop() { this->online = false; }
+   uint8_t connected() { return this->online; }
+   operator bool() { return this->online; }
+
+private:
+
+   bool        online;
+   uint8_t     rx[BENCH_RX_SIZE];
+   uint16_t    rxPos;
+   uint16_t    rxLen;
+   uint8_t     id[ToneIotPacketView::ID_SIZE];
+
+   void push(uint16_t function, uint16_t msgId, const uint8_t* data, uint16_t len) {
+
+      ToneIotPacketView packet;
+
+      // unread bytes move to the front, answers are never dropped
+      memmove(this->rx, &this->rx[this->rxPos], this->rxLen - this->rxPos);
+      this->rxLen -= this->rxPos;
+      this->rxPos = 0;
+      if (this->rxLen + ToneIotPacketView::HEADER_SIZE + len > BENCH_RX_SIZE) return;
+      packet = ToneIotPacketView(&this->rx[this->rxLen]);
+      packet.setId(this->id);
+      packet.setMsgId(msgId);
+      packet.setFunction(function);
+      packet.setDataLen(len);
+      if (len) memcpy(packet.getData(), data, len);
+      this->rxLen += packet.getSize();
+   }
+};
+
+static std::vector<uint32_t> samples;
+static uint8_t payload[BENCH_PAYLOAD];
+
+static uint32_t percentile(uint8_t p) {
+    if (samples.empty()) return 0;
+    return samples[((uint32_t)(samples.size() - 1) * p + 50) / 100];
+}
+
+// ======================================== flows ======================================
+
+// one round trip: ACK of BENCH_FUNCTION and its answer with the same data
+static ToneIotCoro roundTrip(ToneIotCoClient& co) {
+
+    ToneIotCoClient::message_t msg;
+
+    if (co_await co.send(BENCH_FUNCTION, payload, BENCH_PAYLOAD) != TOIC_SEND::ACK) co_return -1;
+    msg = co_await co.receive(BENCH_FUNCTION_RX, 1000);
+    if (msg.buf == NULL || msg.len != BENCH_PAYLOAD || memcmp(msg.buf, payload, BENCH_PAYLOAD) != 0) co_return -1;
+    co_return 0;
+}
+
+static ToneIotCoro flowRequest(ToneIotCoClient& co, uint32_t requests, bool nested) {
+
+    if (co_await co.connect()) co_return -1;
+    for (uint32_t i = 0; i < requests; i++) {
+        uint32_t t = micros();
+        if (nested) {
+            ToneIotCoro child = roundTrip(co);
+            if (!child.valid() || co_await child) co_return -1;
+        } else {
+            ToneIotCoClient::message_t msg;
+            if (co_await co.send(BENCH_FUNCTION, payload, BENCH_PAYLOAD) != TOIC_SEND::ACK) co_return -1;
+            msg = co_await co.receive(BENCH_FUNCTION_RX, 1000);
+            if (msg.buf == NULL || msg.len != BENCH_PAYLOAD) co_return -1;
+        }
+        samples.push_back(micros() - t);
+    }
+    co_return 0;
+}
+
+static ToneIotCoro flowSleep(ToneIotCoClient& co, uint32_t requests) {
+
+    for (uint32_t i = 0; i < requests; i++) {
+        uint32_t t = micros();
+        co_await co.sleep(1);
+        samples.push_back(micros() - t);
+    }
+    co_return 0;
+}
+
+// rings of client are cache line aligned
+static ToneIotClient* newClient(BenchClient& socket) {
+
+    void* memory = NULL;
+    ToneIotClient* client = NULL;
+
+    if (posix_memalign(&memory, alignof(ToneIotClient), sizeof(ToneIotClient)) != 0) {
+        perror("bench");
+        exit(1);
+    }
+    client = new (memory) ToneIotClient(socket);
+    client->setKeepAlive(0);
+    client->setFunctionQos(BENCH_FUNCTION, TOIC_QOS::AT_LEAST_ONCE);
+    return client;
+}
+
+static void freeClient(ToneIotClient* client) {
+    client->disconnect();
+    client->~ToneIotClient();
+    free(client);
+}
+
+/**
+ * @brief run scenario until its flow is done
+ *
+ * @return int8_t result of flow, -1 - failed or frame is not returned to pool
+ */
+static int8_t bench(const char* scenario, uint32_t requests) {
+
+    BenchClient socket;
+    ToneIotClient* client = newClient(socket);
+    ToneIotCoClient co(*client);
+    uint32_t start = millis();
+    uint32_t ms = 0;
+    int8_t result = -1;
+
+    samples.clear();
+    {
+        ToneIotCoro flow = strcmp(scenario, "sleep") == 0 ? flowSleep(co, requests) : flowRequest(co, requests, strcmp(scenario, "nested") == 0);
+        while (flow.valid() && !flow.done() && millis() - start < requests * 10 + 1000) co.loop();
+        result = flow.result();
+    }
+    ms = millis() - start;
+    if (ToneIotCoro::getFreeFrames() != TOCO_FRAME_POOL) result = -1;
+    std::sort(samples.begin(), samples.end());
+    printf("BENCH {\"scenario\": \"%s\", \"result\": %d, \"n\": %u, \"flows_per_s\": %lu, "
+           "\"p50_us\": %u, \"p90_us\": %u, \"p99_us\": %u, \"max_us\": %u, \"frame_size\": %u, \"frame_pool\": %u}\n",
+           scenario, result, (unsigned)samples.size(), (unsigned long)(ms ? (uint64_t)samples.size() * 1000 / ms : 0),
+           percentile(50), percentile(90), percentile(99), samples.empty() ? 0 : samples.back(),
+           (unsigned)TOCO_FRAME_SIZE, (unsigned)TOCO_FRAME_POOL);
+    fflush(stdout);
+    freeClient(client);
+    return result;
+}
+
+static void usage(const char* name) {
+    fprintf(stderr, "usage: %s [--requests %d]\n", name, BENCH_REQUESTS);
+}
+
+int main(int argc, char** argv) {
+
+    static const struct option options[] = {
+        {"requests", required_argument, NULL, 'r'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+    uint32_t requests = BENCH_REQUESTS;
+    int8_t failed = 0;
+    int opt = 0;
+
+    while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1) {
+        switch (opt) {
+        case 'r': requests = atoi(optarg); break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    for (uint16_t i = 0; i < sizeof(payload); i++) payload[i] = i;
+    samples.reserve(requests);
+
+    failed |= bench("request", requests);
+    failed |= bench("nested", requests);
+    failed |= bench("sleep", requests / 10 + 1);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,590 @@
+/**
+    * @author Dyakonov Oleg <o.u.dyakonov@gmail.com>
+    *
+    * @brief bench_micro - microbenchmarks of ToneIotClient hot paths on a Linux host
+*/
+
+/**************************************************************
+ *
+ * Build with env bench_micro (platform native):
+ *   pio run -e bench_micro
+ *   .pio/build/bench_micro/program --out bench_new.json
+ *   tools/bench_compare.py bench/baseline.json bench_new.json
+ *
+ * Every benchmark is calibrated until one run takes --min-time ms, then
+ * repeated --repetitions times, the median is reported with the spread of
+ * the repetitions (stddev, min, max), bench_compare.py does not flag changes
+ * inside it. The socket is a
+ * memory client: it answers INIT and DISCONNECT and feeds server frames
+ * without end, so only library code is measured.
+ *
+ * Output is a table on stdout and, with --out, JSON in the format of
+ * Google Benchmark (benchmarks[].name, iterations, real_time, cpu_time,
+ * time_unit, plus cpu_stddev, cpu_min, cpu_max, repetitions) and the host
+ * in context (cpu model, kernel, load), read by tools/bench_compare.py.
+ * Regenerate bench/baseline.json on the host the comparisons run on.
+ *
+ **************************************************************/
+
+#include <Arduino.h>
+#include <Client.h>
+#include <ToneIotClient.h>
+#include <ToneIotSettings.h>
+#include <Base64.h>
+
+#include <time.h>
+#include <math.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/utsname.h>
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+// BENCH_MIN_TIME : ms of one calibrated run. Override with --min-time
+#define BENCH_MIN_TIME 200
+
+// BENCH_REPETITIONS : calibrated runs, median is reported. Override with --repetitions
+#define BENCH_REPETITIONS 5
+
+// BENCH_FUNCTION : first user function of benchmarks
+#define BENCH_FUNCTION 20
+
+// BENCH_RX_SIZE : bytes of frames waiting in memory client
+#define BENCH_RX_SIZE 1024
+
+// keeps value computed in benchmark loop
+template<typename T>
+static inline void keep(T const& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+static uint64_t clockNs(clockid_t clock) {
+
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+unsigned long millis() {
+    return clockNs(CLOCK_MONOTONIC) / 1000000ULL;
+}
+
+unsigned long micros() {
+    return clockNs(CLOCK_MONOTONIC) / 1000ULL;
+}
+
+void delay(unsigned long ms) {
+    usleep(ms * 1000);
+}
+
+void yield() {
+}
+
+/**
+ * @brief timed region of benchmark, the body runs iterations times between
+ * start() and stop()
+ *
+ */
+class BenchState {
+
+public:
+
+   BenchState(uint64_t iterations) : iterations(iterations), realNs(0), cpuNs(0), realStart(0), cpuStart(0) {}
+
+   void start() {
+      this->realStart = clockNs(CLOCK_MONOTONIC);
+      this->cpuStart = clockNs(CLOCK_PROCESS_CPUTIME_ID);
+   }
+
+   void stop() {
+      this->cpuNs += clockNs(CLOCK_PROCESS_CPUTIME_ID) - this->cpuStart;
+      this->realNs += clockNs(CLOCK_MONOTONIC) - this->realStart;
+   }
+
+   uint64_t    iterations;
+   uint64_t    realNs;
+   uint64_t    cpuNs;
+
+private:
+
+   uint64_t    realStart;
+   uint64_t    cpuStart;
+};
+
+/**
+ * @brief socket in memory: written frames are dropped after INIT and
+ * DISCONNECT are answered, with feed() set every read gets the next
+ * server frame with a new msgId
+ *
+ */
+class BenchClient : public Client {
+
+public:
+
+   BenchClient() : online(false), rxPos(0), rxLen(0), feedFunction(0), feedLen(0), msgId(0) {}
+
+   int connect(IPAddress ip, uint16_t port) { return connect("", port); }
+
+   int connect(const char* host, uint16_t port) {
+      this->online = true;
+      this->rxPos = this->rxLen = 0;
+      this->msgId = 0;
+      return 1;
+   }
+
+   size_t write(uint8_t b) { return write(&b, 1); }
+
+   size_t write(const uint8_t* buf, size_t size) {
+
+      ToneIotPacketView packet((uint8_t*)buf);
+
+      if (size < ToneIotPacketView::HEADER_SIZE) return size;
+      memcpy(this->id, packet.getId(), ToneIotPacketView::ID_SIZE);
+      // empty INIT answer: all functions enabled, no flow control
+      if (packet.getFunction() == TOIC_FUNCTION_SYS_INIT) push(TOIC_FUNCTION_SYS_INIT, 0, 0);
+      if ((packet.getFunction() & TOIC_FUNCTION_MASK) == TOIC_FUNCTION_SYS_DISCONNECT) push(TOIC_FUNCTION_SYS_ACK, packet.getMsgId(), 0);
+      return size;
+   }
+
+   int available() {
+      if (this->rxPos == this->rxLen && this->feedFunction != 0 && this->online) push(this->feedFunction, ++this->msgId, this->feedLen);
+      return this->rxLen - this->rxPos;
+   }
+
+   int read() { return available() ? this->rx[this->rxPos++] : -1; }
+
+   int read(uint8_t* buf, size_t size) {
+
+      int n = std::min((int)size, available());
+
+      memcpy(buf, &this->rx[this->rxPos], n);
+      this->rxPos += n;
+      return n;
+   }
+
+   int peek() { return available() ? this->rx[this->rxPos] : -1; }
+   void flush() {}
+   void stop() { this->online = false; }
+   uint8_t connected() { return this->online; }
+   operator bool() { return this->online; }
+
+   // frames of function with len bytes of data are read without end, 0 - none
+   void feed(uint16_t function, uint16_t len) {
+      this->feedFunction = function;
+      this->feedLen = len;
+   }
+
+private:
+
+   bool        online;
+   uint8_t     rx[BENCH_RX_SIZE];
+   uint16_t    rxPos;
+   uint16_t    rxLen;
+   uint16_t    feedFunction;
+   uint16_t    feedLen;
+   uint16_t    msgId;
+   uint8_t     id[ToneIotPacketView::ID_SIZE];
+
+   void push(uint16_t function, uint16_t msgId, uint16_t len) {
+
+      ToneIotPacketView packet;
+
+      if (this->rxPos == this->rxLen) this->rxPos = this->rxLen = 0;
+      if (this->rxLen + ToneIotPacketView::HEADER_SIZE + len > BENCH_RX_SIZE) return;
+      packet = ToneIotPacketView(&this->rx[this->rxLen]);
+      packet.setId(this->id);
+      packet.setMsgId(msgId);
+      packet.setFunction(function);
+      packet.setDataLen(len);
+      memset(packet.getData(), 0x5A, len);
+      this->rxLen += packet.getSize();
+   }
+};
+
+// rings of client are cache line aligned
+static ToneIotClient* allocClient(BenchClient& socket) {
+
+    void* memory = NULL;
+
+    if (posix_memalign(&memory, alignof(ToneIotClient), sizeof(ToneIotClient)) != 0) {
+        perror("bench");
+        exit(1);
+    }
+    return new (memory) ToneIotClient(socket);
+}
+
+static void freeClient(ToneIotClient* client) {
+    client->~ToneIotClient();
+    free(client);
+}
+
+// client connected to memory socket with functions BENCH_FUNCTION.. registered
+static ToneIotClient* newClient(BenchClient& socket, uint16_t functions, uint32_t* calls) {
+
+    ToneIotClient* client = allocClient(socket);
+
+    for (uint16_t i = 0; i < functions; i++) {
+        client->setFunction(BENCH_FUNCTION + i, [calls](uint8_t* buf, uint16_t len) { (*calls)++; });
+    }
+    if (client->connect()) {
+        fprintf(stderr, "bench: connect to memory client failed\n");
+        exit(1);
+    }
+    return client;
+}
+
+// ======================================== benchmarks ======================================
+
+static void benchBase64Encode(BenchState& state) {
+
+    char input[32];
+    char output[48];
+
+    memset(input, 0xA5, sizeof(input));
+    state.start();
+    for (uint64_t i = 0; i < state.iterations; i++) {
+        keep(Base64.encode(output, input, sizeof(input)));
+    }
+    state.stop();
+}
+
+static void benchBase64Decode(BenchState& state) {
+
+    char input[] = "AQIDBAUGBwgJAAECAwQFBgcICQABAgMEBQYHCAkAAQI=";
+    char output[36];
+
+    state.start();
+    for (uint64_t i = 0; i < state.iterations; i++) {
+        keep(Base64.decode(output, input, sizeof(input) - 1));
+    }
+    state.stop();
+}
+
+static void benchSetToneIotServer(BenchState& state) {
+
+    BenchClient socket;
+    ToneIotClient* client = allocClient(socket);
+    char token[] = TONE_TOKEN;
+
+    state.start();
+    for (uint64_t i = 0; i < state.iterations; i++) {
+        keep(client->setToneIotServer(token));
+    }
+    state.stop();
+    freeClient(client);
+}
+
+static void benchSendFunctio(BenchState& state, uint16_t len) {
+
+    BenchClient socket;
+    uint32_t calls = 0;
+    ToneIotClient* client = newClient(socket, 1, &calls);
+    uint8_t data[TOIC_MAX_PACKET_SIZE];
+    uint64_t failed = 0;
+
+    memset(data, 0x3C, len);
+    state.start();
+    for (uint64_t i = 0; i < state.iterations; i++) {
+        if (client->sendFunctio(BENCH_FUNCTION, data, len)) failed++;
+    }
+    state.stop();
+    if (failed) {
+        fprintf(stderr, "bench: %llu of %llu frames not sent\n", (unsigned long long)failed, (unsigned long long)state.iterations);
+        exit(1);
+    }
+    freeClient(client);
+}
+
+static void benchSendFunctio16(BenchState& state) { benchSendFunctio(state, 16); }
+static void benchSendFunctio200(BenchState& state) { benchSendFunctio(state, 200); }
+
+// loop(): readPacket() of one frame and dispatch to handler functions-th
+static void benchReceive(BenchState& state, uint16_t functions, uint16_t function, uint16_t len) {
+
+    BenchClient socket;
+    uint32_t calls = 0;
+    ToneIotClient* client = newClient(socket, functions, &calls);
+
+    socket.feed(function, len);
+    state.start();
+    for (uint64_t i = 0; i < state.iterations; i++) {
+        keep(client->loop());
+    }
+    state.stop();
+    if (function != 0x3FFF && calls != state.iterations) {
+        fprintf(stderr, "bench: %u of %llu frames dispatched\n", calls, (unsigned long long)state.iterations);
+        exit(1);
+    }
+    freeClient(client);
+}
+
+// frame of function without handler, parse only
+static void benchReadPacket16(BenchState& state) { benchReceive(state, 0, 0x3FFF, 16); }
+static void benchReadPacket200(BenchState& state) { benchReceive(state, 0, 0x3FFF, 200); }
+// handler is the last one in the table
+static void benchDispatch1(BenchState& state) { benchReceive(state, 1, BENCH_FUNCTION, 16); }
+static void benchDispatch16(BenchState& state) { benchReceive(state, 16, BENCH_FUNCTION + 15, 16); }
+static void benchDispatch256(BenchState& state) { benchReceive(state, 256, BENCH_FUNCTION + 255, 16); }
+
+// connect(): INIT with functions, answer and enable; the link is dropped between
+static void benchHandshake(BenchState& state, uint16_t functions) {
+
+    BenchClient socket;
+    uint32_t calls = 0;
+    ToneIotClient* client = newClient(socket, functions, &calls);
+
+    state.start();
+    for (uint64_t i = 0; i < state.iterations; i++) {
+        socket.stop();
+        keep(client->connect());
+    }
+    state.stop();
+    freeClient(client);
+}
+
+static void benchHandshake16(BenchState& state) { benchHandshake(state, 16); }
+static void benchHandshake256(BenchState& state) { benchHandshake(state, 256); }
+
+// handler of function: raw pointer, std::function and cbFunction_t of setFunction()
+static uint32_t callbackCalls = 0;
+
+static void callbackCount(uint8_t* buf, uint16_t len) {
+    callbackCalls++;
+}
+
+// the callable is reloaded every iteration, the call is not inlined
+template<typename Callable>
+static void benchCallback(BenchState& state, Callable callback) {
+
+    uint8_t data[16];
+
+    callbackCalls = 0;
+    state.start();
+    for (uint64_t i = 0; i < state.iterations; i++) {
+        keep(&callback);
+        callback(data, sizeof(data));
+    }
+    state.stop();
+    keep(callbackCalls);
+}
+
+static void benchCallbackPointer(BenchState& state) {
+    benchCallback<void (*)(uint8_t*, uint16_t)>(state, callbackCount);
+}
+
+static void benchCallbackStdFunction(BenchState& state) {
+
+    uint32_t* calls = &callbackCalls;
+
+    benchCallback<std::function<void(uint8_t*, uint16_t)> >(state, [calls](uint8_t* buf, uint16_t len) { (*calls)++; });
+}
+
+static void benchCallbackInplace(BenchState& state) {
+
+    uint32_t* calls = &callbackCalls;
+
+    benchCallback<ToneIotClient::cbFunction_t>(state, [calls](uint8_t* buf, uint16_t len) { (*calls)++; });
+}
+
+typedef struct {
+   const char*    name;
+   void           (*run)(BenchState& state);
+} bench_t;
+
+static const bench_t benches[] = {
+   {"Base64/encode/32", benchBase64Encode},
+   {"Base64/decode/44", benchBase64Decode},
+   {"ToneIotClient/setToneIotServer", benchSetToneIotServer},
+   {"ToneIotClient/sendFunctio/16", benchSendFunctio16},
+   {"ToneIotClient/sendFunctio/200", benchSendFunctio200},
+   {"ToneIotClient/readPacket/16", benchReadPacket16},
+   {"ToneIotClient/readPacket/200", benchReadPacket200},
+   {"ToneIotClient/dispatch/1", benchDispatch1},
+   {"ToneIotClient/dispatch/16", benchDispatch16},
+   {"ToneIotClient/dispatch/256", benchDispatch256},
+   {"ToneIotClient/handshake/16", benchHandshake16},
+   {"ToneIotClient/handshake/256", benchHandshake256},
+   {"Callback/pointer", benchCallbackPointer},
+   {"Callback/std::function", benchCallbackStdFunction},
+   {"Callback/ToneIotInplaceFunction", benchCallbackInplace},
+};
+
+// ======================================== runner ======================================
+
+typedef struct {
+   const char*    name;
+   uint64_t       iterations;
+   double         realNs;      ///< per iteration, median of repetitions
+   double         cpuNs;
+   double         cpuStddev;   ///< ns, sample standard deviation of repetitions
+   double         cpuMin;
+   double         cpuMax;
+   uint8_t        repetitions;
+} result_t;
+
+static result_t measure(const bench_t& bench, uint32_t minTime, uint8_t repetitions) {
+
+    uint64_t iterations = 1;
+    std::vector<double> real;
+    std::vector<double> cpu;
+    result_t result;
+    double mean = 0;
+    double squares = 0;
+
+    // calibration: iterations grow until one run takes minTime
+    for (;;) {
+        BenchState state(iterations);
+        bench.run(state);
+        if (state.realNs >= (uint64_t)minTime * 1000000ULL || iterations >= (1ULL << 40)) break;
+        if (state.realNs < (uint64_t)minTime * 100000ULL) iterations *= 10;
+        else iterations = iterations * (uint64_t)minTime * 1000000ULL * 12 / 10 / state.realNs + 1;
+    }
+    for (uint8_t r = 0; r < repetitions; r++) {
+        BenchState state(iterations);
+        bench.run(state);
+        real.push_back((double)state.realNs / iterations);
+        cpu.push_back((double)state.cpuNs / iterations);
+    }
+    std::sort(real.begin(), real.end());
+    std::sort(cpu.begin(), cpu.end());
+    result.name = bench.name;
+    result.iterations = iterations;
+    result.realNs = real[real.size() / 2];
+    result.cpuNs = cpu[cpu.size() / 2];
+    for (double ns : cpu) mean += ns / cpu.size();
+    for (double ns : cpu) squares += (ns - mean) * (ns - mean);
+    result.cpuStddev = cpu.size() > 1 ? sqrt(squares / (cpu.size() - 1)) : 0;
+    result.cpuMin = cpu.front();
+    result.cpuMax = cpu.back();
+    result.repetitions = repetitions;
+    return result;
+}
+
+/**
+ * @brief value of the first line of file starting with key, "" - none
+ *
+ * @param path - file, /proc/cpuinfo or sysfs
+ * @param key - start of line, NULL - the first line
+ */
+static void readLine(const char* path, const char* key, char* value, size_t size) {
+
+    char line[256];
+    char* start = NULL;
+    FILE* f = fopen(path, "r");
+
+    value[0] = 0;
+    if (f == NULL) return;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (key != NULL && strncmp(line, key, strlen(key)) != 0) continue;
+        start = key != NULL && strchr(line, ':') != NULL ? strchr(line, ':') + 1 : line;
+        while (*start == ' ' || *start == '\t') start++;
+        start[strcspn(start, "\r\n\"\\")] = 0;
+        // long values are cut
+        size = std::min(strlen(start), size - 1);
+        memcpy(value, start, size);
+        value[size] = 0;
+        break;
+    }
+    fclose(f);
+}
+
+static void writeJson(FILE* f, const std::vector<result_t>& results, uint32_t minTime, uint8_t repetitions) {
+
+    char host[64] = "";
+    char date[32] = "";
+    char cpuModel[128] = "";
+    char governor[32] = "";
+    double load[3] = {0, 0, 0};
+    struct utsname name;
+    time_t now = time(NULL);
+
+    gethostname(host, sizeof(host) - 1);
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", localtime(&now));
+    readLine("/proc/cpuinfo", "model name", cpuModel, sizeof(cpuModel));
+    readLine("/sys/devices/system/cpu/cpu0/cpufreq/scaling_governor", NULL, governor, sizeof(governor));
+    if (uname(&name) != 0) memset(&name, 0, sizeof(name));
+    getloadavg(load, 3);
+    fprintf(f, "{\n  \"context\": {\n");
+    fprintf(f, "    \"date\": \"%s\",\n    \"host_name\": \"%s\",\n", date, host);
+    fprintf(f, "    \"cpu_model\": \"%s\",\n", cpuModel);
+    fprintf(f, "    \"num_cpus\": %ld,\n", sysconf(_SC_NPROCESSORS_ONLN));
+    fprintf(f, "    \"cpu_scaling_governor\": \"%s\",\n", governor);
+    fprintf(f, "    \"kernel\": \"%s %s %s\",\n", name.sysname, name.release, name.machine);
+    fprintf(f, "    \"load_avg\": [%.2f, %.2f, %.2f],\n", load[0], load[1], load[2]);
+    fprintf(f, "    \"compiler\": \"%s\",\n", __VERSION__);
+    fprintf(f, "    \"min_time_ms\": %u,\n    \"repetitions\": %u,\n", minTime, repetitions);
+    fprintf(f, "    \"library_build_type\": \"%s\"\n  },\n", __OPTIMIZE__ + 0 ? "release" : "debug");
+    fprintf(f, "  \"benchmarks\": [\n");
+    for (size_t i = 0; i < results.size(); i++) {
+        fprintf(f, "    {\"name\": \"%s\", \"iterations\": %llu, \"real_time\": %.2f, \"cpu_time\": %.2f, \"time_unit\": \"ns\", "
+                "\"repetitions\": %u, \"cpu_stddev\": %.2f, \"cpu_min\": %.2f, \"cpu_max\": %.2f}%s\n",
+                results[i].name, (unsigned long long)results[i].iterations, results[i].realNs, results[i].cpuNs,
+                results[i].repetitions, results[i].cpuStddev, results[i].cpuMin, results[i].cpuMax,
+                i + 1 < results.size() ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+}
+
+static void usage(const char* name) {
+    fprintf(stderr, "usage: %s [--filter SUBSTRING] [--min-time %d] [--repetitions %d] [--out bench.json] [--list]\n",
+            name, BENCH_MIN_TIME, BENCH_REPETITIONS);
+}
+
+int main(int argc, char** argv) {
+
+    static const struct option options[] = {
+        {"filter", required_argument, NULL, 'f'},
+        {"min-time", required_argument, NULL, 't'},
+        {"repetitions", required_argument, NULL, 'r'},
+        {"out", required_argument, NULL, 'o'},
+        {"list", no_argument, NULL, 'l'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+    const char* filter = NULL;
+    const char* out = NULL;
+    uint32_t minTime = BENCH_MIN_TIME;
+    uint8_t repetitions = BENCH_REPETITIONS;
+    std::vector<result_t> results;
+    FILE* f = NULL;
+    int opt = 0;
+
+    while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1) {
+        switch (opt) {
+        case 'f': filter = optarg; break;
+        case 't': minTime = atoi(optarg); break;
+        case 'r': repetitions = std::max(1, atoi(optarg)); break;
+        case 'o': out = optarg; break;
+        case 'l':
+            for (const bench_t& bench : benches) printf("%s\n", bench.name);
+            return 0;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    printf("%-34s %12s %12s %8s %12s\n", "Benchmark", "Time ns", "CPU ns", "+-CPU %", "Iterations");
+    for (const bench_t& bench : benches) {
+        if (filter != NULL && strstr(bench.name, filter) == NULL) continue;
+        results.push_back(measure(bench, minTime, repetitions));
+        printf("%-34s %12.1f %12.1f %8.1f %12llu\n", results.back().name, results.back().realNs, results.back().cpuNs,
+               results.back().cpuNs > 0 ? results.back().cpuStddev * 100 / results.back().cpuNs : 0,
+               (unsigned long long)results.back().iterations);
+        fflush(stdout);
+    }
+
+    if (out != NULL) {
+        f = fopen(out, "w");
+        if (f == NULL) {
+            perror(out);
+            return 1;
+        }
+        writeJson(f, results, minTime, repetitions);
+        fclose(f);
+    }
+    return 0;
+}
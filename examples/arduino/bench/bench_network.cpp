@@ -0,0 +1,401 @@
+/**
+    * @author Dyakonov Oleg <o.u.dyakonov@gmail.com>
+    * 
+    * @brief bench_network - end-to-end scenarios of ToneIotClient over SIM800 transparent mode
+*/
+
+/**************************************************************
+ *
+ * Build with env bench_network (platform native) or, on the board, with
+ * env bench_network_esp32. Results are printed to console as lines
+ *   BENCH {"scenario": ..., ...}
+ * and collected by tools/bench_network.py, which also shapes the link:
+ *   tools/bench_network.py run --exec .pio/build/bench_network/program
+ *   tools/bench_network.py run --console /dev/ttyUSB0 --modem /dev/ttyUSB1
+ *
+ * On host SerialAT is the pty of tools/sim800_emulator.py, argument 1 or
+ * BENCH_LINK. On the board it goes to its SIM800 or, for shaped links, to
+ * a USB-serial adapter served by tools/sim800_emulator.py --serial; only
+ * the board measures the real modem and UART.
+ * The server must acknowledge BENCH_FUNCTION and close the connection
+ * on BENCH_FUNCTION_DROP (tools/bench_network.py does).
+ *
+ **************************************************************/
+
+#include <Arduino.h>
+
+#if defined(ESP32)
+#define SIM800L_IP5306_VERSION_20200811
+
+#include "utilities.h"
+#else
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+#include <sys/ioctl.h>
+#endif
+
+#include <ToneIotClient.h>
+#include <ToneIotSim800Client.h>
+
+#if defined(ESP32)
+#define SerialMon Serial
+#define SerialAT Serial1
+#else
+// BENCH_LINK : pty of tools/sim800_emulator.py, same as --link of tools/bench_network.py
+#define BENCH_LINK "/tmp/ttySIM800"
+#endif
+
+// BENCH_FUNCTION : function acknowledged by server
+#define BENCH_FUNCTION 20
+
+// BENCH_FUNCTION_DROP : server closes the connection after this function
+#define BENCH_FUNCTION_DROP 0x3FF0
+
+// BENCH_CONNECTS : handshakes measured
+#define BENCH_CONNECTS 5
+
+// BENCH_REQUESTS : request/ACK round trips measured
+#define BENCH_REQUESTS 50
+
+// BENCH_REQUEST_PAYLOAD : bytes of request
+#define BENCH_REQUEST_PAYLOAD 16
+
+// BENCH_THROUGHPUT_MS : duration of sustained telemetry
+#define BENCH_THROUGHPUT_MS 30000
+
+// BENCH_TELEMETRY_PAYLOAD : bytes of telemetry frame
+#define BENCH_TELEMETRY_PAYLOAD 200
+
+// BENCH_WINDOW : telemetry frames waiting ACK
+#define BENCH_WINDOW 8
+
+// BENCH_DROPS : connection drops measured
+#define BENCH_DROPS 3
+
+// BENCH_RECOVERY_MS : give up recovery after
+#define BENCH_RECOVERY_MS 120000
+
+#if !defined(ESP32)
+static uint64_t clockUs() {
+
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+unsigned long millis() {
+    return clockUs() / 1000ULL;
+}
+
+unsigned long micros() {
+    return clockUs();
+}
+
+void delay(unsigned long ms) {
+    usleep(ms * 1000);
+}
+
+// loop() polls the serial port, the process does not spin at full CPU
+void yield() {
+    usleep(100);
+}
+
+/**
+ * @brief console on stdout, lines go to tools/bench_network.py at once
+ *
+ */
+class HostConsole : public Print {
+
+public:
+
+   void begin(unsigned long baud) {}
+
+   size_t write(uint8_t b) { return write(&b, 1); }
+
+   size_t write(const uint8_t* buf, size_t size) {
+      size_t n = fwrite(buf, 1, size, stdout);
+      fflush(stdout);
+      return n;
+   }
+};
+
+/**
+ * @brief raw serial port on pty of SIM800 emulator
+ *
+ */
+class HostSerial : public Stream {
+
+public:
+
+   HostSerial() : fd(-1), peeked(-1) {}
+
+   int8_t open(const char* path) {
+
+      struct termios tio;
+
+      this->fd = ::open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+      if (this->fd < 0) return -1;
+      if (tcgetattr(this->fd, &tio) == 0) {
+         cfmakeraw(&tio);
+         tcsetattr(this->fd, TCSANOW, &tio);
+      }
+      return 0;
+   }
+
+   size_t write(uint8_t b) { return write(&b, 1); }
+
+   size_t write(const uint8_t* buf, size_t size) {
+
+      size_t n = 0;
+      ssize_t ret = 0;
+
+      while (n < size) {
+         ret = ::write(this->fd, buf + n, size - n);
+         if (ret > 0) n += ret;
+         else usleep(100);
+      }
+      return n;
+   }
+
+   int available() {
+
+      int n = 0;
+
+      if (ioctl(this->fd, FIONREAD, &n) != 0) n = 0;
+      return n + (this->peeked >= 0 ? 1 : 0);
+   }
+
+   int read() {
+
+      uint8_t b = 0;
+      int ret = this->peeked;
+
+      if (ret >= 0) {
+         this->peeked = -1;
+         return ret;
+      }
+      return ::read(this->fd, &b, 1) == 1 ? b : -1;
+   }
+
+   int peek() {
+      if (this->peeked < 0) this->peeked = read();
+      return this->peeked;
+   }
+
+private:
+
+   int         fd;
+   int         peeked;
+};
+
+HostConsole SerialMon;
+HostSerial SerialAT;
+#endif
+
+const char apn[] = "m.tinkoff.";
+const char gprsUser[] = "";
+const char gprsPass[] = "";
+
+ToneIotSim800Client client(SerialAT);
+ToneIotClient toneiotclient(client);
+
+uint8_t payload[BENCH_TELEMETRY_PAYLOAD];
+uint32_t samples[BENCH_REQUESTS];
+
+uint16_t telemetryPending = 0;
+uint32_t telemetryAcked = 0;
+uint32_t telemetryFailed = 0;
+
+void cbTelemetry(ToneIotClient::sendHandle_t handle, TOIC_SEND result, uint16_t error)
+{
+    telemetryPending--;
+    if (result == TOIC_SEND::ACK) telemetryAcked++;
+    else telemetryFailed++;
+}
+
+// percentile of sorted samples
+uint32_t percentile(uint32_t* sorted, uint16_t n, uint8_t p)
+{
+    if (n == 0) return 0;
+    return sorted[((uint32_t)(n - 1) * p + 50) / 100];
+}
+
+void sortSamples(uint32_t* buf, uint16_t n)
+{
+    for (uint16_t i = 1; i < n; i++) {
+        uint32_t v = buf[i];
+        uint16_t j = i;
+        while (j > 0 && buf[j - 1] > v) {
+            buf[j] = buf[j - 1];
+            j--;
+        }
+        buf[j] = v;
+    }
+}
+
+void printSamples(const char* scenario, uint16_t n, uint16_t fail)
+{
+    sortSamples(samples, n);
+    SerialMon.printf("BENCH {\"scenario\": \"%s\", \"n\": %u, \"fail\": %u, \"p50_ms\": %lu, \"p90_ms\": %lu, \"p99_ms\": %lu, \"max_ms\": %lu}\n",
+                     scenario, n, fail,
+                     (unsigned long)percentile(samples, n, 50), (unsigned long)percentile(samples, n, 90),
+                     (unsigned long)percentile(samples, n, 99), (unsigned long)(n ? samples[n - 1] : 0));
+}
+
+// connect with retries until timeout
+int8_t benchConnect(uint32_t timeout)
+{
+    uint32_t start = millis();
+    while (toneiotclient.connect() != 0) {
+        if (millis() - start >= timeout) return -1;
+        delay(100);
+    }
+    return 0;
+}
+
+// handshake: TCP connect through modem + INIT
+void benchConnectTime()
+{
+    uint16_t n = 0;
+    uint16_t fail = 0;
+
+    for (uint16_t i = 0; i < BENCH_CONNECTS; i++) {
+        uint32_t t = millis();
+        if (toneiotclient.connect() != 0) {
+            fail++;
+            continue;
+        }
+        samples[n++] = millis() - t;
+        toneiotclient.disconnect();
+    }
+    printSamples("connect", n, fail);
+}
+
+// request RTT: function and its ACK
+void benchRequest()
+{
+    uint16_t n = 0;
+    uint16_t fail = 0;
+
+    if (benchConnect(BENCH_RECOVERY_MS)) return;
+    for (uint16_t i = 0; i < BENCH_REQUESTS; i++) {
+        uint32_t t = millis();
+        toneiotclient.sendFunctio(BENCH_FUNCTION, payload, BENCH_REQUEST_PAYLOAD);
+        if (toneiotclient.waitServerRespons() != TOIC_FUNCTION_SYS_ACK) {
+            fail++;
+            continue;
+        }
+        samples[n++] = millis() - t;
+    }
+    printSamples("request", n, fail);
+}
+
+// sustained telemetry with window of asynchronous sends, bytes on wire per payload byte
+void benchThroughput()
+{
+    uint32_t start = 0;
+    uint32_t elapsed = 0;
+
+    if (benchConnect(BENCH_RECOVERY_MS)) return;
+    telemetryPending = 0;
+    telemetryAcked = 0;
+    telemetryFailed = 0;
+    toneiotclient.resetStats();
+    start = millis();
+    while (millis() - start < BENCH_THROUGHPUT_MS) {
+        while (telemetryPending < BENCH_WINDOW) {
+            if (toneiotclient.sendFunctioAsync(BENCH_FUNCTION, payload, BENCH_TELEMETRY_PAYLOAD, cbTelemetry) == TOIC_SEND_HANDLE_INVALID) break;
+            telemetryPending++;
+        }
+        if (toneiotclient.loop() != 0) break;
+    }
+    // answers of the last window
+    while (telemetryPending > 0 && toneiotclient.loop() == 0) yield();
+    elapsed = millis() - start;
+
+    ToneIotClient::stats_t stats = toneiotclient.getStats();
+    uint32_t useful = telemetryAcked * BENCH_TELEMETRY_PAYLOAD;
+    SerialMon.printf("BENCH {\"scenario\": \"throughput\", \"ms\": %lu, \"acked\": %lu, \"fail\": %lu, \"payload_Bps\": %lu, "
+                     "\"wire_tx\": %lu, \"wire_rx\": %lu, \"wire_per_payload\": %.3f, \"retransmits\": %lu}\n",
+                     (unsigned long)elapsed, (unsigned long)telemetryAcked, (unsigned long)telemetryFailed,
+                     (unsigned long)(elapsed ? (uint64_t)useful * 1000 / elapsed : 0),
+                     (unsigned long)stats.txBytes, (unsigned long)stats.rxBytes,
+                     useful ? (double)(stats.txBytes + stats.rxBytes) / useful : 0.0,
+                     (unsigned long)stats.retransmits);
+}
+
+// recovery: server drops the connection, time until the next request is acknowledged
+void benchRecovery()
+{
+    uint16_t n = 0;
+    uint16_t fail = 0;
+
+    for (uint16_t i = 0; i < BENCH_DROPS; i++) {
+        if (benchConnect(BENCH_RECOVERY_MS)) {
+            fail++;
+            continue;
+        }
+        toneiotclient.sendFunctio(BENCH_FUNCTION_DROP);
+        uint32_t t = millis();
+        while (toneiotclient.connected() && millis() - t < BENCH_RECOVERY_MS) toneiotclient.loop();
+        if (benchConnect(BENCH_RECOVERY_MS - (millis() - t))) {
+            fail++;
+            continue;
+        }
+        toneiotclient.sendFunctio(BENCH_FUNCTION, payload, BENCH_REQUEST_PAYLOAD);
+        if (toneiotclient.waitServerRespons() != TOIC_FUNCTION_SYS_ACK) {
+            fail++;
+            continue;
+        }
+        samples[n++] = millis() - t;
+    }
+    printSamples("recovery", n, fail);
+}
+
+void setup()
+{
+    SerialMon.begin(115200);
+    delay(10);
+
+#if defined(ESP32)
+    setupModem();
+    SerialAT.begin(115200, SERIAL_8N1, MODEM_RX, MODEM_TX);
+#endif
+    client.setApn(apn, gprsUser, gprsPass);
+    toneiotclient.setKeepAlive(0);
+
+    for (uint16_t i = 0; i < BENCH_TELEMETRY_PAYLOAD; i++) payload[i] = i;
+
+    // modem registers in network after power on
+    if (benchConnect(BENCH_RECOVERY_MS) == 0) toneiotclient.disconnect();
+
+    SerialMon.println("BENCH {\"event\": \"start\"}");
+    benchConnectTime();
+    benchRequest();
+    benchThroughput();
+    benchRecovery();
+    toneiotclient.disconnect();
+    SerialMon.println("BENCH {\"event\": \"done\"}");
+}
+
+void loop()
+{
+    delay(1000);
+}
+
+#if !defined(ESP32)
+int main(int argc, char** argv)
+{
+    const char* link = argc > 1 ? argv[1] : BENCH_LINK;
+
+    if (SerialAT.open(link)) {
+        fprintf(stderr, "bench: can not open %s\n", link);
+        return 1;
+    }
+    setup();
+    return 0;
+}
+#endif
@@ -0,0 +1,253 @@
+/**
+    * @author Dyakonov Oleg <o.u.dyakonov@gmail.com>
+    *
+    * @brief bench_ring - producer/consumer throughput and latency of ToneIotRing under std::thread on a Linux host
+*/
+
+/**************************************************************
+ *
+ * Build with env bench_ring (platform native):
+ *   pio run -e bench_ring
+ *   .pio/build/bench_ring/program --frames 2000000 --pingpong 100000
+ *
+ * A producer thread writes frames, a consumer thread reads them and checks
+ * their order, like the network task and the application with rings of
+ * ToneIotClient. The ring is measured as is (lock free) and under
+ * ToneIotMutex (locked) for comparison:
+ *
+ *   stream   - producer writes as fast as the ring takes frames, frame
+ *              rate, bytes rate and time from commit() to peek()
+ *   pingpong - one frame in ring, the next one is written when the
+ *              consumer got it, time from commit() to peek()
+ *
+ * A waiting thread yields, on a host with one CPU the other one runs.
+ * Results are printed as lines
+ *   BENCH {"ring": ..., "scenario": ..., ...}
+ *
+ **************************************************************/
+
+#include <Arduino.h>
+#include <ToneIotRing.h>
+#include <ToneIotPort.h>
+#include <ToneIotClient.h>
+
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+// BENCH_FRAMES : frames of scenario stream. Override with --frames
+#define BENCH_FRAMES 1000000
+
+// BENCH_PINGPONG : frames of scenario pingpong. Override with --pingpong
+#define BENCH_PINGPONG 100000
+
+// BENCH_BIG_RING : bytes of ring compared to TOIC_RING_SIZE
+#define BENCH_BIG_RING 16384
+
+static uint64_t clockNs() {
+
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// library is linked with the host shims, its clock is not used by rings
+unsigned long millis() {
+    return clockNs() / 1000000ULL;
+}
+
+unsigned long micros() {
+    return clockNs() / 1000ULL;
+}
+
+void delay(unsigned long ms) {
+    usleep(ms * 1000);
+}
+
+void yield() {
+    std::this_thread::yield();
+}
+
+/**
+ * @brief ring with producer and consumer side, Locked - every call under
+ * ToneIotMutex
+ *
+ * @tparam Capacity - size of ring in bytes
+ * @tparam Locked - take mutex
+ */
+template<uint32_t Capacity, bool Locked>
+class BenchQueue {
+
+public:
+
+   uint8_t* prepare(uint16_t len) {
+      if (Locked) this->mutex.lock();
+      uint8_t* frame = this->ring.prepare(len);
+      if (Locked) this->mutex.unlock();
+      return frame;
+   }
+
+   void commit(uint16_t len) {
+      if (Locked) this->mutex.lock();
+      this->ring.commit(len);
+      if (Locked) this->mutex.unlock();
+   }
+
+   uint8_t* peek(uint16_t* len) {
+      if (Locked) this->mutex.lock();
+      uint8_t* frame = this->ring.peek(len);
+      if (Locked) this->mutex.unlock();
+      return frame;
+   }
+
+   void pop() {
+      if (Locked) this->mutex.lock();
+      this->ring.pop();
+      if (Locked) this->mutex.unlock();
+   }
+
+private:
+
+   ToneIotRing<Capacity>   ring;
+   ToneIotMutex            mutex;
+};
+
+// frame: sequence 4 bytes, nanoseconds of commit 8 bytes, filler
+typedef struct {
+   uint32_t    seq;
+   uint64_t    stamp;
+} __attribute__((packed)) stamp_t;
+
+static std::vector<uint32_t> samples;
+
+static uint32_t percentile(uint8_t p) {
+    if (samples.empty()) return 0;
+    return samples[((uint32_t)(samples.size() - 1) * p + 50) / 100];
+}
+
+/**
+ * @brief run producer and consumer threads
+ *
+ * @param frames - frames written
+ * @param len - length frame, at least sizeof(stamp_t)
+ * @param pingpong - next frame is written when the consumer got the previous one
+ * @param ns - duration of run
+ * @return uint32_t frames out of order, 0 - ok
+ */
+template<uint32_t Capacity, bool Locked>
+static uint32_t run(uint32_t frames, uint16_t len, bool pingpong, uint64_t* ns) {
+
+    BenchQueue<Capacity, Locked>* queue = NULL;
+    void* memory = NULL;
+    std::atomic<uint32_t> received(0);
+    uint32_t errors = 0;
+    uint64_t start = 0;
+
+    // indexes of ring are cache line aligned
+    if (posix_memalign(&memory, TOIR_CACHE_LINE, sizeof(*queue)) != 0) {
+        perror("bench");
+        exit(1);
+    }
+    queue = new (memory) BenchQueue<Capacity, Locked>();
+    samples.clear();
+    start = clockNs();
+
+    std::thread consumer([&]() {
+        stamp_t frame;
+        uint16_t got = 0;
+        uint8_t* buf = NULL;
+
+        for (uint32_t i = 0; i < frames; i++) {
+            while ((buf = queue->peek(&got)) == NULL) std::this_thread::yield();
+            memcpy(&frame, buf, sizeof(frame));
+            samples.push_back(clockNs() - frame.stamp);
+            if (frame.seq != i || got != len) errors++;
+            queue->pop();
+            received.store(i + 1, std::memory_order_release);
+        }
+    });
+
+    std::thread producer([&]() {
+        stamp_t frame;
+        uint8_t* buf = NULL;
+
+        for (uint32_t i = 0; i < frames; i++) {
+            if (pingpong) {
+                while (received.load(std::memory_order_acquire) != i) std::this_thread::yield();
+            }
+            while ((buf = queue->prepare(len)) == NULL) std::this_thread::yield();
+            memset(buf + sizeof(frame), 0x5A, len - sizeof(frame));
+            frame.seq = i;
+            frame.stamp = clockNs();
+            memcpy(buf, &frame, sizeof(frame));
+            queue->commit(len);
+        }
+    });
+
+    producer.join();
+    consumer.join();
+    *ns = clockNs() - start;
+    queue->~BenchQueue();
+    free(memory);
+    return errors;
+}
+
+template<uint32_t Capacity, bool Locked>
+static void bench(const char* scenario, uint32_t frames, uint16_t len) {
+
+    uint64_t ns = 0;
+    uint32_t errors = run<Capacity, Locked>(frames, len, strcmp(scenario, "pingpong") == 0, &ns);
+    double seconds = ns / 1e9;
+
+    std::sort(samples.begin(), samples.end());
+    printf("BENCH {\"ring\": \"%s/%u\", \"scenario\": \"%s\", \"len\": %u, \"frames\": %u, \"errors\": %u, "
+           "\"frames_per_s\": %.0f, \"MB_per_s\": %.1f, \"p50_ns\": %u, \"p90_ns\": %u, \"p99_ns\": %u, \"max_ns\": %u}\n",
+           Locked ? "locked" : "lockfree", (unsigned)Capacity, scenario, len, frames, errors,
+           frames / seconds, (double)frames * len / seconds / 1e6,
+           percentile(50), percentile(90), percentile(99), samples.empty() ? 0 : samples.back());
+    fflush(stdout);
+}
+
+static void usage(const char* name) {
+    fprintf(stderr, "usage: %s [--frames %d] [--pingpong %d]\n", name, BENCH_FRAMES, BENCH_PINGPONG);
+}
+
+int main(int argc, char** argv) {
+
+    static const struct option options[] = {
+        {"frames", required_argument, NULL, 'f'},
+        {"pingpong", required_argument, NULL, 'p'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+    static const uint16_t lengths[] = {16, 64, 256};
+    uint32_t frames = BENCH_FRAMES;
+    uint32_t pingpong = BENCH_PINGPONG;
+    int opt = 0;
+
+    while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1) {
+        switch (opt) {
+        case 'f': frames = atoi(optarg); break;
+        case 'p': pingpong = atoi(optarg); break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    samples.reserve(std::max(frames, pingpong));
+
+    for (uint16_t len : lengths) {
+        bench<TOIC_RING_SIZE, false>("stream", frames, len);
+        bench<TOIC_RING_SIZE, true>("stream", frames, len);
+        bench<BENCH_BIG_RING, false>("stream", frames, len);
+    }
+    bench<TOIC_RING_SIZE, false>("pingpong", pingpong, 16);
+    bench<TOIC_RING_SIZE, true>("pingpong", pingpong, 16);
+    return 0;
+}
@@ -0,0 +1,349 @@
+/**
+    * @author Dyakonov Oleg <o.u.dyakonov@gmail.com>
+    *
+    * @brief bench_task - frame latency and throughput of ToneIotClient with network task on a Linux host
+*/
+
+/**************************************************************
+ *
+ * Build with env bench_task (platform native):
+ *   pio run -e bench_task
+ *   .pio/build/bench_task/program --requests 2000 --duration 2000
+ *
+ * The same scenarios run with the socket read in loop() (mode inline) and
+ * with startTask(): a std::thread owns the socket and the application
+ * thread talks to it through the rings (mode task). The socket is a memory
+ * client, it acknowledges every function and in scenario rx feeds server
+ * frames without end, so the pipeline of the library is measured:
+ *
+ *   request - sendFunctio() and waitServerRespons() until ACK
+ *   tx      - window of sendFunctioAsync(), send to callback of ACK
+ *   rx      - server frames, push in socket to callback of function
+ *
+ * Results are printed as lines
+ *   BENCH {"mode": ..., "scenario": ..., ...}
+ *
+ **************************************************************/
+
+#include <Arduino.h>
+#include <Client.h>
+#include <ToneIotClient.h>
+
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+// BENCH_FUNCTION : function acknowledged by memory client
+#define BENCH_FUNCTION 20
+
+// BENCH_FUNCTION_RX : function fed by memory client in scenario rx
+#define BENCH_FUNCTION_RX 21
+
+// BENCH_PAYLOAD : bytes of frames, first 4 bytes are micros() of push
+#define BENCH_PAYLOAD 16
+
+// BENCH_REQUESTS : request/ACK round trips measured. Override with --requests
+#define BENCH_REQUESTS 1000
+
+// BENCH_DURATION : ms of scenarios tx and rx. Override with --duration
+#define BENCH_DURATION 2000
+
+// BENCH_WINDOW : asynchronous sends waiting ACK in scenario tx, max TOIC_MAX_PENDING
+#define BENCH_WINDOW 8
+
+// BENCH_RX_SIZE : bytes of frames waiting in memory client
+#define BENCH_RX_SIZE 1024
+
+static uint64_t clockUs() {
+
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+unsigned long millis() {
+    return clockUs() / 1000ULL;
+}
+
+unsigned long micros() {
+    return clockUs();
+}
+
+void delay(unsigned long ms) {
+    usleep(ms * 1000);
+}
+
+// application spins on loop(), the network task gets the CPU on small hosts
+void yield() {
+    sched_yield();
+}
+
+/**
+ * @brief socket in memory: INIT and DISCONNECT are answered, every user
+ * function is acknowledged, with feed() set every read gets the next
+ * server frame. Only the owner of the socket calls it, the network task
+ * in mode task
+ *
+ */
+class BenchClient : public Client {
+
+public:
+
+   BenchClient() : online(false), rxPos(0), rxLen(0), feedFunction(0), msgId(0) {}
+
+   int connect(IPAddress ip, uint16_t port) { return connect("", port); }
+
+   int connect(const char* host, uint16_t port) {
+      this->online = true;
+      this->rxPos = this->rxLen = 0;
+      this->msgId = 0;
+      return 1;
+   }
+
+   size_t write(uint8_t b) { return write(&b, 1); }
+
+   size_t write(const uint8_t* buf, size_t size) {
+
+      ToneIotPacketView packet((uint8_t*)buf);
+      uint16_t function = 0;
+
+      if (size < ToneIotPacketView::HEADER_SIZE) return size;
+      memcpy(this->id, packet.getId(), ToneIotPacketView::ID_SIZE);
+      function = packet.getFunction() & TOIC_FUNCTION_MASK;
+      // empty INIT answer: all functions enabled, no flow control
+      if (function == TOIC_FUNCTION_SYS_INIT) push(TOIC_FUNCTION_SYS_INIT, 0, 0);
+      else if (function == TOIC_FUNCTION_SYS_DISCONNECT || function >= BENCH_FUNCTION) push(TOIC_FUNCTION_SYS_ACK, packet.getMsgId(), 0);
+      return size;
+   }
+
+   int available() {
+      if (this->rxPos == this->rxLen && this->feedFunction != 0 && this->online) push(this->feedFunction, ++this->msgId, BENCH_PAYLOAD);
+      return this->rxLen - this->rxPos;
+   }
+
+   int read() { return available() ? this->rx[this->rxPos++] : -1; }
+
+   int read(uint8_t* buf, size_t size) {
+
+      int n = std::min((int)size, available());
+
+      memcpy(buf, &this->rx[this->rxPos], n);
+      this->rxPos += n;
+      return n;
+   }
+
+   int peek() { return available() ? this->rx[this->rxPos] : -1; }
+   void flush() {}
+   void stop() { this->online = false; }
+   uint8_t connected() { return this->online; }
+   operator bool() { return this->online; }
+
+   // frames of function are read without end, 0 - none; set from application thread
+   void feed(uint16_t function) { this->feedFunction = function; }
+
+private:
+
+   bool                    online;
+   uint8_t                 rx[BENCH_RX_SIZE];
+   uint16_t                rxPos;
+   uint16_t                rxLen;
+   std::atomic<uint16_t>   feedFunction;
+   uint16_t                msgId;
+   uint8_t                 id[ToneIotPacketView::ID_SIZE];
+
+   void push(uint16_t function, uint16_t msgId, uint16_t len) {
+
+      ToneIotPacketView packet;
+      uint32_t stamp = micros();
+
+      // unread bytes move to the front, answers are never dropped
+      memmove(this->rx, &this->rx[this->rxPos], this->rxLen - this->rxPos);
+      this->rxLen -= this->rxPos;
+      this->rxPos = 0;
+      if (this->rxLen + ToneIotPacketView::HEADER_SIZE + len > BENCH_RX_SIZE) return;
+      packet = ToneIotPacketView(&this->rx[this->rxLen]);
+      packet.setId(this->id);
+      packet.setMsgId(msgId);
+      packet.setFunction(function);
+      packet.setDataLen(len);
+      memset(packet.getData(), 0x5A, len);
+      if (len >= sizeof(stamp)) memcpy(packet.getData(), &stamp, sizeof(stamp));
+      this->rxLen += packet.getSize();
+   }
+};
+
+static std::vector<uint32_t> samples;
+static uint8_t payload[BENCH_PAYLOAD];
+static uint32_t sent[256];
+static uint32_t done = 0;
+static uint32_t failed = 0;
+
+static uint32_t percentile(uint8_t p) {
+    if (samples.empty()) return 0;
+    return samples[((uint32_t)(samples.size() - 1) * p + 50) / 100];
+}
+
+static void printSamples(ToneIotClient* client, const char* mode, const char* scenario, uint32_t ms) {
+    std::sort(samples.begin(), samples.end());
+    printf("BENCH {\"mode\": \"%s\", \"scenario\": \"%s\", \"n\": %u, \"fail\": %u, \"frames_per_s\": %lu, "
+           "\"p50_us\": %u, \"p90_us\": %u, \"p99_us\": %u, \"max_us\": %u, \"retransmits\": %lu}\n",
+           mode, scenario, (unsigned)samples.size(), (unsigned)failed,
+           (unsigned long)(ms ? (uint64_t)samples.size() * 1000 / ms : 0),
+           percentile(50), percentile(90), percentile(99), samples.empty() ? 0 : samples.back(),
+           (unsigned long)client->getStats().retransmits);
+    fflush(stdout);
+}
+
+static void cbSent(ToneIotClient::sendHandle_t handle, TOIC_SEND result, uint16_t error) {
+    done++;
+    if (result == TOIC_SEND::ACK) samples.push_back(micros() - sent[handle & 0xFF]);
+    else failed++;
+}
+
+static void cbReceived(uint8_t* buf, uint16_t len) {
+
+    uint32_t stamp = 0;
+
+    memcpy(&stamp, buf, sizeof(stamp));
+    samples.push_back(micros() - stamp);
+}
+
+// rings of client are cache line aligned
+static ToneIotClient* newClient(BenchClient& socket, bool task) {
+
+    void* memory = NULL;
+    ToneIotClient* client = NULL;
+
+    if (posix_memalign(&memory, alignof(ToneIotClient), sizeof(ToneIotClient)) != 0) {
+        perror("bench");
+        exit(1);
+    }
+    client = new (memory) ToneIotClient(socket);
+    client->setKeepAlive(0);
+    client->setFunctionQos(BENCH_FUNCTION, TOIC_QOS::AT_LEAST_ONCE);
+    client->setFunction(BENCH_FUNCTION_RX, cbReceived);
+    if (client->connect() || (task && client->startTask())) {
+        fprintf(stderr, "bench: connect to memory client failed\n");
+        exit(1);
+    }
+    return client;
+}
+
+static void freeClient(ToneIotClient* client) {
+    client->stopTask();
+    client->disconnect();
+    client->~ToneIotClient();
+    free(client);
+}
+
+// ======================================== scenarios ======================================
+
+static void benchRequest(const char* mode, bool task, uint32_t requests) {
+
+    BenchClient socket;
+    ToneIotClient* client = newClient(socket, task);
+    uint32_t start = millis();
+
+    samples.clear();
+    failed = 0;
+    for (uint32_t i = 0; i < requests; i++) {
+        uint32_t t = micros();
+        if (client->sendFunctio(BENCH_FUNCTION, payload, BENCH_PAYLOAD) || client->waitServerRespons() != TOIC_FUNCTION_SYS_ACK) {
+            failed++;
+            continue;
+        }
+        samples.push_back(micros() - t);
+    }
+    printSamples(client, mode, "request", millis() - start);
+    freeClient(client);
+}
+
+static void benchTx(const char* mode, bool task, uint32_t duration) {
+
+    BenchClient socket;
+    ToneIotClient* client = newClient(socket, task);
+    ToneIotClient::sendHandle_t handle = TOIC_SEND_HANDLE_INVALID;
+    uint32_t requested = 0;
+    uint32_t start = millis();
+
+    samples.clear();
+    done = failed = 0;
+    while (millis() - start < duration) {
+        while (requested - done < BENCH_WINDOW) {
+            uint32_t t = micros();
+            handle = client->sendFunctioAsync(BENCH_FUNCTION, payload, BENCH_PAYLOAD, cbSent);
+            if (handle == TOIC_SEND_HANDLE_INVALID) break;
+            sent[handle & 0xFF] = t;
+            requested++;
+        }
+        if (client->loop() != 0) break;
+        yield();
+    }
+    // answers of the last window
+    while (requested != done && millis() - start < duration + 1000 && client->loop() == 0) yield();
+    failed += requested - done;
+    printSamples(client, mode, "tx", millis() - start);
+    freeClient(client);
+}
+
+static void benchRx(const char* mode, bool task, uint32_t duration) {
+
+    BenchClient socket;
+    ToneIotClient* client = newClient(socket, task);
+    uint32_t start = millis();
+
+    samples.clear();
+    failed = 0;
+    socket.feed(BENCH_FUNCTION_RX);
+    while (millis() - start < duration) {
+        if (client->loop() != 0) break;
+        yield();
+    }
+    socket.feed(0);
+    printSamples(client, mode, "rx", millis() - start);
+    freeClient(client);
+}
+
+static void usage(const char* name) {
+    fprintf(stderr, "usage: %s [--requests %d] [--duration %d]\n", name, BENCH_REQUESTS, BENCH_DURATION);
+}
+
+int main(int argc, char** argv) {
+
+    static const struct option options[] = {
+        {"requests", required_argument, NULL, 'r'},
+        {"duration", required_argument, NULL, 'd'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+    uint32_t requests = BENCH_REQUESTS;
+    uint32_t duration = BENCH_DURATION;
+    int opt = 0;
+
+    while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1) {
+        switch (opt) {
+        case 'r': requests = atoi(optarg); break;
+        case 'd': duration = atoi(optarg); break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    for (uint16_t i = 0; i < sizeof(payload); i++) payload[i] = i;
+    samples.reserve(1 << 20);
+
+    for (uint8_t task = 0; task < 2; task++) {
+        const char* mode = task ? "task" : "inline";
+        benchRequest(mode, task, requests);
+        benchTx(mode, task, duration);
+        benchRx(mode, task, duration);
+    }
+    return 0;
+}
@@ -0,0 +1,415 @@
+/**
+    * @author Dyakonov Oleg <o.u.dyakonov@gmail.com>
+    *
+    * @brief bench_transport - ToneIotClient over TCP and over UDP datagrams on a Linux host
+*/
+
+/**************************************************************
+ *
+ * Build with env bench_transport (platform native), started by
+ * tools/bench_transport.py, which shapes the link and compares transports:
+ *   .pio/build/bench_transport/program --tcp 127.0.0.1:5000
+ *   .pio/build/bench_transport/program --udp 127.0.0.1:5000
+ * Results are printed as lines
+ *   BENCH {"scenario": ..., ...}
+ *
+ * Scenarios:
+ *   first   - connect() from closed socket until the first function is
+ *             acknowledged, time to first message of a device waking up
+ *   request - function and its ACK on open session, p50/p90/p99
+ * The function has QoS AT_LEAST_ONCE, lost datagrams are retransmitted by
+ * ToneIotClient. Host and port of token are ignored, sockets go to the
+ * address of options and the domain of token resolves to it.
+ *
+ **************************************************************/
+
+#include <Arduino.h>
+#include <Client.h>
+#include <Udp.h>
+#include <ToneIotClient.h>
+#include <ToneIotUdpClient.h>
+
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <netdb.h>
+#include <getopt.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <algorithm>
+#include <vector>
+
+// BENCH_FUNCTION : function acknowledged by server
+#define BENCH_FUNCTION 20
+
+// BENCH_PAYLOAD : bytes of function, a short alarm
+#define BENCH_PAYLOAD 16
+
+// BENCH_CONNECTS : time to first message measured. Override with --connects
+#define BENCH_CONNECTS 20
+
+// BENCH_REQUESTS : request/ACK round trips measured. Override with --requests
+#define BENCH_REQUESTS 100
+
+// BENCH_TIMEOUT : ms one sample may take, then it is failed
+#define BENCH_TIMEOUT 60000
+
+static sockaddr_in target;
+
+static uint64_t clockUs() {
+
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+unsigned long millis() {
+    return clockUs() / 1000ULL;
+}
+
+unsigned long micros() {
+    return clockUs();
+}
+
+void delay(unsigned long ms) {
+    usleep(ms * 1000);
+}
+
+// loop() polls sockets, the process does not spin at full CPU
+void yield() {
+    usleep(100);
+}
+
+/**
+ * @brief TCP socket to target, host and port of connect() are ignored
+ *
+ */
+class HostTcp : public Client {
+
+public:
+
+   HostTcp() : fd(-1) {}
+
+   int connect(IPAddress ip, uint16_t port) { return connect("", port); }
+
+   int connect(const char* host, uint16_t port) {
+
+      int one = 1;
+
+      stop();
+      this->fd = socket(AF_INET, SOCK_STREAM, 0);
+      if (this->fd < 0) return 0;
+      if (::connect(this->fd, (sockaddr*)&target, sizeof(target)) != 0) {
+         stop();
+         return 0;
+      }
+      setsockopt(this->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      fcntl(this->fd, F_SETFL, O_NONBLOCK);
+      return 1;
+   }
+
+   size_t write(uint8_t b) { return write(&b, 1); }
+
+   size_t write(const uint8_t* buf, size_t size) {
+      ssize_t n = ::send(this->fd, buf, size, MSG_NOSIGNAL);
+      return n > 0 ? n : 0;
+   }
+
+   int available() {
+      uint8_t b;
+      ssize_t n = 0;
+      if (this->fd < 0) return 0;
+      n = recv(this->fd, &b, 1, MSG_PEEK);
+      // peer closed
+      if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) stop();
+      return n > 0 ? 1 : 0;
+   }
+
+   int read() {
+      uint8_t b;
+      return recv(this->fd, &b, 1, 0) == 1 ? b : -1;
+   }
+
+   int read(uint8_t* buf, size_t size) {
+      ssize_t n = recv(this->fd, buf, size, 0);
+      return n > 0 ? n : -1;
+   }
+
+   int peek() { return -1; }
+   void flush() {}
+
+   void stop() {
+      if (this->fd >= 0) close(this->fd);
+      this->fd = -1;
+   }
+
+   uint8_t connected() { return this->fd >= 0; }
+   operator bool() { return this->fd >= 0; }
+
+private:
+
+   int         fd;
+};
+
+/**
+ * @brief UDP socket, datagrams go to target whatever beginPacket() gets,
+ * datagrams of target come from the address of beginPacket()
+ *
+ */
+class HostUdp : public UDP {
+
+public:
+
+   HostUdp() : fd(-1), txLen(0), rxLen(0), rxPos(0), peerPort(0), remote(false) {}
+
+   uint8_t begin(uint16_t port) {
+
+      sockaddr_in local;
+
+      stop();
+      this->fd = socket(AF_INET, SOCK_DGRAM, 0);
+      if (this->fd < 0) return 0;
+      memset(&local, 0, sizeof(local));
+      local.sin_family = AF_INET;
+      local.sin_port = htons(port);
+      if (bind(this->fd, (sockaddr*)&local, sizeof(local)) != 0) {
+         stop();
+         return 0;
+      }
+      fcntl(this->fd, F_SETFL, O_NONBLOCK);
+      return 1;
+   }
+
+   void stop() {
+      if (this->fd >= 0) close(this->fd);
+      this->fd = -1;
+   }
+
+   int beginPacket(IPAddress ip, uint16_t port) {
+      this->peerIp = ip;
+      this->peerPort = port;
+      return beginPacket("", port);
+   }
+
+   int beginPacket(const char* host, uint16_t port) {
+      this->txLen = 0;
+      return this->fd >= 0;
+   }
+
+   int endPacket() {
+      return sendto(this->fd, this->tx, this->txLen, 0, (sockaddr*)&target, sizeof(target)) == (ssize_t)this->txLen;
+   }
+
+   size_t write(uint8_t b) { return write(&b, 1); }
+
+   size_t write(const uint8_t* buf, size_t size) {
+      size = std::min(size, sizeof(this->tx) - this->txLen);
+      memcpy(&this->tx[this->txLen], buf, size);
+      this->txLen += size;
+      return size;
+   }
+
+   int parsePacket() {
+
+      ssize_t n = 0;
+      sockaddr_in source;
+      socklen_t size = sizeof(source);
+
+      if (this->fd < 0) return 0;
+      n = recvfrom(this->fd, this->rx, sizeof(this->rx), 0, (sockaddr*)&source, &size);
+      this->remote = n > 0 && source.sin_addr.s_addr == target.sin_addr.s_addr && source.sin_port == target.sin_port;
+      this->rxLen = n > 0 ? n : 0;
+      this->rxPos = 0;
+      return this->rxLen;
+   }
+
+   int available() { return this->rxLen - this->rxPos; }
+   int read() { return available() ? this->rx[this->rxPos++] : -1; }
+
+   int read(uint8_t* buf, size_t size) {
+      int n = std::min((int)size, available());
+      memcpy(buf, &this->rx[this->rxPos], n);
+      this->rxPos += n;
+      return n;
+   }
+
+   int peek() { return available() ? this->rx[this->rxPos] : -1; }
+   void flush() { this->rxPos = this->rxLen; }
+
+   IPAddress remoteIP() { return this->remote ? this->peerIp : IPAddress(); }
+   uint16_t remotePort() { return this->remote ? this->peerPort : 0; }
+
+private:
+
+   int         fd;
+   uint8_t     tx[2048];
+   size_t      txLen;
+   uint8_t     rx[2048];
+   int         rxLen;
+   int         rxPos;
+   IPAddress   peerIp;     ///< address of beginPacket()
+   uint16_t    peerPort;
+   bool        remote;     ///< last datagram is from target
+};
+
+static uint8_t payload[BENCH_PAYLOAD];
+static std::vector<uint32_t> samples;     ///< us
+
+// send function and run loop() until its ACK, us; -1 - failed
+static int32_t request(ToneIotClient& client) {
+
+    unsigned long start = micros();
+    ToneIotClient::sendHandle_t handle = client.sendFunctioAsync(BENCH_FUNCTION, payload, sizeof(payload));
+    TOIC_SEND state = TOIC_SEND::PENDING;
+
+    if (handle == TOIC_SEND_HANDLE_INVALID) return -1;
+    // final state frees the handle, it is read once
+    while ((state = client.getSendState(handle)) == TOIC_SEND::PENDING) {
+        if (client.loop() != 0 || micros() - start >= BENCH_TIMEOUT * 1000UL) return -1;
+    }
+    return state == TOIC_SEND::ACK ? (int32_t)(micros() - start) : -1;
+}
+
+static uint32_t percentile(uint8_t p) {
+    if (samples.empty()) return 0;
+    return samples[((uint32_t)(samples.size() - 1) * p + 50) / 100];
+}
+
+static void printSamples(const char* transport, const char* scenario, uint16_t fail) {
+    std::sort(samples.begin(), samples.end());
+    printf("BENCH {\"transport\": \"%s\", \"scenario\": \"%s\", \"n\": %u, \"fail\": %u, \"p50_ms\": %.1f, \"p90_ms\": %.1f, \"p99_ms\": %.1f, \"max_ms\": %.1f}\n",
+           transport, scenario, (unsigned)samples.size(), fail,
+           percentile(50) / 1000.0, percentile(90) / 1000.0, percentile(99) / 1000.0,
+           (samples.empty() ? 0 : samples.back()) / 1000.0);
+    fflush(stdout);
+}
+
+// device wakes up: socket, INIT and the first function
+static void benchFirst(ToneIotClient& client, const char* transport, uint16_t connects) {
+
+    uint16_t fail = 0;
+    int32_t us = 0;
+
+    samples.clear();
+    for (uint16_t i = 0; i < connects; i++) {
+        unsigned long start = micros();
+        if (client.connect() != 0) {
+            fail++;
+            continue;
+        }
+        us = request(client);
+        if (us < 0) fail++;
+        else samples.push_back(micros() - start);
+        client.disconnect();
+    }
+    printSamples(transport, "first", fail);
+}
+
+// round trips on open session
+static void benchRequest(ToneIotClient& client, const char* transport, uint16_t requests) {
+
+    uint16_t fail = 0;
+    int32_t us = 0;
+
+    samples.clear();
+    for (uint16_t i = 0; i < requests; i++) {
+        if (!client.connected() && client.connect() != 0) {
+            fail++;
+            continue;
+        }
+        us = request(client);
+        if (us < 0) fail++;
+        else samples.push_back(us);
+    }
+    printSamples(transport, "request", fail);
+    client.disconnect();
+}
+
+static int8_t parseTarget(const char* text) {
+
+    char host[64];
+    const char* colon = strrchr(text, ':');
+    addrinfo hints;
+    addrinfo* result = NULL;
+
+    if (colon == NULL || colon - text >= (int)sizeof(host)) return -1;
+    memcpy(host, text, colon - text);
+    host[colon - text] = 0;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    if (getaddrinfo(host, NULL, &hints, &result) != 0) return -1;
+    memcpy(&target, result->ai_addr, sizeof(target));
+    target.sin_port = htons(atoi(colon + 1));
+    freeaddrinfo(result);
+    return 0;
+}
+
+static void usage(const char* name) {
+    fprintf(stderr, "usage: %s --tcp HOST:PORT | --udp HOST:PORT [--connects %d] [--requests %d]\n",
+            name, BENCH_CONNECTS, BENCH_REQUESTS);
+}
+
+int main(int argc, char** argv) {
+
+    static const struct option options[] = {
+        {"tcp", required_argument, NULL, 't'},
+        {"udp", required_argument, NULL, 'u'},
+        {"connects", required_argument, NULL, 'c'},
+        {"requests", required_argument, NULL, 'r'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+    const char* transport = NULL;
+    uint16_t connects = BENCH_CONNECTS;
+    uint16_t requests = BENCH_REQUESTS;
+    int opt = 0;
+
+    while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1) {
+        switch (opt) {
+        case 't':
+        case 'u':
+            transport = opt == 't' ? "tcp" : "udp";
+            if (parseTarget(optarg) == 0) break;
+            fprintf(stderr, "bad address %s\n", optarg);
+            return 2;
+        case 'c': connects = atoi(optarg); break;
+        case 'r': requests = atoi(optarg); break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (transport == NULL) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    HostTcp tcp;
+    HostUdp udp;
+    ToneIotUdpClient datagrams(udp);
+    Client& socket = strcmp(transport, "tcp") == 0 ? (Client&)tcp : (Client&)datagrams;
+    // rings of client are cache line aligned
+    static ToneIotClient client(socket);
+
+    for (uint16_t i = 0; i < sizeof(payload); i++) payload[i] = i;
+    client.setKeepAlive(0);
+    client.setFunctionQos(BENCH_FUNCTION, TOIC_QOS::AT_LEAST_ONCE);
+    // connect() of transports gets the address of options
+    client.setResolver([](const char* host, IPAddress* ip) -> int8_t {
+        uint32_t a = ntohl(target.sin_addr.s_addr);
+        *ip = IPAddress(a >> 24, a >> 16, a >> 8, a);
+        return 0;
+    });
+
+    printf("BENCH {\"event\": \"start\", \"transport\": \"%s\"}\n", transport);
+    benchFirst(client, transport, connects);
+    benchRequest(client, transport, requests);
+    printf("BENCH {\"event\": \"done\", \"transport\": \"%s\", \"repeats\": %lu, \"dropped\": %lu, \"retransmits\": %lu}\n",
+           transport, (unsigned long)datagrams.getRepeats(), (unsigned long)datagrams.getDropped(),
+           (unsigned long)client.getStats().retransmits);
+    return 0;
+}
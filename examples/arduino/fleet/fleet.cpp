@@ -0,0 +1,926 @@
+/**
+    * @author Dyakonov Oleg <o.u.dyakonov@gmail.com>
+    *
+    * @brief fleet - thousands of ToneIotClient devices in one process against the server stand-in
+*/
+
+/**************************************************************
+ *
+ * Build with env fleet (platform native, Linux):
+ *   pio run -e fleet
+ *   ulimit -n 65536
+ *   tools/toneiot_server.py --port 5000 &
+ *   .pio/build/fleet/program --devices 10000 --duration 120 --drop storm:60
+ *
+ * Every device is a real ToneIotClient with its own token and id. It runs
+ * in a fiber with its own stack; millis(), delay() and yield() of
+ * fleet/host park the fiber and one epoll loop resumes it on socket data
+ * or timer. Blocking calls of the library (connect, waitServerRespons)
+ * block only their device.
+ *
+ * Each second a line with connection rate, frame rate and ACK latency
+ * percentiles of the second is printed to stderr, the summary of the run
+ * is printed as FLEET {json} and written to --out.
+ *
+ **************************************************************/
+
+#include <Arduino.h>
+#include <ToneIotClient.h>
+#include <Base64.h>
+
+#include <ucontext.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <poll.h>
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <new>
+#include <deque>
+#include <queue>
+#include <random>
+#include <vector>
+
+// FLEET_FUNCTION : function sent periodically, acknowledged by server
+#define FLEET_FUNCTION 20
+
+// FLEET_STACK_SIZE : stack of device fiber, pages are committed on use
+#define FLEET_STACK_SIZE (32 * 1024)
+
+// FLEET_RX_BUFFER : socket read buffer of device
+#define FLEET_RX_BUFFER 512
+
+// FLEET_YIELD_MS : yield() of library waiting data parks the device at most
+#define FLEET_YIELD_MS 5
+
+// FLEET_CONNECT_TIMEOUT : ms of TCP connect
+#define FLEET_CONNECT_TIMEOUT 10000
+
+// FLEET_MAX_EVENTS : epoll events per wait
+#define FLEET_MAX_EVENTS 1024
+
+/**
+ * @brief drop pattern
+ *
+ */
+enum class FLEET_DROP {
+   NONE   = 0,
+   RANDOM = 1,  ///< every device each second with probability
+   STORM  = 2   ///< all devices at once every period
+};
+
+typedef struct {
+   uint32_t       devices;
+   sockaddr_in    server;
+   uint32_t       duration;      ///< s
+   uint32_t       ramp;          ///< connects per second at start, 0 - all at once
+   uint16_t       keepAlive;     ///< s
+   uint32_t       period;        ///< ms between functions, 0 - no functions
+   uint16_t       payload;       ///< bytes of function
+   TOIC_QOS       qos;
+   bool           sync;          ///< all devices send at the same time
+   uint32_t       on;            ///< s connected in duty cycle, 0 - always
+   uint32_t       off;           ///< s disconnected in duty cycle
+   FLEET_DROP     drop;
+   double         dropRate;      ///< probability per device and second
+   uint32_t       dropPeriod;    ///< s between storms
+   uint32_t       reconnect;     ///< ms before reconnect, +-50%
+   uint32_t       tick;          ///< ms between loop() of idle device
+   uint32_t       seed;
+   const char*    out;
+} options_t;
+
+typedef struct {
+   uint64_t       connects;
+   uint64_t       connectFails;
+   uint64_t       lost;          ///< connections lost, drops included
+   uint64_t       drops;
+   uint64_t       sent;
+   uint64_t       acked;
+   uint64_t       failed;
+   std::vector<uint32_t> latency; ///< ms send to ACK
+   std::vector<uint32_t> connectTime; ///< ms TCP connect and INIT
+} counters_t;
+
+class Device;
+
+static options_t options;
+static counters_t total;
+static counters_t second;
+static std::vector<Device*> devices;
+static std::deque<Device*> runnable;
+static ucontext_t scheduler;
+static Device* current = NULL;
+static int epollFd = -1;
+static volatile bool running = true;
+static struct timespec started;
+static std::mt19937 rnd;
+
+/**
+ * @brief non-blocking TCP socket, waiting parks the device
+ *
+ */
+class FleetSocket : public Client {
+
+public:
+
+   FleetSocket(Device* owner) : owner(owner), fd(-1), closed(true), pos(0), len(0) {}
+
+   int connect(IPAddress ip, uint16_t port) { return connect("", port); }
+   int connect(const char* host, uint16_t port);
+   size_t write(uint8_t b) { return write(&b, 1); }
+   size_t write(const uint8_t* buf, size_t size);
+   int available();
+   int read();
+   int read(uint8_t* buf, size_t size);
+   int peek();
+   void flush() {}
+   void stop();
+   uint8_t connected() { return this->fd >= 0 && !this->closed; }
+   operator bool() { return connected(); }
+
+   void drop();
+
+private:
+
+   Device*           owner;
+   int               fd;
+   bool              closed;        ///< peer closed or error, fd is open until stop()
+   uint16_t          pos;
+   uint16_t          len;
+   uint8_t           buffer[FLEET_RX_BUFFER];
+};
+
+/**
+ * @brief device: ToneIotClient over FleetSocket in own fiber
+ *
+ */
+class Device {
+
+public:
+
+   Device(uint32_t index);
+
+   void start();
+   void run();
+   void park(unsigned long until, bool io);
+   void wake();
+   void drop();
+
+   FleetSocket       socket;
+   ToneIotClient     client;
+   uint32_t          index;
+   ucontext_t        context;
+   bool              parked;
+   bool              waitIo;
+   uint32_t          generation;    ///< of park, timers of older parks are stale
+   bool              dropRequest;
+   bool              online;        ///< connected at last check
+   unsigned long     nextConnect;
+   unsigned long     nextSend;
+   unsigned long     connectedAt;
+   unsigned long     sendTime[TOIC_MAX_PENDING];
+   ToneIotClient::stats_t reported; ///< stats of client already counted
+
+private:
+
+   static void entry(int index);
+   unsigned long reconnectDelay();
+   void send();
+};
+
+typedef struct {
+   unsigned long  until;
+   Device*        device;
+   uint32_t       generation;
+} fleetTimer_t;
+
+struct TimerLater {
+   bool operator()(const fleetTimer_t& a, const fleetTimer_t& b) const { return a.until > b.until; }
+};
+
+static std::priority_queue<fleetTimer_t, std::vector<fleetTimer_t>, TimerLater> timers;
+static uint8_t* stacks = NULL;
+
+// ======================================== Arduino API ======================================
+
+unsigned long millis() {
+
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - started.tv_sec) * 1000UL + (now.tv_nsec - started.tv_nsec) / 1000000L;
+}
+
+unsigned long micros() {
+
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - started.tv_sec) * 1000000UL + (now.tv_nsec - started.tv_nsec) / 1000L;
+}
+
+void delay(unsigned long ms) {
+    if (current != NULL) current->park(millis() + ms, false);
+}
+
+void yield() {
+    if (current != NULL) current->park(millis() + FLEET_YIELD_MS, true);
+}
+
+// ======================================== FleetSocket ======================================
+
+/**
+ * @brief connect to the server of options, host and port of token are ignored
+ *
+ * @return int = 1 - ok; 0 - error
+ */
+int FleetSocket::connect(const char* host, uint16_t port) {
+
+    epoll_event event;
+    pollfd pfd;
+    int error = 0;
+    socklen_t size = sizeof(error);
+    int one = 1;
+    unsigned long deadline = millis() + FLEET_CONNECT_TIMEOUT;
+
+    stop();
+    this->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (this->fd < 0) return 0;
+    setsockopt(this->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.ptr = this->owner;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, this->fd, &event);
+
+    if (::connect(this->fd, (sockaddr*)&options.server, sizeof(options.server)) != 0 && errno != EINPROGRESS) {
+        stop();
+        return 0;
+    }
+    pfd.fd = this->fd;
+    pfd.events = POLLOUT;
+    while (poll(&pfd, 1, 0) == 0) {
+        if (millis() >= deadline) {
+            stop();
+            return 0;
+        }
+        this->owner->park(deadline, true);
+    }
+    getsockopt(this->fd, SOL_SOCKET, SO_ERROR, &error, &size);
+    if (error != 0) {
+        stop();
+        return 0;
+    }
+    this->closed = false;
+    this->pos = 0;
+    this->len = 0;
+    return 1;
+}
+
+size_t FleetSocket::write(const uint8_t* buf, size_t size) {
+
+    size_t n = 0;
+    ssize_t ret = 0;
+    unsigned long deadline = millis() + FLEET_CONNECT_TIMEOUT;
+
+    while (n < size && connected()) {
+        ret = send(this->fd, buf + n, size - n, MSG_NOSIGNAL);
+        if (ret > 0) {
+            n += ret;
+            continue;
+        }
+        if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) && millis() < deadline) {
+            this->owner->park(deadline, true);
+            continue;
+        }
+        this->closed = true;
+    }
+    return n;
+}
+
+int FleetSocket::available() {
+
+    ssize_t ret = 0;
+
+    if (this->pos < this->len) return this->len - this->pos;
+    if (!connected()) return 0;
+    ret = recv(this->fd, this->buffer, sizeof(this->buffer), 0);
+    if (ret > 0) {
+        this->pos = 0;
+        this->len = ret;
+        return ret;
+    }
+    if (ret == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) this->closed = true;
+    return 0;
+}
+
+int FleetSocket::read() {
+
+    if (available() <= 0) return -1;
+    return this->buffer[this->pos++];
+}
+
+int FleetSocket::read(uint8_t* buf, size_t size) {
+
+    size_t n = 0;
+
+    while (n < size && available() > 0) buf[n++] = this->buffer[this->pos++];
+    return n;
+}
+
+int FleetSocket::peek() {
+
+    if (available() <= 0) return -1;
+    return this->buffer[this->pos];
+}
+
+void FleetSocket::stop() {
+
+    if (this->fd >= 0) close(this->fd);
+    this->fd = -1;
+    this->closed = true;
+    this->pos = 0;
+    this->len = 0;
+}
+
+/**
+ * @brief lose the link: reset without FIN, the library finds it on next read
+ *
+ */
+void FleetSocket::drop() {
+
+    linger hard = {1, 0};
+
+    if (this->fd < 0) return;
+    setsockopt(this->fd, SOL_SOCKET, SO_LINGER, &hard, sizeof(hard));
+    shutdown(this->fd, SHUT_RDWR);
+    this->closed = true;
+}
+
+// ======================================== Device ======================================
+
+/**
+ * @brief Constructor, token: id index, domain of server, random key
+ *
+ * @param index - device index
+ */
+Device::Device(uint32_t index) : socket(this), client(socket) {
+
+    uint8_t id[8];
+    uint8_t key[32];
+    const char* domain = inet_ntoa(options.server.sin_addr);
+    char token[12 + 1 + 64 + 1 + 44 + 1];
+    int n = 0;
+
+    this->index = index;
+    this->parked = false;
+    this->waitIo = false;
+    this->generation = 0;
+    this->dropRequest = false;
+    this->online = false;
+    this->nextConnect = 0;
+    this->nextSend = 0;
+    this->connectedAt = 0;
+    memset(&this->reported, 0, sizeof(this->reported));
+
+    for (uint8_t i = 0; i < 8; i++) id[i] = i < 4 ? 0xF1 : (uint8_t)(index >> ((7 - i) * 8));
+    for (uint8_t i = 0; i < sizeof(key); i++) key[i] = (uint8_t)rnd();
+    n = Base64.encode(token, (char*)id, sizeof(id));
+    token[n++] = '.';
+    n += Base64.encode(&token[n], (char*)domain, strlen(domain));
+    token[n++] = '.';
+    n += Base64.encode(&token[n], (char*)key, sizeof(key));
+    token[n] = '\0';
+    this->client.setToneIotServer(token);
+    this->client.setKeepAlive(options.keepAlive);
+    this->client.setFunctionQos(FLEET_FUNCTION, options.qos);
+}
+
+/**
+ * @brief create fiber, first connect is spread by ramp
+ *
+ */
+void Device::start() {
+
+    getcontext(&this->context);
+    this->context.uc_stack.ss_sp = stacks + (size_t)this->index * FLEET_STACK_SIZE;
+    this->context.uc_stack.ss_size = FLEET_STACK_SIZE;
+    this->context.uc_link = &scheduler;
+    makecontext(&this->context, (void (*)())&Device::entry, 1, (int)this->index);
+    this->nextConnect = options.ramp ? (unsigned long)this->index * 1000 / options.ramp : 0;
+    runnable.push_back(this);
+}
+
+/**
+ * @brief device life: connect, duty cycle, periodic functions and loop()
+ *
+ */
+void Device::run() {
+
+    unsigned long now = 0;
+    unsigned long t = 0;
+    unsigned long until = 0;
+
+    while (running) {
+        now = millis();
+        if (this->dropRequest) {
+            this->dropRequest = false;
+            if (this->socket.connected()) {
+                this->socket.drop();
+                total.drops++;
+                second.drops++;
+            }
+        }
+
+        if (!this->client.connected()) {
+            if (this->online) {
+                this->online = false;
+                total.lost++;
+                second.lost++;
+                this->nextConnect = now + reconnectDelay();
+            }
+            if (now < this->nextConnect) {
+                park(this->nextConnect, false);
+                continue;
+            }
+            t = millis();
+            if (this->client.connect() != 0) {
+                total.connectFails++;
+                second.connectFails++;
+                this->nextConnect = millis() + reconnectDelay();
+                continue;
+            }
+            now = millis();
+            total.connects++;
+            second.connects++;
+            second.connectTime.push_back(now - t);
+            this->online = true;
+            this->connectedAt = now;
+            if (options.period == 0) this->nextSend = (unsigned long)-1;
+            else if (options.sync) this->nextSend = (now / options.period + 1) * options.period;
+            else this->nextSend = now + rnd() % options.period;
+        }
+
+        // duty cycle: planned disconnect
+        if (options.on && now - this->connectedAt >= options.on * 1000UL) {
+            this->client.disconnect();
+            this->socket.stop();
+            this->online = false;
+            this->nextConnect = now + options.off * 1000UL;
+            continue;
+        }
+
+        if (now >= this->nextSend) {
+            send();
+            this->nextSend += options.period;
+            if (this->nextSend <= now) this->nextSend = now + options.period;
+        }
+
+        this->client.loop();
+
+        // more frames are buffered, other devices run first
+        until = this->socket.available() > 0 ? now : std::min(this->nextSend, now + options.tick);
+        park(until, true);
+    }
+}
+
+/**
+ * @brief give control to the event loop until timer or socket event
+ *
+ * @param until - ms wake up time
+ * @param io - socket event wakes up earlier
+ */
+void Device::park(unsigned long until, bool io) {
+
+    fleetTimer_t timer;
+
+    if (current != this) return;
+    this->generation++;
+    this->parked = true;
+    this->waitIo = io;
+    timer.until = until;
+    timer.device = this;
+    timer.generation = this->generation;
+    timers.push(timer);
+    current = NULL;
+    swapcontext(&this->context, &scheduler);
+    current = this;
+}
+
+void Device::wake() {
+
+    if (!this->parked) return;
+    this->parked = false;
+    runnable.push_back(this);
+}
+
+void Device::drop() {
+    this->dropRequest = true;
+    wake();
+}
+
+void Device::entry(int index) {
+
+    devices[index]->run();
+    // fiber ends, uc_link returns to scheduler
+    devices[index]->parked = true;
+    current = NULL;
+}
+
+unsigned long Device::reconnectDelay() {
+    return options.reconnect / 2 + (options.reconnect ? rnd() % (options.reconnect + 1) : 0);
+}
+
+// answer of FLEET_FUNCTION, called in fiber of device
+static void cbComplete(ToneIotClient::sendHandle_t handle, TOIC_SEND result, uint16_t error) {
+
+    Device* device = current;
+
+    if (device == NULL) return;
+    if (result == TOIC_SEND::ACK) {
+        total.acked++;
+        second.acked++;
+        second.latency.push_back(millis() - device->sendTime[handle & 0xFF]);
+    } else {
+        total.failed++;
+        second.failed++;
+    }
+}
+
+void Device::send() {
+
+    static uint8_t payload[TOIC_MAX_PACKET_SIZE];
+    ToneIotClient::sendHandle_t handle = this->client.sendFunctioAsync(FLEET_FUNCTION, payload, options.payload, cbComplete);
+
+    if (handle == TOIC_SEND_HANDLE_INVALID) {
+        total.failed++;
+        second.failed++;
+        return;
+    }
+    this->sendTime[handle & 0xFF] = millis();
+    total.sent++;
+    second.sent++;
+}
+
+// ======================================== event loop ======================================
+
+static uint32_t percentile(std::vector<uint32_t>& sorted, uint8_t p) {
+
+    if (sorted.empty()) return 0;
+    return sorted[((sorted.size() - 1) * p + 50) / 100];
+}
+
+static long rssKb() {
+
+    char line[128];
+    long kb = 0;
+    FILE* f = fopen("/proc/self/status", "r");
+
+    if (f == NULL) return 0;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (sscanf(line, "VmRSS: %ld", &kb) == 1) break;
+    }
+    fclose(f);
+    return kb;
+}
+
+// frames and bytes of all clients since last call
+static ToneIotClient::stats_t collectStats() {
+
+    ToneIotClient::stats_t sum;
+    ToneIotClient::stats_t s;
+
+    memset(&sum, 0, sizeof(sum));
+    for (Device* device : devices) {
+        s = device->client.getStats();
+        sum.txFrames += s.txFrames - device->reported.txFrames;
+        sum.txBytes += s.txBytes - device->reported.txBytes;
+        sum.rxFrames += s.rxFrames - device->reported.rxFrames;
+        sum.rxBytes += s.rxBytes - device->reported.rxBytes;
+        sum.retransmits += s.retransmits - device->reported.retransmits;
+        sum.duplicates += s.duplicates - device->reported.duplicates;
+        device->reported = s;
+    }
+    return sum;
+}
+
+// start drop pattern of this second
+static void dropPattern(uint32_t elapsed) {
+
+    std::uniform_real_distribution<double> chance(0.0, 1.0);
+
+    switch (options.drop) {
+    case FLEET_DROP::RANDOM:
+        for (Device* device : devices) {
+            if (device->online && chance(rnd) < options.dropRate) device->drop();
+        }
+        break;
+    case FLEET_DROP::STORM:
+        if (elapsed == 0 || elapsed % options.dropPeriod != 0) break;
+        for (Device* device : devices) {
+            if (device->online) device->drop();
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+static void report(uint32_t elapsed, ToneIotClient::stats_t& frames, uint64_t& txFrames, uint64_t& rxFrames,
+                   uint64_t& txBytes, uint64_t& rxBytes) {
+
+    uint32_t online = 0;
+
+    for (Device* device : devices) online += device->online;
+    std::sort(second.latency.begin(), second.latency.end());
+    std::sort(second.connectTime.begin(), second.connectTime.end());
+    fprintf(stderr, "t=%u online=%u connect/s=%lu fail/s=%lu lost/s=%lu tx/s=%lu rx/s=%lu "
+            "ack p50=%u p90=%u p99=%u ms connect p50=%u p99=%u ms\n",
+            elapsed, online, (unsigned long)second.connects, (unsigned long)second.connectFails,
+            (unsigned long)second.lost, (unsigned long)frames.txFrames, (unsigned long)frames.rxFrames,
+            percentile(second.latency, 50), percentile(second.latency, 90), percentile(second.latency, 99),
+            percentile(second.connectTime, 50), percentile(second.connectTime, 99));
+
+    txFrames += frames.txFrames;
+    rxFrames += frames.rxFrames;
+    txBytes += frames.txBytes;
+    rxBytes += frames.rxBytes;
+    total.latency.insert(total.latency.end(), second.latency.begin(), second.latency.end());
+    total.connectTime.insert(total.connectTime.end(), second.connectTime.begin(), second.connectTime.end());
+    second.latency.clear();
+    second.connectTime.clear();
+    second.connects = second.connectFails = second.lost = second.drops = 0;
+    second.sent = second.acked = second.failed = 0;
+}
+
+static void summary(uint32_t elapsed, uint64_t txFrames, uint64_t rxFrames, uint64_t txBytes, uint64_t rxBytes) {
+
+    char json[1024];
+    long rss = rssKb();
+    double seconds = elapsed ? elapsed : 1;
+    FILE* f = NULL;
+
+    std::sort(total.latency.begin(), total.latency.end());
+    std::sort(total.connectTime.begin(), total.connectTime.end());
+    snprintf(json, sizeof(json),
+             "{\"devices\": %u, \"duration_s\": %u, \"connects\": %lu, \"connect_fails\": %lu, "
+             "\"lost\": %lu, \"drops\": %lu, \"connect_rate\": %.1f, "
+             "\"tx_frames\": %lu, \"rx_frames\": %lu, \"tx_bytes\": %lu, \"rx_bytes\": %lu, "
+             "\"tx_frame_rate\": %.1f, \"rx_frame_rate\": %.1f, "
+             "\"sent\": %lu, \"acked\": %lu, \"failed\": %lu, "
+             "\"ack_ms\": {\"p50\": %u, \"p90\": %u, \"p99\": %u, \"max\": %u}, "
+             "\"connect_ms\": {\"p50\": %u, \"p90\": %u, \"p99\": %u, \"max\": %u}, "
+             "\"rss_kb\": %ld, \"bytes_per_device\": %ld}",
+             options.devices, elapsed, (unsigned long)total.connects, (unsigned long)total.connectFails,
+             (unsigned long)total.lost, (unsigned long)total.drops, total.connects / seconds,
+             (unsigned long)txFrames, (unsigned long)rxFrames, (unsigned long)txBytes, (unsigned long)rxBytes,
+             txFrames / seconds, rxFrames / seconds,
+             (unsigned long)total.sent, (unsigned long)total.acked, (unsigned long)total.failed,
+             percentile(total.latency, 50), percentile(total.latency, 90), percentile(total.latency, 99),
+             total.latency.empty() ? 0 : total.latency.back(),
+             percentile(total.connectTime, 50), percentile(total.connectTime, 90), percentile(total.connectTime, 99),
+             total.connectTime.empty() ? 0 : total.connectTime.back(),
+             rss, rss * 1024 / (long)options.devices);
+    printf("FLEET %s\n", json);
+    if (options.out == NULL) return;
+    f = fopen(options.out, "w");
+    if (f == NULL) return;
+    fprintf(f, "%s\n", json);
+    fclose(f);
+}
+
+static void loop() {
+
+    epoll_event events[FLEET_MAX_EVENTS];
+    ToneIotClient::stats_t frames;
+    unsigned long now = 0;
+    unsigned long nextSecond = 1000;
+    unsigned long end = options.duration * 1000UL;
+    uint64_t txFrames = 0, rxFrames = 0, txBytes = 0, rxBytes = 0;
+    Device* device = NULL;
+    int timeout = 0;
+    int n = 0;
+
+    while (running) {
+        while (!runnable.empty()) {
+            device = runnable.front();
+            runnable.pop_front();
+            current = device;
+            swapcontext(&scheduler, &device->context);
+            current = NULL;
+        }
+
+        now = millis();
+        timeout = timers.empty() ? 1000 : (timers.top().until > now ? timers.top().until - now : 0);
+        if (now + timeout > nextSecond) timeout = nextSecond > now ? nextSecond - now : 0;
+        n = epoll_wait(epollFd, events, FLEET_MAX_EVENTS, timeout);
+        for (int i = 0; i < n; i++) {
+            device = (Device*)events[i].data.ptr;
+            if (device->waitIo) device->wake();
+        }
+
+        now = millis();
+        while (!timers.empty() && timers.top().until <= now) {
+            if (timers.top().generation == timers.top().device->generation) timers.top().device->wake();
+            timers.pop();
+        }
+
+        if (now >= nextSecond) {
+            frames = collectStats();
+            report(nextSecond / 1000, frames, txFrames, rxFrames, txBytes, rxBytes);
+            if (nextSecond >= end) break;
+            dropPattern(nextSecond / 1000);
+            nextSecond += 1000;
+        }
+    }
+    summary(std::min(now, end) / 1000, txFrames, rxFrames, txBytes, rxBytes);
+}
+
+// ======================================== main ======================================
+
+static void onSignal(int signal) {
+    running = false;
+}
+
+static int parseServer(const char* value) {
+
+    char host[64];
+    const char* colon = strrchr(value, ':');
+    addrinfo hints;
+    addrinfo* result = NULL;
+
+    if (colon == NULL || (size_t)(colon - value) >= sizeof(host)) return -1;
+    memcpy(host, value, colon - value);
+    host[colon - value] = '\0';
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, colon + 1, &hints, &result) != 0) return -1;
+    memcpy(&options.server, result->ai_addr, sizeof(options.server));
+    freeaddrinfo(result);
+    return 0;
+}
+
+static int parseDrop(const char* value) {
+
+    if (strcmp(value, "none") == 0) {
+        options.drop = FLEET_DROP::NONE;
+        return 0;
+    }
+    if (strncmp(value, "random:", 7) == 0) {
+        options.drop = FLEET_DROP::RANDOM;
+        options.dropRate = atof(value + 7);
+        return 0;
+    }
+    if (strncmp(value, "storm:", 6) == 0) {
+        options.drop = FLEET_DROP::STORM;
+        options.dropPeriod = atoi(value + 6);
+        return options.dropPeriod ? 0 : -1;
+    }
+    return -1;
+}
+
+static void usage(const char* name) {
+    fprintf(stderr,
+            "usage: %s [--devices 1000] [--server 127.0.0.1:5000] [--duration 60]\n"
+            "          [--ramp 500] [--keepalive 15] [--period 10000] [--payload 16] [--qos 0|1|2] [--sync]\n"
+            "          [--on 0 --off 0] [--drop none|random:P|storm:S] [--reconnect 10000]\n"
+            "          [--tick 100] [--seed 1] [--out fleet.json]\n"
+            "  --ramp      connects per second at start, 0 - all at once\n"
+            "  --period    ms between functions of device, 0 - keep alive only\n"
+            "  --sync      all devices send at the same ms (telemetry bursts)\n"
+            "  --on/--off  s connected and disconnected of duty cycle\n"
+            "  --drop      random:P - each device loses link with probability P per second,\n"
+            "              storm:S - all devices lose link every S seconds\n"
+            "  --reconnect ms before reconnect after lost link, +-50%%\n", name);
+}
+
+int main(int argc, char** argv) {
+
+    static const option longOptions[] = {
+        {"devices", required_argument, NULL, 'n'},
+        {"server", required_argument, NULL, 's'},
+        {"duration", required_argument, NULL, 'd'},
+        {"ramp", required_argument, NULL, 'r'},
+        {"keepalive", required_argument, NULL, 'k'},
+        {"period", required_argument, NULL, 'p'},
+        {"payload", required_argument, NULL, 'l'},
+        {"qos", required_argument, NULL, 'q'},
+        {"sync", no_argument, NULL, 'y'},
+        {"on", required_argument, NULL, 'o'},
+        {"off", required_argument, NULL, 'f'},
+        {"drop", required_argument, NULL, 'x'},
+        {"reconnect", required_argument, NULL, 'c'},
+        {"tick", required_argument, NULL, 't'},
+        {"seed", required_argument, NULL, 'e'},
+        {"out", required_argument, NULL, 'w'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+    rlimit files;
+    void* memory = NULL;
+    int opt = 0;
+
+    options.devices = 1000;
+    options.duration = 60;
+    options.ramp = 500;
+    options.keepAlive = TOIC_KEEPALIVE;
+    options.period = 10000;
+    options.payload = 16;
+    options.qos = TOIC_QOS::AT_MOST_ONCE;
+    options.sync = false;
+    options.on = 0;
+    options.off = 0;
+    options.drop = FLEET_DROP::NONE;
+    options.reconnect = 10000;
+    options.tick = 100;
+    options.seed = 1;
+    options.out = NULL;
+    parseServer("127.0.0.1:5000");
+
+    while ((opt = getopt_long(argc, argv, "h", longOptions, NULL)) != -1) {
+        switch (opt) {
+        case 'n': options.devices = atoi(optarg); break;
+        case 's':
+            if (parseServer(optarg)) {
+                fprintf(stderr, "bad server %s\n", optarg);
+                return 2;
+            }
+            break;
+        case 'd': options.duration = atoi(optarg); break;
+        case 'r': options.ramp = atoi(optarg); break;
+        case 'k': options.keepAlive = atoi(optarg); break;
+        case 'p': options.period = atoi(optarg); break;
+        case 'l': options.payload = std::min(atoi(optarg), TOIC_MAX_PACKET_SIZE - 14); break;
+        case 'q': options.qos = (TOIC_QOS)atoi(optarg); break;
+        case 'y': options.sync = true; break;
+        case 'o': options.on = atoi(optarg); break;
+        case 'f': options.off = atoi(optarg); break;
+        case 'x':
+            if (parseDrop(optarg)) {
+                fprintf(stderr, "bad drop %s\n", optarg);
+                return 2;
+            }
+            break;
+        case 'c': options.reconnect = atoi(optarg); break;
+        case 't': options.tick = std::max(atoi(optarg), 1); break;
+        case 'e': options.seed = atoi(optarg); break;
+        case 'w': options.out = optarg; break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 2;
+        }
+    }
+    if (options.devices == 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    // a socket per device
+    getrlimit(RLIMIT_NOFILE, &files);
+    files.rlim_cur = files.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &files);
+    if (files.rlim_cur < options.devices + 16) {
+        fprintf(stderr, "open files limit %lu is less than devices, raise ulimit -n\n", (unsigned long)files.rlim_cur);
+        return 1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    rnd.seed(options.seed);
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+    signal(SIGPIPE, SIG_IGN);
+
+    epollFd = epoll_create1(0);
+    stacks = (uint8_t*)mmap(NULL, (size_t)options.devices * FLEET_STACK_SIZE, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (epollFd < 0 || stacks == MAP_FAILED) {
+        perror("fleet");
+        return 1;
+    }
+    devices.reserve(options.devices);
+    // rings of client are cache line aligned
+    for (uint32_t i = 0; i < options.devices; i++) {
+        if (posix_memalign(&memory, alignof(Device), sizeof(Device)) != 0) {
+            perror("fleet");
+            return 1;
+        }
+        devices.push_back(new (memory) Device(i));
+    }
+    for (Device* device : devices) device->start();
+
+    loop();
+
+    // sockets are closed by exit, destructors of clients would write DISCONNECT
+    fflush(stdout);
+    _exit(0);
+}
@@ -0,0 +1,58 @@
+/**
+    * @author Dyakonov Oleg <o.u.dyakonov@gmail.com>
+    * 
+    * @brief Arduino.cpp - host subset of Arduino API for env fleet
+*/
+
+#include <Arduino.h>
+#include <stdarg.h>
+
+size_t Print::write(const uint8_t* buf, size_t size) {
+
+    size_t n = 0;
+
+    while (n < size && write(buf[n])) n++;
+    return n;
+}
+
+size_t Print::print(const char* s) {
+    return write((const uint8_t*)s, strlen(s));
+}
+
+size_t Print::print(unsigned long n) {
+
+    char buf[24];
+
+    snprintf(buf, sizeof(buf), "%lu", n);
+    return print(buf);
+}
+
+size_t Print::println(const char* s) {
+    return print(s) + println();
+}
+
+size_t Print::println(unsigned long n) {
+    return print(n) + println();
+}
+
+size_t Print::println() {
+    return print("\r\n");
+}
+
+size_t Print::printf(const char* format, ...) {
+
+    char buf[256];
+    va_list args;
+    int len = 0;
+
+    va_start(args, format);
+    len = vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+    if (len < 0) return 0;
+    return write((const uint8_t*)buf, (size_t)len < sizeof(buf) ? len : sizeof(buf) - 1);
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {}
+void digitalWrite(uint8_t pin, uint8_t val) {}
+int digitalRead(uint8_t pin) { return HIGH; }
+void attachInterrupt(uint8_t pin, void (*isr)(void), int mode) {}
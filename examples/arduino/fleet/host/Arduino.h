@@ -0,0 +1,46 @@
+/**
+    * @author Dyakonov Oleg <o.u.dyakonov@gmail.com>
+    * 
+    * @brief Arduino.h - host subset of Arduino API for env fleet
+*/
+
+#ifndef ARDUINO_h
+#define ARDUINO_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define HIGH            1
+#define LOW             0
+#define INPUT           0
+#define OUTPUT          1
+#define INPUT_PULLUP    2
+#define FALLING         2
+
+#define IRAM_ATTR
+#define F(x) (x)
+#define digitalPinToInterrupt(p) (p)
+
+// time and scheduling are implemented by the fleet event loop
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void yield();
+
+// devices have no pins
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+void attachInterrupt(uint8_t pin, void (*isr)(void), int mode);
+
+#include "Print.h"
+#include "Stream.h"
+#include "IPAddress.h"
+
+#endif //ARDUINO_h
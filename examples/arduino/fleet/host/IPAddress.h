@@ -0,0 +1,38 @@
+/**
+    * @author Dyakonov Oleg <o.u.dyakonov@gmail.com>
+    * 
+    * @brief IPAddress.h - host subset of Arduino API for env fleet
+*/
+
+#ifndef IPADDRESS_h
+#define IPADDRESS_h
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+class IPAddress {
+
+public:
+
+   IPAddress() : address{0, 0, 0, 0} {}
+   IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : address{a, b, c, d} {}
+
+   bool fromString(const char* text) {
+      unsigned a, b, c, d;
+      char tail;
+      if (sscanf(text, "%u.%u.%u.%u%c", &a, &b, &c, &d, &tail) != 4 || a > 255 || b > 255 || c > 255 || d > 255) return false;
+      this->address[0] = a; this->address[1] = b; this->address[2] = c; this->address[3] = d;
+      return true;
+   }
+
+   uint8_t operator[](int index) const { return this->address[index]; }
+   uint8_t& operator[](int index) { return this->address[index]; }
+   bool operator==(const IPAddress& other) const { return memcmp(this->address, other.address, 4) == 0; }
+
+private:
+
+   uint8_t address[4];
+};
+
+#endif //IPADDRESS_h
@@ -0,0 +1,30 @@
+/**
+    * @author Dyakonov Oleg <o.u.dyakonov@gmail.com>
+    * 
+    * @brief Print.h - host subset of Arduino API for env fleet
+*/
+
+#ifndef PRINT_h
+#define PRINT_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+class Print {
+
+public:
+
+   virtual ~Print() {}
+   virtual size_t write(uint8_t b) = 0;
+   virtual size_t write(const uint8_t* buf, size_t size);
+   virtual void flush() {}
+
+   size_t print(const char* s);
+   size_t print(unsigned long n);
+   size_t println(const char* s);
+   size_t println(unsigned long n);
+   size_t println();
+   size_t printf(const char* format, ...);
+};
+
+#endif //PRINT_h
@@ -0,0 +1,21 @@
+/**
+    * @author Dyakonov Oleg <o.u.dyakonov@gmail.com>
+    * 
+    * @brief Stream.h - host subset of Arduino API for env fleet
+*/
+
+#ifndef STREAM_h
+#define STREAM_h
+
+#include "Print.h"
+
+class Stream : public Print {
+
+public:
+
+   virtual int available() = 0;
+   virtual int read() = 0;
+   virtual int peek() = 0;
+};
+
+#endif //STREAM_h
@@ -0,0 +1,13 @@
+/**
+    * @author Dyakonov Oleg <o.u.dyakonov@gmail.com>
+    * 
+    * @brief pgmspace.h - host subset of Arduino API for env fleet
+*/
+
+#ifndef PGMSPACE_h
+#define PGMSPACE_h
+
+#define PROGMEM
+#define pgm_read_byte(addr) (*(const unsigned char*)(addr))
+
+#endif //PGMSPACE_h
@@ -0,0 +1,55 @@
+/**
+    * @author Dyakonov Oleg <o.u.dyakonov@gmail.com>
+    *
+    * @brief ToneIotBufferPool - fixed pool of packet buffers with RX/TX ownership
+*/
+
+#ifndef TONEIOTBUFFERPOOL_h
+#define TONEIOTBUFFERPOOL_h
+
+#include <Arduino.h>
+#include <atomic>
+
+// TOIC_BUFFER_POOL : number of packet buffers, one is always owned by RX,
+// packets waiting retransmission keep their TX buffer
+#ifndef TOIC_BUFFER_POOL
+#define TOIC_BUFFER_POOL 8
+#endif
+
+/**
+ * @brief owner of buffer
+ *
+ */
+enum class TOIC_BUFFER_OWNER : uint8_t {
+   FREE = 0,
+   RX   = 1,
+   TX   = 2
+};
+
+class ToneIotBufferPool {
+
+public:
+
+   ToneIotBufferPool();
+   ~ToneIotBufferPool();
+
+   int8_t init(uint16_t size);
+   int8_t init(uint16_t size, uint8_t* memory);
+   int8_t acquire(TOIC_BUFFER_OWNER owner);
+   void release(int8_t index);
+
+   uint8_t* get(int8_t index);
+   TOIC_BUFFER_OWNER getOwner(int8_t index);
+   uint16_t getSize();
+   uint8_t getUsed(TOIC_BUFFER_OWNER owner);
+
+private:
+
+   uint8_t*          memory;     ///< all buffers, allocated once
+   bool              external;   ///< memory is given by owner, not freed
+   uint16_t          size;       ///< size one buffer
+   std::atomic<uint8_t> owner[TOIC_BUFFER_POOL];
+};
+
+
+#endif //TONEIOTBUFFERPOOL_h
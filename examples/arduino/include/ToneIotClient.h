@@ -14,8 +14,18 @@
 #include "Client.h"
 #include "Stream.h"
 
+#include "ToneIotBufferPool.h"
+#include "ToneIotPacket.h"
+#include "ToneIotPort.h"
+#include "ToneIotRing.h"
+#include "ToneIotInplaceFunction.h"
+#include "ToneIotRadio.h"
+
 //#include "ToneIotFunction.h"
 
+class ToneIotDelta;
+class ToneIotTelemetry;
+
 // TOIC_MAX_PACKET_SIZE : Maximum packet size. Override with setBufferSize().
 #define TOIC_MAX_PACKET_SIZE 256
 
@@ -25,6 +35,103 @@
 // TOIC_SOCKET_TIMEOUT: socket timeout interval in Seconds. Override with setSocketTimeout()
 #define TOIC_SOCKET_TIMEOUT 15
 
+// TOIC_TASK_CORE : core of network task, Arduino loop() runs on core 1. Override with startTask()
+#define TOIC_TASK_CORE 0
+
+// TOIC_TASK_STACK : stack size network task in bytes
+#define TOIC_TASK_STACK 4096
+
+// TOIC_TASK_PRIORITY : priority network task
+#define TOIC_TASK_PRIORITY 1
+
+// TOIC_TASK_POLL : ms idle network task waits before it polls the socket again, a queued frame or read RX ring wakes it at once
+#define TOIC_TASK_POLL 1
+
+// TOIC_RING_SIZE : bytes of RX ring and of TX ring of every priority class between network and application task, power of two
+#define TOIC_RING_SIZE 1024
+
+// TOIC_TX_STAMP : bytes after frame in TX ring, time of enqueue us
+#define TOIC_TX_STAMP 4
+
+// TOIC_FUNCTION_CAPTURE : bytes for captures of function callback
+#define TOIC_FUNCTION_CAPTURE 16
+
+// TOIC_MAX_PENDING : slots for asynchronous sends waiting ACK/ERROR
+#define TOIC_MAX_PENDING 32
+
+// TOIC_BUFFER_RING : index of packet built in TX ring instead of pool buffer
+#define TOIC_BUFFER_RING -2
+
+// TOIC_BUFFER_BATCH : index of packet held in batch until wake window
+#define TOIC_BUFFER_BATCH -3
+
+// TOIC_BATCH_SIZE : bytes of packets held while the modem sleeps, power of two
+#define TOIC_BATCH_SIZE 1024
+
+// TOIC_WAKE_WINDOW : ms the modem stays awake after last traffic for answers
+#define TOIC_WAKE_WINDOW 2000
+
+// TOIC_MAX_TX_FUNCTIONS : functions with own delivery or delay. Override with setFunctionQos(), setFunctionDelay()
+#define TOIC_MAX_TX_FUNCTIONS 8
+
+// TOIC_MAX_INFLIGHT : packets kept for retransmission until ACK/ERROR, each holds a pool buffer
+#define TOIC_MAX_INFLIGHT 4
+
+// TOIC_MAX_RETRIES : retransmissions before the packet is given up
+#define TOIC_MAX_RETRIES 5
+
+// TOIC_RTO_INITIAL : retransmission timeout in ms before the first RTT sample
+#define TOIC_RTO_INITIAL 3000
+
+// TOIC_RTO_MIN, TOIC_RTO_MAX : bounds of retransmission timeout in ms
+#define TOIC_RTO_MIN 1000
+#define TOIC_RTO_MAX 60000
+
+// TOIC_SYS_FUNCTIONS : callbacks of system functions registered by constructor
+#define TOIC_SYS_FUNCTIONS 2
+
+// TOIC_MAX_ENDPOINTS : servers tried in order, the first one is the domain of token. Override with addEndpoint()
+#define TOIC_MAX_ENDPOINTS 4
+
+// TOIC_DNS_TTL : ms resolved address of endpoint is used without DNS lookup. Override with setDnsTtl()
+#define TOIC_DNS_TTL 3600000
+
+// TOIC_ENDPOINT_BACKOFF : ms failed endpoint is skipped, doubled with every failure in a row up to TOIC_ENDPOINT_BACKOFF_MAX
+#define TOIC_ENDPOINT_BACKOFF 5000
+#define TOIC_ENDPOINT_BACKOFF_MAX 300000
+
+// TOIC_CREDIT_FRAMES, TOIC_CREDIT_BYTES : receive credit given to server, at least one packet buffer of bytes
+#define TOIC_CREDIT_FRAMES 4
+#define TOIC_CREDIT_BYTES 512
+
+// TOIC_RX_WINDOW : received msgIds remembered behind the highest one, bits of rxWindow
+#define TOIC_RX_WINDOW 64
+
+// TOIC_MAX_GROUPS : group ids of addGroup(), their frames are received like frames of own id
+#define TOIC_MAX_GROUPS 8
+
+/**
+ * @brief bits of function number, the number itself is 14 bits
+ * 
+ */
+#define TOIC_FUNCTION_FLAG_DUP     0x8000   ///< retransmission, packet may be received already
+#define TOIC_FUNCTION_FLAG_ONCE    0x4000   ///< server keeps msgId and does not deliver duplicates
+#define TOIC_FUNCTION_MASK         0x3FFF
+
+/**
+ * @brief priority class of outgoing frame, the network task writes queued
+ * frames of higher class first, bulk frames one by one between them
+ * 
+ */
+enum class TOIC_PRIORITY {
+   SYSTEM   = 0,   ///< ACK, ERROR, keep alive and other system functions
+   CONTROL  = 1,   ///< user functions by default
+   BULK     = 2    ///< telemetry batches, logs, transfers. Set with setFunctionPriority()
+};
+
+// TOIC_PRIORITY_COUNT : number of priority classes, TX rings
+#define TOIC_PRIORITY_COUNT 3
+
 /**
  * @brief state
  * 
@@ -36,9 +143,35 @@ enum class TOIC_STATE  {
    DISCONNECTED         = -1,
    CONNECTED            = 0,
    CONNECT_BAD_PROTOCOL = 1,
-   CONNECT_UNAUTHORIZED = 2
+   CONNECT_UNAUTHORIZED = 2,
+   CONNECTING           = 3     ///< INIT is sent by connectAsync()
 };
 
+/**
+ * @brief result asynchronous send
+ * 
+ */
+enum class TOIC_SEND {
+   INVALID  = -3,    ///< handle is free or reused
+   TIMEOUT  = -2,    ///< no answer within socket timeout
+   ERROR    = -1,    ///< server answered TOIC_FUNCTION_SYS_ERROR
+   PENDING  = 0,     ///< waiting answer
+   ACK      = 1      ///< server answered TOIC_FUNCTION_SYS_ACK
+};
+
+/**
+ * @brief delivery of outgoing function
+ * 
+ */
+enum class TOIC_QOS : uint8_t {
+   AT_MOST_ONCE   = 0,   ///< sent once, lost packet is lost
+   AT_LEAST_ONCE  = 1,   ///< retransmitted until ACK/ERROR, server may get duplicates
+   EXACTLY_ONCE   = 2    ///< retransmitted until ACK/ERROR, server drops duplicates by msgId
+};
+
+// TOIC_SEND_HANDLE_INVALID : handle of failed asynchronous send
+#define TOIC_SEND_HANDLE_INVALID 0xFFFF
+
 /**
  * @brief system functions
  * 
@@ -47,6 +180,7 @@ enum class TOIC_STATE  {
 #define TOIC_FUNCTION_SYS_ACK          1
 #define TOIC_FUNCTION_SYS_ERROR        2
 #define TOIC_FUNCTION_SYS_KEEPALIVE    3
+#define TOIC_FUNCTION_SYS_OTA          4
 #define TOIC_FUNCTION_SYS_DISCONNECT   15
 
 /**
@@ -54,6 +188,16 @@ enum class TOIC_STATE  {
  * 
  */
 #define TOIC_ERROR_FAULT    -1   ///< fault
+#define TOIC_ERROR_OTA      -2   ///< ota update failed
+
+/**
+ * @brief commands of function TOIC_FUNCTION_SYS_OTA, first byte data
+ * 
+ */
+#define TOIC_OTA_BEGIN      0   ///< start delta patch
+#define TOIC_OTA_DATA       1   ///< offset patch 4 byte + part patch
+#define TOIC_OTA_END        2   ///< verify image and set boot partition
+#define TOIC_OTA_ABORT      3   ///< abort update
 
 /**
  * @brief disconnection codes tone iot server
@@ -65,7 +209,79 @@ class ToneIotClient {
 
 public:
 
-   typedef void (*cbFunction_t)(uint8_t*, uint16_t);
+   typedef ToneIotInplaceFunction<void(uint8_t*, uint16_t), TOIC_FUNCTION_CAPTURE> cbFunction_t;
+   typedef uint16_t sendHandle_t;   ///< slot 8 bit + generation 8 bit
+   typedef void (*cbComplete_t)(sendHandle_t handle, TOIC_SEND result, uint16_t error);
+   typedef ToneIotInplaceFunction<bool(uint16_t, uint8_t*, uint16_t), TOIC_FUNCTION_CAPTURE> cbReceive_t;
+   typedef ToneIotInplaceFunction<int8_t(const char*, IPAddress*), TOIC_FUNCTION_CAPTURE> cbResolve_t;
+
+   /**
+    * @brief counters of socket traffic. Socket counters are written with
+    * ioMutex held, the others by the application task; getStats() copies
+    * them under ioMutex
+    *
+    */
+   typedef struct 
+   {
+      uint32_t       txFrames;      ///< frames written to socket
+      uint32_t       txBytes;       ///< bytes written to socket, header included
+      uint32_t       rxFrames;      ///< frames read from socket
+      uint32_t       rxBytes;       ///< bytes read from socket, header included
+      uint32_t       retransmits;   ///< frames sent again by checkInflight(), application
+      uint32_t       duplicates;    ///< received frames dropped by msgId window
+      uint32_t       resolves;      ///< DNS lookups by resolver
+      uint32_t       creditStalls;  ///< sends refused without credit of server, application
+      uint32_t       creditOverruns; ///< frames of server above given credit
+      uint32_t       skipped;       ///< frames of other devices and groups or over buffer size, not buffered
+      struct {
+         uint32_t    frames;        ///< frames written from TX ring of class
+         uint64_t    waitTotal;     ///< us frames waited in ring
+         uint32_t    waitMax;       ///< us
+         uint16_t    depth;         ///< frames in ring now
+         uint16_t    depthMax;      ///< application
+      } tx[TOIC_PRIORITY_COUNT];    ///< queues of network task by TOIC_PRIORITY
+   } stats_t;
+
+   typedef struct 
+   {
+      const char*    host;          ///< domain or ip literal, not copied
+      uint16_t       port;
+      IPAddress      ip;            ///< literal or cached address
+      bool           literal;       ///< host is ip, never resolved
+      bool           cached;        ///< ip is resolved
+      unsigned long  resolvedAt;    ///< time of DNS answer ms
+      uint8_t        failures;      ///< failed connects in a row
+      unsigned long  failedAt;      ///< time of last failure ms
+      uint32_t       connects;      ///< successful connects
+      uint32_t       connectTime;   ///< duration of last successful TCP connect ms
+   } endpoint_t;
+
+   /**
+    * @brief subscribed group, the server numbers frames of group by own
+    * msgId sequence, one frame reaches all devices on a shared link
+    *
+    */
+   typedef struct
+   {
+      uint8_t        id[ToneIotPacketView::ID_SIZE];
+      uint16_t       rxMsgId;       ///< highest msgId received for group
+      uint64_t       rxWindow;      ///< bit n - msgId rxMsgId - n is received
+   } group_t;
+
+   /**
+    * @brief rings between network and application task, only startTask() uses them.
+    * A heap client allocates them in startTask(), ToneIotStaticClient is given them
+    * with setTaskRings()
+    *
+    */
+   typedef struct
+   {
+      ToneIotRing<TOIC_RING_SIZE> rx;  ///< received packets, network task -> application
+      ToneIotRing<TOIC_RING_SIZE> tx[TOIC_PRIORITY_COUNT]; ///< packets to send by TOIC_PRIORITY, application -> network task
+   } taskRings_t;
+
+   // batchRing_t : packets held while the modem sleeps, only setRadio() uses it
+   typedef ToneIotRing<TOIC_BATCH_SIZE> batchRing_t;
 
    ToneIotClient(Client& client);
    ToneIotClient(Client& client, Stream& stream);
@@ -74,21 +290,58 @@ public:
 
    int8_t setToneIotServer(char* tonetoken);
    int8_t setFunction(uint16_t function, cbFunction_t cbFunction);
+   bool isFunctionEnabled(uint16_t function);
+   int8_t setFunctionQos(uint16_t function, TOIC_QOS qos);
+   TOIC_QOS getFunctionQos(uint16_t function);
+   int8_t setFunctionDelay(uint16_t function, uint32_t delay);
+   uint32_t getFunctionDelay(uint16_t function);
+   int8_t setFunctionPriority(uint16_t function, TOIC_PRIORITY priority);
+   TOIC_PRIORITY getFunctionPriority(uint16_t function);
+   bool hasCredit(uint16_t len);
    void setClient(Client& client);
    void setStream(Stream& stream);
+   void setDelta(ToneIotDelta& delta);
+   void setRadio(ToneIotRadio& radio);
+   void setTaskRings(taskRings_t& rings);
+   void setBatchRing(batchRing_t& ring);
+   void setTelemetry(ToneIotTelemetry& telemetry, uint16_t function);
+   void setReceiveHook(cbReceive_t cbReceive);
+   int8_t addEndpoint(const char* host, uint16_t port);
+   void clearEndpoints();
+   void setResolver(cbResolve_t cbResolve);
+   int8_t addGroup(const uint8_t* id);
+   int8_t removeGroup(const uint8_t* id);
+   void clearGroups();
+   uint8_t getGroupCount();
+   bool isMember(const uint8_t* id);
+   void setDnsTtl(uint32_t ttl);
+   uint8_t getEndpointCount();
+   const endpoint_t* getEndpoint(uint8_t index);
+   int8_t getEndpointIndex();
    void setKeepAlive(uint16_t keepAlive);
    void setSocketTimeout(uint16_t timeout);
    int8_t setBufferSize(uint16_t size);
    uint16_t getBufferSize();
+   uint32_t getRetransmitTimeout();
+   stats_t getStats();
+   void resetStats();
 
    int8_t connect();
+   int8_t connectAsync();
    void disconnect();
    boolean connected();
    TOIC_STATE getState();
 
    int8_t loop();
+   int8_t startTask();
+   int8_t startTask(int8_t core);
+   void stopTask();
    int8_t sendFunctio(uint16_t function);
    int8_t sendFunctio(uint16_t function, uint8_t* buf, uint16_t len);
+   int8_t sendProfile(uint16_t function);
+   sendHandle_t sendFunctioAsync(uint16_t function, uint8_t* buf, uint16_t len);
+   sendHandle_t sendFunctioAsync(uint16_t function, uint8_t* buf, uint16_t len, cbComplete_t cbComplete);
+   TOIC_SEND getSendState(sendHandle_t handle);
 
    void sendFunctionAck();
    void sendFunctionError(uint16_t error);
@@ -97,18 +350,61 @@ public:
    uint16_t waitServerRespons(uint16_t* function, uint8_t** buf, uint16_t* len);
    uint16_t getErrorCode();
 
-private:
+protected:
 
    typedef struct 
    {
       // header
-      uint8_t    id[8];    ///< id
-      uint16_t   msgId;    ///< packet counter
-      uint16_t   function; ///< function number packet
-      uint16_t   datalen;  ///< length bytes data
-      // data
-      uint8_t    pdata[];  ///< pointer buffer data
-   } packet_t;
+      uint16_t    function;   ///< number function
+      bool        enable;     ///< enable function
+      // callback
+      cbFunction_t cbFunction;
+      // next
+      void* nextfunction;
+   } itemFunction_t;
+
+   /**
+    * @brief memory given by ToneIotStaticClient instead of heap, NULL - heap is used
+    * 
+    */
+   typedef struct 
+   {
+      uint8_t*          memory;        ///< TOIC_BUFFER_POOL packet buffers
+      uint16_t          bufferSize;    ///< max size one packet buffer
+      itemFunction_t*   functions;     ///< callbacks, system functions included
+      uint8_t           functionCount;
+      char*             domain;        ///< two slots of domainSize: decoded domain, terminator included, and the next one
+      uint16_t          domainSize;
+      uint8_t*          key;           ///< two slots of keySize: decoded key, terminator included, and the next one
+      uint16_t          keySize;
+   } storage_t;
+
+   /**
+    * @brief members behind storage_t, base of ToneIotStaticClient constructed before ToneIotClient
+    * 
+    */
+   template<uint16_t BufSize, uint8_t Functions, uint16_t DomainSize, uint16_t KeySize>
+   class staticStorage_t {
+
+   protected:
+
+      storage_t getStorage() {
+         storage_t storage = {this->memory, BufSize, this->functions, Functions, this->domain, DomainSize, this->key, KeySize};
+         return storage;
+      }
+
+   private:
+
+      alignas(4) uint8_t   memory[(size_t)BufSize * TOIC_BUFFER_POOL];
+      itemFunction_t       functions[Functions];
+      char                 domain[2 * DomainSize];
+      uint8_t              key[2 * KeySize];
+   };
+
+   ToneIotClient(Client& client, const storage_t& storage);
+   ToneIotClient(Client& client, Stream& stream, const storage_t& storage);
+
+private:
 
    typedef struct 
    {
@@ -120,55 +416,180 @@ private:
    } toneiotsettings_t;
    toneiotsettings_t  toneiotsettings;
 
-   typedef void (ToneIotClient::*cbFunctionSys_t)(uint8_t*, uint16_t);
-   enum class cbFunctionType_t {sys, user};
+   itemFunction_t* listFunction;
+   storage_t       storage;
+   bool            staticStorage;     ///< storage is given by ToneIotStaticClient, no heap
+   uint8_t         storageFunctions;  ///< used items of storage.functions
+
    typedef struct 
    {
-      // header
-      uint16_t    function;   ///< number function
-      bool        enable;     ///< enable function
-      // callback
-      cbFunctionType_t cbFunctionType;
-      union{
-         cbFunction_t cbFunctionUser;
-         cbFunctionSys_t cbFunctionSys;
-      };
-      // next
-      void* nextfunction;
-   } itemFunction_t;
-   itemFunction_t* listFunction;
+      bool           used;
+      uint8_t        generation; ///< changes on every use, old handles become invalid
+      uint16_t       msgId;      ///< msgId of sent packet, echoed by ACK/ERROR
+      TOIC_SEND      state;
+      unsigned long  timestamp;  ///< send time ms
+      uint32_t       hold;       ///< ms packet can be held in batch before it is sent
+      cbComplete_t   cbComplete;
+   } pendingSend_t;
+   pendingSend_t     pendingSend[TOIC_MAX_PENDING];
+
+   typedef struct 
+   {
+      uint16_t       function;   ///< function number
+      TOIC_QOS       qos;
+      uint32_t       delay;      ///< ms packet may wait for wake window, 0 - urgent
+      TOIC_PRIORITY  priority;
+   } txFunction_t;
+   txFunction_t      txFunction[TOIC_MAX_TX_FUNCTIONS];
+   uint8_t           txFunctionCount;
+
+   typedef struct 
+   {
+      int8_t         buffer;     ///< pool buffer with copy of packet, -1 - entry is free
+      uint16_t       msgId;      ///< msgId of sent packet, echoed by ACK/ERROR
+      uint8_t        retries;    ///< retransmissions made
+      unsigned long  timestamp;  ///< last transmission ms
+      uint32_t       hold;       ///< ms packet can be held in batch before it is sent
+   } inflight_t;
+   inflight_t        inflight[TOIC_MAX_INFLIGHT];
+   uint32_t          srtt;          ///< smoothed round trip time ms, 0 - no sample
+   uint32_t          rttvar;        ///< round trip time variation ms
+   uint32_t          rto;           ///< retransmission timeout ms
+   stats_t           stats;
 
    Client*           client;
    Stream*           stream;
+   ToneIotDelta*     delta;
+   ToneIotRadio*     radio;
+   ToneIotTelemetry* telemetry;
+   cbReceive_t       cbReceive;
+   cbResolve_t       cbResolve;
+   endpoint_t        endpoints[TOIC_MAX_ENDPOINTS];
+   uint8_t           endpointCount;
+   int8_t            endpointIndex; ///< endpoint of connection, -1 - none
+   group_t           groups[TOIC_MAX_GROUPS];   ///< sorted by id
+   uint8_t           groupCount;
+   uint32_t          dnsTtl;        ///< ms
+   uint16_t          telemetryFunction;
    
    uint16_t          bufferSize;
    uint16_t          keepAlive;     ///< keepAlive ms
    uint16_t          socketTimeout; ///< socketTimeout ms
-   uint16_t          msgId;
+   std::atomic<uint16_t> msgId;   ///< TX counter, ACK/ERROR of server echo it
+   uint16_t          rxMsgId;       ///< highest msgId received from server
+   uint64_t          rxWindow;      ///< bit n - msgId rxMsgId - n is received
    unsigned long     lastOutActivity;
    unsigned long     lastInActivity;
    bool              pingOutstanding;
 
-   uint8_t*          buffer;
-   packet_t*         packet;
-   TOIC_STATE        state;
+   // flow control, counters of functions above TOIC_FUNCTION_SYS_DISCONNECT since INIT
+   bool              txCredit;      ///< server gave credit in INIT answer
+   uint16_t          txFrames;      ///< frames sent
+   uint32_t          txBytes;       ///< bytes sent, header included
+   uint16_t          txFrameLimit;  ///< credit of server
+   uint32_t          txByteLimit;
+   std::atomic<uint16_t> rxFrames;  ///< frames dispatched
+   std::atomic<uint32_t> rxBytes;
+   uint16_t          rxFramesSeen;  ///< frames read from socket
+   std::atomic<uint16_t> rxFrameLimit;  ///< credit given to server
+   std::atomic<uint32_t> rxByteLimit;
+   uint32_t          rxCreditBytes; ///< bytes of credit window
+
+   ToneIotBufferPool pool;
+   int8_t            rxBuffer;      ///< index buffer owned by RX
+   ToneIotPacketView rxPacket;      ///< last received packet
+   std::atomic<TOIC_STATE> state;
+
+   ToneIotMutex      ioMutex;       ///< socket, held for one client call at a time
+   ToneIotTask       task;
+   std::atomic<bool> taskRunning;
+   ToneIotEvent      taskEvent;       ///< frame is queued, wakes network task
+   ToneIotEvent      rxEvent;       ///< frame is received, wakes waitServerRespons()
+   uint16_t          rxRead;        ///< bytes of frame read by network task
+   uint16_t          rxSkip;        ///< bytes of skipped frame still in socket
+   unsigned long     rxByteAt;      ///< ms of last byte of unfinished frame
+   taskRings_t*      rings;         ///< NULL - not given and task never started
+   void*             ringsMemory;   ///< heap block of rings, NULL - given by user
+   std::atomic<uint16_t> txDepth[TOIC_PRIORITY_COUNT];     ///< frames in rings->tx
+   batchRing_t*      batchRing;     ///< packets waiting wake window, application only; NULL - no batching
+   void*             batchMemory;   ///< heap block of batchRing, NULL - given by user
+   unsigned long     batchDeadline;  ///< ms when the batch must be sent
+
+   void init(Client& client, Stream* stream);
+   char* settingBuffer(uint8_t element, uint16_t size);
+   void freeSetting(char* buf);
 
    int8_t readByte(uint8_t* buf);
    int8_t readByte(uint8_t* buf, uint16_t* index);
+   int8_t skipBytes(uint16_t len);
    int8_t write(uint8_t *buffer, size_t size);
 
 
-   int8_t readPacket(packet_t** packet);
-   int8_t writePacket(packet_t* packet);
+   int8_t readPacket(ToneIotPacketView packet);
+   int8_t pollPacket(ToneIotPacketView packet);
+   bool skipHeader(ToneIotPacketView packet);
+   int8_t acceptFrame(ToneIotPacketView packet);
+   bool acceptMsgId(uint16_t msgId, uint16_t* last, uint64_t* window);
+   int8_t findGroup(const uint8_t* id);
+   bool isCredited(ToneIotPacketView packet);
+   int8_t writeAck(uint16_t msgId);
+   int8_t writePacket(ToneIotPacketView packet);
+   int8_t sendPacket(uint16_t function, uint16_t msgId, uint8_t* buf, uint16_t len);
+   void dispatch(ToneIotPacketView packet);
+   void completeSend(uint16_t msgId, TOIC_SEND result, uint16_t error);
+   void checkPendingSend();
+   void initInflight();
+   inflight_t* acquireInflight();
+   void releaseInflight(inflight_t* entry);
+   bool isInflight(uint16_t msgId);
+   void completeInflight(uint16_t msgId);
+   void checkInflight();
+   void updateRtt(uint32_t rtt);
+   void startTimers(uint16_t msgId);
+   txFunction_t* findTxFunction(uint16_t function, bool create);
+
+   ToneIotPacketView peekTx(uint8_t* priority);
+   void popTx(uint8_t priority, ToneIotPacketView packet);
+   bool isTxEmpty();
+
+   bool isBatchEmpty();
+   bool isRadioAsleep();
+   void flushBatch();
+   void checkRadio();
+   void checkTelemetry();
+   ToneIotPacketView acquirePacket(int8_t* index, uint16_t function, uint16_t msgId);
+   ToneIotPacketView acquirePacket(int8_t* index, uint16_t function, uint16_t msgId, bool deferred);
+   int8_t transmit(int8_t index, ToneIotPacketView packet);
+   int8_t receive(ToneIotPacketView packet);
+   void checkKeepAlive();
+   bool checkSocket();
+   void closeSocket(TOIC_STATE state);
+   int8_t checkConnecting();
+   void initEndpoint(endpoint_t* endpoint, const char* host, uint16_t port);
+   int8_t connectEndpoints();
+   int8_t connectEndpoint(endpoint_t* endpoint);
+   void failEndpoint(endpoint_t* endpoint);
+   uint32_t getBackoff(endpoint_t* endpoint);
+
+   static void taskEntry(void* client);
+   void taskLoop();
 
    void callFunction(uint16_t function, uint8_t* buf, uint16_t len);
    
-   int8_t setFunction(uint16_t function, cbFunction_t cbFunctionUser, cbFunctionSys_t cbFunctionSys);
+   int8_t setFunction(uint16_t function, cbFunction_t cbFunction, bool enable);
 
    void initFunctionSys(void);
    void cbFunctionDisconnect(uint8_t* buf, uint16_t len);
+   void cbFunctionOta(uint8_t* buf, uint16_t len);
 
    int8_t sendFunctionInit();
+   int32_t writeFunctions(uint8_t* data, uint16_t size, uint8_t* format);
+   void applyInit(uint8_t* buf, uint16_t len);
+   void applyFunctions(uint8_t format, uint8_t* set, uint16_t len);
+   void putCredit(ToneIotPacketView packet);
+   void takeCredit(ToneIotPacketView packet);
+   void checkCredit();
+   int8_t sendFunctionCredit();
    int8_t sendFunctionKeepAlive();
    void sendFunctionDisconnect(uint16_t code);
 };
@@ -0,0 +1,233 @@
+/**
+    * @author Dyakonov Oleg <o.u.dyakonov@gmail.com>
+    *
+    * @brief ToneIotCoro - C++20 coroutine flows over ToneIotClient
+*/
+
+#ifndef TONEIOTCORO_h
+#define TONEIOTCORO_h
+
+/**
+ * @brief needs C++20 coroutines, GCC 10 or newer:
+ *    build_unflags = -std=gnu++11
+ *    build_flags = -std=gnu++20 -fcoroutines
+ * without them the header is empty and the library builds as before.
+ *
+ *    ToneIotCoro flow(ToneIotCoClient& co) {
+ *       if (co_await co.connect()) co_return -1;
+ *       if (co_await co.send(20, buf, len) != TOIC_SEND::ACK) co_return -1;
+ *       ToneIotCoClient::message_t msg = co_await co.receive(21, 5000);
+ *       co_return msg.buf != NULL ? 0 : -1;
+ *    }
+ *
+ * Flows run on the task calling co.loop(), they are resumed by it after
+ * client.loop() returns, received functions too: the frame is copied to a
+ * buffer of TOCO_MESSAGE_SIZE bytes, a frame without room goes to the
+ * function callback as without flow.
+ */
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+
+#include <coroutine>
+#include "ToneIotClient.h"
+
+#define TOCO_ENABLED
+
+// TOCO_FRAME_POOL : coroutine frames in static pool, max 32
+#ifndef TOCO_FRAME_POOL
+#define TOCO_FRAME_POOL 4
+#endif
+
+// TOCO_FRAME_SIZE : bytes of coroutine frame, locals and awaiters of flow included (connect/send/receive/sleep flow ~400 on 64 bit host)
+#ifndef TOCO_FRAME_SIZE
+#define TOCO_FRAME_SIZE 512
+#endif
+
+// TOCO_MESSAGE_SIZE : bytes of frames received for flows within one co.loop()
+#ifndef TOCO_MESSAGE_SIZE
+#define TOCO_MESSAGE_SIZE TOIC_MAX_PACKET_SIZE
+#endif
+
+static_assert(TOCO_FRAME_POOL <= 32, "TOCO_FRAME_POOL is a 32 bit mask");
+
+/**
+ * @brief flow: coroutine returning int8_t, frame from static pool.
+ * The flow starts at call and runs until first suspension. The object owns
+ * the frame, keep it until done(); a flow can be awaited by other flow.
+ *
+ */
+class ToneIotCoro {
+
+public:
+
+   class promise_type {
+
+   public:
+
+      ToneIotCoro get_return_object() { return ToneIotCoro(std::coroutine_handle<promise_type>::from_promise(*this)); }
+      static ToneIotCoro get_return_object_on_allocation_failure() { return ToneIotCoro(); }
+      std::suspend_never initial_suspend() noexcept { return {}; }
+
+      // awaiting flow continues when this one is done
+      struct FinalAwaiter {
+         bool await_ready() noexcept { return false; }
+         std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept {
+            if (h.promise().continuation) return h.promise().continuation;
+            return std::noop_coroutine();
+         }
+         void await_resume() noexcept {}
+      };
+      FinalAwaiter final_suspend() noexcept { return {}; }
+
+      void return_value(int8_t value) { this->result = value; }
+      void unhandled_exception() { this->result = -1; }
+
+      static void* operator new(size_t size) noexcept;
+      static void operator delete(void* frame) noexcept;
+
+      int8_t                     result = -1;
+      std::coroutine_handle<>    continuation;
+   };
+
+   ToneIotCoro() {}
+   ToneIotCoro(ToneIotCoro&& other) noexcept : handle(other.handle) { other.handle = nullptr; }
+   ToneIotCoro& operator=(ToneIotCoro&& other) noexcept;
+   ToneIotCoro(const ToneIotCoro&) = delete;
+   ToneIotCoro& operator=(const ToneIotCoro&) = delete;
+   ~ToneIotCoro();
+
+   bool valid() const { return (bool)this->handle; }
+   bool done() const { return !this->handle || this->handle.done(); }
+   int8_t result() const { return this->handle && this->handle.done() ? this->handle.promise().result : -1; }
+
+   // co_await flow
+   bool await_ready() const { return done(); }
+   void await_suspend(std::coroutine_handle<> awaiting) { this->handle.promise().continuation = awaiting; }
+   int8_t await_resume() const { return result(); }
+
+   static uint8_t getFreeFrames();
+
+private:
+
+   explicit ToneIotCoro(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+
+   std::coroutine_handle<promise_type> handle;
+};
+
+/**
+ * @brief awaitable operations of ToneIotClient, the client is driven by loop()
+ * of this object instead of client.loop()
+ *
+ */
+class ToneIotCoClient {
+
+public:
+
+   typedef struct {
+      uint8_t*       buf;           ///< data, NULL - timeout or disconnected; valid until next suspension
+      uint16_t       len;
+   } message_t;
+
+   class ReceiveAwaiter;
+
+   /**
+    * @brief suspended flow, linked in list of client while waiting
+    *
+    */
+   class Waiter {
+
+   public:
+
+      Waiter(ToneIotCoClient& co) : co(co), next(NULL), receiver(NULL) {}
+      bool await_ready() { return ready(); }
+      void await_suspend(std::coroutine_handle<> handle);
+
+      virtual bool ready() = 0;
+
+      ToneIotCoClient&           co;
+      std::coroutine_handle<>    handle;
+      Waiter*                    next;
+      ReceiveAwaiter*            receiver;  ///< this, when waiting a function
+   };
+
+   class ConnectAwaiter : public Waiter {
+
+   public:
+
+      ConnectAwaiter(ToneIotCoClient& co) : Waiter(co) {}
+      bool await_ready();
+      bool ready();
+      int8_t await_resume();
+   };
+
+   class SendAwaiter : public Waiter {
+
+   public:
+
+      SendAwaiter(ToneIotCoClient& co, uint16_t function, uint8_t* buf, uint16_t len);
+      bool await_ready();
+      bool ready();
+      TOIC_SEND await_resume() { return this->result; }
+
+   private:
+
+      ToneIotClient::sendHandle_t sendHandle;
+      TOIC_SEND                  result;
+   };
+
+   class ReceiveAwaiter : public Waiter {
+
+   public:
+
+      ReceiveAwaiter(ToneIotCoClient& co, uint16_t function, uint32_t timeout);
+      bool ready();
+      message_t await_resume() { return this->message; }
+
+      uint16_t                   function;
+      unsigned long              start;
+      uint32_t                   timeout;
+      bool                       received;
+      message_t                  message;
+   };
+
+   class SleepAwaiter : public Waiter {
+
+   public:
+
+      SleepAwaiter(ToneIotCoClient& co, uint32_t ms) : Waiter(co), start(millis()), ms(ms) {}
+      bool ready() { return millis() - this->start >= this->ms; }
+      void await_resume() {}
+
+   private:
+
+      unsigned long              start;
+      uint32_t                   ms;
+   };
+
+   ToneIotCoClient(ToneIotClient& client);
+
+   ConnectAwaiter connect() { return ConnectAwaiter(*this); }
+   SendAwaiter send(uint16_t function, uint8_t* buf, uint16_t len) { return SendAwaiter(*this, function, buf, len); }
+   ReceiveAwaiter receive(uint16_t function) { return ReceiveAwaiter(*this, function, 0); }
+   ReceiveAwaiter receive(uint16_t function, uint32_t timeout) { return ReceiveAwaiter(*this, function, timeout); }
+   SleepAwaiter sleep(uint32_t ms) { return SleepAwaiter(*this, ms); }
+
+   int8_t loop();
+   ToneIotClient& getClient() { return this->client; }
+
+private:
+
+   ToneIotClient&    client;
+   Waiter*           waiters;
+   uint8_t           messages[TOCO_MESSAGE_SIZE];   ///< data of received frames until their flows are resumed
+   uint16_t          messagesLen;
+
+   void link(Waiter* waiter);
+   bool unlink(Waiter* waiter);
+   bool deliver(uint16_t function, uint8_t* buf, uint16_t len);
+};
+
+#endif // __has_include(<coroutine>)
+#endif // __cpp_impl_coroutine
+
+#endif //TONEIOTCORO_h
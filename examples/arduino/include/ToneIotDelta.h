@@ -0,0 +1,99 @@
+/**
+    * @author Dyakonov Oleg <o.u.dyakonov@gmail.com>
+    *
+    * @brief ToneIotDelta - streaming applier of delta firmware patches
+*/
+
+#ifndef TONEIOTDELTA_h
+#define TONEIOTDELTA_h
+
+#include <Arduino.h>
+
+#if defined(ESP32)
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+#endif
+
+// TOID_WINDOW_SIZE : RAM window for copying blocks from the running partition
+#define TOID_WINDOW_SIZE 256
+
+/**
+ * @brief patch format (little-endian), produced by tools/toneiot_delta.py
+ *
+ * header 20 bytes: magic "TOD2", source size, target size, crc32 source, crc32 target
+ * the first source size bytes of the running partition must have crc32 source
+ * then operations until target size is written:
+ *    COPY   - opcode, varint zigzag offset from end of previous copy, varint length
+ *    INSERT - opcode, varint length, length bytes of data
+ */
+#define TOID_MAGIC          0x32444F54  ///< "TOD2"
+#define TOID_HEADER_SIZE    20
+#define TOID_OP_COPY        1
+#define TOID_OP_INSERT      2
+
+/**
+ * @brief state applier
+ *
+ */
+enum class TOID_STATE {
+   ERROR       = -1,
+   IDLE        = 0,
+   HEADER      = 1,
+   OPCODE      = 2,
+   COPY_OFFSET = 3,
+   COPY_LENGTH = 4,
+   INSERT_LENGTH = 5,
+   INSERT_DATA = 6,
+   DONE        = 7
+};
+
+class ToneIotDelta {
+
+public:
+
+   ToneIotDelta();
+
+   int8_t begin();
+   int8_t write(uint8_t* buf, uint16_t len);
+   int8_t end();
+   void abort();
+
+   TOID_STATE getState();
+   uint32_t getReceived();
+   uint32_t getWritten();
+
+private:
+
+   TOID_STATE        state;
+   uint8_t           header[TOID_HEADER_SIZE];
+   uint8_t           window[TOID_WINDOW_SIZE];
+
+   uint32_t          sourceSize;    ///< size running image
+   uint32_t          targetSize;    ///< size new image
+   uint32_t          sourceCrc;     ///< crc32 running image
+   uint32_t          targetCrc;     ///< crc32 new image
+   uint32_t          crc;           ///< crc32 of written data
+
+   uint32_t          received;      ///< patch bytes received
+   uint32_t          written;       ///< image bytes written
+   uint32_t          copyOffset;    ///< current offset in running image
+   uint32_t          varint;        ///< varint being decoded
+   uint8_t           varintShift;
+   uint32_t          remaining;     ///< bytes left of current insert
+
+#if defined(ESP32)
+   const esp_partition_t* source;
+   const esp_partition_t* target;
+   esp_ota_handle_t  handle;
+#endif
+
+   int8_t parseHeader();
+   int8_t checkSource();
+   int8_t readVarint(uint8_t byte);
+   int8_t copy(uint32_t offset, uint32_t len);
+   int8_t output(uint8_t* buf, uint32_t len);
+   static uint32_t updateCrc(uint32_t crc, uint8_t* buf, uint32_t len);
+};
+
+
+#endif //TONEIOTDELTA_h
@@ -7,11 +7,10 @@
 #ifndef TONEIOTFUNCTION_h
 #define TONEIOTFUNCTION_h
 
-#include <functional>
-
 #include "ToneIotClient.h"
+#include "ToneIotInplaceFunction.h"
 
-#define TOIF_CALLBACK_SIGNATURE std::function<int(uint8_t* buf, size_t len)> callback
+#define TOIF_CALLBACK_SIGNATURE ToneIotInplaceFunction<int(uint8_t* buf, size_t len), TOIC_FUNCTION_CAPTURE> callback
 
 class ToneIotFunction {
 
@@ -0,0 +1,107 @@
+/**
+    * @author Dyakonov Oleg <o.u.dyakonov@gmail.com>
+    *
+    * @brief ToneIotInplaceFunction - callable with captures stored inline, never allocates
+*/
+
+#ifndef TONEIOTINPLACEFUNCTION_h
+#define TONEIOTINPLACEFUNCTION_h
+
+#include <stddef.h>
+#include <new>
+#include <utility>
+#include <type_traits>
+
+// TOIF_CAPTURE_SIZE : default bytes for captures of callable
+#define TOIF_CAPTURE_SIZE 16
+
+template<typename Signature, size_t Capacity = TOIF_CAPTURE_SIZE>
+class ToneIotInplaceFunction;
+
+/**
+ * @brief function pointer, lambda or functor up to Capacity bytes.
+ * The call is one indirect call through a pointer to a template function,
+ * copy and destruction go through a second pointer.
+ *
+ * @tparam R - return type
+ * @tparam Args - arguments
+ * @tparam Capacity - max size of callable
+ */
+template<typename R, typename... Args, size_t Capacity>
+class ToneIotInplaceFunction<R(Args...), Capacity> {
+
+public:
+
+   ToneIotInplaceFunction() : invoker(NULL), manager(NULL) {}
+
+   ToneIotInplaceFunction(std::nullptr_t) : invoker(NULL), manager(NULL) {}
+
+   template<typename Callable, typename = typename std::enable_if<
+      !std::is_same<typename std::decay<Callable>::type, ToneIotInplaceFunction>::value>::type>
+   ToneIotInplaceFunction(Callable&& f) : invoker(NULL), manager(NULL) {
+      typedef typename std::decay<Callable>::type callable_t;
+      static_assert(sizeof(callable_t) <= Capacity, "callable is larger than capacity");
+      static_assert(alignof(callable_t) <= alignof(storage_t), "callable alignment is not supported");
+      if (isNull(f)) return;
+      new (&this->storage) callable_t(std::forward<Callable>(f));
+      this->invoker = &invoke<callable_t>;
+      this->manager = &manage<callable_t>;
+   }
+
+   ToneIotInplaceFunction(const ToneIotInplaceFunction& other) : invoker(other.invoker), manager(other.manager) {
+      if (this->manager) this->manager(&this->storage, &other.storage);
+   }
+
+   ~ToneIotInplaceFunction() {
+      if (this->manager) this->manager(&this->storage, NULL);
+   }
+
+   ToneIotInplaceFunction& operator=(const ToneIotInplaceFunction& other) {
+      if (this == &other) return *this;
+      if (this->manager) this->manager(&this->storage, NULL);
+      this->invoker = other.invoker;
+      this->manager = other.manager;
+      if (this->manager) this->manager(&this->storage, &other.storage);
+      return *this;
+   }
+
+   R operator()(Args... args) const {
+      return this->invoker(&this->storage, std::forward<Args>(args)...);
+   }
+
+   explicit operator bool() const {
+      return this->invoker != NULL;
+   }
+
+private:
+
+   typedef typename std::aligned_storage<Capacity, alignof(void*)>::type storage_t;
+   typedef R (*invoker_t)(const storage_t*, Args...);
+   typedef void (*manager_t)(storage_t*, const storage_t*);  ///< copy from source; source NULL - destroy
+
+   storage_t         storage;
+   invoker_t         invoker;
+   manager_t         manager;
+
+   template<typename Callable>
+   static R invoke(const storage_t* storage, Args... args) {
+      return (*const_cast<Callable*>(reinterpret_cast<const Callable*>(storage)))(std::forward<Args>(args)...);
+   }
+
+   template<typename Callable>
+   static void manage(storage_t* storage, const storage_t* source) {
+      if (source) new (storage) Callable(*reinterpret_cast<const Callable*>(source));
+      else reinterpret_cast<Callable*>(storage)->~Callable();
+   }
+
+   // empty function pointer is stored as empty callable
+   template<typename Callable>
+   static bool isNull(const Callable& f) { return isNullPointer(f, typename std::is_pointer<Callable>::type()); }
+   template<typename Callable>
+   static bool isNullPointer(const Callable& f, std::true_type) { return f == NULL; }
+   template<typename Callable>
+   static bool isNullPointer(const Callable&, std::false_type) { return false; }
+};
+
+
+#endif //TONEIOTINPLACEFUNCTION_h
@@ -0,0 +1,139 @@
+/**
+    * @author Dyakonov Oleg <o.u.dyakonov@gmail.com>
+    *
+    * @brief ToneIotPacket - zero-copy view of protocol frame with little-endian fields
+*/
+
+#ifndef TONEIOTPACKET_h
+#define TONEIOTPACKET_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/**
+ * @brief frame over byte buffer, all numbers are little-endian on the wire:
+ *    id 8 bytes, msgId u16, function u16, datalen u16, data datalen bytes
+ * Fields are read and written by offset, the buffer needs no alignment and
+ * the layout does not depend on padding of compiler. On little-endian
+ * targets (ESP32, x86) the accessors are plain loads and stores.
+ *
+ * Same layout in tools/toneiot_packet.py.
+ */
+class ToneIotPacketView {
+
+public:
+
+   static constexpr uint16_t OFFSET_ID       = 0;
+   static constexpr uint16_t OFFSET_MSGID    = 8;
+   static constexpr uint16_t OFFSET_FUNCTION = 10;
+   static constexpr uint16_t OFFSET_DATALEN  = 12;
+   static constexpr uint16_t HEADER_SIZE     = 14;
+   static constexpr uint16_t ID_SIZE         = 8;
+
+   /**
+    * @brief data of TOIC_FUNCTION_SYS_INIT sent by device, list of
+    * function numbers u16 follows
+    */
+   static constexpr uint16_t INIT_OFFSET_HEADER        = 0;
+   static constexpr uint16_t INIT_OFFSET_ID            = 1;
+   static constexpr uint16_t INIT_OFFSET_DEVICE_TYPE   = 9;
+   static constexpr uint16_t INIT_OFFSET_VERSION_MAJOR = 10;
+   static constexpr uint16_t INIT_OFFSET_VERSION_MINOR = 11;
+   static constexpr uint16_t INIT_OFFSET_DATE          = 12;   ///< __DATE__ and terminator
+   static constexpr uint16_t INIT_DATE_SIZE            = 12;
+   static constexpr uint16_t INIT_OFFSET_KEEPALIVE     = 24;
+   static constexpr uint16_t INIT_SIZE                 = 26;
+
+   /**
+    * @brief set of function numbers, format is in INIT header byte of device
+    * and in the first byte of INIT answer of server:
+    *    FUNCTIONS_LIST   - u16 numbers, ascending
+    *    FUNCTIONS_BITMAP - base u16, bits u16, bitmap, bit n is function base + n
+    * With INIT_FLAG_CREDIT in the same byte the receive credit of the sender
+    * goes before the set.
+    */
+   static constexpr uint8_t  FUNCTIONS_LIST            = 0;
+   static constexpr uint8_t  FUNCTIONS_BITMAP          = 1;
+   static constexpr uint8_t  FUNCTIONS_FORMAT_MASK     = 0x7F;
+   static constexpr uint8_t  INIT_FLAG_CREDIT          = 0x80;
+   static constexpr uint16_t BITMAP_OFFSET_BASE        = 0;
+   static constexpr uint16_t BITMAP_OFFSET_BITS        = 2;
+   static constexpr uint16_t BITMAP_HEADER_SIZE        = 4;
+
+   /**
+    * @brief receive credit: the peer may send functions above 15 while its
+    * frame counter is below frames and its byte counter plus the frame is not
+    * above bytes. Counters start at 0 with INIT and wrap. In INIT and after
+    * data of ACK, ERROR and KEEPALIVE.
+    */
+   static constexpr uint16_t CREDIT_OFFSET_FRAMES      = 0;
+   static constexpr uint16_t CREDIT_OFFSET_BYTES       = 2;
+   static constexpr uint16_t CREDIT_SIZE               = 6;
+
+   ToneIotPacketView() : buf(NULL) {}
+   explicit ToneIotPacketView(uint8_t* buf) : buf(buf) {}
+
+   bool valid() const { return this->buf != NULL; }
+   uint8_t* getBuffer() const { return this->buf; }
+
+   uint8_t* getId() const { return &this->buf[OFFSET_ID]; }
+   void setId(const uint8_t* id) { memcpy(&this->buf[OFFSET_ID], id, ID_SIZE); }
+   uint16_t getMsgId() const { return load16(&this->buf[OFFSET_MSGID]); }
+   void setMsgId(uint16_t msgId) { store16(&this->buf[OFFSET_MSGID], msgId); }
+   uint16_t getFunction() const { return load16(&this->buf[OFFSET_FUNCTION]); }
+   void setFunction(uint16_t function) { store16(&this->buf[OFFSET_FUNCTION], function); }
+   uint16_t getDataLen() const { return load16(&this->buf[OFFSET_DATALEN]); }
+   void setDataLen(uint16_t len) { store16(&this->buf[OFFSET_DATALEN], len); }
+   uint8_t* getData() const { return &this->buf[HEADER_SIZE]; }
+
+   // header and data
+   uint16_t getSize() const { return HEADER_SIZE + getDataLen(); }
+
+   static uint16_t load16(const uint8_t* p) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+      uint16_t value;
+      memcpy(&value, p, 2);
+      return value;
+#else
+      return (uint16_t)p[0] | ((uint16_t)p[1] << 8);
+#endif
+   }
+
+   static void store16(uint8_t* p, uint16_t value) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+      memcpy(p, &value, 2);
+#else
+      p[0] = (uint8_t)value;
+      p[1] = (uint8_t)(value >> 8);
+#endif
+   }
+
+   static uint32_t load32(const uint8_t* p) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+      uint32_t value;
+      memcpy(&value, p, 4);
+      return value;
+#else
+      return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+#endif
+   }
+
+   static void store32(uint8_t* p, uint32_t value) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+      memcpy(p, &value, 4);
+#else
+      p[0] = (uint8_t)value;
+      p[1] = (uint8_t)(value >> 8);
+      p[2] = (uint8_t)(value >> 16);
+      p[3] = (uint8_t)(value >> 24);
+#endif
+   }
+
+private:
+
+   uint8_t*    buf;
+};
+
+
+#endif //TONEIOTPACKET_h
@@ -0,0 +1,198 @@
+/**
+    * @author Dyakonov Oleg <o.u.dyakonov@gmail.com>
+    *
+    * @brief ToneIotPort - task and mutex for ESP32 FreeRTOS and host std::thread
+*/
+
+#ifndef TONEIOTPORT_h
+#define TONEIOTPORT_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+#if defined(ESP32)
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#else
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#endif
+
+/**
+ * @brief recursive mutex, static memory
+ *
+ */
+class ToneIotMutex {
+
+public:
+
+#if defined(ESP32)
+   ToneIotMutex() { this->handle = xSemaphoreCreateRecursiveMutexStatic(&this->buffer); }
+   void lock() { xSemaphoreTakeRecursive(this->handle, portMAX_DELAY); }
+   void unlock() { xSemaphoreGiveRecursive(this->handle); }
+#else
+   void lock() { this->mutex.lock(); }
+   void unlock() { this->mutex.unlock(); }
+#endif
+
+private:
+
+#if defined(ESP32)
+   StaticSemaphore_t    buffer;
+   SemaphoreHandle_t    handle;
+#else
+   std::recursive_mutex mutex;
+#endif
+};
+
+/**
+ * @brief lock mutex until end of scope
+ *
+ */
+class ToneIotLock {
+
+public:
+
+   ToneIotLock(ToneIotMutex& mutex) : mutex(mutex) { this->mutex.lock(); }
+   ~ToneIotLock() { this->mutex.unlock(); }
+
+private:
+
+   ToneIotMutex&        mutex;
+};
+
+/**
+ * @brief wakes one waiting task, a signal without waiter is kept for the
+ * next wait(). Binary semaphore on ESP32, condition variable on host
+ *
+ */
+class ToneIotEvent {
+
+public:
+
+#if defined(ESP32)
+   ToneIotEvent() { this->handle = xSemaphoreCreateBinaryStatic(&this->buffer); }
+   void signal() { xSemaphoreGive(this->handle); }
+
+   /**
+    * @brief wait signal
+    *
+    * @param ms - timeout, at least one tick
+    * @return true - signaled; false - timeout
+    */
+   bool wait(uint32_t ms) {
+      TickType_t ticks = pdMS_TO_TICKS(ms);
+      return xSemaphoreTake(this->handle, ticks ? ticks : 1) == pdTRUE;
+   }
+#else
+   ToneIotEvent() : signaled(false) {}
+
+   void signal() {
+      std::lock_guard<std::mutex> lock(this->mutex);
+      this->signaled = true;
+      this->condition.notify_one();
+   }
+
+   bool wait(uint32_t ms) {
+      std::unique_lock<std::mutex> lock(this->mutex);
+      bool ret = this->condition.wait_for(lock, std::chrono::milliseconds(ms), [this] { return this->signaled; });
+      this->signaled = false;
+      return ret;
+   }
+#endif
+
+private:
+
+#if defined(ESP32)
+   StaticSemaphore_t    buffer;
+   SemaphoreHandle_t    handle;
+#else
+   std::mutex           mutex;
+   std::condition_variable condition;
+   bool                 signaled;
+#endif
+};
+
+/**
+ * @brief task pinned to core on ESP32, thread on host
+ *
+ */
+class ToneIotTask {
+
+public:
+
+   typedef void (*entry_t)(void*);
+
+   ToneIotTask() : entry(NULL), arg(NULL), running(false) {}
+
+   /**
+    * @brief start task
+    *
+    * @param entry - task function, the task ends when it returns
+    * @param arg - argument task function
+    * @param name - task name
+    * @param stack - stack size bytes
+    * @param priority - priority
+    * @param core - core number, -1 - any core
+    * @return int8_t = 0 - ok; -1 - error
+    */
+   int8_t start(entry_t entry, void* arg, const char* name, uint32_t stack, uint8_t priority, int8_t core) {
+      if (this->running) return -1;
+      this->entry = entry;
+      this->arg = arg;
+      this->running = true;
+#if defined(ESP32)
+      if (xTaskCreatePinnedToCore(&ToneIotTask::run, name, stack, this, priority, NULL,
+                                  core < 0 ? tskNO_AFFINITY : core) != pdPASS) {
+         this->running = false;
+         return -1;
+      }
+#else
+      (void)name; (void)stack; (void)priority; (void)core;
+      this->thread = std::thread(&ToneIotTask::run, this);
+#endif
+      return 0;
+   }
+
+   // wait end of task function
+   void join() {
+#if defined(ESP32)
+      while (this->running) sleep(1);
+#else
+      if (this->thread.joinable()) this->thread.join();
+#endif
+   }
+
+   static void sleep(uint32_t ms) {
+#if defined(ESP32)
+      vTaskDelay(ms ? pdMS_TO_TICKS(ms) : 1);
+#else
+      std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+#endif
+   }
+
+private:
+
+   entry_t              entry;
+   void*                arg;
+   std::atomic<bool>    running;
+#if !defined(ESP32)
+   std::thread          thread;
+#endif
+
+   static void run(void* task) {
+      ToneIotTask* self = (ToneIotTask*)task;
+      self->entry(self->arg);
+      self->running = false;
+#if defined(ESP32)
+      vTaskDelete(NULL);
+#endif
+   }
+};
+
+
+#endif //TONEIOTPORT_h
@@ -0,0 +1,126 @@
+/**
+    * @author Dyakonov Oleg <o.u.dyakonov@gmail.com>
+    *
+    * @brief ToneIotProfile - cycle counters of library hot paths, rendered by tools/toneiot_profile.py
+*/
+
+#ifndef TONEIOTPROFILE_h
+#define TONEIOTPROFILE_h
+
+#include <Arduino.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/**
+ * @brief the scopes are counted only with build flag TOIP_PROFILE:
+ *    build_flags = -D TOIP_PROFILE
+ * without it TOIP_MEASURE() is empty and the table stays zero.
+ *
+ * Cycles are CCOUNT of the core on Xtensa, TSC on x86 host, micros()
+ * elsewhere. CCOUNT is 32 bit and wraps after 17.9 s at 240 MHz, scopes
+ * longer than TOIP_WRAP_CHECK us add the wraps counted by micros(), so
+ * connect of many seconds is right too. Scopes are inclusive: connect
+ * includes writePacket, callFunction includes the callback. One table for all clients, it is updated without lock, a scope
+ * run by two tasks at the same time may lose a count.
+ */
+
+/**
+ * @brief measured scopes, order is the id in encode() and in tools/toneiot_profile.py
+ *
+ */
+enum class TOIP_SCOPE {
+   READ_PACKET    = 0,   ///< ToneIotClient::readPacket, socket reads included
+   WRITE_PACKET   = 1,   ///< ToneIotClient::writePacket, socket write included
+   CALL_FUNCTION  = 2,   ///< ToneIotClient::callFunction, callback included
+   TOKEN_PARSE    = 3,   ///< ToneIotClient::setToneIotServer
+   CONNECT        = 4,   ///< ToneIotClient::connect, socket connect and INIT answer included
+   COUNT
+};
+
+/**
+ * @brief table format (little-endian):
+ *    version u8, cycles per second u32 (0 - unknown), scope count u8,
+ *    for every scope: id u8, calls u32, total cycles u64, max cycles u64
+ */
+#define TOIP_VERSION        2
+#define TOIP_HEADER_SIZE    6
+#define TOIP_SCOPE_SIZE     21
+
+// TOIP_WRAP_CHECK : us of scope below any wrap of a 32-bit counter, longer scopes are checked for wraps
+#define TOIP_WRAP_CHECK     1000000UL
+
+// TOIP_SIZE : bytes of encoded table
+#define TOIP_SIZE (TOIP_HEADER_SIZE + (uint8_t)TOIP_SCOPE::COUNT * TOIP_SCOPE_SIZE)
+
+// TOIP_MEASURE : count cycles of the rest of block in scope
+#ifdef TOIP_PROFILE
+#define TOIP_MEASURE(scope) ToneIotProfileScope toipScope(scope)
+#else
+#define TOIP_MEASURE(scope)
+#endif
+
+class ToneIotProfile {
+
+public:
+
+   typedef struct {
+      uint32_t       calls;
+      uint64_t       total;         ///< cycles
+      uint64_t       max;           ///< cycles of the longest call
+   } scope_t;
+
+   /**
+    * @brief cycle counter, 32 bit on Xtensa and with micros(), 64 bit TSC on x86
+    *
+    * @return uint64_t cycles
+    */
+   static inline uint64_t cycles() {
+#if defined(__XTENSA__)
+      uint32_t ccount;
+      asm volatile("rsr %0, ccount" : "=a"(ccount));
+      return ccount;
+#elif defined(__x86_64__) || defined(__i386__)
+      return __rdtsc();
+#else
+      return (uint32_t)micros();
+#endif
+   }
+
+   static uint64_t since(uint64_t start, unsigned long startMicros);
+   static void add(TOIP_SCOPE scope, uint64_t cycles);
+   static void reset();
+
+   static const scope_t& get(TOIP_SCOPE scope);
+   static const char* getName(TOIP_SCOPE scope);
+   static uint32_t getFrequency();
+
+   static void print(Print& out);
+   static uint16_t encode(uint8_t* buf, uint16_t size);
+
+private:
+
+   static scope_t scopes[(uint8_t)TOIP_SCOPE::COUNT];
+};
+
+/**
+ * @brief adds cycles from construction to end of block to the scope
+ *
+ */
+class ToneIotProfileScope {
+
+public:
+
+   ToneIotProfileScope(TOIP_SCOPE scope) : scope(scope), startMicros(micros()), start(ToneIotProfile::cycles()) {}
+   ~ToneIotProfileScope() { ToneIotProfile::add(this->scope, ToneIotProfile::since(this->start, this->startMicros)); }
+
+private:
+
+   TOIP_SCOPE     scope;
+   unsigned long  startMicros;
+   uint64_t       start;
+};
+
+
+#endif //TONEIOTPROFILE_h
@@ -0,0 +1,56 @@
+/**
+    * @author Dyakonov Oleg <o.u.dyakonov@gmail.com>
+    *
+    * @brief ToneIotRadio - SIM800 sleep through DTR, wake up by RI, radio-on time
+*/
+
+#ifndef TONEIOTRADIO_h
+#define TONEIOTRADIO_h
+
+#include <Arduino.h>
+#include <atomic>
+
+// TOIRA_WAKE_DELAY : ms after DTR low before the modem takes UART data
+#define TOIRA_WAKE_DELAY 50
+
+// TOIRA_PIN_NONE : pin is not wired
+#define TOIRA_PIN_NONE -1
+
+/**
+ * @brief the modem must be in sleep mode 1 (AT+CSCLK=1): it sleeps while DTR
+ * is high and keeps GPRS context and TCP connection. Incoming data pulls RI
+ * low (AT+CFGRI=1) and the modem outputs it without wake up.
+ *
+ * wake() and isAwake() are safe from network task, sleep() is called by
+ * the owner of send scheduling only.
+ */
+class ToneIotRadio {
+
+public:
+
+   ToneIotRadio(int8_t pinDtr, int8_t pinRi);
+
+   void begin();
+   void wake();
+   void sleep();
+   bool isAwake();
+   bool takeRing();
+
+   uint32_t getOnTime();
+   uint32_t getOnTimePerHour();
+
+private:
+
+   int8_t            pinDtr;
+   int8_t            pinRi;
+   std::atomic<bool> awake;
+   std::atomic<unsigned long> onSince;    ///< wake time ms
+   uint32_t          onTime;        ///< ms awake before onSince
+   unsigned long     started;       ///< begin() time ms
+
+   static std::atomic<bool> ring;
+   static void IRAM_ATTR onRing();
+};
+
+
+#endif //TONEIOTRADIO_h
@@ -0,0 +1,169 @@
+/**
+    * @author Dyakonov Oleg <o.u.dyakonov@gmail.com>
+    *
+    * @brief ToneIotRing - lock-free single-producer/single-consumer ring of variable-length frames
+*/
+
+#ifndef TONEIOTRING_h
+#define TONEIOTRING_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <atomic>
+
+// TOIR_CACHE_LINE : producer and consumer indexes are kept on separate lines
+#define TOIR_CACHE_LINE 64
+
+// TOIR_HEADER : bytes before each frame, frames are 4-byte aligned
+#define TOIR_HEADER 4
+
+// TOIR_WRAP : frame length marking the unused tail of the ring
+#define TOIR_WRAP 0xFFFF
+
+/**
+ * @brief frames are stored inline: length 2 bytes, reserved 2 bytes, data.
+ * A frame never wraps, the rest of the ring is skipped instead.
+ *
+ * producer: prepare() -> write frame -> commit()
+ * consumer: peek() -> read frame -> pop()
+ *
+ * @tparam Capacity - size of ring in bytes, power of two
+ */
+template<uint32_t Capacity>
+class ToneIotRing {
+
+   static_assert(Capacity >= 64 && (Capacity & (Capacity - 1)) == 0, "capacity must be power of two");
+
+public:
+
+   ToneIotRing() {
+      this->producer.head = 0;
+      this->producer.tailCache = 0;
+      this->producer.skip = 0;
+      this->consumer.tail = 0;
+      this->consumer.headCache = 0;
+      this->consumer.size = 0;
+   }
+
+   /**
+    * @brief producer: reserve space for frame
+    *
+    * @param len - max length frame
+    * @return uint8_t* frame memory; NULL - ring is full
+    */
+   uint8_t* prepare(uint16_t len) {
+
+      uint32_t head = this->producer.head.load(std::memory_order_relaxed);
+      uint32_t pos = head & (Capacity - 1);
+      uint32_t need = frameSize(len);
+      uint32_t skip = 0;
+
+      if (need > Capacity) return NULL;
+      // frame does not fit before the end, the rest is skipped
+      if (need > Capacity - pos) skip = Capacity - pos;
+      if (need + skip > Capacity - (head - this->producer.tailCache)) {
+         this->producer.tailCache = this->consumer.tail.load(std::memory_order_acquire);
+         if (need + skip > Capacity - (head - this->producer.tailCache)) return NULL;
+      }
+      if (skip) {
+         writeLength(pos, TOIR_WRAP);
+         pos = 0;
+      }
+      this->producer.skip = skip;
+      return &this->data[pos + TOIR_HEADER];
+   }
+
+   /**
+    * @brief producer: publish frame written after prepare()
+    *
+    * @param len - length frame, not more than prepared
+    */
+   void commit(uint16_t len) {
+
+      uint32_t head = this->producer.head.load(std::memory_order_relaxed) + this->producer.skip;
+
+      writeLength(head & (Capacity - 1), len);
+      this->producer.skip = 0;
+      this->producer.head.store(head + frameSize(len), std::memory_order_release);
+   }
+
+   /**
+    * @brief consumer: get oldest frame, it stays valid until pop()
+    *
+    * @param len - length frame
+    * @return uint8_t* frame memory; NULL - ring is empty
+    */
+   uint8_t* peek(uint16_t* len) {
+
+      uint32_t tail = this->consumer.tail.load(std::memory_order_relaxed);
+      uint32_t pos = tail & (Capacity - 1);
+      uint32_t skip = 0;
+      uint16_t length = 0;
+
+      if (tail == this->consumer.headCache) {
+         this->consumer.headCache = this->producer.head.load(std::memory_order_acquire);
+         if (tail == this->consumer.headCache) return NULL;
+      }
+      length = readLength(pos);
+      if (length == TOIR_WRAP) {
+         skip = Capacity - pos;
+         pos = 0;
+         length = readLength(pos);
+      }
+      this->consumer.size = skip + frameSize(length);
+      *len = length;
+      return &this->data[pos + TOIR_HEADER];
+   }
+
+   /**
+    * @brief consumer: release frame returned by peek()
+    *
+    */
+   void pop() {
+
+      uint32_t tail = this->consumer.tail.load(std::memory_order_relaxed);
+      this->consumer.tail.store(tail + this->consumer.size, std::memory_order_release);
+      this->consumer.size = 0;
+   }
+
+   /**
+    * @brief consumer: ring has no frame
+    *
+    */
+   bool empty() {
+      return this->consumer.tail.load(std::memory_order_relaxed) == this->producer.head.load(std::memory_order_acquire);
+   }
+
+private:
+
+   struct alignas(TOIR_CACHE_LINE) {
+      std::atomic<uint32_t> head;      ///< written by producer
+      uint32_t          tailCache;     ///< last seen tail
+      uint32_t          skip;          ///< skipped tail of ring for prepared frame
+   } producer;
+
+   struct alignas(TOIR_CACHE_LINE) {
+      std::atomic<uint32_t> tail;      ///< written by consumer
+      uint32_t          headCache;     ///< last seen head
+      uint32_t          size;          ///< bytes released by pop()
+   } consumer;
+
+   alignas(TOIR_CACHE_LINE) uint8_t data[Capacity];
+
+   static uint32_t frameSize(uint32_t len) {
+      return (TOIR_HEADER + len + 3) & ~(uint32_t)3;
+   }
+
+   void writeLength(uint32_t pos, uint16_t len) {
+      this->data[pos] = (uint8_t)len;
+      this->data[pos + 1] = (uint8_t)(len >> 8);
+   }
+
+   uint16_t readLength(uint32_t pos) {
+      return (uint16_t)this->data[pos] | ((uint16_t)this->data[pos + 1] << 8);
+   }
+};
+
+
+#endif //TONEIOTRING_h
@@ -0,0 +1,102 @@
+/**
+    * @author Dyakonov Oleg <o.u.dyakonov@gmail.com>
+    *
+    * @brief ToneIotSim800Client - TCP client over SIM800 transparent mode (AT+CIPMODE=1)
+*/
+
+#ifndef TONEIOTSIM800CLIENT_h
+#define TONEIOTSIM800CLIENT_h
+
+#include <Arduino.h>
+#include "Client.h"
+#include "IPAddress.h"
+#include "Stream.h"
+
+// TOIS_AT_TIMEOUT : answer of short AT command in ms
+#define TOIS_AT_TIMEOUT 2000
+
+// TOIS_CONNECT_TIMEOUT : answer of AT+CIPSHUT, AT+CIICR, AT+CIPSTART in ms
+#define TOIS_CONNECT_TIMEOUT 85000
+
+// TOIS_DNS_TIMEOUT : answer of AT+CDNSGIP in ms
+#define TOIS_DNS_TIMEOUT 30000
+
+// TOIS_GUARD_TIME : silence before and after "+++" escape in ms
+#define TOIS_GUARD_TIME 1000
+
+// TOIS_CLOSED_GUARD : silence after which a partly matched "CLOSED" is given out as data, ms
+#define TOIS_CLOSED_GUARD 20
+
+// TOIS_LINE_SIZE : max length of AT answer line, +CDNSGIP repeats the domain
+#define TOIS_LINE_SIZE 96
+
+/**
+ * @brief state
+ *
+ */
+enum class TOIS_STATE : uint8_t {
+   CLOSED   = 0,   ///< no connection, modem in command mode
+   DATA     = 1,   ///< connection, bytes go to server
+   COMMAND  = 2    ///< connection kept, modem in command mode after "+++"
+};
+
+/**
+ * @brief in transparent mode the serial port is the socket: write() and read()
+ * move raw bytes without AT+CIPSEND framing, prompts and URC parsing.
+ * The modem ends data mode itself with "\r\nCLOSED\r\n", it is filtered out
+ * of received data. Only the serial Stream is used, so the client can be driven
+ * by a scripted serial peer on host.
+ */
+class ToneIotSim800Client : public Client {
+
+public:
+
+   ToneIotSim800Client(Stream& stream);
+
+   void setApn(const char* apn, const char* user, const char* pass);
+
+   int connect(IPAddress ip, uint16_t port);
+   int connect(const char* host, uint16_t port);
+   size_t write(uint8_t b);
+   size_t write(const uint8_t* buf, size_t size);
+   int available();
+   int read();
+   int read(uint8_t* buf, size_t size);
+   int peek();
+   void flush();
+   void stop();
+   uint8_t connected();
+   operator bool();
+
+   int8_t enterCommandMode();
+   int8_t enterDataMode();
+   int8_t sendAt(const char* command, const char* expect, uint32_t timeout);
+   int8_t resolve(const char* host, IPAddress* ip);
+   TOIS_STATE getState();
+
+private:
+
+   Stream*           stream;
+   const char*       apn;
+   const char*       user;
+   const char*       pass;
+   TOIS_STATE        state;
+   bool              bearer;        ///< bearer opened by resolve(), used by next connect()
+
+   char              line[TOIS_LINE_SIZE];
+
+   uint8_t           matched;       ///< bytes of "\r\nCLOSED\r\n" held back
+   unsigned long     matchTime;     ///< time of last held byte ms
+   uint8_t           pending[16];   ///< data released by matcher
+   uint8_t           pendingLen;
+   uint8_t           pendingPos;
+
+   int8_t readLine(uint32_t timeout);
+   int8_t waitLine(const char* expect, uint32_t timeout);
+   int8_t openBearer();
+   void pump();
+   void release(uint8_t len);
+};
+
+
+#endif //TONEIOTSIM800CLIENT_h
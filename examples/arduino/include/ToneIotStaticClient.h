@@ -0,0 +1,62 @@
+/**
+    * @author Dyakonov Oleg <o.u.dyakonov@gmail.com>
+    *
+    * @brief ToneIotStaticClient - ToneIotClient without heap, memory sized at compile time
+*/
+
+#ifndef TONEIOTSTATICCLIENT_h
+#define TONEIOTSTATICCLIENT_h
+
+#include "ToneIotClient.h"
+
+// TOIC_STATIC_DOMAIN : max length of server domain in token
+#define TOIC_STATIC_DOMAIN 64
+
+// TOIC_STATIC_KEY : max length of key in token, aes-256 32 bytes
+#define TOIC_STATIC_KEY 32
+
+/**
+ * @brief ToneIotClient with packet buffers, function callbacks and token
+ * settings in members: setBufferSize(), setFunction() and setToneIotServer()
+ * do not use malloc/new, the first two fail above the template limits.
+ *
+ *    ToneIotStaticClient<256, 8> toneiotclient(modem);
+ *    static_assert(decltype(toneiotclient)::getRamSize() < 8192, "ToneIotClient RAM");
+ *
+ * Rings of startTask() and of batching with setRadio() are not members,
+ * give them when used:
+ *
+ *    static ToneIotClient::taskRings_t rings;
+ *    toneiotclient.setTaskRings(rings);
+ *
+ * @tparam BufSize - max packet size, TOIC_BUFFER_POOL buffers are reserved
+ * @tparam MaxFunctions - user functions of setFunction()
+ * @tparam MaxDomain - max length of server domain
+ * @tparam MaxKey - max length of key
+ * @tparam RamBudget - bytes one instance may take, 0 - not checked
+ */
+template<uint16_t BufSize, uint8_t MaxFunctions, uint16_t MaxDomain = TOIC_STATIC_DOMAIN, uint16_t MaxKey = TOIC_STATIC_KEY, size_t RamBudget = 0>
+class ToneIotStaticClient : private ToneIotClient::staticStorage_t<BufSize, MaxFunctions + TOIC_SYS_FUNCTIONS, MaxDomain + 1, MaxKey + 1>, public ToneIotClient {
+
+   static_assert(BufSize > 14, "BufSize is less than packet header");
+
+public:
+
+   ToneIotStaticClient(Client& client) : ToneIotClient(client, this->getStorage()) {
+      static_assert(RamBudget == 0 || sizeof(ToneIotStaticClient) <= RamBudget, "ToneIotStaticClient is over RamBudget");
+   }
+
+   ToneIotStaticClient(Client& client, Stream& stream) : ToneIotClient(client, stream, this->getStorage()) {
+      static_assert(RamBudget == 0 || sizeof(ToneIotStaticClient) <= RamBudget, "ToneIotStaticClient is over RamBudget");
+   }
+
+   /**
+    * @brief RAM of one instance, everything the client uses without startTask() and batching
+    *
+    * @return size_t bytes
+    */
+   static constexpr size_t getRamSize() { return sizeof(ToneIotStaticClient); }
+};
+
+
+#endif //TONEIOTSTATICCLIENT_h
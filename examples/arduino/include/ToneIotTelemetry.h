@@ -0,0 +1,100 @@
+/**
+    * @author Dyakonov Oleg <o.u.dyakonov@gmail.com>
+    *
+    * @brief ToneIotTelemetry - batching of periodic samples with delta-of-delta and varint compression
+*/
+
+#ifndef TONEIOTTELEMETRY_h
+#define TONEIOTTELEMETRY_h
+
+#include <Arduino.h>
+
+// TOIT_MAX_CHANNELS : channels in one batch
+#define TOIT_MAX_CHANNELS 4
+
+// TOIT_FRAME_SIZE : max size of encoded batch, ToneIotClient lowers it by setFrameSize() to packet data of its buffer
+#define TOIT_FRAME_SIZE 240
+
+// TOIT_MAX_AGE : ms from first sample until the batch is sent
+#define TOIT_MAX_AGE 60000
+
+/**
+ * @brief batch format (little-endian), decoded by tools/toneiot_telemetry.py
+ *
+ * version u8, channel count u8, then for every channel:
+ *    id u8, type u8, varint sample count, varint time of first sample ms,
+ *    first value (INT - varint zigzag, FLOAT - 4 bytes),
+ *    for next samples: varint zigzag delta-of-delta of time (delta for second),
+ *    value: INT - varint zigzag delta, FLOAT - varint (xor >> trailing zeros) << 5 | trailing zeros
+ */
+#define TOIT_VERSION        1
+#define TOIT_HEADER_SIZE    2
+#define TOIT_CHANNEL_HEADER 16  ///< max size of channel header with first value
+#define TOIT_SAMPLE_MAX     11  ///< max size of next sample
+
+/**
+ * @brief type of channel values
+ *
+ */
+enum class TOIT_TYPE {
+   INT   = 0,
+   FLOAT = 1
+};
+
+class ToneIotTelemetry {
+
+public:
+
+   ToneIotTelemetry();
+
+   int8_t addChannel(uint8_t id, TOIT_TYPE type);
+   int8_t add(uint8_t id, int32_t value);
+   int8_t add(uint8_t id, float value);
+   int8_t add(uint8_t id, uint32_t time, int32_t value);
+   int8_t add(uint8_t id, uint32_t time, float value);
+   int8_t add(uint8_t id, double value) { return add(id, (float)value); }
+   int8_t add(uint8_t id, uint32_t time, double value) { return add(id, time, (float)value); }
+
+   void setMaxAge(uint32_t maxAge);
+   void setFrameSize(uint16_t frameSize);
+   bool isReady();
+   uint16_t encode(uint8_t* buf, uint16_t size);
+   void clear();
+
+   uint16_t getSize();
+   uint32_t getSamples();
+   uint32_t getDropped();
+
+private:
+
+   typedef struct {
+      uint8_t        id;
+      TOIT_TYPE      type;
+      uint16_t       count;         ///< samples in batch
+      uint32_t       firstTime;     ///< ms
+      uint32_t       firstValue;    ///< value bits
+      uint32_t       lastTime;      ///< ms
+      int32_t        lastDelta;     ///< ms between two last samples
+      uint32_t       lastValue;     ///< value bits
+      uint16_t       len;           ///< bytes of next samples
+      uint8_t        data[TOIT_FRAME_SIZE];
+   } channel_t;
+
+   channel_t         channel[TOIT_MAX_CHANNELS];
+   uint8_t           channelCount;
+   uint16_t          size;          ///< reserved size of encoded batch
+   uint16_t          frameSize;     ///< max size of encoded batch
+   unsigned long     started;       ///< ms of first sample in batch
+   uint32_t          maxAge;
+   uint32_t          samples;       ///< samples added since constructor
+   uint32_t          dropped;       ///< samples not fitted into batch
+
+   int8_t addSample(uint8_t id, TOIT_TYPE type, uint32_t time, uint32_t value);
+   channel_t* findChannel(uint8_t id);
+   uint8_t encodeValue(channel_t* ch, uint32_t value, uint8_t* out);
+   static uint8_t writeVarint(uint64_t value, uint8_t* out);
+   static uint32_t zigzag(int32_t value);
+};
+
+
+#endif //TONEIOTTELEMETRY_h
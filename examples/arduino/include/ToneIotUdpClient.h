@@ -0,0 +1,102 @@
+/**
+    * @author Dyakonov Oleg <o.u.dyakonov@gmail.com>
+    *
+    * @brief ToneIotUdpClient - datagram transport of ToneIotClient over Arduino UDP
+*/
+
+#ifndef TONEIOTUDPCLIENT_h
+#define TONEIOTUDPCLIENT_h
+
+#include <Arduino.h>
+#include "Client.h"
+#include "IPAddress.h"
+#include "Udp.h"
+#include "ToneIotClient.h"
+
+// TOIU_DATAGRAM_SIZE : max frame, one frame is one datagram; not less than buffer size of ToneIotClient
+#define TOIU_DATAGRAM_SIZE 256
+
+// TOIU_LOCAL_PORT : local UDP port, 0 - any free port for every connect()
+#define TOIU_LOCAL_PORT 0
+
+// TOIU_RETRY : ms until INIT, KEEPALIVE or DISCONNECT without answer is sent again, doubled every time
+#define TOIU_RETRY 1000
+
+// TOIU_RETRIES : repeats of one INIT, KEEPALIVE or DISCONNECT
+#define TOIU_RETRIES 3
+
+/**
+ * @brief Client over datagrams for ToneIotClient, the server listens on UDP
+ * (tools/toneiot_server.py --udp):
+ *
+ *    WiFiUDP udp;
+ *    ToneIotUdpClient transport(udp);
+ *    ToneIotClient toneiotclient(transport);
+ *
+ * connect() only opens the local socket, there is no handshake of its own,
+ * and a lost datagram does not hold up the next ones. Written bytes are cut
+ * into frames by the header, every frame goes in its own datagram, a frame
+ * over TOIU_DATAGRAM_SIZE closes the socket; received datagrams that are not
+ * exactly one frame or not from the address and port of connect() are dropped.
+ *
+ * Delivery of user functions is the QoS of ToneIotClient (setFunctionQos()):
+ * AT_MOST_ONCE frames may be lost, the others are retransmitted until ACK.
+ * INIT, KEEPALIVE and DISCONNECT have no QoS, they are repeated here until
+ * any datagram of server arrives. The peer is the address of connect(), a
+ * domain is resolved once in connect() by setResolver(), on ESP32 by WiFi
+ * without it; set resolver of ToneIotClient to keep the address between
+ * connects.
+ */
+class ToneIotUdpClient : public Client {
+
+public:
+
+   ToneIotUdpClient(UDP& udp);
+
+   int connect(IPAddress ip, uint16_t port);
+   int connect(const char* host, uint16_t port);
+   size_t write(uint8_t b);
+   size_t write(const uint8_t* buf, size_t size);
+   int available();
+   int read();
+   int read(uint8_t* buf, size_t size);
+   int peek();
+   void flush();
+   void stop();
+   uint8_t connected();
+   operator bool();
+
+   void setResolver(ToneIotClient::cbResolve_t cbResolve);
+   uint32_t getDropped();
+   uint32_t getRepeats();
+
+private:
+
+   UDP*              udp;
+   ToneIotClient::cbResolve_t cbResolve;
+   IPAddress         ip;
+   uint16_t          port;
+   bool              open;
+
+   uint8_t           tx[TOIU_DATAGRAM_SIZE];    ///< written bytes until frame is complete
+   uint16_t          txLen;
+   uint8_t           rx[TOIU_DATAGRAM_SIZE];    ///< received frame
+   uint16_t          rxLen;
+   uint16_t          rxPos;
+
+   uint8_t           retry[TOIU_DATAGRAM_SIZE]; ///< system frame waiting answer
+   uint16_t          retryLen;      ///< 0 - nothing to repeat
+   uint8_t           retries;
+   uint32_t          retryDelay;    ///< ms
+   unsigned long     retryAt;       ///< time of last send ms
+
+   uint32_t          dropped;       ///< received datagrams not one frame or not from server
+   uint32_t          repeats;       ///< system frames sent again
+
+   int8_t resolve(const char* host, IPAddress* ip);
+   int8_t send(const uint8_t* buf, uint16_t len);
+   void repeat();
+};
+
+
+#endif //TONEIOTUDPCLIENT_h
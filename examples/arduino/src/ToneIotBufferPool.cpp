@@ -0,0 +1,149 @@
+/**
+    * @author Dyakonov Oleg <o.u.dyakonov@gmail.com>
+    *
+    * @brief ToneIotBufferPool - fixed pool of packet buffers with RX/TX ownership
+*/
+
+#include "ToneIotBufferPool.h"
+
+// ======================================== public ======================================
+/**
+ *  @brief Constructor
+ */
+ToneIotBufferPool::ToneIotBufferPool() {
+
+    this->memory = NULL;
+    this->external = false;
+    this->size = 0;
+    for (uint8_t i = 0; i < TOIC_BUFFER_POOL; i++) this->owner[i] = (uint8_t)TOIC_BUFFER_OWNER::FREE;
+}
+
+/**
+ * @brief Destruction
+ */
+ToneIotBufferPool::~ToneIotBufferPool() {
+
+    if (this->memory && !this->external) free(this->memory);
+}
+
+/**
+ * @brief allocate all buffers, allowed only while no buffer is owned
+ *
+ * @param size - size one buffer
+ * @return int8_t = 0 - ok; -1 - error
+ */
+int8_t ToneIotBufferPool::init(uint16_t size) {
+
+    uint8_t* newMemory = NULL;
+
+    if (size == 0 || this->external) return -1;
+    for (uint8_t i = 0; i < TOIC_BUFFER_POOL; i++) {
+        if (this->owner[i] != (uint8_t)TOIC_BUFFER_OWNER::FREE) return -1;
+    }
+
+    newMemory = (uint8_t*)realloc(this->memory, (size_t)size * TOIC_BUFFER_POOL);
+    // not enough memory, old buffers stay
+    if (newMemory == NULL) return -1;
+    this->memory = newMemory;
+    this->size = size;
+    return 0;
+}
+
+/**
+ * @brief use static memory for all buffers, heap is not touched,
+ * allowed only while no buffer is owned
+ *
+ * @param size - size one buffer
+ * @param memory - TOIC_BUFFER_POOL buffers of size bytes, owned by caller
+ * @return int8_t = 0 - ok; -1 - error
+ */
+int8_t ToneIotBufferPool::init(uint16_t size, uint8_t* memory) {
+
+    if (size == 0 || memory == NULL) return -1;
+    if (this->memory != NULL && !this->external) return -1;
+    for (uint8_t i = 0; i < TOIC_BUFFER_POOL; i++) {
+        if (this->owner[i] != (uint8_t)TOIC_BUFFER_OWNER::FREE) return -1;
+    }
+
+    this->memory = memory;
+    this->external = true;
+    this->size = size;
+    return 0;
+}
+
+/**
+ * @brief take free buffer, safe to call from network and application task
+ *
+ * @param owner - new owner RX or TX
+ * @return int8_t index buffer; -1 - no free buffer
+ */
+int8_t ToneIotBufferPool::acquire(TOIC_BUFFER_OWNER owner) {
+
+    uint8_t expected = 0;
+
+    if (this->memory == NULL || owner == TOIC_BUFFER_OWNER::FREE) return -1;
+    for (uint8_t i = 0; i < TOIC_BUFFER_POOL; i++) {
+        expected = (uint8_t)TOIC_BUFFER_OWNER::FREE;
+        if (this->owner[i].compare_exchange_strong(expected, (uint8_t)owner)) return i;
+    }
+    return -1;
+}
+
+/**
+ * @brief return buffer to pool
+ *
+ * @param index - index buffer
+ */
+void ToneIotBufferPool::release(int8_t index) {
+
+    if (index < 0 || index >= TOIC_BUFFER_POOL) return;
+    this->owner[index] = (uint8_t)TOIC_BUFFER_OWNER::FREE;
+}
+
+/**
+ * @brief get buffer
+ *
+ * @param index - index buffer
+ * @return uint8_t* buffer; NULL - bad index
+ */
+uint8_t* ToneIotBufferPool::get(int8_t index) {
+
+    if (index < 0 || index >= TOIC_BUFFER_POOL || this->memory == NULL) return NULL;
+    return &this->memory[(size_t)index * this->size];
+}
+
+/**
+ * @brief get owner buffer
+ *
+ * @param index - index buffer
+ * @return TOIC_BUFFER_OWNER owner
+ */
+TOIC_BUFFER_OWNER ToneIotBufferPool::getOwner(int8_t index) {
+
+    if (index < 0 || index >= TOIC_BUFFER_POOL) return TOIC_BUFFER_OWNER::FREE;
+    return (TOIC_BUFFER_OWNER)this->owner[index].load();
+}
+
+/**
+ * @brief get size one buffer
+ *
+ * @return uint16_t size
+ */
+uint16_t ToneIotBufferPool::getSize() {
+    return this->size;
+}
+
+/**
+ * @brief get count buffers of owner
+ *
+ * @param owner - owner
+ * @return uint8_t count
+ */
+uint8_t ToneIotBufferPool::getUsed(TOIC_BUFFER_OWNER owner) {
+
+    uint8_t count = 0;
+    for (uint8_t i = 0; i < TOIC_BUFFER_POOL; i++) {
+        if (this->owner[i] == (uint8_t)owner) count++;
+    }
+    return count;
+}
@@ -8,8 +8,37 @@
 #include "Arduino.h"
 
 #include "ToneIotSettings.h"
+#include "ToneIotDelta.h"
+#include "ToneIotTelemetry.h"
+#include "ToneIotProfile.h"
 #include "Base64.h"
 
+/**
+ * @brief object in heap aligned as its type, rings keep indexes on own cache lines
+ * and malloc() aligns to 8 or 16 bytes only
+ * 
+ * @param memory - heap block to free()
+ * @return T* object; NULL - not enough memory
+ */
+template<typename T>
+static T* newAligned(void** memory) {
+
+    uintptr_t address = 0;
+
+    *memory = malloc(sizeof(T) + alignof(T) - 1);
+    if (*memory == NULL) return NULL;
+    address = ((uintptr_t)*memory + alignof(T) - 1) & ~(uintptr_t)(alignof(T) - 1);
+    return new ((void*)address) T();
+}
+
+template<typename T>
+static void deleteAligned(T* object, void* memory) {
+
+    if (memory == NULL) return;
+    object->~T();
+    free(memory);
+}
+
 
 // ======================================== public ======================================
 /**
@@ -18,16 +47,9 @@
  */
 ToneIotClient::ToneIotClient(Client& client) {
 
-    this->state = TOIC_STATE::DISCONNECTED;
-    setToneIotServer(TONE_TOKEN);
-    setClient(client);
-    this->stream = NULL;
-    this->listFunction = NULL;
-    this->bufferSize = 0;
-    setBufferSize(TOIC_MAX_PACKET_SIZE);
-    setKeepAlive(TOIC_KEEPALIVE);
-    setSocketTimeout(TOIC_SOCKET_TIMEOUT);
-    initFunctionSys();
+    memset(&this->storage, 0, sizeof(this->storage));
+    this->staticStorage = false;
+    init(client, NULL);
 }
 
 /**
@@ -37,16 +59,28 @@ ToneIotClient::ToneIotClient(Client& client) {
  */
 ToneIotClient::ToneIotClient(Client& client, Stream& stream) {
 
-    this->state = TOIC_STATE::DISCONNECTED;
-    setToneIotServer(TONE_TOKEN);
-    setClient(client);
-    setStream(stream);
-    this->listFunction = NULL;
-    this->bufferSize = 0;
-    setBufferSize(TOIC_MAX_PACKET_SIZE);
-    setKeepAlive(TOIC_KEEPALIVE);
-    setSocketTimeout(TOIC_SOCKET_TIMEOUT);
-    initFunctionSys();
+    memset(&this->storage, 0, sizeof(this->storage));
+    this->staticStorage = false;
+    init(client, &stream);
+}
+
+/**
+ *  @brief Constructor, buffers, callbacks and settings in given memory
+ *  @param client - object socket client
+ *  @param storage - memory of ToneIotStaticClient
+ */
+ToneIotClient::ToneIotClient(Client& client, const storage_t& storage) {
+
+    this->storage = storage;
+    this->staticStorage = true;
+    init(client, NULL);
+}
+
+ToneIotClient::ToneIotClient(Client& client, Stream& stream, const storage_t& storage) {
+
+    this->storage = storage;
+    this->staticStorage = true;
+    init(client, &stream);
 }
 
 /**
@@ -54,7 +88,11 @@ ToneIotClient::ToneIotClient(Client& client, Stream& stream) {
  */
 ToneIotClient::~ToneIotClient() {
 
-  if (this->buffer) free(this->buffer);
+    stopTask();
+    // packet buffers are freed by pool
+    this->pool.release(this->rxBuffer);
+    deleteAligned(this->rings, this->ringsMemory);
+    deleteAligned(this->batchRing, this->batchMemory);
 }
 
 /**
@@ -71,11 +109,11 @@ int8_t ToneIotClient::setToneIotServer(char* tonetoken) {
     int tonetokenLength = 0;
     int len = 0;
     int index = 0;
-    int decodedLength = 0;
-    char* decodedbuf = NULL;
+    int decodedLength[p_tonetoken_max] = {0};
+    char* decodedbuf[p_tonetoken_max] = {0};
+    uint8_t id[8] = {0};
 
-    //init structure toneiotsettigs
-    for (int i = 0; i < 8; i++) this->toneiotsettings.id[i] = 0;
+    TOIP_MEASURE(TOIP_SCOPE::TOKEN_PARSE);
 
     tonetokenLength = strlen(tonetoken);
     p_tonetoken[index] = tonetoken;
@@ -96,47 +134,183 @@ int8_t ToneIotClient::setToneIotServer(char* tonetoken) {
 
     // failed structure token
     if (index != p_tonetoken_max - 1) return -1;
-    // cycle by token structure
+    // cycle by token structure, elements are decoded aside and the current
+    // settings stay valid until the whole token is decoded
     for (int i = 0; i < p_tonetoken_max; i++){
 
         // element token length equal to 0 failed
-        if (len_tonetoken[i] == 0) return -1;
-        decodedLength = Base64.decodedLength(p_tonetoken[i], len_tonetoken[i]);
+        if (len_tonetoken[i] == 0) break;
+        decodedLength[i] = Base64.decodedLength(p_tonetoken[i], len_tonetoken[i]);
         // element token decode base64 failed
-        if (decodedLength <= 0) return -1;
-        decodedbuf = (char*)malloc(decodedLength + 1);
+        if (decodedLength[i] <= 0) break;
+        decodedbuf[i] = settingBuffer(i, decodedLength[i] + 1);
         // not enough memory
-        if (decodedbuf == NULL) return -1;
+        if (decodedbuf[i] == NULL) break;
         // decode element token
-        Base64.decode(decodedbuf, p_tonetoken[i], len_tonetoken[i]);
-        // set settings
-        if (i == 0){ //id
-            for (int ii = 0; ii < 8; ii++){
-                if (ii < decodedLength) this->toneiotsettings.id[7 - ii] = (uint8_t)decodedbuf[decodedLength - ii - 1];
-                else this->toneiotsettings.id[7 - ii] = 0;
+        Base64.decode(decodedbuf[i], p_tonetoken[i], len_tonetoken[i]);
+        if (i == 0){ //id, its buffer is the key buffer in static storage
+            for (int ii = 0; ii < 8 && ii < decodedLength[0]; ii++){
+                id[7 - ii] = (uint8_t)decodedbuf[0][decodedLength[0] - ii - 1];
             }
-            free(decodedbuf); 
-        }else if (i == 1){ //domain
-            this->toneiotsettings.domain = decodedbuf;
-        }else if (i == 2){ //key
-            this->toneiotsettings.key = (uint8_t*)decodedbuf;
-            this->toneiotsettings.key_len = decodedLength;
+            freeSetting(decodedbuf[0]);
+            decodedbuf[0] = NULL;
         }
-        decodedbuf = NULL;
     }
+    if (decodedbuf[p_tonetoken_max - 1] == NULL) {
+        for (int i = 0; i < p_tonetoken_max; i++) freeSetting(decodedbuf[i]);
+        return -1;
+    }
+
+    // set settings
+    memcpy(this->toneiotsettings.id, id, sizeof(id));
+    freeSetting(this->toneiotsettings.domain);
+    this->toneiotsettings.domain = decodedbuf[1];
+    // domain of token is the primary endpoint
+    initEndpoint(&this->endpoints[0], decodedbuf[1], TONE_CONNECT_PORT);
+    if (this->endpointCount == 0) this->endpointCount = 1;
+    freeSetting((char*)this->toneiotsettings.key);
+    this->toneiotsettings.key = (uint8_t*)decodedbuf[2];
+    this->toneiotsettings.key_len = decodedLength[2];
 
     return 0;
 }
 
 /**
- * @brief set function callback
+ * @brief set function callback, the function is advertised in INIT and
+ * called after the server enables it in its INIT answer
  * 
  * @param function number packet function
- * @param cbFunction callback user function
+ * @param cbFunction callback user function, function pointer or lambda with
+ *                   captures up to TOIC_FUNCTION_CAPTURE bytes
  * @return int8_t = 0 - ok; -1 - error
  */
 int8_t ToneIotClient::setFunction(uint16_t function, cbFunction_t cbFunction){
-    return setFunction(function, cbFunction, NULL);
+    return setFunction(function, cbFunction, false);
+}
+
+/**
+ * @brief function is registered and enabled by server
+ * 
+ * @param function - function number
+ * @return true - callback is called
+ */
+bool ToneIotClient::isFunctionEnabled(uint16_t function){
+
+    for (itemFunction_t* itemFunction = this->listFunction; itemFunction != NULL; itemFunction = (itemFunction_t*)itemFunction->nextfunction) {
+        if (itemFunction->function == function) return itemFunction->enable;
+    }
+    return false;
+}
+
+/**
+ * @brief set delivery of outgoing function, default TOIC_QOS::AT_MOST_ONCE
+ * 
+ * @param function - function number
+ * @param qos - delivery
+ * @return int8_t = 0 - ok; -1 - error, table is full or number uses flag bits
+ */
+int8_t ToneIotClient::setFunctionQos(uint16_t function, TOIC_QOS qos){
+
+    txFunction_t* item = NULL;
+
+    if (function & ~TOIC_FUNCTION_MASK) return -1;
+    item = findTxFunction(function, qos != TOIC_QOS::AT_MOST_ONCE);
+    if (item == NULL) return qos == TOIC_QOS::AT_MOST_ONCE ? 0 : -1;
+    item->qos = qos;
+    return 0;
+}
+
+/**
+ * @brief get delivery of outgoing function
+ * 
+ * @param function - function number
+ * @return TOIC_QOS delivery
+ */
+TOIC_QOS ToneIotClient::getFunctionQos(uint16_t function){
+
+    txFunction_t* item = findTxFunction(function, false);
+    return item != NULL ? item->qos : TOIC_QOS::AT_MOST_ONCE;
+}
+
+/**
+ * @brief set how long packets of outgoing function may wait while the modem
+ * sleeps, they are sent together in the next wake window. Works with setRadio()
+ * 
+ * @param function - function number
+ * @param delay - ms, 0 - urgent, default
+ * @return int8_t = 0 - ok; -1 - error, table is full or number uses flag bits
+ */
+int8_t ToneIotClient::setFunctionDelay(uint16_t function, uint32_t delay){
+
+    txFunction_t* item = NULL;
+
+    if (function & ~TOIC_FUNCTION_MASK) return -1;
+    item = findTxFunction(function, delay != 0);
+    if (item == NULL) return delay == 0 ? 0 : -1;
+    item->delay = delay;
+    return 0;
+}
+
+/**
+ * @brief get how long packets of outgoing function may wait
+ * 
+ * @param function - function number
+ * @return uint32_t delay ms, 0 - urgent
+ */
+uint32_t ToneIotClient::getFunctionDelay(uint16_t function){
+
+    txFunction_t* item = findTxFunction(function, false);
+    return item != NULL ? item->delay : 0;
+}
+
+/**
+ * @brief set priority class of outgoing function, frames queued for the
+ * network task are written by class, default TOIC_PRIORITY::CONTROL
+ * 
+ * @param function - function number, not a system function
+ * @param priority - class
+ * @return int8_t = 0 - ok; -1 - error, table is full or number is system or uses flag bits
+ */
+int8_t ToneIotClient::setFunctionPriority(uint16_t function, TOIC_PRIORITY priority){
+
+    txFunction_t* item = NULL;
+
+    if (function & ~TOIC_FUNCTION_MASK) return -1;
+    if (function <= TOIC_FUNCTION_SYS_DISCONNECT || priority == TOIC_PRIORITY::SYSTEM) return -1;
+    item = findTxFunction(function, priority != TOIC_PRIORITY::CONTROL);
+    if (item == NULL) return priority == TOIC_PRIORITY::CONTROL ? 0 : -1;
+    item->priority = priority;
+    return 0;
+}
+
+/**
+ * @brief get priority class of outgoing function
+ * 
+ * @param function - function number, flag bits are ignored
+ * @return TOIC_PRIORITY class
+ */
+TOIC_PRIORITY ToneIotClient::getFunctionPriority(uint16_t function){
+
+    txFunction_t* item = NULL;
+
+    function &= TOIC_FUNCTION_MASK;
+    if (function <= TOIC_FUNCTION_SYS_DISCONNECT) return TOIC_PRIORITY::SYSTEM;
+    item = findTxFunction(function, false);
+    return item != NULL ? item->priority : TOIC_PRIORITY::CONTROL;
+}
+
+/**
+ * @brief server has room for a function, sends are refused without credit,
+ * the app retries when ACK or KEEPALIVE of server brings new credit
+ * 
+ * @param len - length data
+ * @return true - function can be sent now or server has no flow control
+ */
+bool ToneIotClient::hasCredit(uint16_t len){
+
+    if (!this->txCredit) return true;
+    if ((int16_t)(this->txFrameLimit - this->txFrames) <= 0) return false;
+    return (int32_t)(this->txByteLimit - this->txBytes - ToneIotPacketView::HEADER_SIZE - len) >= 0;
 }
 
 /**
@@ -157,6 +331,217 @@ void ToneIotClient::setStream(Stream& stream){
     this->stream = &stream;
 }
 
+/**
+ * @brief set delta firmware patch applier, enables function TOIC_FUNCTION_SYS_OTA
+ * 
+ * @param delta - object delta patch applier
+ */
+void ToneIotClient::setDelta(ToneIotDelta& delta){
+    this->delta = &delta;
+}
+
+/**
+ * @brief set modem power control, the modem sleeps between wake windows.
+ * Keep alive wakes the modem too, set it long. The socket is not polled
+ * while the modem sleeps, incoming data must pull RI (AT+CFGRI=1)
+ * 
+ * @param radio - object radio, begin() is called by user
+ */
+void ToneIotClient::setRadio(ToneIotRadio& radio){
+    this->radio = &radio;
+    // without batch ring delayed functions are sent at once
+    if (this->batchRing == NULL && !this->staticStorage) this->batchRing = newAligned<batchRing_t>(&this->batchMemory);
+}
+
+/**
+ * @brief set rings of network task, a heap client allocates them in
+ * startTask() when not set. Call before startTask()
+ * 
+ * @param rings - object rings, static or living longer than client
+ */
+void ToneIotClient::setTaskRings(taskRings_t& rings){
+
+    if (this->taskRunning) return;
+    deleteAligned(this->rings, this->ringsMemory);
+    this->ringsMemory = NULL;
+    this->rings = &rings;
+}
+
+/**
+ * @brief set ring of packets held while the modem sleeps, a heap client
+ * allocates it in setRadio() when not set. Call before setRadio()
+ * 
+ * @param ring - object ring, static or living longer than client
+ */
+void ToneIotClient::setBatchRing(batchRing_t& ring){
+
+    if (this->batchRing != NULL && !this->batchRing->empty()) return;
+    deleteAligned(this->batchRing, this->batchMemory);
+    this->batchMemory = NULL;
+    this->batchRing = &ring;
+}
+
+/**
+ * @brief set telemetry batch, it is sent by loop() with function when full or old
+ * 
+ * @param telemetry - object telemetry
+ * @param function - function of batch, decoded by server
+ */
+void ToneIotClient::setTelemetry(ToneIotTelemetry& telemetry, uint16_t function){
+    this->telemetry = &telemetry;
+    this->telemetryFunction = function;
+    // batches do not delay answers and commands
+    setFunctionPriority(function, TOIC_PRIORITY::BULK);
+}
+
+/**
+ * @brief set hook called for every received user function before its callback
+ * 
+ * @param cbReceive - hook, returns true when the packet is consumed
+ */
+void ToneIotClient::setReceiveHook(cbReceive_t cbReceive){
+    this->cbReceive = cbReceive;
+}
+
+/**
+ * @brief add fallback server, tried in order after the domain of token
+ * 
+ * @param host - domain or ip literal, the string must stay valid
+ * @param port - TCP port
+ * @return int8_t = 0 - ok; -1 - error, table is full
+ */
+int8_t ToneIotClient::addEndpoint(const char* host, uint16_t port){
+
+    if (host == NULL || this->endpointCount == 0 || this->endpointCount >= TOIC_MAX_ENDPOINTS) return -1;
+    initEndpoint(&this->endpoints[this->endpointCount++], host, port);
+    return 0;
+}
+
+/**
+ * @brief remove fallback servers, the domain of token stays
+ * 
+ */
+void ToneIotClient::clearEndpoints(){
+    if (this->endpointCount > 1) this->endpointCount = 1;
+    if (this->endpointIndex >= this->endpointCount) this->endpointIndex = -1;
+}
+
+/**
+ * @brief set DNS resolver, resolved addresses are cached for setDnsTtl(),
+ * without resolver the domain is passed to client->connect() every time
+ * 
+ * @param cbResolve - resolver, returns 0 and address or -1
+ */
+void ToneIotClient::setResolver(cbResolve_t cbResolve){
+    this->cbResolve = cbResolve;
+}
+
+/**
+ * @brief set time resolved address is used, default TOIC_DNS_TTL
+ * 
+ * @param ttl - ms
+ */
+void ToneIotClient::setDnsTtl(uint32_t ttl){
+    this->dnsTtl = ttl;
+}
+
+uint8_t ToneIotClient::getEndpointCount(){
+    return this->endpointCount;
+}
+
+/**
+ * @brief get endpoint with address cache and health
+ * 
+ * @param index - index endpoint, 0 - domain of token
+ * @return const endpoint_t* endpoint; NULL - bad index
+ */
+const ToneIotClient::endpoint_t* ToneIotClient::getEndpoint(uint8_t index){
+
+    if (index >= this->endpointCount) return NULL;
+    return &this->endpoints[index];
+}
+
+/**
+ * @brief get endpoint of last successful TCP connect
+ * 
+ * @return int8_t index endpoint; -1 - none
+ */
+int8_t ToneIotClient::getEndpointIndex(){
+    return this->endpointIndex;
+}
+
+/**
+ * @brief subscribe to group, frames with the group id in place of device id
+ * are received like own ones; frames of other groups are skipped unread
+ * 
+ * @param id - group id 8 bytes
+ * @return int8_t = 0 - ok, also already subscribed; -1 - error, table is full
+ */
+int8_t ToneIotClient::addGroup(const uint8_t* id){
+
+    ToneIotLock lock(this->ioMutex);
+    uint8_t i = 0;
+
+    if (id == NULL) return -1;
+    if (findGroup(id) >= 0) return 0;
+    if (this->groupCount >= TOIC_MAX_GROUPS) return -1;
+    // table stays sorted for findGroup()
+    for (i = this->groupCount; i > 0 && memcmp(this->groups[i - 1].id, id, ToneIotPacketView::ID_SIZE) > 0; i--) {
+        this->groups[i] = this->groups[i - 1];
+    }
+    memcpy(this->groups[i].id, id, ToneIotPacketView::ID_SIZE);
+    this->groups[i].rxMsgId = 0;
+    this->groups[i].rxWindow = 0;
+    this->groupCount++;
+    return 0;
+}
+
+/**
+ * @brief unsubscribe from group
+ * 
+ * @param id - group id 8 bytes
+ * @return int8_t = 0 - ok; -1 - error, not subscribed
+ */
+int8_t ToneIotClient::removeGroup(const uint8_t* id){
+
+    ToneIotLock lock(this->ioMutex);
+    int8_t index = id != NULL ? findGroup(id) : -1;
+
+    if (index < 0) return -1;
+    this->groupCount--;
+    for (uint8_t i = index; i < this->groupCount; i++) this->groups[i] = this->groups[i + 1];
+    return 0;
+}
+
+/**
+ * @brief unsubscribe from all groups
+ * 
+ */
+void ToneIotClient::clearGroups(){
+    ToneIotLock lock(this->ioMutex);
+    this->groupCount = 0;
+}
+
+/**
+ * @brief get count of subscribed groups
+ * 
+ * @return uint8_t count
+ */
+uint8_t ToneIotClient::getGroupCount(){
+    return this->groupCount;
+}
+
+/**
+ * @brief check subscription to group
+ * 
+ * @param id - group id 8 bytes
+ * @return true - subscribed
+ * @return false - not subscribed
+ */
+bool ToneIotClient::isMember(const uint8_t* id){
+    return id != NULL && findGroup(id) >= 0;
+}
+
 /**
  * @brief set time keep alive
  * 
@@ -183,25 +568,23 @@ void ToneIotClient::setSocketTimeout(uint16_t timeout) {
  */
 int8_t ToneIotClient::setBufferSize(uint16_t size) {
 
-    uint8_t* newBuffer = NULL;
-
-    if (size == 0) {
-        // Cannot set it back to 0
+    if (size <= 14) {
+        // Cannot be less than header
         return -1;
     }
-    if (this->bufferSize == 0) {
-        this->buffer = (uint8_t*)malloc(size);
-    } else {
-        newBuffer = (uint8_t*)realloc(this->buffer, size);
-        if (newBuffer != NULL) {
-            this->buffer = newBuffer;
-        } else {
-            return -1;
-        }
+    // static buffers do not grow
+    if (this->staticStorage && size > this->storage.bufferSize) return -1;
+
+    // RX buffer is returned while the pool is reallocated, TX buffers must be free
+    this->pool.release(this->rxBuffer);
+    if (this->staticStorage) {
+        if (this->pool.init(size, this->storage.memory) == 0) this->bufferSize = size;
+    } else if (this->pool.init(size) == 0) {
+        this->bufferSize = size;
     }
-    this->bufferSize = size;
-    this->packet = (packet_t*) this->buffer;
-    if (this->buffer == NULL) return -1;
+    this->rxBuffer = this->pool.acquire(TOIC_BUFFER_OWNER::RX);
+    this->rxPacket = ToneIotPacketView(this->pool.get(this->rxBuffer));
+    if (!this->rxPacket.valid() || this->bufferSize != size) return -1;
     return 0;
 }
 
@@ -214,6 +597,35 @@ uint16_t ToneIotClient::getBufferSize() {
     return this->bufferSize;
 }
 
+/**
+ * @brief get current retransmission timeout
+ * 
+ * @return uint32_t timeout ms
+ */
+uint32_t ToneIotClient::getRetransmitTimeout() {
+    return this->rto;
+}
+
+/**
+ * @brief get counters of socket traffic, copy taken while the network task
+ * does not write them
+ * 
+ * @return stats_t counters
+ */
+ToneIotClient::stats_t ToneIotClient::getStats() {
+
+    ToneIotLock lock(this->ioMutex);
+    stats_t stats = this->stats;
+
+    for (uint8_t i = 0; i < TOIC_PRIORITY_COUNT; i++) stats.tx[i].depth = this->txDepth[i];
+    return stats;
+}
+
+void ToneIotClient::resetStats() {
+    ToneIotLock lock(this->ioMutex);
+    memset(&this->stats, 0, sizeof(this->stats));
+}
+
 /**
  * @brief connect to tone iot server
  * 
@@ -221,33 +633,86 @@ uint16_t ToneIotClient::getBufferSize() {
  */
 int8_t ToneIotClient::connect() {
 
+    TOIP_MEASURE(TOIP_SCOPE::CONNECT);
+    // network task does not touch the socket while handshake
+    ToneIotLock lock(this->ioMutex);
+
+    if (connected()) return 0;
+    if (connectAsync()) return -1;
+
+    // wait answer INIT here, loop() is not called
+    if (waitServerRespons() != TOIC_FUNCTION_SYS_INIT) {
+        if (this->endpointIndex >= 0) failEndpoint(&this->endpoints[this->endpointIndex]);
+        this->state = TOIC_STATE::CONNECT_BAD_PROTOCOL;
+        this->client->flush();
+        this->client->stop();
+        return -1;
+    }
+    applyInit(this->rxPacket.getData(), this->rxPacket.getDataLen());
+
+    lastInActivity = lastOutActivity = millis();
+    this->pingOutstanding = false;
+    this->state = TOIC_STATE::CONNECTED;
+    return 0;
+}
+
+/**
+ * @brief connect to tone iot server without waiting answer INIT, state is
+ * TOIC_STATE::CONNECTING until loop() gets INIT and sets CONNECTED
+ * 
+ * @return int8_t = 0 - INIT is sent or already connected; -1 - error
+ */
+int8_t ToneIotClient::connectAsync() {
+
+    // network task does not touch the socket while handshake
+    ToneIotLock lock(this->ioMutex);
+
     if (this->toneiotsettings.domain == NULL || this->toneiotsettings.key == NULL || this->toneiotsettings.key_len == 0){
         this->state = TOIC_STATE::CONNECT_BAD_PROTOCOL;
         return -1;
     }
 
-    if (connected()) return 0;
+    if (connected() || this->state == TOIC_STATE::CONNECTING) return 0;
+    // handshake needs UART of modem
+    if (this->radio != NULL) this->radio->wake();
           
-    //tcp connect to tone iot server
+    //tcp connect to tone iot server, fallback endpoints on failure
     if(!this->client->connected()) {
-        if(this->client->connect(this->toneiotsettings.domain, TONE_CONNECT_PORT) != 1){ // error connect tone iot server
+        if(connectEndpoints()){ // error connect tone iot server
             this->state = TOIC_STATE::CONNECT_FAILED;
             return -1;
         }
     }
 
+    // server starts its sequence with the session
+    this->rxRead = 0;
+    this->rxSkip = 0;
+    this->rxMsgId = 0;
+    this->rxWindow = 0;
+    for (uint8_t i = 0; i < this->groupCount; i++) this->groups[i].rxWindow = 0;
+
+    // flow control starts with INIT, server without credit is not paced
+    this->txCredit = false;
+    this->txFrames = 0;
+    this->txBytes = 0;
+    this->rxFrames = 0;
+    this->rxBytes = 0;
+    this->rxFramesSeen = 0;
+    this->rxCreditBytes = TOIC_CREDIT_BYTES > this->bufferSize ? TOIC_CREDIT_BYTES : this->bufferSize;
+    this->rxFrameLimit = TOIC_CREDIT_FRAMES;
+    this->rxByteLimit = this->rxCreditBytes;
+
     //function init verify key connected tone iot server
     if (sendFunctionInit()) {
         this->state = TOIC_STATE::CONNECT_BAD_PROTOCOL;
-        goto ERROR;
+        this->client->flush();
+        this->client->stop();
+        return -1;
     }
 
-    this->state = TOIC_STATE::CONNECTED;
+    lastInActivity = lastOutActivity = millis();
+    this->state = TOIC_STATE::CONNECTING;
     return 0;
-ERROR:
-    this->client->flush();
-    this->client->stop();
-    return -1;
 }
 
 /**
@@ -256,11 +721,16 @@ ERROR:
  */
 void ToneIotClient::disconnect() {
 
+    // socket of sleeping modem is not polled
+    if (this->radio != NULL) this->radio->wake();
     //not tcp connect to tone iot server
     if(!this->client->connected()) return;
 
+    // held packets are not lost on planned disconnect
+    if (this->state == TOIC_STATE::CONNECTED) flushBatch();
     sendFunctionDisconnect(0);
 
+    ToneIotLock lock(this->ioMutex);
     this->state = TOIC_STATE::DISCONNECTED;
     this->client->flush();
     this->client->stop();
@@ -268,29 +738,17 @@ void ToneIotClient::disconnect() {
 }
 
 /**
- * @brief connected to tone iot server
+ * @brief connected to tone iot server. With network task the state it keeps
+ * is read, while the modem sleeps the last state is read; the socket is not
+ * touched then
  * 
  * @return true - connected
  * @return false - disconnected
  */
 bool ToneIotClient::connected() {
 
-    bool rc;
-    if (this->client == NULL ) {
-        rc = false;
-    } else {
-        rc = (int)this->client->connected();
-        if (!rc) {
-            if (this->state == TOIC_STATE::CONNECTED) {
-                this->state = TOIC_STATE::CONNECTION_LOST;
-                this->client->flush();
-                this->client->stop();
-            }
-        } else {
-            return this->state == TOIC_STATE::CONNECTED;
-        }
-    }
-    return rc;
+    if (this->taskRunning || isRadioAsleep()) return this->state == TOIC_STATE::CONNECTED;
+    return checkSocket();
 }
 
 /**
@@ -309,125 +767,391 @@ TOIC_STATE ToneIotClient::getState() {
  */
 int8_t ToneIotClient::loop() {
 
-    //if (connected()) {
-    //     unsigned long t = millis();
-    //     if ((t - lastInActivity > this->keepAlive*1000UL) || (t - lastOutActivity > this->keepAlive*1000UL)) {
-    //         if (pingOutstanding) {
-    //             this->_state = TOIC_CONNECTION_TIMEOUT;
-    //             _client->stop();
-    //             return false;
-    //         } else {
-    //             this->buffer[0] = TOICPINGREQ;
-    //             this->buffer[1] = 0;
-    //             _client->write(this->buffer,2);
-    //             lastOutActivity = t;
-    //             lastInActivity = t;
-    //             pingOutstanding = true;
-    //         }
-    //     }
-    //    if (_client->available()) {
-    //         uint8_t llen;
-    //         uint16_t len = readPacket(&llen);
-    //         uint16_t msgId = 0;
-    //         uint8_t *payload;
-    //         if (len > 0) {
-    //             lastInActivity = t;
-    //             uint8_t type = this->buffer[0]&0xF0;
-    //             if (type == MQTTPUBLISH) {
-    //                 if (callback) {
-    //                     uint16_t tl = (this->buffer[llen+1]<<8)+this->buffer[llen+2]; /* topic length in bytes */
-    //                     memmove(this->buffer+llen+2,this->buffer+llen+3,tl); /* move topic inside buffer 1 byte to front */
-    //                     this->buffer[llen+2+tl] = 0; /* end the topic as a 'C' string with \x00 */
-    //                     char *topic = (char*) this->buffer+llen+2;
-    //                     // msgId only present for QOS>0
-    //                     if ((this->buffer[0]&0x06) == MQTTQOS1) {
-    //                         msgId = (this->buffer[llen+3+tl]<<8)+this->buffer[llen+3+tl+1];
-    //                         payload = this->buffer+llen+3+tl+2;
-    //                         callback(topic,payload,len-llen-3-tl-2);
-
-    //                         this->buffer[0] = MQTTPUBACK;
-    //                         this->buffer[1] = 2;
-    //                         this->buffer[2] = (msgId >> 8);
-    //                         this->buffer[3] = (msgId & 0xFF);
-    //                         _client->write(this->buffer,4);
-    //                         lastOutActivity = t;
-
-    //                     } else {
-    //                         payload = this->buffer+llen+3+tl;
-    //                         callback(topic,payload,len-llen-3-tl);
-    //                     }
-    //                 }
-    //             } else if (type == MQTTPINGREQ) {
-    //                 this->buffer[0] = MQTTPINGRESP;
-    //                 this->buffer[1] = 0;
-    //                 _client->write(this->buffer,2);
-    //             } else if (type == MQTTPINGRESP) {
-    //                 pingOutstanding = false;
-    //             }
-    //         } else if (!connected()) {
-    //             // readPacket has closed the connection
-    //             return false;
-    //         }
-    //     }
-    //     return true;
-    // }
-    return false;
-}
+    uint16_t len = 0;
+    ToneIotPacketView packet;
+
+    // handshake of connectAsync()
+    if (this->state == TOIC_STATE::CONNECTING) return checkConnecting();
+
+    // packets received by network task are dispatched on the application task from the ring
+    if (this->taskRunning) {
+        if ((packet = ToneIotPacketView(this->rings->rx.peek(&len))).valid()) {
+            do {
+                this->rxPacket = packet;
+                dispatch(packet);
+                this->rxPacket = ToneIotPacketView(this->pool.get(this->rxBuffer));
+                this->rings->rx.pop();
+            } while ((packet = ToneIotPacketView(this->rings->rx.peek(&len))).valid());
+            // network task waits for room of a full ring
+            this->taskEvent.signal();
+        }
+        if (this->state == TOIC_STATE::CONNECTED) checkInflight();
+        if (this->state == TOIC_STATE::CONNECTED) checkCredit();
+        checkPendingSend();
+        checkTelemetry();
+        checkRadio();
+        return connected() ? 0 : -1;
+    }
 
-int8_t ToneIotClient::sendFunctio(uint16_t function){
-    return sendFunctio(function, NULL, 0);
-}
+    if (!connected()) return -1;
 
-int8_t ToneIotClient::sendFunctio(uint16_t function, uint8_t* buf, uint16_t len){
-    memcpy(this->packet->id, this->toneiotsettings.id, 8); 
-    this->packet->msgId = ++this->msgId;
-    this->packet->function = function;
-    if (buf != NULL) {
-        memcpy(this->packet->pdata, buf, len); 
-        this->packet->datalen = len;
+    // dispatch incoming function, socket of sleeping modem is polled after RI wakes it
+    switch (isRadioAsleep() ? 0 : receive(this->rxPacket)) {
+    case -1:
+        return -1;
+    case 1:
+        dispatch(this->rxPacket);
+        break;
     }
-    return writePacket(this->packet);
-}
 
+    checkInflight();
+    checkCredit();
+    checkPendingSend();
+    checkKeepAlive();
+    checkTelemetry();
+    checkRadio();
+    return 0;
+}
+
+/**
+ * @brief run socket I/O, parsing and keep alive in own task,
+ * callbacks are still called from loop() of the application task
+ * 
+ * @return int8_t = 0 - ok; -1 - error
+ */
+int8_t ToneIotClient::startTask() {
+    return startTask(TOIC_TASK_CORE);
+}
+
+/**
+ * @brief run socket I/O, parsing and keep alive in own task,
+ * callbacks are still called from loop() of the application task
+ * 
+ * @param core - core number network task, -1 - any core
+ * @return int8_t = 0 - ok; -1 - error, no rings or task is not created
+ */
+int8_t ToneIotClient::startTask(int8_t core) {
+
+    if (this->taskRunning) return 0;
+    // ToneIotStaticClient does not use heap, its rings are given by setTaskRings()
+    if (this->rings == NULL && !this->staticStorage) this->rings = newAligned<taskRings_t>(&this->ringsMemory);
+    if (this->rings == NULL) return -1;
+    this->taskRunning = true;
+    if (this->task.start(&ToneIotClient::taskEntry, this, "toneiot", TOIC_TASK_STACK, TOIC_TASK_PRIORITY, core)) {
+        this->taskRunning = false;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief stop network task, the socket is served by loop() again
+ * 
+ */
+void ToneIotClient::stopTask() {
+
+    uint16_t len = 0;
+
+    if (!this->taskRunning) return;
+    this->taskRunning = false;
+    this->taskEvent.signal();
+    this->task.join();
+    // packets not dispatched and not sent
+    while (this->rings->rx.peek(&len) != NULL) this->rings->rx.pop();
+    for (uint8_t i = 0; i < TOIC_PRIORITY_COUNT; i++) {
+        while (this->rings->tx[i].peek(&len) != NULL) this->rings->tx[i].pop();
+        this->txDepth[i] = 0;
+    }
+}
+
+int8_t ToneIotClient::sendFunctio(uint16_t function){
+    return sendFunctio(function, NULL, 0);
+}
+
+int8_t ToneIotClient::sendFunctio(uint16_t function, uint8_t* buf, uint16_t len){
+    return sendPacket(function, ++this->msgId, buf, len);
+}
+
+/**
+ * @brief send table of ToneIotProfile, decoded by tools/toneiot_profile.py;
+ * all zero without build flag TOIP_PROFILE
+ * 
+ * @param function - function number
+ * @return int8_t = 0 - ok; -1 - error
+ */
+int8_t ToneIotClient::sendProfile(uint16_t function){
+
+    uint8_t buf[TOIP_SIZE];
+    uint16_t len = ToneIotProfile::encode(buf, sizeof(buf));
+
+    if (len == 0) return -1;
+    return sendFunctio(function, buf, len);
+}
+
+/**
+ * @brief send function without waiting answer, result is read by getSendState()
+ * 
+ * @param function - function number
+ * @param buf - array buffer
+ * @param len - length buffer
+ * @return sendHandle_t handle; TOIC_SEND_HANDLE_INVALID - error
+ */
+ToneIotClient::sendHandle_t ToneIotClient::sendFunctioAsync(uint16_t function, uint8_t* buf, uint16_t len){
+    return sendFunctioAsync(function, buf, len, NULL);
+}
+
+/**
+ * @brief send function without waiting answer, cbComplete is called from loop()
+ * when ACK/ERROR with the same msgId arrives or socket timeout passes
+ * 
+ * @param function - function number
+ * @param buf - array buffer
+ * @param len - length buffer
+ * @param cbComplete - callback result, NULL - result is read by getSendState()
+ * @return sendHandle_t handle; TOIC_SEND_HANDLE_INVALID - error
+ */
+ToneIotClient::sendHandle_t ToneIotClient::sendFunctioAsync(uint16_t function, uint8_t* buf, uint16_t len, cbComplete_t cbComplete){
+
+    pendingSend_t* slot = NULL;
+    uint8_t i = 0;
+
+    for (i = 0; i < TOIC_MAX_PENDING; i++) {
+        if (!this->pendingSend[i].used) {
+            slot = &this->pendingSend[i];
+            break;
+        }
+    }
+    // all slots are in flight
+    if (slot == NULL) return TOIC_SEND_HANDLE_INVALID;
+
+    slot->msgId = ++this->msgId;
+    if (sendPacket(function, slot->msgId, buf, len)) return TOIC_SEND_HANDLE_INVALID;
+    slot->used = true;
+    slot->generation++;
+    slot->state = TOIC_SEND::PENDING;
+    slot->timestamp = millis();
+    slot->hold = this->radio != NULL ? getFunctionDelay(function) : 0;
+    slot->cbComplete = cbComplete;
+    return ((sendHandle_t)slot->generation << 8) | i;
+}
+
+/**
+ * @brief get result of asynchronous send, a final result frees the handle
+ * 
+ * @param handle - handle of sendFunctioAsync()
+ * @return TOIC_SEND result
+ */
+TOIC_SEND ToneIotClient::getSendState(sendHandle_t handle){
+
+    pendingSend_t* slot = NULL;
+    TOIC_SEND state;
+
+    if ((handle & 0xFF) >= TOIC_MAX_PENDING) return TOIC_SEND::INVALID;
+    slot = &this->pendingSend[handle & 0xFF];
+    if (!slot->used || slot->generation != (handle >> 8)) return TOIC_SEND::INVALID;
+    state = slot->state;
+    if (state != TOIC_SEND::PENDING) slot->used = false;
+    return state;
+}
+
+// acknowledgement of the last received packet
 void ToneIotClient::sendFunctionAck(){
-    memcpy(this->packet->id, this->toneiotsettings.id, 8); 
-    this->packet->function = TOIC_FUNCTION_SYS_ACK;
-    this->packet->datalen = 0;
-    writePacket(this->packet);
+
+    int8_t index = -1;
+    ToneIotPacketView packet = acquirePacket(&index, TOIC_FUNCTION_SYS_ACK, this->rxPacket.getMsgId());
+
+    if (!packet.valid()) return;
+    putCredit(packet);
+    transmit(index, packet);
 }
 
+// error on the last received packet
 void ToneIotClient::sendFunctionError(uint16_t error){
-    memcpy(this->packet->id, this->toneiotsettings.id, 8);
-    this->packet->datalen = 2; // header + id + keepAlive
-    this->packet->function = TOIC_FUNCTION_SYS_ERROR;
-    memcpy(&this->packet->pdata, &error, 2);           // error 2 byte
-    writePacket(this->packet);
+
+    int8_t index = -1;
+    ToneIotPacketView packet = acquirePacket(&index, TOIC_FUNCTION_SYS_ERROR, this->rxPacket.getMsgId());
+
+    if (!packet.valid()) return;
+    packet.setDataLen(2);
+    ToneIotPacketView::store16(packet.getData(), error);       // error 2 byte
+    putCredit(packet);
+    transmit(index, packet);
 }
 
+/**
+ * @brief wait next packet of server. With network task only answers INIT, ACK
+ * and ERROR are returned, other packets are dispatched to their callbacks
+ * while waiting, as loop() does
+ *
+ * @return uint16_t function of packet; TOIC_FUNCTION_SYS_ERROR with code 0 - timeout or error
+ */
 uint16_t ToneIotClient::waitServerRespons(){
-    if (readPacket(&packet) == -1){ 
-        this->packet->function = TOIC_FUNCTION_SYS_ERROR;
-        this->packet->pdata[0] = 0;
-        this->packet->pdata[1] = 0;
+
+    int8_t ret = -1;
+    uint16_t len = 0;
+    uint8_t* frame = NULL;
+    uint16_t function = 0;
+    uint32_t previousMillis = millis();
+
+    if (this->taskRunning && this->state == TOIC_STATE::CONNECTED) {
+        while (ret == -1 && this->state == TOIC_STATE::CONNECTED) {
+            frame = this->rings->rx.peek(&len);
+            if (frame == NULL) {
+                if (millis() - previousMillis >= (uint32_t)this->socketTimeout * 1000) break;
+                // network task signals every received frame
+                this->rxEvent.wait(TOIC_TASK_POLL);
+                continue;
+            }
+            function = ToneIotPacketView(frame).getFunction();
+            if (function == TOIC_FUNCTION_SYS_INIT || function == TOIC_FUNCTION_SYS_ACK || function == TOIC_FUNCTION_SYS_ERROR) {
+                // the packet is copied out of the ring, buf of waitServerRespons() stays valid
+                memcpy(this->rxPacket.getBuffer(), frame, len);
+                this->rings->rx.pop();
+                ret = 0;
+                break;
+            }
+            this->rxPacket = ToneIotPacketView(frame);
+            dispatch(this->rxPacket);
+            this->rxPacket = ToneIotPacketView(this->pool.get(this->rxBuffer));
+            this->rings->rx.pop();
+        }
+    } else {
+        // socket and its counters are not shared with the network task meanwhile
+        ToneIotLock lock(this->ioMutex);
+        // packets of other device and duplicates are skipped
+        do {
+            ret = readPacket(this->rxPacket);
+        } while (ret > 0 && millis() - previousMillis < (uint32_t)this->socketTimeout * 1000);
+        if (ret > 0) ret = -1;
+    }
+
+    // answer can be awaited also by asynchronous send and retransmission
+    if (ret == 0) takeCredit(this->rxPacket);
+    if (ret == 0 && isCredited(this->rxPacket)) {
+        this->rxFrames++;
+        this->rxBytes += this->rxPacket.getSize();
+    }
+    if (ret == 0 && this->rxPacket.getFunction() == TOIC_FUNCTION_SYS_ACK) {
+        completeInflight(this->rxPacket.getMsgId());
+        completeSend(this->rxPacket.getMsgId(), TOIC_SEND::ACK, 0);
+    } else if (ret == 0 && this->rxPacket.getFunction() == TOIC_FUNCTION_SYS_ERROR) {
+        completeInflight(this->rxPacket.getMsgId());
+        completeSend(this->rxPacket.getMsgId(), TOIC_SEND::ERROR, getErrorCode());
+    }
+
+    if (ret == -1){ 
+        this->rxPacket.setFunction(TOIC_FUNCTION_SYS_ERROR);
+        this->rxPacket.setDataLen(2);
+        ToneIotPacketView::store16(this->rxPacket.getData(), 0);
     }
-    return this->packet->function;
+    return this->rxPacket.getFunction();
 }
 
 uint16_t ToneIotClient::waitServerRespons(uint16_t* function, uint8_t** buf, uint16_t* len){
     waitServerRespons();
-    *function = this->packet->function;
-    *buf = this->packet->pdata;
-    *len = this->packet->datalen;
-    return this->packet->function;
+    *function = this->rxPacket.getFunction();
+    *buf = this->rxPacket.getData();
+    *len = this->rxPacket.getDataLen();
+    return this->rxPacket.getFunction();
 }
 
 // last error code
 uint16_t ToneIotClient::getErrorCode(){
-    return (this->packet->pdata[0] << 8) | this->packet->pdata[1];
+    return ToneIotPacketView::load16(this->rxPacket.getData());
 }
 
 // =============================================== private =================================
 
+/**
+ * @brief common part of constructors
+ * 
+ * @param client - object socket client
+ * @param stream - object stream, NULL - no stream
+ */
+void ToneIotClient::init(Client& client, Stream* stream) {
+
+    this->state = TOIC_STATE::DISCONNECTED;
+    this->taskRunning = false;
+    this->rxRead = 0;
+    this->rxSkip = 0;
+    this->rxByteAt = 0;
+    this->rings = NULL;
+    this->ringsMemory = NULL;
+    this->batchRing = NULL;
+    this->batchMemory = NULL;
+    this->msgId = 0;
+    this->rxMsgId = 0;
+    this->rxWindow = 0;
+    this->groupCount = 0;
+    this->pingOutstanding = false;
+    this->txCredit = false;
+    this->rxFrames = 0;
+    this->rxBytes = 0;
+    this->rxFrameLimit = 0;
+    this->rxByteLimit = 0;
+    memset(this->pendingSend, 0, sizeof(this->pendingSend));
+    initInflight();
+    resetStats();
+    this->toneiotsettings.domain = NULL;
+    this->toneiotsettings.key = NULL;
+    this->toneiotsettings.key_len = 0;
+    this->endpointCount = 0;
+    this->endpointIndex = -1;
+    this->dnsTtl = TOIC_DNS_TTL;
+    setToneIotServer(TONE_TOKEN);
+    setClient(client);
+    this->stream = stream;
+    this->delta = NULL;
+    this->radio = NULL;
+    this->telemetry = NULL;
+    this->telemetryFunction = 0;
+    this->batchDeadline = 0;
+    for (uint8_t i = 0; i < TOIC_PRIORITY_COUNT; i++) this->txDepth[i] = 0;
+    this->listFunction = NULL;
+    this->storageFunctions = 0;
+    this->bufferSize = 0;
+    this->rxBuffer = -1;
+    this->rxPacket = ToneIotPacketView();
+    setBufferSize(this->staticStorage ? this->storage.bufferSize : TOIC_MAX_PACKET_SIZE);
+    setKeepAlive(TOIC_KEEPALIVE);
+    setSocketTimeout(TOIC_SOCKET_TIMEOUT);
+    initFunctionSys();
+}
+
+/**
+ * @brief buffer for decoded element of token: static storage or heap.
+ * Static storage has two slots of domain and key, the one not used by
+ * current settings is given
+ * 
+ * @param element - 0 - id, 1 - domain, 2 - key
+ * @param size - bytes, terminator included
+ * @return char* buffer; NULL - not enough memory
+ */
+char* ToneIotClient::settingBuffer(uint8_t element, uint16_t size) {
+
+    char* slot = NULL;
+
+    if (!this->staticStorage) return (char*)malloc(size);
+    if (element == 1) {
+        if (size > this->storage.domainSize) return NULL;
+        slot = this->storage.domain;
+        return this->toneiotsettings.domain == slot ? slot + this->storage.domainSize : slot;
+    }
+    // id is copied at once, the free key slot is used for it
+    if (size > this->storage.keySize) return NULL;
+    slot = (char*)this->storage.key;
+    return (char*)this->toneiotsettings.key == slot ? slot + this->storage.keySize : slot;
+}
+
+/**
+ * @brief release buffer of settingBuffer(), static storage is kept
+ * 
+ * @param buf - buffer, NULL - nothing
+ */
+void ToneIotClient::freeSetting(char* buf) {
+    if (!this->staticStorage) free(buf);
+}
+
 /**
  * @brief reads a byte into buf
  * 
@@ -450,6 +1174,23 @@ int8_t ToneIotClient::readByte(uint8_t* buf) {
    return 0;
 }
 
+/**
+ * @brief reads len bytes from socket without keeping them
+ * 
+ * @param len - count bytes
+ * @return int8_t = 0 - ok; -1 - error
+ */
+int8_t ToneIotClient::skipBytes(uint16_t len) {
+
+    uint8_t byte = 0;
+
+    while (len > 0) {
+        if (readByte(&byte) == -1) return -1;
+        len--;
+    }
+    return 0;
+}
+
 /**
  * @brief reads a byte into buf[*index] and increments index
  * 
@@ -469,41 +1210,206 @@ int8_t ToneIotClient::readByte(uint8_t* buf, uint16_t* index){
 /**
  * @brief read packet
  * 
- * @param packet - pointer structure packet
- * @return int8_t = 0 - ok; -1 - error; 1 - not equally id 
+ * @param packet - buffer packet
+ * @return int8_t = 0 - ok; -1 - error; 1 - frame of other device or group, over buffer size or repeated group frame, skipped; 2 - duplicate or too old msgId of device, acknowledged by receive()
  */
-int8_t ToneIotClient::readPacket(packet_t** packet) {
+int8_t ToneIotClient::readPacket(ToneIotPacketView packet) {
 
     uint16_t len = 0;
+    uint8_t* buffer = packet.getBuffer();
+
+    TOIP_MEASURE(TOIP_SCOPE::READ_PACKET);
+
+    while (len < ToneIotPacketView::HEADER_SIZE){
+        if(readByte(buffer, &len) == -1) return -1;
+    }
+    // data of other frames is not buffered, the stream stays in sync
+    if (skipHeader(packet)) return skipBytes(packet.getDataLen()) ? -1 : 1;
+    while (len < packet.getSize()) {
+        if(readByte(buffer, &len) == -1) return -1;
+    }
+    return acceptFrame(packet);
+}
+
+/**
+ * @brief read packet of network task without waiting: bytes available in
+ * socket are added to the frame read so far, ioMutex is held for the reads
+ * only. A frame stopped in the middle for socket timeout is an error
+ * 
+ * @param packet - buffer packet, the same until the frame is complete; not valid - no free buffer
+ * @return int8_t = 0 - frame is not complete; 1 - frame received; 2 - duplicate, acknowledge msgId of packet; -1 - error
+ */
+int8_t ToneIotClient::pollPacket(ToneIotPacketView packet) {
+
+    uint8_t* buffer = packet.getBuffer();
+    int available = 0;
+    int n = 0;
+    int8_t ret = 0;
+    ToneIotLock lock(this->ioMutex);
+
+    if (!packet.valid()) return 0;
+    while ((available = this->client->available()) > 0) {
+        // data of skipped frame is read over the free buffer
+        if (this->rxSkip > 0) {
+            n = this->rxSkip < this->bufferSize ? this->rxSkip : this->bufferSize;
+            n = this->client->read(buffer, n < available ? n : available);
+            if (n <= 0) break;
+            this->rxSkip -= n;
+            this->rxByteAt = millis();
+            continue;
+        }
+        n = (this->rxRead < ToneIotPacketView::HEADER_SIZE ? ToneIotPacketView::HEADER_SIZE : packet.getSize()) - this->rxRead;
+        n = this->client->read(buffer + this->rxRead, n < available ? n : available);
+        if (n <= 0) break;
+        this->rxRead += n;
+        this->rxByteAt = millis();
+        if (this->rxRead == ToneIotPacketView::HEADER_SIZE && skipHeader(packet)) {
+            this->rxSkip = packet.getDataLen();
+            this->rxRead = 0;
+            continue;
+        }
+        if (this->rxRead < ToneIotPacketView::HEADER_SIZE || this->rxRead < packet.getSize()) continue;
+        this->rxRead = 0;
+        ret = acceptFrame(packet);
+        if (ret != 1) return ret == 0 ? 1 : ret;
+    }
+    if ((this->rxRead > 0 || this->rxSkip > 0) && millis() - this->rxByteAt >= this->socketTimeout * 1000UL) return -1;
+    return 0;
+}
+
+/**
+ * @brief count header of received frame and check whether its data is kept
+ * 
+ * @param packet - packet with header
+ * @return true - frame of other device or group or over buffer size, data is skipped
+ * @return false - data is read
+ */
+bool ToneIotClient::skipHeader(ToneIotPacketView packet) {
+
+    this->stats.rxFrames++;
+    this->stats.rxBytes += packet.getSize();
 
-    *packet = NULL;
+    // check id device, then groups
+    if (memcmp(this->toneiotsettings.id, packet.getId(), ToneIotPacketView::ID_SIZE)) {
+        // groups carry only user functions, system ones belong to a session
+        if (findGroup(packet.getId()) < 0 || (packet.getFunction() & TOIC_FUNCTION_MASK) <= TOIC_FUNCTION_SYS_DISCONNECT) {
+            this->stats.skipped++;
+            return true;
+        }
+    }
 
-    while (len < 14){
-        if(readByte(this->buffer, &len) == -1) return -1;
+    // protocol data - 0-65535 byte, a packet over the buffer is skipped whole
+    if (packet.getDataLen() > this->bufferSize - ToneIotPacketView::HEADER_SIZE) {
+        this->stats.skipped++;
+        return true;
     }
+    return false;
+}
 
-    // protocol data - 0-65535 byte
-    while (len < this->packet->datalen + 14) {
-        if(readByte(this->buffer, &len) == -1) return -1;
+/**
+ * @brief check msgId and credit of received frame
+ * 
+ * @param packet - whole packet, header accepted by skipHeader()
+ * @return int8_t = 0 - ok; 1 - skipped, also repeated group frame; 2 - duplicate or too old msgId of device
+ */
+int8_t ToneIotClient::acceptFrame(ToneIotPacketView packet) {
+
+    int8_t group = -1;
+
+    // group frames are numbered by group, outside of flow control and QoS:
+    // a repeated one is dropped, an ACK of own id would answer other msgId
+    if (memcmp(this->toneiotsettings.id, packet.getId(), ToneIotPacketView::ID_SIZE)) {
+        group = findGroup(packet.getId());
+        if (group < 0) return 1;
+        if (acceptMsgId(packet.getMsgId(), &this->groups[group].rxMsgId, &this->groups[group].rxWindow)) return 0;
+        this->stats.duplicates++;
+        return 1;
     }
 
-    
-    // check id device
-    if (memcmp(this->toneiotsettings.id, this->packet->id, 8)) return 1;
-
-    // check msgId
-    if (this->msgId <= this->packet->msgId) {
-        if (this->msgId == this->packet->msgId 
-            && this->packet->function == TOIC_FUNCTION_SYS_ACK
-            && this->packet->function == TOIC_FUNCTION_SYS_ERROR
-            ) return 0;
+    // answers echo msgId of our packets, they are matched by completeSend()
+    if (packet.getFunction() == TOIC_FUNCTION_SYS_INIT
+        || packet.getFunction() == TOIC_FUNCTION_SYS_ACK
+        || packet.getFunction() == TOIC_FUNCTION_SYS_ERROR) return 0;
+
+    // check msgId of server sequence
+    if (!acceptMsgId(packet.getMsgId(), &this->rxMsgId, &this->rxWindow)) {
+        this->stats.duplicates++;
         return 2;
     }
-    
 
-    *packet = this->packet;
+    // server sent above credit given to it
+    if ((packet.getFunction() & TOIC_FUNCTION_MASK) > TOIC_FUNCTION_SYS_DISCONNECT) {
+        if ((int16_t)(this->rxFramesSeen - this->rxFrameLimit) >= 0) this->stats.creditOverruns++;
+        this->rxFramesSeen++;
+    }
+
     return 0;
-    
+}
+
+/**
+ * @brief sliding window of received msgIds, accepts packets reordered by less
+ * than TOIC_RX_WINDOW and drops repeated ones
+ * 
+ * @param msgId - msgId of received packet
+ * @param last - highest msgId of sequence, device or group
+ * @param window - received bits of sequence
+ * @return true - new packet
+ * @return false - duplicate or older than window
+ */
+bool ToneIotClient::acceptMsgId(uint16_t msgId, uint16_t* last, uint64_t* window) {
+
+    int16_t diff = (int16_t)(msgId - *last);
+
+    // first packet of session
+    if (*window == 0) diff = 1;
+
+    if (diff > 0) {
+        // window moves forward, bit 0 is the highest msgId
+        *window = diff >= TOIC_RX_WINDOW ? 0 : *window << diff;
+        *window |= 1;
+        *last = msgId;
+        return true;
+    }
+    if (-diff >= TOIC_RX_WINDOW) return false;
+    if (*window & ((uint64_t)1 << -diff)) return false;
+    *window |= (uint64_t)1 << -diff;
+    return true;
+}
+
+/**
+ * @brief binary search of group, at most log2(TOIC_MAX_GROUPS) + 1 compares
+ * 
+ * @param id - group id 8 bytes
+ * @return int8_t index in groups; -1 - not subscribed
+ */
+int8_t ToneIotClient::findGroup(const uint8_t* id) {
+
+    int8_t low = 0;
+    int8_t high = (int8_t)this->groupCount - 1;
+    int8_t middle = 0;
+    int cmp = 0;
+
+    while (low <= high) {
+        middle = (low + high) / 2;
+        cmp = memcmp(this->groups[middle].id, id, ToneIotPacketView::ID_SIZE);
+        if (cmp == 0) return middle;
+        if (cmp < 0) low = middle + 1;
+        else high = middle - 1;
+    }
+    return -1;
+}
+
+/**
+ * @brief check that received packet is counted by flow control: user
+ * function of own id, frames of groups are not counted
+ * 
+ * @param packet - received packet
+ * @return true - counted
+ * @return false - not counted
+ */
+bool ToneIotClient::isCredited(ToneIotPacketView packet) {
+    return (packet.getFunction() & TOIC_FUNCTION_MASK) > TOIC_FUNCTION_SYS_DISCONNECT
+           && memcmp(this->toneiotsettings.id, packet.getId(), ToneIotPacketView::ID_SIZE) == 0;
 }
 
 /**
@@ -514,189 +1420,1226 @@ int8_t ToneIotClient::readPacket(packet_t** packet) {
  */
 int8_t ToneIotClient::write(uint8_t *buf, size_t size) {
     
-    if (!this->client->connected()) return -1;
-    lastOutActivity = millis();
-    if (this->client->write(buf, size) != size) return -1;
+    size_t n = 0;
+    bool online = false;
+    unsigned long start = millis();
+
+    // UART of sleeping modem drops data
+    if (this->radio != NULL) this->radio->wake();
+    lastOutActivity = start;
+    // full TX buffer of modem or socket takes a part, the rest is written when it drains;
+    // the socket is locked per call, not while it drains
+    while (size > 0) {
+        this->ioMutex.lock();
+        online = this->client->connected();
+        n = online ? this->client->write(buf, size) : 0;
+        this->ioMutex.unlock();
+        if (!online || n > size) return -1;
+        buf += n;
+        size -= n;
+        if (size == 0) break;
+        if (millis() - start >= this->socketTimeout * 1000UL) return -1;
+        yield();
+    }
     return 0;
 }
 
+/**
+ * @brief build and send packet, with QoS above at-most-once a copy is kept
+ * for retransmission until ACK/ERROR
+ * 
+ * @param function - function number
+ * @param msgId - packet counter
+ * @param buf - array buffer
+ * @param len - length buffer
+ * @return int8_t = 0 - ok; -1 - error
+ */
+int8_t ToneIotClient::sendPacket(uint16_t function, uint16_t msgId, uint8_t* buf, uint16_t len) {
+
+    int8_t index = -1;
+    ToneIotPacketView packet;
+    inflight_t* entry = NULL;
+    txFunction_t* item = findTxFunction(function, false);
+    TOIC_QOS qos = item != NULL ? item->qos : TOIC_QOS::AT_MOST_ONCE;
+    uint32_t delay = item != NULL && this->radio != NULL && this->batchRing != NULL ? item->delay : 0;
+    unsigned long t = millis();
+
+    if (len > this->bufferSize - ToneIotPacketView::HEADER_SIZE) return -1;
+    // server has no room, the caller retries later instead of overrunning it
+    if (function > TOIC_FUNCTION_SYS_DISCONNECT && !hasCredit(len)) {
+        this->stats.creditStalls++;
+        return -1;
+    }
+    if (qos != TOIC_QOS::AT_MOST_ONCE) {
+        // no room to keep the packet, the caller retries later
+        entry = acquireInflight();
+        if (entry == NULL) return -1;
+        if (qos == TOIC_QOS::EXACTLY_ONCE) function |= TOIC_FUNCTION_FLAG_ONCE;
+    }
+    // urgent packet opens wake window, held packets go with it
+    if (delay == 0 && !isBatchEmpty() && this->state == TOIC_STATE::CONNECTED) flushBatch();
+    packet = acquirePacket(&index, function, msgId, delay != 0);
+    if (!packet.valid()) {
+        releaseInflight(entry);
+        return -1;
+    }
+    if (buf != NULL) {
+        memcpy(packet.getData(), buf, len); 
+        packet.setDataLen(len);
+    }
+    // credit is taken once, retransmissions replace lost frames
+    if ((function & TOIC_FUNCTION_MASK) > TOIC_FUNCTION_SYS_DISCONNECT) {
+        this->txFrames++;
+        this->txBytes += packet.getSize();
+    }
+    if (entry != NULL) {
+        memcpy(this->pool.get(entry->buffer), packet.getBuffer(), packet.getSize());
+        entry->msgId = msgId;
+        entry->retries = 0;
+        entry->timestamp = t;
+        entry->hold = index == TOIC_BUFFER_BATCH ? delay : 0;
+    }
+    if (index == TOIC_BUFFER_BATCH) {
+        if (this->batchRing->empty() || (long)(t + delay - this->batchDeadline) < 0) this->batchDeadline = t + delay;
+    }
+    // a failed write is repeated by retransmission
+    return transmit(index, packet);
+}
+
 /**
  * @brief send server pocket
  * 
  * @param packet - pointer structure pocket
  * @return int8_t = 0 - ok; -1 - error
  */
-int8_t ToneIotClient::writePacket(packet_t* packet) {
+int8_t ToneIotClient::writePacket(ToneIotPacketView packet) {
+
+    uint8_t* buf = packet.getBuffer();
+    uint16_t len = packet.getSize();
 
-    uint8_t* buf = (uint8_t*) packet;
-    uint16_t len = this->packet->datalen + 14;
+    TOIP_MEASURE(TOIP_SCOPE::WRITE_PACKET);
+    this->ioMutex.lock();
+    this->stats.txFrames++;
+    this->stats.txBytes += len;
+    this->ioMutex.unlock();
     return write(buf, len);
 }
 
 /**
- * @brief call the function callback
+ * @brief take TX buffer from pool and fill header
  * 
- * @param function function
- * @param buf - array buffer
- * @param len - length buffer
+ * @param index - index buffer, release it after write
+ * @param function - function number packet
+ * @param msgId - packet counter
+ * @return ToneIotPacketView packet; not valid - no free buffer or ring is full
  */
-void ToneIotClient::callFunction(uint16_t function, uint8_t* buf, uint16_t len){
-    itemFunction_t* itemFunction = this->listFunction;
-    while(itemFunction != NULL) {
-        if (itemFunction->function == function){
-            if (itemFunction->enable) {
-                if (itemFunction->cbFunctionType == cbFunctionType_t::sys && itemFunction->cbFunctionSys != NULL){
-                    ((this)->*(itemFunction->cbFunctionSys))(buf, len);
-                } else if (itemFunction->cbFunctionType == cbFunctionType_t::user && itemFunction->cbFunctionUser != NULL){
-                    itemFunction->cbFunctionUser(buf, len);
-                }
-            } 
-            break;
-        }
-        itemFunction = (itemFunction_t*)itemFunction->nextfunction;
-    }
+ToneIotPacketView ToneIotClient::acquirePacket(int8_t* index, uint16_t function, uint16_t msgId) {
+    return acquirePacket(index, function, msgId, false);
 }
 
-int8_t ToneIotClient::setFunction(uint16_t function, cbFunction_t cbFunctionUser, cbFunctionSys_t cbFunctionSys) {
-
-    itemFunction_t* newfcb = NULL;
-    itemFunction_t* itemfcb = this->listFunction;
+/**
+ * @brief take TX buffer and fill header
+ * 
+ * @param index - index buffer, release it after write
+ * @param function - function number packet
+ * @param msgId - packet counter
+ * @param deferred - packet is held in batch until wake window, TX buffer when batch is full
+ * @return ToneIotPacketView packet; not valid - no free buffer or ring is full
+ */
+ToneIotPacketView ToneIotClient::acquirePacket(int8_t* index, uint16_t function, uint16_t msgId, bool deferred) {
 
-    if (cbFunctionUser == NULL && cbFunctionSys == NULL) return -1;
+    ToneIotPacketView packet;
 
-    // create item function
-    newfcb = new itemFunction_t;
-    // not enough memory
-    if (newfcb == NULL) return -1;
-    newfcb->function = function;
-    newfcb->enable = false;
-    if (cbFunctionUser != NULL){
-        newfcb->cbFunctionType = cbFunctionType_t::user;
-        newfcb->cbFunctionUser = cbFunctionUser;
-    } else if (cbFunctionSys != NULL){
-        newfcb->cbFunctionType = cbFunctionType_t::sys;
-        newfcb->cbFunctionSys = cbFunctionSys;
+    if (deferred) {
+        *index = TOIC_BUFFER_BATCH;
+        packet = ToneIotPacketView(this->batchRing->prepare(this->bufferSize));
     }
-    newfcb->nextfunction = NULL;
-
-    if (itemfcb == NULL) { // first item
-        this->listFunction = newfcb;
-    } else { // next item
-        while(itemfcb->nextfunction != NULL) itemfcb = (itemFunction_t*)itemfcb->nextfunction;
-        itemfcb->nextfunction = newfcb;
+    if (packet.valid()) {
+        // packet is held
+    } else if (this->taskRunning && this->state == TOIC_STATE::CONNECTED) {
+        // in threaded mode the packet is built in place in the TX ring of its class
+        *index = TOIC_BUFFER_RING;
+        packet = ToneIotPacketView(this->rings->tx[(uint8_t)getFunctionPriority(function)].prepare(this->bufferSize + TOIC_TX_STAMP));
+    } else {
+        *index = this->pool.acquire(TOIC_BUFFER_OWNER::TX);
+        packet = ToneIotPacketView(this->pool.get(*index));
     }
-
-    return 0;
+    if (!packet.valid()) return packet;
+    packet.setId(this->toneiotsettings.id);
+    packet.setMsgId(msgId);
+    packet.setFunction(function);
+    packet.setDataLen(0);
+    return packet;
 }
 
+/**
+ * @brief send packet and return TX buffer to pool, in threaded mode the packet is
+ * published to network task
+ * 
+ * @param index - index TX buffer or TOIC_BUFFER_RING
+ * @param packet - packet
+ * @return int8_t = 0 - ok; -1 - error
+ */
+int8_t ToneIotClient::transmit(int8_t index, ToneIotPacketView packet) {
 
+    int8_t ret = 0;
+    uint8_t priority = 0;
+    uint16_t depth = 0;
+
+    if (index == TOIC_BUFFER_RING) {
+        priority = (uint8_t)getFunctionPriority(packet.getFunction());
+        ToneIotPacketView::store32(packet.getBuffer() + packet.getSize(), micros());
+        this->rings->tx[priority].commit(packet.getSize() + TOIC_TX_STAMP);
+        depth = ++this->txDepth[priority];
+        if (depth > this->stats.tx[priority].depthMax) this->stats.tx[priority].depthMax = depth;
+        this->taskEvent.signal();
+        return 0;
+    }
+    if (index == TOIC_BUFFER_BATCH) {
+        this->batchRing->commit(packet.getSize());
+        return 0;
+    }
+    // network task is running but not connected: the socket is written here
+    ret = writePacket(packet);
+    this->pool.release(index);
+    return ret;
+}
 
-//============================================ private standart function ==================================================
+/**
+ * @brief read packet when data is available
+ * 
+ * @param packet - buffer packet, not valid - no free buffer
+ * @return int8_t = 0 - no packet; 1 - packet received; -1 - error
+ */
+int8_t ToneIotClient::receive(ToneIotPacketView packet) {
 
-void ToneIotClient::initFunctionSys(void){
+    int8_t ret = 0;
 
-    setFunction(TOIC_FUNCTION_SYS_DISCONNECT, NULL, &ToneIotClient::cbFunctionDisconnect);
+    if (!packet.valid() || !this->client->available()) return 0;
+    ret = readPacket(packet);
+    if (ret == -1) return -1;
+    if (ret != 0) {
+        // server repeats the packet because our answer is lost
+        if (ret == 2) writeAck(packet.getMsgId());
+        return 0;
+    }
+    lastInActivity = millis();
+    this->pingOutstanding = false;
+    return 1;
 }
 
-void ToneIotClient::cbFunctionDisconnect(uint8_t* buf, uint16_t len){
+/**
+ * @brief finish handshake of connectAsync(): answer INIT or timeout
+ * 
+ * @return int8_t = 0 - ok, connected or waiting; -1 - error
+ */
+int8_t ToneIotClient::checkConnecting() {
 
-    sendFunctionAck();
+    int8_t ret = 0;
+    ToneIotLock lock(this->ioMutex);
 
-    this->state = TOIC_STATE::DISCONNECTED;
+    if (!this->client->connected()) {
+        this->state = TOIC_STATE::CONNECTION_LOST;
+        return -1;
+    }
+    while (this->client->available()) {
+        // packets of other device and duplicates are skipped
+        ret = readPacket(this->rxPacket);
+        if (ret > 0) continue;
+        if (ret == -1 || this->rxPacket.getFunction() != TOIC_FUNCTION_SYS_INIT) {
+            this->state = TOIC_STATE::CONNECT_BAD_PROTOCOL;
+            goto ERROR;
+        }
+        applyInit(this->rxPacket.getData(), this->rxPacket.getDataLen());
+        lastInActivity = lastOutActivity = millis();
+        this->pingOutstanding = false;
+        this->state = TOIC_STATE::CONNECTED;
+        return 0;
+    }
+    if (millis() - lastOutActivity < this->socketTimeout * 1000UL) return 0;
+    this->state = TOIC_STATE::CONNECTION_TIMEOUT;
+ERROR:
+    // server accepts TCP but does not answer, next connect tries the fallback
+    if (this->endpointIndex >= 0) failEndpoint(&this->endpoints[this->endpointIndex]);
     this->client->flush();
     this->client->stop();
-    lastInActivity = lastOutActivity = millis();
+    return -1;
 }
 
-int8_t ToneIotClient::sendFunctionInit(){
-    
-    itemFunction_t* itemFunction = this->listFunction;
+/**
+ * @brief send keep alive when link is idle, close connection without answer
+ * 
+ */
+void ToneIotClient::checkKeepAlive() {
 
-    memcpy(this->packet->id, this->toneiotsettings.id, 8);
-    this->packet->msgId = 0;   
-    this->packet->function = TOIC_FUNCTION_SYS_INIT;
-
-    struct
-    {
-        uint8_t  header;         // header 1 byte
-        uint32_t salt;           // salt 1 byte
-        uint8_t  id[8];          // id 8 bytes
-        uint8_t  deviceType;     // device type 1 byte
-        uint8_t  versionMajor;   // major version 1 byte
-        uint8_t  versionMinor;   // minor version 1 byte
-        uint8_t  date[12];       // compilation date 11 byte
-        uint16_t keepAlive;     // keepAlive 2 byte
-    } headerdata = {
-        .header = 0,
-        .deviceType = TONE_DEVICE_TYPE,
-        .versionMajor = TONE_VERSION_MAJOR,
-        .versionMinor = TONE_VERSION_MINOR,
-        .keepAlive = this->keepAlive
-    };
-    
+    unsigned long t = millis();
+
+    if (this->keepAlive == 0) return;
+    if (this->pingOutstanding) {
+        if (t - lastInActivity >= (this->keepAlive + this->socketTimeout) * 1000UL) closeSocket(TOIC_STATE::CONNECTION_TIMEOUT);
+    } else if (t - lastOutActivity >= this->keepAlive * 1000UL) {
+        if (sendFunctionKeepAlive() == 0) this->pingOutstanding = true;
+    }
+}
+
+/**
+ * @brief socket is connected, a lost socket is closed and the state is set
+ * 
+ * @return true - connected
+ * @return false - disconnected
+ */
+bool ToneIotClient::checkSocket() {
+
+    ToneIotLock lock(this->ioMutex);
+
+    if (this->client == NULL) return false;
+    if (this->client->connected()) return this->state == TOIC_STATE::CONNECTED;
+    if (this->state == TOIC_STATE::CONNECTED) closeSocket(TOIC_STATE::CONNECTION_LOST);
+    return false;
+}
+
+/**
+ * @brief close socket
+ * 
+ * @param state - new state
+ */
+void ToneIotClient::closeSocket(TOIC_STATE state) {
+
+    ToneIotLock lock(this->ioMutex);
+
+    this->state = state;
+    this->client->flush();
+    this->client->stop();
+}
+
+//============================================ private network task ==================================================
+
+void ToneIotClient::taskEntry(void* client){
+    ((ToneIotClient*)client)->taskLoop();
+}
+
+/**
+ * @brief network task: writes queued frames and reads frames into the RX
+ * ring, ioMutex is held for single client calls, the application only
+ * waits for one of them. Socket has no readiness event, an idle task polls
+ * it every TOIC_TASK_POLL ms, a queued frame or a read RX ring wakes it at once
+ * 
+ */
+void ToneIotClient::taskLoop(){
+
+    int8_t ret = 0;
+    uint8_t priority = 0;
+    bool busy = false;
+    ToneIotPacketView packet;
+
+    while (this->taskRunning) {
+        busy = false;
+        // queued frames wake the modem, incoming data wakes it by RI in checkRadio()
+        if (this->state == TOIC_STATE::CONNECTED && !isTxEmpty() && this->radio != NULL) this->radio->wake();
+        // socket is served by application while handshake, socket of sleeping modem is not polled
+        if (this->state == TOIC_STATE::CONNECTED && !isRadioAsleep() && checkSocket()) {
+            // queued packets, classes are checked again after every frame
+            while ((packet = peekTx(&priority)).valid()) {
+                writePacket(packet);
+                popTx(priority, packet);
+                busy = true;
+            }
+            // packet is read in place into the RX ring, when it is full the packet stays in socket
+            packet = ToneIotPacketView(this->rings->rx.prepare(this->bufferSize));
+            ret = pollPacket(packet);
+            if (ret == 1) {
+                this->rings->rx.commit(packet.getSize());
+                this->rxEvent.signal();
+                lastInActivity = millis();
+                this->pingOutstanding = false;
+                busy = true;
+            } else if (ret == 2) {
+                // server repeats the packet because our answer is lost
+                writeAck(packet.getMsgId());
+                busy = true;
+            } else if (ret == -1) {
+                closeSocket(TOIC_STATE::CONNECTION_TIMEOUT);
+                this->rxEvent.signal();
+            }
+            checkKeepAlive();
+        }
+        if (!busy) this->taskEvent.wait(TOIC_TASK_POLL);
+    }
+}
+
+/**
+ * @brief next frame to write: oldest frame of the highest non-empty class
+ * 
+ * @param priority - class of frame
+ * @return ToneIotPacketView packet; not valid - rings are empty
+ */
+ToneIotPacketView ToneIotClient::peekTx(uint8_t* priority){
+
+    uint16_t len = 0;
+    uint8_t* frame = NULL;
+
+    for (uint8_t i = 0; i < TOIC_PRIORITY_COUNT; i++) {
+        frame = this->rings->tx[i].peek(&len);
+        if (frame == NULL) continue;
+        *priority = i;
+        return ToneIotPacketView(frame);
+    }
+    return ToneIotPacketView();
+}
+
+/**
+ * @brief release written frame, account its wait in ring
+ * 
+ * @param priority - class of frame
+ * @param packet - frame of peekTx()
+ */
+void ToneIotClient::popTx(uint8_t priority, ToneIotPacketView packet){
+
+    uint32_t wait = micros() - ToneIotPacketView::load32(packet.getBuffer() + packet.getSize());
+
+    this->stats.tx[priority].frames++;
+    this->stats.tx[priority].waitTotal += wait;
+    if (wait > this->stats.tx[priority].waitMax) this->stats.tx[priority].waitMax = wait;
+    this->txDepth[priority]--;
+    this->rings->tx[priority].pop();
+}
+
+bool ToneIotClient::isTxEmpty(){
+
+    if (this->rings == NULL) return true;
+    for (uint8_t i = 0; i < TOIC_PRIORITY_COUNT; i++) {
+        if (!this->rings->tx[i].empty()) return false;
+    }
+    return true;
+}
+
+/**
+ * @brief handle received packet: resolve asynchronous send and call the function callback
+ * 
+ * @param packet - received packet
+ */
+void ToneIotClient::dispatch(ToneIotPacketView packet){
+
+    takeCredit(packet);
+    // the frame leaves our buffers, its credit is given back by next update
+    if (isCredited(packet)) {
+        this->rxFrames++;
+        this->rxBytes += packet.getSize();
+    }
+
+    if (packet.getFunction() == TOIC_FUNCTION_SYS_ACK) {
+        completeInflight(packet.getMsgId());
+        completeSend(packet.getMsgId(), TOIC_SEND::ACK, 0);
+    } else if (packet.getFunction() == TOIC_FUNCTION_SYS_ERROR) {
+        completeInflight(packet.getMsgId());
+        completeSend(packet.getMsgId(), TOIC_SEND::ERROR, packet.getDataLen() >= 2 ? ToneIotPacketView::load16(packet.getData()) : 0);
+    } else if (packet.getFunction() == TOIC_FUNCTION_SYS_INIT) {
+        // server changes enabled functions or credit of the session
+        applyInit(packet.getData(), packet.getDataLen());
+        return;
+    }
+    // functions of server awaited by coroutine flows
+    if ((packet.getFunction() & TOIC_FUNCTION_MASK) > TOIC_FUNCTION_SYS_DISCONNECT && this->cbReceive
+        && this->cbReceive(packet.getFunction() & TOIC_FUNCTION_MASK, packet.getData(), packet.getDataLen())) return;
+    callFunction(packet.getFunction() & TOIC_FUNCTION_MASK, packet.getData(), packet.getDataLen());
+}
+
+/**
+ * @brief resolve asynchronous send waiting answer with msgId
+ * 
+ * @param msgId - msgId of answer
+ * @param result - result
+ * @param error - error code server
+ */
+void ToneIotClient::completeSend(uint16_t msgId, TOIC_SEND result, uint16_t error){
+
+    pendingSend_t* slot = NULL;
+
+    for (uint8_t i = 0; i < TOIC_MAX_PENDING; i++) {
+        slot = &this->pendingSend[i];
+        if (!slot->used || slot->state != TOIC_SEND::PENDING || slot->msgId != msgId) continue;
+        slot->state = result;
+        if (slot->cbComplete != NULL) {
+            slot->used = false;
+            slot->cbComplete(((sendHandle_t)slot->generation << 8) | i, result, error);
+        }
+        return;
+    }
+}
+
+/**
+ * @brief resolve asynchronous sends without answer within socket timeout
+ * 
+ */
+void ToneIotClient::checkPendingSend(){
+
+    unsigned long t = millis();
+
+    for (uint8_t i = 0; i < TOIC_MAX_PENDING; i++) {
+        if (!this->pendingSend[i].used || this->pendingSend[i].state != TOIC_SEND::PENDING) continue;
+        // retransmitted packet is timed out by checkInflight()
+        if (isInflight(this->pendingSend[i].msgId)) continue;
+        if (t - this->pendingSend[i].timestamp >= this->socketTimeout * 1000UL + this->pendingSend[i].hold) {
+            completeSend(this->pendingSend[i].msgId, TOIC_SEND::TIMEOUT, 0);
+        }
+    }
+}
+
+//============================================ private retransmission ==================================================
+
+void ToneIotClient::initInflight(){
+
+    this->txFunctionCount = 0;
+    for (uint8_t i = 0; i < TOIC_MAX_INFLIGHT; i++) this->inflight[i].buffer = -1;
+    this->srtt = 0;
+    this->rttvar = 0;
+    this->rto = TOIC_RTO_INITIAL;
+}
+
+/**
+ * @brief take free in-flight entry with pool buffer for copy of packet
+ * 
+ * @return inflight_t* entry; NULL - table is full or no free buffer
+ */
+ToneIotClient::inflight_t* ToneIotClient::acquireInflight(){
+
+    for (uint8_t i = 0; i < TOIC_MAX_INFLIGHT; i++) {
+        if (this->inflight[i].buffer != -1) continue;
+        this->inflight[i].buffer = this->pool.acquire(TOIC_BUFFER_OWNER::TX);
+        if (this->inflight[i].buffer == -1) return NULL;
+        return &this->inflight[i];
+    }
+    return NULL;
+}
+
+void ToneIotClient::releaseInflight(inflight_t* entry){
+
+    if (entry == NULL || entry->buffer == -1) return;
+    this->pool.release(entry->buffer);
+    entry->buffer = -1;
+}
+
+bool ToneIotClient::isInflight(uint16_t msgId){
+
+    for (uint8_t i = 0; i < TOIC_MAX_INFLIGHT; i++) {
+        if (this->inflight[i].buffer != -1 && this->inflight[i].msgId == msgId) return true;
+    }
+    return false;
+}
+
+/**
+ * @brief packet with msgId is answered, stop retransmission
+ * 
+ * @param msgId - msgId of answer
+ */
+void ToneIotClient::completeInflight(uint16_t msgId){
+
+    inflight_t* entry = NULL;
+
+    for (uint8_t i = 0; i < TOIC_MAX_INFLIGHT; i++) {
+        entry = &this->inflight[i];
+        if (entry->buffer == -1 || entry->msgId != msgId) continue;
+        // answer of retransmitted packet is ambiguous, it is not sampled (Karn)
+        if (entry->retries == 0) updateRtt(millis() - entry->timestamp);
+        releaseInflight(entry);
+        return;
+    }
+}
+
+/**
+ * @brief retransmit packets without answer within RTO, the timeout doubles on
+ * each retry, after TOIC_MAX_RETRIES the asynchronous send is resolved as timeout
+ * 
+ */
+void ToneIotClient::checkInflight(){
+
+    unsigned long t = millis();
+    inflight_t* entry = NULL;
+    ToneIotPacketView copy;
+    ToneIotPacketView packet;
+    int8_t index = -1;
+    uint32_t timeout = 0;
+    uint16_t msgId = 0;
+
+    for (uint8_t i = 0; i < TOIC_MAX_INFLIGHT; i++) {
+        entry = &this->inflight[i];
+        if (entry->buffer == -1) continue;
+        timeout = this->rto << entry->retries;
+        if (timeout > TOIC_RTO_MAX) timeout = TOIC_RTO_MAX;
+        timeout += entry->hold;
+        if (t - entry->timestamp < timeout) continue;
+
+        if (entry->retries >= TOIC_MAX_RETRIES) {
+            msgId = entry->msgId;
+            releaseInflight(entry);
+            completeSend(msgId, TOIC_SEND::TIMEOUT, 0);
+            continue;
+        }
+
+        copy = ToneIotPacketView(this->pool.get(entry->buffer));
+        copy.setFunction(copy.getFunction() | TOIC_FUNCTION_FLAG_DUP);
+        // no free buffer or ring is full, repeated on next loop()
+        packet = acquirePacket(&index, copy.getFunction(), copy.getMsgId());
+        if (!packet.valid()) continue;
+        memcpy(packet.getBuffer(), copy.getBuffer(), copy.getSize());
+        transmit(index, packet);
+        this->stats.retransmits++;
+        entry->retries++;
+        entry->timestamp = t;
+    }
+}
+
+/**
+ * @brief estimate retransmission timeout from round trip time (RFC 6298)
+ * 
+ * @param rtt - round trip time ms
+ */
+void ToneIotClient::updateRtt(uint32_t rtt){
+
+    uint32_t diff = 0;
+
+    if (this->srtt == 0) {
+        this->srtt = rtt ? rtt : 1;
+        this->rttvar = rtt / 2;
+    } else {
+        diff = this->srtt > rtt ? this->srtt - rtt : rtt - this->srtt;
+        this->rttvar = (3 * this->rttvar + diff) / 4;
+        this->srtt = (7 * this->srtt + rtt) / 8;
+        if (this->srtt == 0) this->srtt = 1;
+    }
+    this->rto = this->srtt + 4 * this->rttvar;
+    if (this->rto < TOIC_RTO_MIN) this->rto = TOIC_RTO_MIN;
+    if (this->rto > TOIC_RTO_MAX) this->rto = TOIC_RTO_MAX;
+}
+
+/**
+ * @brief retransmission and answer timeouts of packet start when it is really sent
+ * 
+ * @param msgId - msgId of sent packet
+ */
+void ToneIotClient::startTimers(uint16_t msgId){
+
+    unsigned long t = millis();
+
+    for (uint8_t i = 0; i < TOIC_MAX_INFLIGHT; i++) {
+        if (this->inflight[i].buffer != -1 && this->inflight[i].msgId == msgId) {
+            this->inflight[i].timestamp = t;
+            this->inflight[i].hold = 0;
+        }
+    }
+    for (uint8_t i = 0; i < TOIC_MAX_PENDING; i++) {
+        if (this->pendingSend[i].used && this->pendingSend[i].msgId == msgId) {
+            this->pendingSend[i].timestamp = t;
+            this->pendingSend[i].hold = 0;
+        }
+    }
+}
+
+/**
+ * @brief find options of outgoing function
+ * 
+ * @param function - function number
+ * @param create - add function when it is not found
+ * @return txFunction_t* options; NULL - not found or table is full
+ */
+ToneIotClient::txFunction_t* ToneIotClient::findTxFunction(uint16_t function, bool create){
+
+    txFunction_t* item = NULL;
+
+    for (uint8_t i = 0; i < this->txFunctionCount; i++) {
+        if (this->txFunction[i].function == function) return &this->txFunction[i];
+    }
+    if (!create || this->txFunctionCount >= TOIC_MAX_TX_FUNCTIONS) return NULL;
+    item = &this->txFunction[this->txFunctionCount++];
+    item->function = function;
+    item->qos = TOIC_QOS::AT_MOST_ONCE;
+    item->delay = 0;
+    item->priority = TOIC_PRIORITY::CONTROL;
+    return item;
+}
+
+//============================================ private radio ==================================================
+
+/**
+ * @brief send held packets
+ * 
+ */
+void ToneIotClient::flushBatch(){
+
+    uint16_t len = 0;
+    int8_t index = -1;
+    ToneIotPacketView frame;
+    ToneIotPacketView packet;
+
+    if (this->batchRing == NULL) return;
+    while ((frame = ToneIotPacketView(this->batchRing->peek(&len))).valid()) {
+        packet = acquirePacket(&index, frame.getFunction(), frame.getMsgId());
+        // no free buffer or ring is full, repeated on next loop()
+        if (!packet.valid()) return;
+        memcpy(packet.getBuffer(), frame.getBuffer(), len);
+        transmit(index, packet);
+        startTimers(frame.getMsgId());
+        this->batchRing->pop();
+    }
+}
+
+bool ToneIotClient::isBatchEmpty(){
+    return this->batchRing == NULL || this->batchRing->empty();
+}
+
+/**
+ * @brief modem sleeps: it ignores UART, an AT poll of TinyGsmClient
+ * available() or connected() would wait its timeout and close the socket
+ * 
+ * @return true - radio is set and sleeps
+ */
+bool ToneIotClient::isRadioAsleep(){
+    return this->radio != NULL && !this->radio->isAwake();
+}
+
+/**
+ * @brief wake window: wake on RI, send batch at its deadline, let the modem
+ * sleep when nothing is sent or awaited
+ * 
+ */
+void ToneIotClient::checkRadio(){
 
-    //this->packet->pdata[0] = 0;   // header 1 byte
-    memcpy(&this->packet->pdata[1], this->toneiotsettings.id, 8);   // id 8 bytes
-    //this->packet->pdata[9] = TONE_DEVICE_TYPE;   // device type 1 byte
-    //this->packet->pdata[10] = TONE_VERSION_MAJOR;   // major version 1 byte
-    //this->packet->pdata[11] = TONE_VERSION_MINOR;   // minor version 1 byte
-    memcpy(&this->packet->pdata[12], __DATE__, 11);    // DATE 11 byte
-    //this->packet->pdata[23] = '\0';
-    //memcpy(&this->packet->pdata[24], &this->keepAlive, 2);           // keepAlive 2 byte
+    unsigned long t = millis();
 
-    this->packet->datalen = sizeof(headerdata); // header + id + TONE_DEVICE_TYPE + TONE_VERSION_MAJOR + TONE_VERSION_MINOR + DATE + keepAlive
-    memcpy(this->packet->pdata, &headerdata, this->packet->datalen);
+    if (this->radio == NULL) return;
+    // incoming data, the answer needs UART
+    if (this->radio->takeRing()) this->radio->wake();
+    if (this->state != TOIC_STATE::CONNECTED) return;
+    if (!isBatchEmpty() && (long)(t - this->batchDeadline) >= 0) flushBatch();
 
-    // 26 bytes is the beginning of the supported functions
+    if (!this->radio->isAwake() || !isBatchEmpty() || !isTxEmpty()) return;
+    for (uint8_t i = 0; i < TOIC_MAX_INFLIGHT; i++) {
+        if (this->inflight[i].buffer != -1) return;
+    }
+    if (t - this->lastOutActivity < TOIC_WAKE_WINDOW || t - this->lastInActivity < TOIC_WAKE_WINDOW) return;
+    this->radio->sleep();
+}
+
+/**
+ * @brief send telemetry batch, on error it is kept and sent on next loop()
+ * 
+ */
+void ToneIotClient::checkTelemetry(){
+
+    uint8_t buf[TOIT_FRAME_SIZE];
+    uint16_t len = this->bufferSize - ToneIotPacketView::HEADER_SIZE;
+
+    if (this->telemetry == NULL || this->state != TOIC_STATE::CONNECTED) return;
+    // batch fits packet data of buffer, also after setBufferSize() made it smaller
+    if (len > sizeof(buf)) len = sizeof(buf);
+    this->telemetry->setFrameSize(len);
+    if (!this->telemetry->isReady()) return;
+    len = this->telemetry->encode(buf, len);
+    if (len == 0) return;
+    if (sendFunctioAsync(this->telemetryFunction, buf, len) == TOIC_SEND_HANDLE_INVALID) return;
+    this->telemetry->clear();
+}
+
+/**
+ * @brief call the function callback
+ * 
+ * @param function function
+ * @param buf - array buffer
+ * @param len - length buffer
+ */
+void ToneIotClient::callFunction(uint16_t function, uint8_t* buf, uint16_t len){
+    itemFunction_t* itemFunction = this->listFunction;
+    TOIP_MEASURE(TOIP_SCOPE::CALL_FUNCTION);
     while(itemFunction != NULL) {
-        if (this->packet->datalen > TOIC_MAX_PACKET_SIZE - 20) break;
-        memcpy(&this->packet->pdata[this->packet->datalen], &itemFunction->function, 2);           // add number function 2 byte
+        if (itemFunction->function == function){
+            if (itemFunction->enable) itemFunction->cbFunction(buf, len);
+            break;
+        }
         itemFunction = (itemFunction_t*)itemFunction->nextfunction;
-        this->packet->datalen += 2;
     }
+}
+
+int8_t ToneIotClient::setFunction(uint16_t function, cbFunction_t cbFunction, bool enable) {
+
+    itemFunction_t* newfcb = NULL;
+    itemFunction_t* itemfcb = this->listFunction;
+
+    if (!cbFunction) return -1;
+
+    // create item function
+    if (this->staticStorage) {
+        if (this->storageFunctions >= this->storage.functionCount) return -1;
+        newfcb = &this->storage.functions[this->storageFunctions++];
+    } else {
+        newfcb = new itemFunction_t;
+    }
+    // not enough memory
+    if (newfcb == NULL) return -1;
+    newfcb->function = function;
+    newfcb->enable = enable;
+    newfcb->cbFunction = cbFunction;
+    newfcb->nextfunction = NULL;
+
+    // list is sorted by number, INIT advertises it ascending and its answer is merged in one pass
+    if (itemfcb == NULL || itemfcb->function > function) { // first item
+        newfcb->nextfunction = itemfcb;
+        this->listFunction = newfcb;
+    } else { // next item, after items of the same number
+        while(itemfcb->nextfunction != NULL && ((itemFunction_t*)itemfcb->nextfunction)->function <= function) itemfcb = (itemFunction_t*)itemfcb->nextfunction;
+        newfcb->nextfunction = itemfcb->nextfunction;
+        itemfcb->nextfunction = newfcb;
+    }
+
+    return 0;
+}
+
+
 
-    //TODO Encrypt the data packet
-    //TODO this->packet->length will change after encryption
+//============================================ private flow control ==================================================
 
-    if (writePacket(this->packet)) return -1;
+/**
+ * @brief append credit given to server after data of ACK, ERROR or KEEPALIVE,
+ * only for server with flow control
+ * 
+ * @param packet - packet with own data
+ */
+void ToneIotClient::putCredit(ToneIotPacketView packet){
+
+    uint8_t* data = NULL;
+
+    if (!this->txCredit) return;
+    if (packet.getSize() + ToneIotPacketView::CREDIT_SIZE > this->bufferSize) return;
+    this->rxFrameLimit = this->rxFrames + TOIC_CREDIT_FRAMES;
+    this->rxByteLimit = this->rxBytes + this->rxCreditBytes;
+    data = packet.getData() + packet.getDataLen();
+    ToneIotPacketView::store16(&data[ToneIotPacketView::CREDIT_OFFSET_FRAMES], this->rxFrameLimit);
+    ToneIotPacketView::store32(&data[ToneIotPacketView::CREDIT_OFFSET_BYTES], this->rxByteLimit);
+    packet.setDataLen(packet.getDataLen() + ToneIotPacketView::CREDIT_SIZE);
+}
 
-    //TODO wait init package, parse the init function, enable function
+/**
+ * @brief take credit of server after data of ACK, ERROR or KEEPALIVE, a stale
+ * update does not lower the credit
+ * 
+ * @param packet - received packet
+ */
+void ToneIotClient::takeCredit(ToneIotPacketView packet){
+
+    uint16_t offset = 0;
+    uint16_t frames = 0;
+    uint32_t bytes = 0;
+
+    if (!this->txCredit) return;
+    if (packet.getFunction() == TOIC_FUNCTION_SYS_ERROR) offset = 2;
+    else if (packet.getFunction() != TOIC_FUNCTION_SYS_ACK && packet.getFunction() != TOIC_FUNCTION_SYS_KEEPALIVE) return;
+    if (packet.getDataLen() < offset + ToneIotPacketView::CREDIT_SIZE) return;
+
+    frames = ToneIotPacketView::load16(packet.getData() + offset + ToneIotPacketView::CREDIT_OFFSET_FRAMES);
+    bytes = ToneIotPacketView::load32(packet.getData() + offset + ToneIotPacketView::CREDIT_OFFSET_BYTES);
+    if ((int16_t)(frames - this->txFrameLimit) > 0) this->txFrameLimit = frames;
+    if ((int32_t)(bytes - this->txByteLimit) > 0) this->txByteLimit = bytes;
+}
 
-    if (waitServerRespons() != TOIC_FUNCTION_SYS_INIT) return -1;
+/**
+ * @brief give credit back when half of it is used and no answer carried it
+ * 
+ */
+void ToneIotClient::checkCredit(){
 
-    // lastInActivity = lastOutActivity = millis();
+    uint16_t frames = 0;
+    uint32_t bytes = 0;
 
-    // while (!_client->available()) {
-    //     unsigned long t = millis();
-    //     if (t-lastInActivity >= ((int32_t) this->socketTimeout*1000UL)) {
-    //         _state = TOIC_CONNECTION_TIMEOUT;
-    //         _client->stop();
-    //         return false;
-    //     }
-    // }
-    // uint8_t llen;
-    // uint32_t len = readPacket(&llen);
+    if (!this->txCredit) return;
+    frames = this->rxFrames + TOIC_CREDIT_FRAMES - this->rxFrameLimit;
+    bytes = this->rxBytes + this->rxCreditBytes - this->rxByteLimit;
+    if (frames * 2 < TOIC_CREDIT_FRAMES && bytes * 2 < this->rxCreditBytes) return;
+    sendFunctionCredit();
+}
 
-    // if (len == 4) {
-    //     if (buffer[3] == 0) {
-    //         lastInActivity = millis();
-    //         pingOutstanding = false;
-    //        this->state = TOIC_STATE::CONNECTED;
-    //        return true;
-    //     } else {
-    //         _state = buffer[3];
-    //     }
-    // }
-    // _client->stop();
+//============================================ private endpoints ==================================================
+
+void ToneIotClient::initEndpoint(endpoint_t* endpoint, const char* host, uint16_t port){
+
+    endpoint->host = host;
+    endpoint->port = port;
+    endpoint->ip = IPAddress();
+    // ip literal skips DNS for ever
+    endpoint->literal = endpoint->ip.fromString(host);
+    endpoint->cached = false;
+    endpoint->resolvedAt = 0;
+    endpoint->failures = 0;
+    endpoint->failedAt = 0;
+    endpoint->connects = 0;
+    endpoint->connectTime = 0;
+}
 
+/**
+ * @brief TCP connect to first healthy endpoint in order, failed endpoints
+ * are skipped during backoff; when all are failed the one failed longest ago is tried
+ * 
+ * @return int8_t = 0 - ok; -1 - error
+ */
+int8_t ToneIotClient::connectEndpoints(){
+
+    unsigned long t = millis();
+    endpoint_t* endpoint = NULL;
+    endpoint_t* oldest = NULL;
+    bool tried = false;
+
+    for (uint8_t i = 0; i < this->endpointCount; i++) {
+        endpoint = &this->endpoints[i];
+        if (endpoint->failures != 0 && t - endpoint->failedAt < getBackoff(endpoint)) {
+            if (oldest == NULL || (long)(endpoint->failedAt - oldest->failedAt) < 0) oldest = endpoint;
+            continue;
+        }
+        tried = true;
+        if (connectEndpoint(endpoint) == 0) {
+            this->endpointIndex = i;
+            return 0;
+        }
+    }
+    if (!tried && oldest != NULL && connectEndpoint(oldest) == 0) {
+        this->endpointIndex = oldest - this->endpoints;
+        return 0;
+    }
+    this->endpointIndex = -1;
+    return -1;
+}
+
+/**
+ * @brief TCP connect to endpoint by cached address, DNS lookup only when the
+ * cache is expired
+ * 
+ * @param endpoint - endpoint
+ * @return int8_t = 0 - ok; -1 - error
+ */
+int8_t ToneIotClient::connectEndpoint(endpoint_t* endpoint){
+
+    IPAddress ip;
+    unsigned long t = millis();
+    int ret = 0;
+
+    if (!endpoint->literal && endpoint->cached && t - endpoint->resolvedAt >= this->dnsTtl) endpoint->cached = false;
+    if (!endpoint->literal && !endpoint->cached && this->cbResolve) {
+        this->stats.resolves++;
+        if (this->cbResolve(endpoint->host, &ip) == 0) {
+            endpoint->ip = ip;
+            endpoint->cached = true;
+            endpoint->resolvedAt = millis();
+        }
+    }
+
+    t = millis();
+    if (endpoint->literal || endpoint->cached) ret = this->client->connect(endpoint->ip, endpoint->port);
+    else ret = this->client->connect(endpoint->host, endpoint->port);
+    if (ret != 1) {
+        failEndpoint(endpoint);
+        return -1;
+    }
+    endpoint->failures = 0;
+    endpoint->connects++;
+    endpoint->connectTime = millis() - t;
     return 0;
 }
 
+void ToneIotClient::failEndpoint(endpoint_t* endpoint){
+
+    if (endpoint->failures < 0xFF) endpoint->failures++;
+    endpoint->failedAt = millis();
+    // server may have moved, next connect asks DNS again
+    endpoint->cached = false;
+}
+
+// backoff doubles with every failure in a row
+uint32_t ToneIotClient::getBackoff(endpoint_t* endpoint){
+
+    uint32_t backoff = TOIC_ENDPOINT_BACKOFF;
+
+    for (uint8_t i = 1; i < endpoint->failures && backoff < TOIC_ENDPOINT_BACKOFF_MAX; i++) backoff <<= 1;
+    return backoff < TOIC_ENDPOINT_BACKOFF_MAX ? backoff : TOIC_ENDPOINT_BACKOFF_MAX;
+}
+
+//============================================ private standart function ==================================================
+
+void ToneIotClient::initFunctionSys(void){
+
+    // system functions are always served
+    setFunction(TOIC_FUNCTION_SYS_DISCONNECT, [this](uint8_t* buf, uint16_t len) { this->cbFunctionDisconnect(buf, len); }, true);
+    setFunction(TOIC_FUNCTION_SYS_OTA, [this](uint8_t* buf, uint16_t len) { this->cbFunctionOta(buf, len); }, true);
+}
+
+void ToneIotClient::cbFunctionDisconnect(uint8_t* buf, uint16_t len){
+
+    sendFunctionAck();
+
+    closeSocket(TOIC_STATE::DISCONNECTED);
+    lastInActivity = lastOutActivity = millis();
+}
+
+/**
+ * @brief delta firmware update, each part is acknowledged
+ * 
+ * @param buf - command 1 byte + command data
+ * @param len - length buffer
+ */
+void ToneIotClient::cbFunctionOta(uint8_t* buf, uint16_t len){
+
+    int8_t ret = -1;
+    uint32_t offset = 0;
+
+    if (this->delta != NULL && len >= 1) {
+        switch (buf[0]) {
+        case TOIC_OTA_BEGIN:
+            ret = this->delta->begin();
+            break;
+        case TOIC_OTA_DATA:
+            if (len < 5) break;
+            offset = (uint32_t)buf[1] | ((uint32_t)buf[2] << 8) | ((uint32_t)buf[3] << 16) | ((uint32_t)buf[4] << 24);
+            // repeated part after lost acknowledgement
+            if (offset + (len - 5) <= this->delta->getReceived()) ret = 0;
+            else if (offset == this->delta->getReceived()) ret = this->delta->write(&buf[5], len - 5);
+            break;
+        case TOIC_OTA_END:
+            ret = this->delta->end();
+            break;
+        case TOIC_OTA_ABORT:
+            this->delta->abort();
+            ret = 0;
+            break;
+        }
+    }
+
+    if (ret) sendFunctionError(TOIC_ERROR_OTA);
+    else sendFunctionAck();
+}
+
+int8_t ToneIotClient::sendFunctionInit(){
+    
+    int32_t size = 0;
+    int8_t index = -1;
+    ToneIotPacketView packet = acquirePacket(&index, TOIC_FUNCTION_SYS_INIT, 0);
+    uint8_t* data = NULL;
+
+    if (!packet.valid()) return -1;
+
+    // layout by offsets, no padding of struct on the wire
+    data = packet.getData();
+    data[ToneIotPacketView::INIT_OFFSET_HEADER] = 0;
+    memcpy(&data[ToneIotPacketView::INIT_OFFSET_ID], this->toneiotsettings.id, 8);
+    data[ToneIotPacketView::INIT_OFFSET_DEVICE_TYPE] = TONE_DEVICE_TYPE;
+    data[ToneIotPacketView::INIT_OFFSET_VERSION_MAJOR] = TONE_VERSION_MAJOR;
+    data[ToneIotPacketView::INIT_OFFSET_VERSION_MINOR] = TONE_VERSION_MINOR;
+    memcpy(&data[ToneIotPacketView::INIT_OFFSET_DATE], __DATE__, ToneIotPacketView::INIT_DATE_SIZE);   // DATE 11 byte + '\0'
+    ToneIotPacketView::store16(&data[ToneIotPacketView::INIT_OFFSET_KEEPALIVE], this->keepAlive);
+    packet.setDataLen(ToneIotPacketView::INIT_SIZE);
+
+    // credit of device follows 26 bytes, then the supported functions, all or nothing
+    ToneIotPacketView::store16(&data[ToneIotPacketView::INIT_SIZE + ToneIotPacketView::CREDIT_OFFSET_FRAMES], this->rxFrameLimit);
+    ToneIotPacketView::store32(&data[ToneIotPacketView::INIT_SIZE + ToneIotPacketView::CREDIT_OFFSET_BYTES], this->rxByteLimit);
+    size = writeFunctions(&data[ToneIotPacketView::INIT_SIZE + ToneIotPacketView::CREDIT_SIZE], this->bufferSize - ToneIotPacketView::HEADER_SIZE - ToneIotPacketView::INIT_SIZE - ToneIotPacketView::CREDIT_SIZE, &data[ToneIotPacketView::INIT_OFFSET_HEADER]);
+    if (size < 0) {
+        // ring space is not committed, pool buffer is returned
+        if (index >= 0) this->pool.release(index);
+        return -1;
+    }
+    data[ToneIotPacketView::INIT_OFFSET_HEADER] |= ToneIotPacketView::INIT_FLAG_CREDIT;
+    packet.setDataLen(ToneIotPacketView::INIT_SIZE + ToneIotPacketView::CREDIT_SIZE + size);
+
+    if (transmit(index, packet)) return -1;
+    return 0;
+}
+
+/**
+ * @brief write registered functions in the smaller format: bitmap from the
+ * lowest to the highest number or list of numbers
+ * 
+ * @param data - buffer
+ * @param size - size of buffer
+ * @param format - FUNCTIONS_LIST or FUNCTIONS_BITMAP is written here
+ * @return int32_t bytes written; -1 - functions do not fit
+ */
+int32_t ToneIotClient::writeFunctions(uint8_t* data, uint16_t size, uint8_t* format){
+
+    uint8_t* start = data;
+    itemFunction_t* itemFunction = NULL;
+    uint16_t count = 0;
+    uint16_t first = 0xFFFF;
+    uint16_t last = 0;
+    uint16_t bit = 0;
+    uint32_t listSize = 0;
+    uint32_t bitmapSize = 0;
+
+    // table is sorted, a number registered twice is next to itself and advertised once
+    for (itemFunction = this->listFunction; itemFunction != NULL; itemFunction = (itemFunction_t*)itemFunction->nextfunction) {
+        if (count != 0 && itemFunction->function == last) continue;
+        if (itemFunction->function < first) first = itemFunction->function;
+        if (itemFunction->function > last) last = itemFunction->function;
+        count++;
+    }
+
+    *format = ToneIotPacketView::FUNCTIONS_LIST;
+    if (count == 0) return 0;
+
+    listSize = (uint32_t)count * 2;
+    bitmapSize = ToneIotPacketView::BITMAP_HEADER_SIZE + (last - first) / 8 + 1;
+
+    if (bitmapSize <= listSize) {
+        if (bitmapSize > size) return -1;
+        *format = ToneIotPacketView::FUNCTIONS_BITMAP;
+        ToneIotPacketView::store16(&data[ToneIotPacketView::BITMAP_OFFSET_BASE], first);
+        ToneIotPacketView::store16(&data[ToneIotPacketView::BITMAP_OFFSET_BITS], last - first + 1);
+        data += ToneIotPacketView::BITMAP_HEADER_SIZE;
+        memset(data, 0, bitmapSize - ToneIotPacketView::BITMAP_HEADER_SIZE);
+        for (itemFunction = this->listFunction; itemFunction != NULL; itemFunction = (itemFunction_t*)itemFunction->nextfunction) {
+            bit = itemFunction->function - first;
+            data[bit / 8] |= 1 << (bit % 8);
+        }
+        return bitmapSize;
+    }
+
+    if (listSize > size) return -1;
+    for (itemFunction = this->listFunction; itemFunction != NULL; itemFunction = (itemFunction_t*)itemFunction->nextfunction) {
+        if (data != start && ToneIotPacketView::load16(data - 2) == itemFunction->function) continue;
+        ToneIotPacketView::store16(data, itemFunction->function);   // number function 2 byte
+        data += 2;
+    }
+    return listSize;
+}
+
+/**
+ * @brief INIT answer of server: format byte with INIT_FLAG_CREDIT, credit of
+ * server, set of enabled functions. Empty answer of server without flags
+ * enables all functions and does not pace sends.
+ * 
+ * @param buf - data of INIT answer
+ * @param len - length data
+ */
+void ToneIotClient::applyInit(uint8_t* buf, uint16_t len){
+
+    uint16_t offset = 1;
+
+    this->txCredit = false;
+    if (len == 0) {
+        applyFunctions(ToneIotPacketView::FUNCTIONS_LIST, NULL, 0);
+        return;
+    }
+    if ((buf[0] & ToneIotPacketView::INIT_FLAG_CREDIT) && len >= 1 + ToneIotPacketView::CREDIT_SIZE) {
+        this->txCredit = true;
+        this->txFrameLimit = ToneIotPacketView::load16(&buf[offset + ToneIotPacketView::CREDIT_OFFSET_FRAMES]);
+        this->txByteLimit = ToneIotPacketView::load32(&buf[offset + ToneIotPacketView::CREDIT_OFFSET_BYTES]);
+        offset += ToneIotPacketView::CREDIT_SIZE;
+    }
+    applyFunctions(buf[0] & ToneIotPacketView::FUNCTIONS_FORMAT_MASK, &buf[offset], len - offset);
+}
+
+/**
+ * @brief enable functions in one pass over the table, system functions are
+ * not changed. The table is sorted by number, an ascending list is merged
+ * with it, a list in other order is searched for every function
+ * 
+ * @param format - FUNCTIONS_LIST or FUNCTIONS_BITMAP
+ * @param set - set of enabled functions, NULL - all
+ * @param len - length set
+ */
+void ToneIotClient::applyFunctions(uint8_t format, uint8_t* set, uint16_t len){
+
+    itemFunction_t* itemFunction = NULL;
+    uint16_t base = 0;
+    uint16_t bits = 0;
+    uint16_t bit = 0;
+    uint16_t i = 0;
+    bool enable = false;
+    bool sorted = true;
+
+    if (set != NULL && format == ToneIotPacketView::FUNCTIONS_BITMAP && len >= ToneIotPacketView::BITMAP_HEADER_SIZE) {
+        base = ToneIotPacketView::load16(&set[ToneIotPacketView::BITMAP_OFFSET_BASE]);
+        bits = ToneIotPacketView::load16(&set[ToneIotPacketView::BITMAP_OFFSET_BITS]);
+        // short bitmap, missing bits are disabled
+        if ((uint32_t)bits > (uint32_t)(len - ToneIotPacketView::BITMAP_HEADER_SIZE) * 8) bits = (len - ToneIotPacketView::BITMAP_HEADER_SIZE) * 8;
+        set += ToneIotPacketView::BITMAP_HEADER_SIZE;
+    }
+    if (set != NULL && format != ToneIotPacketView::FUNCTIONS_BITMAP) {
+        for (i = 2; i + 1 < len && sorted; i += 2) sorted = ToneIotPacketView::load16(&set[i - 2]) <= ToneIotPacketView::load16(&set[i]);
+        i = 0;
+    }
+
+    for (itemFunction = this->listFunction; itemFunction != NULL; itemFunction = (itemFunction_t*)itemFunction->nextfunction) {
+        if (itemFunction->function <= TOIC_FUNCTION_SYS_DISCONNECT) continue;
+        if (set == NULL) {
+            enable = true;
+        } else if (format == ToneIotPacketView::FUNCTIONS_BITMAP) {
+            // numbers below base wrap above bits
+            bit = itemFunction->function - base;
+            enable = bit < bits && (set[bit / 8] & (1 << (bit % 8)));
+        } else if (sorted) {
+            // list position only moves forward, numbers of the table grow
+            while (i + 1 < len && ToneIotPacketView::load16(&set[i]) < itemFunction->function) i += 2;
+            enable = i + 1 < len && ToneIotPacketView::load16(&set[i]) == itemFunction->function;
+        } else {
+            enable = false;
+            for (i = 0; i + 1 < len && !enable; i += 2) enable = ToneIotPacketView::load16(&set[i]) == itemFunction->function;
+        }
+        itemFunction->enable = enable;
+    }
+}
+
+// keep alive with credit only, queued in threaded mode
+int8_t ToneIotClient::sendFunctionCredit(){
+
+    int8_t index = -1;
+    ToneIotPacketView packet = acquirePacket(&index, TOIC_FUNCTION_SYS_KEEPALIVE, ++this->msgId);
+
+    if (!packet.valid()) return -1;
+    putCredit(packet);
+    return transmit(index, packet);
+}
+
+// keep alive is written directly by the socket owner, loop() or network task
 int8_t ToneIotClient::sendFunctionKeepAlive(){
-    sendFunctio(TOIC_FUNCTION_SYS_KEEPALIVE);
+
+    int8_t ret = 0;
+    int8_t index = this->pool.acquire(TOIC_BUFFER_OWNER::TX);
+    ToneIotPacketView packet = ToneIotPacketView(this->pool.get(index));
+
+    if (!packet.valid()) return -1;
+    packet.setId(this->toneiotsettings.id);
+    packet.setMsgId(++this->msgId);
+    packet.setFunction(TOIC_FUNCTION_SYS_KEEPALIVE);
+    packet.setDataLen(0);
+    putCredit(packet);
+    ret = writePacket(packet);
+    this->pool.release(index);
+    return ret;
+}
+
+/**
+ * @brief acknowledgement written directly by the socket owner, loop() or network task
+ * 
+ * @param msgId - msgId of acknowledged packet
+ * @return int8_t = 0 - ok; -1 - error
+ */
+int8_t ToneIotClient::writeAck(uint16_t msgId){
+
+    int8_t ret = 0;
+    int8_t index = this->pool.acquire(TOIC_BUFFER_OWNER::TX);
+    ToneIotPacketView packet = ToneIotPacketView(this->pool.get(index));
+
+    if (!packet.valid()) return -1;
+    packet.setId(this->toneiotsettings.id);
+    packet.setMsgId(msgId);
+    packet.setFunction(TOIC_FUNCTION_SYS_ACK);
+    packet.setDataLen(0);
+    putCredit(packet);
+    ret = writePacket(packet);
+    this->pool.release(index);
+    return ret;
 }
 
 void ToneIotClient::sendFunctionDisconnect(uint16_t code){
-    sendFunctio(TOIC_FUNCTION_SYS_DISCONNECT, (uint8_t*)&code, 2);
+
+    uint8_t buf[2];
+
+    ToneIotPacketView::store16(buf, code);
+    sendFunctio(TOIC_FUNCTION_SYS_DISCONNECT, buf, 2);
     waitServerRespons();
 }
\ No newline at end of file
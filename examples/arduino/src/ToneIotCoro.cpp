@@ -0,0 +1,208 @@
+/**
+    * @author Dyakonov Oleg <o.u.dyakonov@gmail.com>
+    *
+    * @brief ToneIotCoro - C++20 coroutine flows over ToneIotClient
+*/
+
+#include "ToneIotCoro.h"
+
+#if defined(TOCO_ENABLED)
+
+// frames are aligned as from operator new
+typedef struct {
+   alignas(__STDCPP_DEFAULT_NEW_ALIGNMENT__) uint8_t data[TOCO_FRAME_SIZE];
+} frame_t;
+
+static frame_t frames[TOCO_FRAME_POOL];
+static uint32_t framesUsed = 0;   ///< bit n - frames[n] is used
+
+// ======================================== ToneIotCoro ======================================
+
+/**
+ * @brief frame from pool, without free frame the flow is not started
+ * and ToneIotCoro::valid() is false
+ *
+ * @param size - size of frame
+ * @return void* frame; NULL - frame is larger than TOCO_FRAME_SIZE or pool is empty
+ */
+void* ToneIotCoro::promise_type::operator new(size_t size) noexcept {
+
+    if (size > TOCO_FRAME_SIZE) return NULL;
+    for (uint8_t i = 0; i < TOCO_FRAME_POOL; i++) {
+        if (framesUsed & (1UL << i)) continue;
+        framesUsed |= 1UL << i;
+        return frames[i].data;
+    }
+    return NULL;
+}
+
+void ToneIotCoro::promise_type::operator delete(void* frame) noexcept {
+
+    uint8_t i = ((frame_t*)frame) - frames;
+
+    if (i < TOCO_FRAME_POOL) framesUsed &= ~(1UL << i);
+}
+
+ToneIotCoro& ToneIotCoro::operator=(ToneIotCoro&& other) noexcept {
+
+    if (this == &other) return *this;
+    if (this->handle) this->handle.destroy();
+    this->handle = other.handle;
+    other.handle = nullptr;
+    return *this;
+}
+
+/**
+ * @brief destroy frame, suspended flow is abandoned: do not destroy
+ * a flow waiting in ToneIotCoClient
+ *
+ */
+ToneIotCoro::~ToneIotCoro() {
+    if (this->handle) this->handle.destroy();
+}
+
+uint8_t ToneIotCoro::getFreeFrames() {
+
+    uint8_t n = 0;
+
+    for (uint8_t i = 0; i < TOCO_FRAME_POOL; i++) n += (framesUsed & (1UL << i)) ? 0 : 1;
+    return n;
+}
+
+// ======================================== ToneIotCoClient ======================================
+/**
+ *  @brief Constructor, installs receive hook of client
+ *  @param client - object tone iot client
+ */
+ToneIotCoClient::ToneIotCoClient(ToneIotClient& client) : client(client), waiters(NULL), messagesLen(0) {
+    this->client.setReceiveHook([this](uint16_t function, uint8_t* buf, uint16_t len) { return this->deliver(function, buf, len); });
+}
+
+/**
+ * @brief drive client and resume flows with met conditions
+ *
+ * @return int8_t result of client.loop()
+ */
+int8_t ToneIotCoClient::loop() {
+
+    int8_t ret = this->client.loop();
+    Waiter* waiter = this->waiters;
+
+    // resumed flow can link new waiters, the list is scanned again
+    while (waiter != NULL) {
+        if (!waiter->ready()) {
+            waiter = waiter->next;
+            continue;
+        }
+        unlink(waiter);
+        waiter->handle.resume();
+        waiter = this->waiters;
+    }
+    // received flows are resumed, their data is not used after suspension
+    this->messagesLen = 0;
+    return ret;
+}
+
+void ToneIotCoClient::Waiter::await_suspend(std::coroutine_handle<> handle) {
+    this->handle = handle;
+    this->co.link(this);
+}
+
+void ToneIotCoClient::link(Waiter* waiter) {
+    waiter->next = this->waiters;
+    this->waiters = waiter;
+}
+
+bool ToneIotCoClient::unlink(Waiter* waiter) {
+
+    Waiter** item = &this->waiters;
+
+    while (*item != NULL) {
+        if (*item == waiter) {
+            *item = waiter->next;
+            waiter->next = NULL;
+            return true;
+        }
+        item = &(*item)->next;
+    }
+    return false;
+}
+
+/**
+ * @brief receive hook: give the packet to the oldest flow awaiting the function.
+ * The flow is resumed by loop(), not here: it may send while the client
+ * is still in dispatch of this packet
+ *
+ * @return true - packet is consumed by flow; false - no flow or no room in messages
+ */
+bool ToneIotCoClient::deliver(uint16_t function, uint8_t* buf, uint16_t len) {
+
+    ReceiveAwaiter* found = NULL;
+
+    // list is newest first
+    for (Waiter* waiter = this->waiters; waiter != NULL; waiter = waiter->next) {
+        if (waiter->receiver != NULL && !waiter->receiver->received && waiter->receiver->function == function) found = waiter->receiver;
+    }
+    if (found == NULL || len > TOCO_MESSAGE_SIZE - this->messagesLen) return false;
+    // buf of client is reused by the next frame
+    memcpy(&this->messages[this->messagesLen], buf, len);
+    found->received = true;
+    found->message.buf = &this->messages[this->messagesLen];
+    found->message.len = len;
+    this->messagesLen += len;
+    return true;
+}
+
+// connect
+bool ToneIotCoClient::ConnectAwaiter::await_ready() {
+
+    if (this->co.client.getState() == TOIC_STATE::CONNECTED) return true;
+    // failed TCP connect or INIT is not sent: no suspension
+    return this->co.client.connectAsync() != 0;
+}
+
+bool ToneIotCoClient::ConnectAwaiter::ready() {
+    return this->co.client.getState() != TOIC_STATE::CONNECTING;
+}
+
+int8_t ToneIotCoClient::ConnectAwaiter::await_resume() {
+    return this->co.client.getState() == TOIC_STATE::CONNECTED ? 0 : -1;
+}
+
+// send
+ToneIotCoClient::SendAwaiter::SendAwaiter(ToneIotCoClient& co, uint16_t function, uint8_t* buf, uint16_t len) : Waiter(co) {
+    this->sendHandle = this->co.client.sendFunctioAsync(function, buf, len);
+    this->result = this->sendHandle == TOIC_SEND_HANDLE_INVALID ? TOIC_SEND::INVALID : TOIC_SEND::PENDING;
+}
+
+bool ToneIotCoClient::SendAwaiter::await_ready() {
+    return this->result != TOIC_SEND::PENDING || ready();
+}
+
+bool ToneIotCoClient::SendAwaiter::ready() {
+
+    if (this->result != TOIC_SEND::PENDING) return true;
+    this->result = this->co.client.getSendState(this->sendHandle);
+    return this->result != TOIC_SEND::PENDING;
+}
+
+// receive
+ToneIotCoClient::ReceiveAwaiter::ReceiveAwaiter(ToneIotCoClient& co, uint16_t function, uint32_t timeout) : Waiter(co) {
+    this->receiver = this;
+    this->function = function;
+    this->start = millis();
+    this->timeout = timeout;
+    this->received = false;
+    this->message.buf = NULL;
+    this->message.len = 0;
+}
+
+// packets are delivered by deliver(), here only timeout and lost connection
+bool ToneIotCoClient::ReceiveAwaiter::ready() {
+
+    if (this->received) return true;
+    if (this->timeout != 0 && millis() - this->start >= this->timeout) return true;
+    return this->co.client.getState() != TOIC_STATE::CONNECTED && this->co.client.getState() != TOIC_STATE::CONNECTING;
+}
+
+#endif
@@ -0,0 +1,334 @@
+/**
+    * @author Dyakonov Oleg <o.u.dyakonov@gmail.com>
+    *
+    * @brief ToneIotDelta - streaming applier of delta firmware patches
+*/
+
+#include "ToneIotDelta.h"
+
+static const uint32_t crcTable[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+};
+
+// ======================================== public ======================================
+/**
+ *  @brief Constructor
+ */
+ToneIotDelta::ToneIotDelta() {
+
+    this->state = TOID_STATE::IDLE;
+    this->received = 0;
+    this->written = 0;
+}
+
+/**
+ * @brief start new patch, the image is written to the next ota partition
+ *
+ * @return int8_t = 0 - ok; -1 - error
+ */
+int8_t ToneIotDelta::begin() {
+
+    abort();
+
+    this->received = 0;
+    this->written = 0;
+    this->copyOffset = 0;
+    this->crc = 0xFFFFFFFF;
+
+#if defined(ESP32)
+    this->source = esp_ota_get_running_partition();
+    this->target = esp_ota_get_next_update_partition(NULL);
+    if (this->source == NULL || this->target == NULL) {
+        this->state = TOID_STATE::ERROR;
+        return -1;
+    }
+    this->state = TOID_STATE::HEADER;
+    return 0;
+#else
+    this->state = TOID_STATE::ERROR;
+    return -1;
+#endif
+}
+
+/**
+ * @brief apply next part of patch, parts can be split at any byte
+ *
+ * @param buf - array buffer
+ * @param len - length buffer
+ * @return int8_t = 0 - ok; -1 - error
+ */
+int8_t ToneIotDelta::write(uint8_t* buf, uint16_t len) {
+
+    uint16_t i = 0;
+    uint32_t n = 0;
+    int8_t ret = 0;
+
+    if (this->state < TOID_STATE::HEADER || this->state == TOID_STATE::DONE) return -1;
+
+    while (i < len) {
+        switch (this->state) {
+        case TOID_STATE::HEADER:
+            this->header[this->received++] = buf[i++];
+            if (this->received == TOID_HEADER_SIZE && parseHeader()) goto ERROR;
+            break;
+        case TOID_STATE::OPCODE:
+            // all image is written, the patch is longer than expected
+            if (this->written == this->targetSize) goto ERROR;
+            this->varint = 0;
+            this->varintShift = 0;
+            if (buf[i] == TOID_OP_COPY) this->state = TOID_STATE::COPY_OFFSET;
+            else if (buf[i] == TOID_OP_INSERT) this->state = TOID_STATE::INSERT_LENGTH;
+            else goto ERROR;
+            i++;
+            this->received++;
+            break;
+        case TOID_STATE::COPY_OFFSET:
+            ret = readVarint(buf[i++]);
+            this->received++;
+            if (ret == -1) goto ERROR;
+            if (ret == 1) {
+                // zigzag offset from end of previous copy
+                this->copyOffset += (int32_t)((this->varint >> 1) ^ (~(this->varint & 1) + 1));
+                this->varint = 0;
+                this->varintShift = 0;
+                this->state = TOID_STATE::COPY_LENGTH;
+            }
+            break;
+        case TOID_STATE::COPY_LENGTH:
+            ret = readVarint(buf[i++]);
+            this->received++;
+            if (ret == -1) goto ERROR;
+            if (ret == 1) {
+                if (copy(this->copyOffset, this->varint)) goto ERROR;
+                this->copyOffset += this->varint;
+                this->state = TOID_STATE::OPCODE;
+            }
+            break;
+        case TOID_STATE::INSERT_LENGTH:
+            ret = readVarint(buf[i++]);
+            this->received++;
+            if (ret == -1) goto ERROR;
+            if (ret == 1) {
+                if (this->varint == 0) goto ERROR;
+                this->remaining = this->varint;
+                this->state = TOID_STATE::INSERT_DATA;
+            }
+            break;
+        case TOID_STATE::INSERT_DATA:
+            n = len - i;
+            if (n > this->remaining) n = this->remaining;
+            if (output(&buf[i], n)) goto ERROR;
+            i += n;
+            this->received += n;
+            this->remaining -= n;
+            if (this->remaining == 0) this->state = TOID_STATE::OPCODE;
+            break;
+        default:
+            goto ERROR;
+        }
+    }
+
+    return 0;
+ERROR:
+    abort();
+    this->state = TOID_STATE::ERROR;
+    return -1;
+}
+
+/**
+ * @brief finish patch, verify image and select it for the next boot
+ *
+ * @return int8_t = 0 - ok; -1 - error
+ */
+int8_t ToneIotDelta::end() {
+
+    if (this->state != TOID_STATE::OPCODE || this->written != this->targetSize) goto ERROR;
+    if ((this->crc ^ 0xFFFFFFFF) != this->targetCrc) goto ERROR;
+
+#if defined(ESP32)
+    // esp_ota_end releases the handle also on error
+    if (esp_ota_end(this->handle) != ESP_OK) {
+        this->state = TOID_STATE::ERROR;
+        return -1;
+    }
+    if (esp_ota_set_boot_partition(this->target) != ESP_OK) {
+        this->state = TOID_STATE::ERROR;
+        return -1;
+    }
+#endif
+
+    this->state = TOID_STATE::DONE;
+    return 0;
+ERROR:
+    abort();
+    this->state = TOID_STATE::ERROR;
+    return -1;
+}
+
+/**
+ * @brief abort patch, the running image stays selected
+ *
+ */
+void ToneIotDelta::abort() {
+
+#if defined(ESP32)
+    // the ota handle is open after the header is parsed
+    if (this->state > TOID_STATE::HEADER && this->state < TOID_STATE::DONE) esp_ota_abort(this->handle);
+#endif
+    this->state = TOID_STATE::IDLE;
+}
+
+/**
+ * @brief get state
+ *
+ * @return TOID_STATE state
+ */
+TOID_STATE ToneIotDelta::getState() {
+    return this->state;
+}
+
+/**
+ * @brief get patch bytes received
+ *
+ * @return uint32_t bytes
+ */
+uint32_t ToneIotDelta::getReceived() {
+    return this->received;
+}
+
+/**
+ * @brief get image bytes written
+ *
+ * @return uint32_t bytes
+ */
+uint32_t ToneIotDelta::getWritten() {
+    return this->written;
+}
+
+// =============================================== private =================================
+
+/**
+ * @brief parse patch header and open ota partition
+ *
+ * @return int8_t = 0 - ok; -1 - error
+ */
+int8_t ToneIotDelta::parseHeader() {
+
+    uint32_t magic = 0;
+
+    magic = (uint32_t)this->header[0] | ((uint32_t)this->header[1] << 8) | ((uint32_t)this->header[2] << 16) | ((uint32_t)this->header[3] << 24);
+    this->sourceSize = (uint32_t)this->header[4] | ((uint32_t)this->header[5] << 8) | ((uint32_t)this->header[6] << 16) | ((uint32_t)this->header[7] << 24);
+    this->targetSize = (uint32_t)this->header[8] | ((uint32_t)this->header[9] << 8) | ((uint32_t)this->header[10] << 16) | ((uint32_t)this->header[11] << 24);
+    this->sourceCrc = (uint32_t)this->header[12] | ((uint32_t)this->header[13] << 8) | ((uint32_t)this->header[14] << 16) | ((uint32_t)this->header[15] << 24);
+    this->targetCrc = (uint32_t)this->header[16] | ((uint32_t)this->header[17] << 8) | ((uint32_t)this->header[18] << 16) | ((uint32_t)this->header[19] << 24);
+
+    if (magic != TOID_MAGIC || this->targetSize == 0) return -1;
+
+#if defined(ESP32)
+    if (this->sourceSize > this->source->size || this->targetSize > this->target->size) return -1;
+    // patch of other firmware would copy wrong blocks, found only by crc of new image
+    if (checkSource()) return -1;
+    if (esp_ota_begin(this->target, this->targetSize, &this->handle) != ESP_OK) return -1;
+#endif
+
+    this->state = TOID_STATE::OPCODE;
+    return 0;
+}
+
+/**
+ * @brief check crc32 of running image against the header, read through the window
+ *
+ * @return int8_t = 0 - ok; -1 - patch is made for another image
+ */
+int8_t ToneIotDelta::checkSource() {
+
+    uint32_t crc = 0xFFFFFFFF;
+    uint32_t offset = 0;
+    uint32_t n = 0;
+
+    while (offset < this->sourceSize) {
+        n = this->sourceSize - offset > TOID_WINDOW_SIZE ? TOID_WINDOW_SIZE : this->sourceSize - offset;
+#if defined(ESP32)
+        if (esp_partition_read(this->source, offset, this->window, n) != ESP_OK) return -1;
+#endif
+        crc = updateCrc(crc, this->window, n);
+        offset += n;
+    }
+    return (crc ^ 0xFFFFFFFF) == this->sourceCrc ? 0 : -1;
+}
+
+/**
+ * @brief decode next byte varint
+ *
+ * @param byte - next byte
+ * @return int8_t = 0 - more bytes; 1 - varint complete; -1 - error
+ */
+int8_t ToneIotDelta::readVarint(uint8_t byte) {
+
+    if (this->varintShift > 28) return -1;
+    this->varint |= (uint32_t)(byte & 0x7F) << this->varintShift;
+    this->varintShift += 7;
+    return (byte & 0x80) ? 0 : 1;
+}
+
+/**
+ * @brief copy block of running image through the window
+ *
+ * @param offset - offset in running image
+ * @param len - length block
+ * @return int8_t = 0 - ok; -1 - error
+ */
+int8_t ToneIotDelta::copy(uint32_t offset, uint32_t len) {
+
+    uint32_t n = 0;
+
+    if (len == 0 || offset > this->sourceSize || len > this->sourceSize - offset) return -1;
+
+    while (len > 0) {
+        n = len > TOID_WINDOW_SIZE ? TOID_WINDOW_SIZE : len;
+#if defined(ESP32)
+        if (esp_partition_read(this->source, offset, this->window, n) != ESP_OK) return -1;
+#endif
+        if (output(this->window, n)) return -1;
+        offset += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/**
+ * @brief write data of new image
+ *
+ * @param buf - array buffer
+ * @param len - length buffer
+ * @return int8_t = 0 - ok; -1 - error
+ */
+int8_t ToneIotDelta::output(uint8_t* buf, uint32_t len) {
+
+    if (len > this->targetSize - this->written) return -1;
+#if defined(ESP32)
+    if (esp_ota_write(this->handle, buf, len) != ESP_OK) return -1;
+#endif
+    this->crc = updateCrc(this->crc, buf, len);
+    this->written += len;
+    return 0;
+}
+
+/**
+ * @brief update crc32 with data
+ *
+ * @param crc - crc32 before, 0xFFFFFFFF at start
+ * @param buf - array buffer
+ * @param len - length buffer
+ * @return uint32_t crc32 after
+ */
+uint32_t ToneIotDelta::updateCrc(uint32_t crc, uint8_t* buf, uint32_t len) {
+
+    for (uint32_t i = 0; i < len; i++) {
+        crc ^= buf[i];
+        crc = (crc >> 4) ^ crcTable[crc & 0x0F];
+        crc = (crc >> 4) ^ crcTable[crc & 0x0F];
+    }
+    return crc;
+}
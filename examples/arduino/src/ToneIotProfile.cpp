@@ -0,0 +1,148 @@
+/**
+    * @author Dyakonov Oleg <o.u.dyakonov@gmail.com>
+    *
+    * @brief ToneIotProfile - cycle counters of library hot paths, rendered by tools/toneiot_profile.py
+*/
+
+#include "ToneIotProfile.h"
+#include "ToneIotPacket.h"
+
+ToneIotProfile::scope_t ToneIotProfile::scopes[(uint8_t)TOIP_SCOPE::COUNT];
+
+static const char* const scopeNames[(uint8_t)TOIP_SCOPE::COUNT] = {
+    "readPacket",
+    "writePacket",
+    "callFunction",
+    "tokenParse",
+    "connect"
+};
+
+// ======================================== public ======================================
+/**
+ * @brief cycles since start. A 32-bit counter wraps, in a long scope the
+ * wraps are taken from the elapsed micros(), the low 32 bits stay exact
+ *
+ * @param start - cycles() at start
+ * @param startMicros - micros() at start
+ * @return uint64_t cycles
+ */
+uint64_t ToneIotProfile::since(uint64_t start, unsigned long startMicros) {
+
+    uint64_t count = cycles() - start;
+    uint32_t elapsed = micros() - startMicros;
+    uint64_t expected = 0;
+
+#if !defined(__x86_64__) && !defined(__i386__)
+    count = (uint32_t)count;
+    if (elapsed < TOIP_WRAP_CHECK) return count;
+    expected = (uint64_t)elapsed * (getFrequency() / 1000000UL);
+    // nearest count with the same low 32 bits
+    if (expected > count) count += ((expected - count + 0x80000000ULL) >> 32) << 32;
+#else
+    (void)elapsed;
+    (void)expected;
+#endif
+    return count;
+}
+
+/**
+ * @brief add one call of scope
+ *
+ * @param scope - scope
+ * @param cycles - cycles of the call
+ */
+void ToneIotProfile::add(TOIP_SCOPE scope, uint64_t cycles) {
+
+    scope_t* s = &scopes[(uint8_t)scope];
+
+    s->calls++;
+    s->total += cycles;
+    if (cycles > s->max) s->max = cycles;
+}
+
+/**
+ * @brief clear all scopes
+ *
+ */
+void ToneIotProfile::reset() {
+    memset(scopes, 0, sizeof(scopes));
+}
+
+/**
+ * @brief get counters of scope
+ *
+ * @param scope - scope
+ * @return const scope_t& counters
+ */
+const ToneIotProfile::scope_t& ToneIotProfile::get(TOIP_SCOPE scope) {
+    return scopes[(uint8_t)scope];
+}
+
+/**
+ * @brief get name of scope, same as in tools/toneiot_profile.py
+ *
+ * @param scope - scope
+ * @return const char* name
+ */
+const char* ToneIotProfile::getName(TOIP_SCOPE scope) {
+    return scopeNames[(uint8_t)scope];
+}
+
+/**
+ * @brief get rate of cycles()
+ *
+ * @return uint32_t cycles per second; 0 - unknown (TSC of host)
+ */
+uint32_t ToneIotProfile::getFrequency() {
+#if defined(__XTENSA__)
+    return getCpuFrequencyMhz() * 1000000UL;
+#elif defined(__x86_64__) || defined(__i386__)
+    return 0;
+#else
+    return 1000000UL;
+#endif
+}
+
+/**
+ * @brief print table as text lines, tools/toneiot_profile.py reads them from serial log:
+ *    TOIP hz=240000000 scopes=5
+ *    TOIP readPacket calls=12 total=345678 max=45678
+ *
+ * @param out - serial port or other stream
+ */
+void ToneIotProfile::print(Print& out) {
+
+    out.printf("TOIP hz=%lu scopes=%u\n", (unsigned long)getFrequency(), (unsigned)TOIP_SCOPE::COUNT);
+    for (uint8_t i = 0; i < (uint8_t)TOIP_SCOPE::COUNT; i++) {
+        out.printf("TOIP %s calls=%lu total=%llu max=%llu\n", scopeNames[i], (unsigned long)scopes[i].calls,
+                   (unsigned long long)scopes[i].total, (unsigned long long)scopes[i].max);
+    }
+}
+
+/**
+ * @brief encode table for a protocol function, see ToneIotClient::sendProfile()
+ *
+ * @param buf - output buffer
+ * @param size - size buffer, TOIP_SIZE is enough
+ * @return uint16_t bytes encoded; 0 - buffer is too small
+ */
+uint16_t ToneIotProfile::encode(uint8_t* buf, uint16_t size) {
+
+    uint8_t* p = buf;
+
+    if (size < TOIP_SIZE) return 0;
+    *p++ = TOIP_VERSION;
+    ToneIotPacketView::store32(p, getFrequency());
+    p += 4;
+    *p++ = (uint8_t)TOIP_SCOPE::COUNT;
+    for (uint8_t i = 0; i < (uint8_t)TOIP_SCOPE::COUNT; i++) {
+        *p++ = i;
+        ToneIotPacketView::store32(p, scopes[i].calls);
+        ToneIotPacketView::store32(p + 4, (uint32_t)scopes[i].total);
+        ToneIotPacketView::store32(p + 8, (uint32_t)(scopes[i].total >> 32));
+        ToneIotPacketView::store32(p + 12, (uint32_t)scopes[i].max);
+        ToneIotPacketView::store32(p + 16, (uint32_t)(scopes[i].max >> 32));
+        p += 20;
+    }
+    return p - buf;
+}
@@ -0,0 +1,118 @@
+/**
+    * @author Dyakonov Oleg <o.u.dyakonov@gmail.com>
+    *
+    * @brief ToneIotRadio - SIM800 sleep through DTR, wake up by RI, radio-on time
+*/
+
+#include "ToneIotRadio.h"
+
+std::atomic<bool> ToneIotRadio::ring(false);
+
+// ======================================== public ======================================
+/**
+ *  @brief Constructor
+ *  @param pinDtr - pin wired to modem DTR, TOIRA_PIN_NONE - modem never sleeps
+ *  @param pinRi - pin wired to modem RI, TOIRA_PIN_NONE - no wake up by incoming data
+ */
+ToneIotRadio::ToneIotRadio(int8_t pinDtr, int8_t pinRi) {
+
+    this->pinDtr = pinDtr;
+    this->pinRi = pinRi;
+    this->awake = true;
+    this->onSince = 0;
+    this->onTime = 0;
+    this->started = 0;
+}
+
+/**
+ * @brief configure pins, the modem is awake
+ *
+ */
+void ToneIotRadio::begin() {
+
+    if (this->pinDtr != TOIRA_PIN_NONE) {
+        pinMode(this->pinDtr, OUTPUT);
+        digitalWrite(this->pinDtr, LOW);
+    }
+    if (this->pinRi != TOIRA_PIN_NONE) {
+        pinMode(this->pinRi, INPUT_PULLUP);
+        attachInterrupt(digitalPinToInterrupt(this->pinRi), &ToneIotRadio::onRing, FALLING);
+    }
+    this->started = millis();
+    this->onSince = this->started;
+    this->onTime = 0;
+    this->awake = true;
+}
+
+/**
+ * @brief pull DTR low and wait until UART of modem is ready
+ *
+ */
+void ToneIotRadio::wake() {
+
+    bool asleep = false;
+
+    if (!this->awake.compare_exchange_strong(asleep, true)) return;
+    this->onSince = millis();
+    if (this->pinDtr == TOIRA_PIN_NONE) return;
+    digitalWrite(this->pinDtr, LOW);
+    delay(TOIRA_WAKE_DELAY);
+}
+
+/**
+ * @brief let the modem sleep, data written before wake() is lost
+ *
+ */
+void ToneIotRadio::sleep() {
+
+    // without DTR the modem is always on
+    if (this->pinDtr == TOIRA_PIN_NONE || !this->awake) return;
+    digitalWrite(this->pinDtr, HIGH);
+    this->onTime += millis() - this->onSince;
+    this->awake = false;
+}
+
+bool ToneIotRadio::isAwake() {
+    return this->awake;
+}
+
+/**
+ * @brief RI fell since last call, incoming data or URC
+ *
+ * @return true - modem rang
+ */
+bool ToneIotRadio::takeRing() {
+    return ring.exchange(false);
+}
+
+/**
+ * @brief radio-on time since begin()
+ *
+ * @return uint32_t ms
+ */
+uint32_t ToneIotRadio::getOnTime() {
+
+    uint32_t on = this->onTime;
+
+    if (this->awake) on += millis() - this->onSince;
+    return on;
+}
+
+/**
+ * @brief average radio-on time per hour since begin()
+ *
+ * @return uint32_t ms per hour
+ */
+uint32_t ToneIotRadio::getOnTimePerHour() {
+
+    uint32_t elapsed = millis() - this->started;
+
+    if (elapsed == 0) return 0;
+    return (uint64_t)getOnTime() * 3600000UL / elapsed;
+}
+
+// =============================================== private =================================
+
+void IRAM_ATTR ToneIotRadio::onRing() {
+    ring = true;
+}
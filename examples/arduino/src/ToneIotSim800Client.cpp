@@ -0,0 +1,390 @@
+/**
+    * @author Dyakonov Oleg <o.u.dyakonov@gmail.com>
+    *
+    * @brief ToneIotSim800Client - TCP client over SIM800 transparent mode (AT+CIPMODE=1)
+*/
+
+#include "ToneIotSim800Client.h"
+
+// modem leaves data mode with this line when the server closes the connection
+static const char closedPattern[] = "\r\nCLOSED\r\n";
+#define TOIS_CLOSED_LEN (sizeof(closedPattern) - 1)
+
+// ======================================== public ======================================
+/**
+ *  @brief Constructor
+ *  @param stream - serial port of modem
+ */
+ToneIotSim800Client::ToneIotSim800Client(Stream& stream) {
+
+    this->stream = &stream;
+    this->apn = "";
+    this->user = "";
+    this->pass = "";
+    this->state = TOIS_STATE::CLOSED;
+    this->bearer = false;
+    this->matched = 0;
+    this->matchTime = 0;
+    this->pendingLen = 0;
+    this->pendingPos = 0;
+}
+
+/**
+ * @brief set GPRS credentials, the bearer is opened by connect()
+ *
+ * @param apn - access point name
+ * @param user - user name
+ * @param pass - password
+ */
+void ToneIotSim800Client::setApn(const char* apn, const char* user, const char* pass) {
+    this->apn = apn;
+    this->user = user;
+    this->pass = pass;
+}
+
+int ToneIotSim800Client::connect(IPAddress ip, uint16_t port) {
+
+    char host[16];
+
+    snprintf(host, sizeof(host), "%u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
+    return connect(host, port);
+}
+
+/**
+ * @brief open bearer in single connection transparent mode and connect TCP,
+ * after "CONNECT" the modem is in data mode
+ *
+ * @param host - domain or ip
+ * @param port - port
+ * @return int = 1 - ok; 0 - error
+ */
+int ToneIotSim800Client::connect(const char* host, uint16_t port) {
+
+    char command[TOIS_LINE_SIZE + 32];
+
+    if (this->state != TOIS_STATE::CLOSED) stop();
+    // bearer of resolve() is fresh, otherwise the IP stack is reset
+    if (!this->bearer && openBearer()) return 0;
+    this->bearer = false;
+
+    snprintf(command, sizeof(command), "AT+CIPSTART=\"TCP\",\"%s\",%u", host, port);
+    if (sendAt(command, "CONNECT", TOIS_CONNECT_TIMEOUT)) return 0;
+
+    this->matched = 0;
+    this->pendingLen = 0;
+    this->pendingPos = 0;
+    this->state = TOIS_STATE::DATA;
+    return 1;
+}
+
+size_t ToneIotSim800Client::write(uint8_t b) {
+    return write(&b, 1);
+}
+
+/**
+ * @brief write raw bytes to server
+ *
+ * @param buf - array buffer
+ * @param size - size
+ * @return size_t written bytes, 0 - not in data mode
+ */
+size_t ToneIotSim800Client::write(const uint8_t* buf, size_t size) {
+
+    if (this->state != TOIS_STATE::DATA) return 0;
+    return this->stream->write(buf, size);
+}
+
+int ToneIotSim800Client::available() {
+
+    if (this->state != TOIS_STATE::DATA) return 0;
+    pump();
+    return this->pendingLen - this->pendingPos;
+}
+
+int ToneIotSim800Client::read() {
+
+    if (available() <= 0) return -1;
+    return this->pending[this->pendingPos++];
+}
+
+int ToneIotSim800Client::read(uint8_t* buf, size_t size) {
+
+    size_t n = 0;
+
+    while (n < size && available() > 0) buf[n++] = this->pending[this->pendingPos++];
+    return n;
+}
+
+int ToneIotSim800Client::peek() {
+
+    if (available() <= 0) return -1;
+    return this->pending[this->pendingPos];
+}
+
+void ToneIotSim800Client::flush() {
+    this->stream->flush();
+}
+
+/**
+ * @brief leave data mode and close connection, the bearer stays open
+ *
+ */
+void ToneIotSim800Client::stop() {
+
+    // data not read by application, "CLOSED" can be behind it
+    this->pendingLen = 0;
+    this->pendingPos = 0;
+    while (this->state == TOIS_STATE::DATA && this->stream->available()) {
+        pump();
+        this->pendingLen = 0;
+        this->pendingPos = 0;
+    }
+    if (this->state == TOIS_STATE::DATA) enterCommandMode();
+    if (this->state == TOIS_STATE::COMMAND) sendAt("AT+CIPCLOSE", "CLOSE OK", TOIS_AT_TIMEOUT);
+    this->state = TOIS_STATE::CLOSED;
+}
+
+uint8_t ToneIotSim800Client::connected() {
+
+    // "CLOSED" can be waiting in serial buffer
+    if (this->state == TOIS_STATE::DATA) pump();
+    return this->state != TOIS_STATE::CLOSED;
+}
+
+ToneIotSim800Client::operator bool() {
+    return connected();
+}
+
+/**
+ * @brief switch to command mode by "+++" escape, the connection is kept
+ *
+ * @return int8_t = 0 - ok; -1 - error
+ */
+int8_t ToneIotSim800Client::enterCommandMode() {
+
+    if (this->state == TOIS_STATE::COMMAND) return 0;
+    if (this->state != TOIS_STATE::DATA) return -1;
+
+    // escape is recognized only between two silent guard times
+    this->stream->flush();
+    delay(TOIS_GUARD_TIME);
+    this->stream->write((const uint8_t*)"+++", 3);
+    delay(TOIS_GUARD_TIME);
+    if (waitLine("OK", TOIS_AT_TIMEOUT)) return -1;
+    this->state = TOIS_STATE::COMMAND;
+    return 0;
+}
+
+/**
+ * @brief return to data mode after enterCommandMode()
+ *
+ * @return int8_t = 0 - ok; -1 - error
+ */
+int8_t ToneIotSim800Client::enterDataMode() {
+
+    if (this->state == TOIS_STATE::DATA) return 0;
+    if (this->state != TOIS_STATE::COMMAND) return -1;
+    if (sendAt("ATO", "CONNECT", TOIS_AT_TIMEOUT)) return -1;
+    this->state = TOIS_STATE::DATA;
+    return 0;
+}
+
+/**
+ * @brief send AT command and wait answer line, only in command mode or without connection
+ *
+ * @param command - command without line end
+ * @param expect - expected answer line, NULL - any line
+ * @param timeout - timeout ms
+ * @return int8_t = 0 - ok; -1 - error or timeout
+ */
+int8_t ToneIotSim800Client::sendAt(const char* command, const char* expect, uint32_t timeout) {
+
+    if (this->state == TOIS_STATE::DATA) return -1;
+    // answers of previous commands
+    while (this->stream->available()) this->stream->read();
+    this->stream->write((const uint8_t*)command, strlen(command));
+    this->stream->write((const uint8_t*)"\r\n", 2);
+    return waitLine(expect, timeout);
+}
+
+/**
+ * @brief DNS lookup by modem, resolver of ToneIotClient::setResolver().
+ * The bearer is opened for it and kept for the next connect().
+ *
+ * @param host - domain
+ * @param ip - first address of answer
+ * @return int8_t = 0 - ok; -1 - error or timeout
+ */
+int8_t ToneIotSim800Client::resolve(const char* host, IPAddress* ip) {
+
+    char command[TOIS_LINE_SIZE + 32];
+    char* begin = NULL;
+    char* end = NULL;
+    uint32_t previousMillis = 0;
+    uint32_t elapsed = 0;
+
+    if (this->state != TOIS_STATE::CLOSED) return -1;
+    if (!this->bearer) {
+        if (openBearer()) return -1;
+        this->bearer = true;
+    }
+
+    snprintf(command, sizeof(command), "AT+CDNSGIP=\"%s\"", host);
+    if (sendAt(command, "OK", TOIS_AT_TIMEOUT)) return -1;
+
+    // +CDNSGIP: 1,"domain","ip"[,"ip2"] or +CDNSGIP: 0,<error>
+    previousMillis = millis();
+    while ((elapsed = millis() - previousMillis) < TOIS_DNS_TIMEOUT) {
+        if (readLine(TOIS_DNS_TIMEOUT - elapsed)) return -1;
+        if (strncmp(this->line, "+CDNSGIP: ", 10) != 0) continue;
+        if (strncmp(this->line, "+CDNSGIP: 1,", 12) != 0) return -1;
+        begin = strstr(this->line, "\",\"");
+        if (begin == NULL) return -1;
+        begin += 3;
+        end = strchr(begin, '"');
+        if (end == NULL) return -1;
+        *end = '\0';
+        return ip->fromString(begin) ? 0 : -1;
+    }
+    return -1;
+}
+
+TOIS_STATE ToneIotSim800Client::getState() {
+    return this->state;
+}
+
+// =============================================== private =================================
+
+/**
+ * @brief read answer line without line end into line
+ *
+ * @param timeout - timeout ms
+ * @return int8_t = 0 - ok; -1 - timeout
+ */
+int8_t ToneIotSim800Client::readLine(uint32_t timeout) {
+
+    uint8_t len = 0;
+    int c = 0;
+    uint32_t previousMillis = millis();
+
+    while (millis() - previousMillis < timeout) {
+        if (!this->stream->available()) {
+            yield();
+            continue;
+        }
+        c = this->stream->read();
+        if (c == '\r') continue;
+        if (c == '\n') {
+            // empty lines around answers
+            if (len == 0) continue;
+            this->line[len] = '\0';
+            return 0;
+        }
+        if (len < TOIS_LINE_SIZE - 1) this->line[len++] = c;
+    }
+    return -1;
+}
+
+/**
+ * @brief skip lines until expected one, echo and URC are skipped
+ *
+ * @param expect - expected answer line, NULL - any line
+ * @param timeout - timeout ms
+ * @return int8_t = 0 - ok; -1 - error answer or timeout
+ */
+int8_t ToneIotSim800Client::waitLine(const char* expect, uint32_t timeout) {
+
+    uint32_t previousMillis = millis();
+    uint32_t elapsed = 0;
+
+    while ((elapsed = millis() - previousMillis) < timeout) {
+        if (readLine(timeout - elapsed)) return -1;
+        if (expect == NULL || strcmp(this->line, expect) == 0) return 0;
+        // connection is closed while waiting, e.g. answer of "+++"
+        if (strcmp(this->line, "CLOSED") == 0) {
+            this->state = TOIS_STATE::CLOSED;
+            return -1;
+        }
+        if (strcmp(this->line, "ERROR") == 0 || strcmp(this->line, "CONNECT FAIL") == 0) return -1;
+    }
+    return -1;
+}
+
+/**
+ * @brief reset IP stack and open GPRS bearer, transparent mode needs single
+ * connection mode which is set only in state IP INITIAL
+ *
+ * @return int8_t = 0 - ok; -1 - error
+ */
+int8_t ToneIotSim800Client::openBearer() {
+
+    char command[TOIS_LINE_SIZE + 32];
+
+    // ends a line left by "+++" sent after the modem left data mode itself
+    sendAt("AT", "OK", TOIS_AT_TIMEOUT);
+    if (sendAt("ATE0", "OK", TOIS_AT_TIMEOUT)) return -1;
+    if (sendAt("AT+CIPSHUT", "SHUT OK", TOIS_CONNECT_TIMEOUT)) return -1;
+    if (sendAt("AT+CIPMUX=0", "OK", TOIS_AT_TIMEOUT)) return -1;
+    if (sendAt("AT+CIPMODE=1", "OK", TOIS_AT_TIMEOUT)) return -1;
+    snprintf(command, sizeof(command), "AT+CSTT=\"%s\",\"%s\",\"%s\"", this->apn, this->user, this->pass);
+    if (sendAt(command, "OK", TOIS_AT_TIMEOUT)) return -1;
+    if (sendAt("AT+CIICR", "OK", TOIS_CONNECT_TIMEOUT)) return -1;
+    // answer is local ip without OK
+    if (sendAt("AT+CIFSR", NULL, TOIS_AT_TIMEOUT)) return -1;
+    return 0;
+}
+
+/**
+ * @brief move bytes from serial port to pending, bytes that can start
+ * "\r\nCLOSED\r\n" are held until the match fails or serial is silent
+ *
+ */
+void ToneIotSim800Client::pump() {
+
+    int c = 0;
+
+    if (this->pendingPos < this->pendingLen) return;
+    this->pendingLen = 0;
+    this->pendingPos = 0;
+
+    while (this->pendingLen == 0 && this->stream->available()) {
+        c = this->stream->read();
+        if (c < 0) break;
+        if ((uint8_t)c == (uint8_t)closedPattern[this->matched]) {
+            this->matched++;
+            this->matchTime = millis();
+            if (this->matched == TOIS_CLOSED_LEN) {
+                // modem is in command mode, connection is closed
+                this->matched = 0;
+                this->state = TOIS_STATE::CLOSED;
+                return;
+            }
+            continue;
+        }
+        // the only border of the pattern is "\r"
+        release(this->matched);
+        if (c == '\r') {
+            this->matched = 1;
+            this->matchTime = millis();
+        } else {
+            this->pending[this->pendingLen++] = c;
+        }
+    }
+
+    // held bytes were data
+    if (this->pendingLen == 0 && this->matched && millis() - this->matchTime >= TOIS_CLOSED_GUARD) {
+        release(this->matched);
+    }
+}
+
+/**
+ * @brief give out held bytes of pattern as data
+ *
+ * @param len - held bytes
+ */
+void ToneIotSim800Client::release(uint8_t len) {
+
+    memcpy(&this->pending[this->pendingLen], closedPattern, len);
+    this->pendingLen += len;
+    this->matched = 0;
+}
@@ -0,0 +1,292 @@
+/**
+    * @author Dyakonov Oleg <o.u.dyakonov@gmail.com>
+    *
+    * @brief ToneIotTelemetry - batching of periodic samples with delta-of-delta and varint compression
+*/
+
+#include "ToneIotTelemetry.h"
+
+// ======================================== public ======================================
+/**
+ *  @brief Constructor
+ */
+ToneIotTelemetry::ToneIotTelemetry() {
+
+    this->channelCount = 0;
+    this->maxAge = TOIT_MAX_AGE;
+    this->frameSize = TOIT_FRAME_SIZE;
+    this->samples = 0;
+    this->dropped = 0;
+    clear();
+}
+
+/**
+ * @brief register channel, samples of not registered channels are dropped
+ *
+ * @param id - channel id
+ * @param type - type of values
+ * @return int8_t = 0 - ok; -1 - error
+ */
+int8_t ToneIotTelemetry::addChannel(uint8_t id, TOIT_TYPE type) {
+
+    channel_t* ch = findChannel(id);
+
+    if (ch != NULL) return ch->type == type ? 0 : -1;
+    if (this->channelCount == TOIT_MAX_CHANNELS) return -1;
+    ch = &this->channel[this->channelCount++];
+    ch->id = id;
+    ch->type = type;
+    ch->count = 0;
+    ch->len = 0;
+    return 0;
+}
+
+/**
+ * @brief add sample with current time
+ *
+ * @param id - channel id
+ * @param value - value
+ * @return int8_t = 0 - ok; -1 - no channel or batch is full
+ */
+int8_t ToneIotTelemetry::add(uint8_t id, int32_t value) {
+    return add(id, (uint32_t)millis(), value);
+}
+
+int8_t ToneIotTelemetry::add(uint8_t id, float value) {
+    return add(id, (uint32_t)millis(), value);
+}
+
+/**
+ * @brief add sample
+ *
+ * @param id - channel id
+ * @param time - time of sample ms
+ * @param value - value
+ * @return int8_t = 0 - ok; -1 - no channel or batch is full
+ */
+int8_t ToneIotTelemetry::add(uint8_t id, uint32_t time, int32_t value) {
+    return addSample(id, TOIT_TYPE::INT, time, (uint32_t)value);
+}
+
+int8_t ToneIotTelemetry::add(uint8_t id, uint32_t time, float value) {
+
+    uint32_t bits = 0;
+
+    memcpy(&bits, &value, sizeof(bits));
+    return addSample(id, TOIT_TYPE::FLOAT, time, bits);
+}
+
+/**
+ * @brief set age threshold
+ *
+ * @param maxAge - ms from first sample until the batch is ready
+ */
+void ToneIotTelemetry::setMaxAge(uint32_t maxAge) {
+    this->maxAge = maxAge;
+}
+
+/**
+ * @brief set max size of encoded batch, a batch already larger is dropped
+ *
+ * @param frameSize - bytes, above TOIT_FRAME_SIZE is TOIT_FRAME_SIZE
+ */
+void ToneIotTelemetry::setFrameSize(uint16_t frameSize) {
+
+    this->frameSize = frameSize < TOIT_FRAME_SIZE ? frameSize : TOIT_FRAME_SIZE;
+    if (this->size <= this->frameSize) return;
+    // it could never be encoded
+    for (uint8_t i = 0; i < this->channelCount; i++) this->dropped += this->channel[i].count;
+    clear();
+}
+
+/**
+ * @brief batch should be sent: next sample may not fit or the first sample is too old
+ *
+ * @return true - ready
+ */
+bool ToneIotTelemetry::isReady() {
+
+    if (this->size == TOIT_HEADER_SIZE) return false;
+    if (this->size + TOIT_SAMPLE_MAX > this->frameSize) return true;
+    return millis() - this->started >= this->maxAge;
+}
+
+/**
+ * @brief write batch, the batch is kept until clear()
+ *
+ * @param buf - array buffer
+ * @param size - size buffer
+ * @return uint16_t length of batch; 0 - batch is empty or buffer is small
+ */
+uint16_t ToneIotTelemetry::encode(uint8_t* buf, uint16_t size) {
+
+    uint16_t len = TOIT_HEADER_SIZE;
+    uint8_t count = 0;
+    uint8_t head[TOIT_CHANNEL_HEADER];
+    uint8_t n = 0;
+    channel_t* ch = NULL;
+
+    if (this->size == TOIT_HEADER_SIZE) return 0;
+
+    for (uint8_t i = 0; i < this->channelCount; i++) {
+        ch = &this->channel[i];
+        if (ch->count == 0) continue;
+        n = 0;
+        head[n++] = ch->id;
+        head[n++] = (uint8_t)ch->type;
+        n += writeVarint(ch->count, &head[n]);
+        n += writeVarint(ch->firstTime, &head[n]);
+        if (ch->type == TOIT_TYPE::FLOAT) {
+            memcpy(&head[n], &ch->firstValue, 4);
+            n += 4;
+        } else {
+            n += writeVarint(zigzag((int32_t)ch->firstValue), &head[n]);
+        }
+        if (len + n + ch->len > size) return 0;
+        memcpy(&buf[len], head, n);
+        len += n;
+        memcpy(&buf[len], ch->data, ch->len);
+        len += ch->len;
+        count++;
+    }
+    buf[0] = TOIT_VERSION;
+    buf[1] = count;
+    return len;
+}
+
+/**
+ * @brief start new batch, channels are kept
+ *
+ */
+void ToneIotTelemetry::clear() {
+
+    for (uint8_t i = 0; i < this->channelCount; i++) {
+        this->channel[i].count = 0;
+        this->channel[i].len = 0;
+    }
+    this->size = TOIT_HEADER_SIZE;
+    this->started = 0;
+}
+
+/**
+ * @brief reserved size of encoded batch
+ *
+ * @return uint16_t bytes
+ */
+uint16_t ToneIotTelemetry::getSize() {
+    return this->size;
+}
+
+uint32_t ToneIotTelemetry::getSamples() {
+    return this->samples;
+}
+
+uint32_t ToneIotTelemetry::getDropped() {
+    return this->dropped;
+}
+
+// =============================================== private =================================
+
+/**
+ * @brief append sample to channel stream
+ *
+ * @param id - channel id
+ * @param type - type of value
+ * @param time - time of sample ms
+ * @param value - value bits
+ * @return int8_t = 0 - ok; -1 - error
+ */
+int8_t ToneIotTelemetry::addSample(uint8_t id, TOIT_TYPE type, uint32_t time, uint32_t value) {
+
+    channel_t* ch = findChannel(id);
+    uint8_t out[TOIT_SAMPLE_MAX];
+    uint8_t n = 0;
+    int32_t delta = 0;
+
+    if (ch == NULL || ch->type != type) return -1;
+
+    if (ch->count == 0) {
+        // header size is reserved, it is written by encode()
+        if (this->size + TOIT_CHANNEL_HEADER > this->frameSize) {
+            this->dropped++;
+            return -1;
+        }
+        if (this->size == TOIT_HEADER_SIZE) this->started = millis();
+        this->size += TOIT_CHANNEL_HEADER;
+        ch->firstTime = time;
+        ch->firstValue = value;
+        ch->lastTime = time;
+        ch->lastDelta = 0;
+        ch->lastValue = value;
+        ch->count = 1;
+        this->samples++;
+        return 0;
+    }
+
+    // periodic samples give delta-of-delta 0, one byte
+    delta = (int32_t)(time - ch->lastTime);
+    n = writeVarint(zigzag((int32_t)((uint32_t)delta - (uint32_t)ch->lastDelta)), out);
+    n += encodeValue(ch, value, &out[n]);
+    if (this->size + n > this->frameSize || ch->count == 0xFFFF) {
+        this->dropped++;
+        return -1;
+    }
+    memcpy(&ch->data[ch->len], out, n);
+    ch->len += n;
+    this->size += n;
+    ch->lastTime = time;
+    ch->lastDelta = delta;
+    ch->lastValue = value;
+    ch->count++;
+    this->samples++;
+    return 0;
+}
+
+ToneIotTelemetry::channel_t* ToneIotTelemetry::findChannel(uint8_t id) {
+
+    for (uint8_t i = 0; i < this->channelCount; i++) {
+        if (this->channel[i].id == id) return &this->channel[i];
+    }
+    return NULL;
+}
+
+/**
+ * @brief encode value against previous one: integer by delta, float by xor
+ * without trailing zero bits, slowly varying signals give 1-3 bytes
+ *
+ * @param ch - channel
+ * @param value - value bits
+ * @param out - output
+ * @return uint8_t bytes written
+ */
+uint8_t ToneIotTelemetry::encodeValue(channel_t* ch, uint32_t value, uint8_t* out) {
+
+    uint32_t x = 0;
+    uint8_t trailing = 0;
+
+    if (ch->type == TOIT_TYPE::INT) return writeVarint(zigzag((int32_t)(value - ch->lastValue)), out);
+
+    x = value ^ ch->lastValue;
+    if (x == 0) return writeVarint(0, out);
+    while ((x & 1) == 0) {
+        x >>= 1;
+        trailing++;
+    }
+    return writeVarint(((uint64_t)x << 5) | trailing, out);
+}
+
+uint8_t ToneIotTelemetry::writeVarint(uint64_t value, uint8_t* out) {
+
+    uint8_t n = 0;
+
+    while (value >= 0x80) {
+        out[n++] = (uint8_t)value | 0x80;
+        value >>= 7;
+    }
+    out[n++] = (uint8_t)value;
+    return n;
+}
+
+uint32_t ToneIotTelemetry::zigzag(int32_t value) {
+    return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
@@ -0,0 +1,288 @@
+/**
+    * @author Dyakonov Oleg <o.u.dyakonov@gmail.com>
+    *
+    * @brief ToneIotUdpClient - datagram transport of ToneIotClient over Arduino UDP
+*/
+
+#include "ToneIotUdpClient.h"
+
+#if defined(ESP32)
+#include <WiFi.h>
+#endif
+
+// ======================================== public ======================================
+/**
+ *  @brief Constructor
+ *  @param udp - UDP socket of network stack, WiFiUDP on ESP32
+ */
+ToneIotUdpClient::ToneIotUdpClient(UDP& udp) {
+
+    this->udp = &udp;
+    this->port = 0;
+    this->open = false;
+    this->txLen = 0;
+    this->rxLen = 0;
+    this->rxPos = 0;
+    this->retryLen = 0;
+    this->retries = 0;
+    this->retryDelay = TOIU_RETRY;
+    this->retryAt = 0;
+    this->dropped = 0;
+    this->repeats = 0;
+}
+
+/**
+ * @brief open local socket, datagrams go to ip:port
+ *
+ * @param ip - server address
+ * @param port - server UDP port
+ * @return int = 1 - ok; 0 - error
+ */
+int ToneIotUdpClient::connect(IPAddress ip, uint16_t port) {
+
+    if (this->open) stop();
+    if (!this->udp->begin(TOIU_LOCAL_PORT)) return 0;
+    this->ip = ip;
+    this->port = port;
+    this->open = true;
+    return 1;
+}
+
+/**
+ * @brief open local socket, datagrams go to host:port. A domain is
+ * resolved once, datagrams of other addresses are dropped
+ *
+ * @param host - ip literal or domain
+ * @param port - server UDP port
+ * @return int = 1 - ok; 0 - error, domain is not resolved
+ */
+int ToneIotUdpClient::connect(const char* host, uint16_t port) {
+
+    IPAddress ip;
+
+    if (!ip.fromString(host) && resolve(host, &ip)) return 0;
+    return connect(ip, port);
+}
+
+size_t ToneIotUdpClient::write(uint8_t b) {
+    return write(&b, 1);
+}
+
+/**
+ * @brief collect bytes of frames, every complete frame is sent as one datagram
+ *
+ * @param buf - bytes of one or more frames, a frame may be split between calls
+ * @param size - count bytes
+ * @return size_t bytes taken: size - ok; less - frames before are sent, the
+ * frame starting here is not, write it again; 0 - also error, a frame over
+ * TOIU_DATAGRAM_SIZE closes the socket
+ */
+size_t ToneIotUdpClient::write(const uint8_t* buf, size_t size) {
+
+    size_t n = 0;
+    size_t first = 0;              // byte of buf where the frame in tx starts
+    uint16_t kept = this->txLen;   // bytes of that frame taken by earlier calls
+    uint16_t frame = 0;
+
+    if (!this->open) return 0;
+    while (n < size) {
+        if (this->txLen == 0) {
+            first = n;
+            kept = 0;
+        }
+        // header first, then the frame up to its datalen
+        frame = this->txLen < ToneIotPacketView::HEADER_SIZE ? ToneIotPacketView::HEADER_SIZE
+                : ToneIotPacketView(this->tx).getSize();
+        // no datagram can carry it, ToneIotClient sees lost connection instead of waiting for room
+        if (frame > TOIU_DATAGRAM_SIZE) {
+            stop();
+            return 0;
+        }
+        while (n < size && this->txLen < frame) this->tx[this->txLen++] = buf[n++];
+        if (this->txLen < ToneIotPacketView::HEADER_SIZE || this->txLen < ToneIotPacketView(this->tx).getSize()) continue;
+        this->txLen = 0;
+        // sent frames are not repeated, the failed one is taken again from its first byte
+        if (send(this->tx, ToneIotPacketView(this->tx).getSize())) {
+            this->txLen = kept;
+            return first;
+        }
+    }
+    return size;
+}
+
+/**
+ * @brief bytes of received frame, the next datagram is taken when the frame is read
+ *
+ * @return int count bytes
+ */
+int ToneIotUdpClient::available() {
+
+    int len = 0;
+
+    if (!this->open) return 0;
+    if (this->rxPos < this->rxLen) return this->rxLen - this->rxPos;
+    repeat();
+    while ((len = this->udp->parsePacket()) > 0) {
+        if (len > TOIU_DATAGRAM_SIZE) {
+            this->udp->flush();
+            this->dropped++;
+            continue;
+        }
+        len = this->udp->read(this->rx, len);
+        // datagrams of other peers and partial frames are not passed to the stream
+        if (!(this->udp->remoteIP() == this->ip) || this->udp->remotePort() != this->port
+            || len < ToneIotPacketView::HEADER_SIZE || len != ToneIotPacketView(this->rx).getSize()) {
+            this->dropped++;
+            continue;
+        }
+        // server is alive, answer of system frame is here or on the way
+        this->retryLen = 0;
+        this->rxLen = len;
+        this->rxPos = 0;
+        return len;
+    }
+    return 0;
+}
+
+int ToneIotUdpClient::read() {
+    if (!available()) return -1;
+    return this->rx[this->rxPos++];
+}
+
+int ToneIotUdpClient::read(uint8_t* buf, size_t size) {
+
+    int len = available();
+
+    if (len == 0) return -1;
+    if ((size_t)len > size) len = size;
+    memcpy(buf, &this->rx[this->rxPos], len);
+    this->rxPos += len;
+    return len;
+}
+
+int ToneIotUdpClient::peek() {
+    if (!available()) return -1;
+    return this->rx[this->rxPos];
+}
+
+/**
+ * @brief frames are sent by write(), nothing is buffered
+ *
+ */
+void ToneIotUdpClient::flush() {
+}
+
+void ToneIotUdpClient::stop() {
+    if (this->open) this->udp->stop();
+    this->open = false;
+    this->txLen = 0;
+    this->rxLen = 0;
+    this->rxPos = 0;
+    this->retryLen = 0;
+}
+
+/**
+ * @brief socket is open, liveness of server is checked by keep alive of ToneIotClient
+ *
+ * @return uint8_t = 1 - open; 0 - closed
+ */
+uint8_t ToneIotUdpClient::connected() {
+    return this->open;
+}
+
+ToneIotUdpClient::operator bool() {
+    return this->open;
+}
+
+/**
+ * @brief set DNS resolver of connect(), without it ESP32 asks WiFi and
+ * other targets accept only ip literals
+ *
+ * @param cbResolve - resolver, returns 0 and address or -1
+ */
+void ToneIotUdpClient::setResolver(ToneIotClient::cbResolve_t cbResolve) {
+    this->cbResolve = cbResolve;
+}
+
+/**
+ * @brief get count of received datagrams dropped: not one frame or not from server
+ *
+ * @return uint32_t count
+ */
+uint32_t ToneIotUdpClient::getDropped() {
+    return this->dropped;
+}
+
+/**
+ * @brief get count of INIT, KEEPALIVE and DISCONNECT sent again
+ *
+ * @return uint32_t count
+ */
+uint32_t ToneIotUdpClient::getRepeats() {
+    return this->repeats;
+}
+
+// ======================================== private ======================================
+/**
+ * @brief address of domain
+ *
+ * @param host - domain
+ * @param ip - resolved address
+ * @return int8_t = 0 - ok; -1 - error
+ */
+int8_t ToneIotUdpClient::resolve(const char* host, IPAddress* ip) {
+
+    if (this->cbResolve) return this->cbResolve(host, ip);
+#if defined(ESP32)
+    return WiFi.hostByName(host, *ip) == 1 ? 0 : -1;
+#else
+    return -1;
+#endif
+}
+
+/**
+ * @brief send one frame as datagram, system frames awaiting answer are kept for repeat()
+ *
+ * @param buf - frame
+ * @param len - length frame
+ * @return int8_t = 0 - ok; -1 - error
+ */
+int8_t ToneIotUdpClient::send(const uint8_t* buf, uint16_t len) {
+
+    uint16_t function = ToneIotPacketView((uint8_t*)buf).getFunction() & TOIC_FUNCTION_MASK;
+    int ret = 0;
+
+    ret = this->udp->beginPacket(this->ip, this->port);
+    if (!ret) return -1;
+    if (this->udp->write(buf, len) != len) return -1;
+    if (!this->udp->endPacket()) return -1;
+
+    if (function == TOIC_FUNCTION_SYS_INIT || function == TOIC_FUNCTION_SYS_KEEPALIVE || function == TOIC_FUNCTION_SYS_DISCONNECT) {
+        memcpy(this->retry, buf, len);
+        this->retryLen = len;
+        this->retries = 0;
+        this->retryDelay = TOIU_RETRY;
+        this->retryAt = millis();
+    }
+    return 0;
+}
+
+/**
+ * @brief send kept system frame again while the server is silent
+ *
+ */
+void ToneIotUdpClient::repeat() {
+
+    if (this->retryLen == 0 || millis() - this->retryAt < this->retryDelay) return;
+    if (this->retries >= TOIU_RETRIES) {
+        this->retryLen = 0;
+        return;
+    }
+    this->retries++;
+    this->retryDelay *= 2;
+    this->retryAt = millis();
+    this->repeats++;
+    this->udp->beginPacket(this->ip, this->port);
+    this->udp->write(this->retry, this->retryLen);
+    this->udp->endPacket();
+}
@@ -61,6 +61,22 @@
 #define TINY_GSM_USE_GPRS true
 #define TINY_GSM_USE_WIFI false
 
+// Run ToneIotClient socket I/O and keep alive in own task on core 0
+// #define TONEIOT_USE_TASK
+
+// Use SIM800 transparent mode instead of TinyGsmClient, frames go to the UART without AT+CIPSEND
+// #define TONEIOT_USE_TRANSPARENT
+
+// Telemetry batch function and channels, decoded by tools/toneiot_server.py --telemetry 30
+#define TELEMETRY_FUNCTION      30
+#define TELEMETRY_PERIOD        10000
+#define TELEMETRY_TEMPERATURE   1
+#define TELEMETRY_HEAP          2
+
+// Profile table of hot paths with build flag TOIP_PROFILE, printed and sent to tools/toneiot_server.py --profile 31
+#define PROFILE_FUNCTION        31
+#define PROFILE_PERIOD          60000
+
 // set GSM PIN, if any
 #define GSM_PIN ""
 
@@ -71,6 +87,10 @@ const char gprsPass[] = "";
 
 #include <TinyGsmClient.h>
 #include <ToneIotClient.h>
+#include <ToneIotDelta.h>
+#include <ToneIotSim800Client.h>
+#include <ToneIotTelemetry.h>
+#include <ToneIotProfile.h>
 
 #ifdef DUMP_AT_COMMANDS
 #include <StreamDebugger.h>
@@ -79,12 +99,28 @@ TinyGsm modem(debugger);
 #else
 TinyGsm modem(SerialAT);
 #endif
+#ifdef TONEIOT_USE_TRANSPARENT
+ToneIotSim800Client client(SerialAT);
+#else
 TinyGsmClient client(modem);
+#endif
 ToneIotClient toneiotclient(client);
+ToneIotDelta delta;
+ToneIotTelemetry telemetry;
+#if defined(MODEM_DTR) && defined(MODEM_RI)
+// modem sleeps between batches of not urgent packets. A sleeping modem ignores
+// the UART: toneiotclient does not poll the socket then, data of server wakes
+// it by RI. TinyGsmClient polls the socket by AT commands (CIPRXGET, CIPSTATUS),
+// do not call client or modem methods from the sketch while it sleeps, they
+// wait their AT timeout and TinyGsmClient closes the socket
+ToneIotRadio radio(MODEM_DTR, MODEM_RI);
+#endif
 
 int ledStatus = LOW;
 
 uint32_t lastReconnectAttempt = 0;
+uint32_t lastSample = 0;
+uint32_t lastProfile = 0;
 
 // void mqttCallback(char *topic, byte *payload, unsigned int len)
 // {
@@ -152,6 +188,21 @@ int8_t modemConnect()
         SerialMon.println("Network connected");
     }
 
+#if defined(MODEM_DTR) && defined(MODEM_RI)
+    // sleep while DTR is high, RI pulse on incoming data
+    modem.sleepEnable(true);
+    modem.sendAT(GF("+CFGRI=1"));
+    modem.waitResponse();
+#endif
+
+#ifdef TONEIOT_USE_TRANSPARENT
+    // bearer is opened in transparent mode by client.connect()
+    client.setApn(apn, gprsUser, gprsPass);
+    // server domain is resolved by modem once per TOIC_DNS_TTL
+    toneiotclient.setResolver([](const char* host, IPAddress* ip) { return client.resolve(host, ip); });
+    return 0;
+#endif
+
     // GPRS connection parameters are usually set after network registration
     SerialMon.print(F("Connecting to "));
     SerialMon.print(apn);
@@ -185,6 +236,19 @@ void setup()
 
     delay(6000);
 
+    toneiotclient.setDelta(delta);
+    // chip temperature and free heap, batched by telemetry
+    telemetry.addChannel(TELEMETRY_TEMPERATURE, TOIT_TYPE::FLOAT);
+    telemetry.addChannel(TELEMETRY_HEAP, TOIT_TYPE::INT);
+    toneiotclient.setTelemetry(telemetry, TELEMETRY_FUNCTION);
+#if defined(MODEM_DTR) && defined(MODEM_RI)
+    radio.begin();
+    toneiotclient.setRadio(radio);
+#endif
+#ifdef TONEIOT_USE_TASK
+    toneiotclient.startTask();
+#endif
+
     if (modemConnect() != 0){
       return;
     }
@@ -210,6 +274,29 @@ void loop()
         return;
     }
 
+    if (millis() - lastSample >= TELEMETRY_PERIOD) {
+        lastSample = millis();
+        telemetry.add(TELEMETRY_TEMPERATURE, temperatureRead());
+        telemetry.add(TELEMETRY_HEAP, (int32_t)ESP.getFreeHeap());
+    }
+
+#ifdef TOIP_PROFILE
+    if (millis() - lastProfile >= PROFILE_PERIOD) {
+        lastProfile = millis();
+        ToneIotProfile::print(SerialMon);
+        toneiotclient.sendProfile(PROFILE_FUNCTION);
+    }
+#endif
+
+    toneiotclient.loop();
+
+    // new firmware is written by delta update
+    if (delta.getState() == TOID_STATE::DONE) {
+        SerialMon.println("Firmware updated, restart");
+        toneiotclient.disconnect();
+        ESP.restart();
+    }
+
     //ToneIotClient::packet_t *packet = NULL;
 
     // if (toneiotclient.readPacket(&packet) == 0){
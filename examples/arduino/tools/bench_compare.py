@@ -0,0 +1,76 @@
+#!/usr/bin/env python3
+"""
+Compare two results of microbenchmarks (bench/bench_micro.cpp, env
+bench_micro) and flag regressions.
+
+    bench_compare.py base.json new.json [--threshold 30] [--noise 2] [--metric cpu_time]
+
+Files are in the JSON format of Google Benchmark, the baseline is
+bench/baseline.json. Benchmarks are matched by name; missing ones are
+listed and do not fail. Exits 1 when a benchmark gets slower by more than
+threshold percent and, when both files have cpu_stddev of repetitions, by
+more than noise times their combined standard deviation. Repeated runs on
+one VM differ by 20-25%, the default threshold is above that. Results of
+other hosts (cpu model, kernel, cpus in context) are compared with a
+warning, regenerate the baseline on the host of the comparison.
+"""
+
+import argparse
+import json
+import math
+import sys
+
+UNITS = {"ns": 1.0, "us": 1e3, "ms": 1e6, "s": 1e9}
+
+# context keys of the host, results of different hosts do not compare
+HOST_KEYS = ("host_name", "cpu_model", "num_cpus", "kernel", "compiler", "library_build_type")
+
+
+def load(path, metric):
+    """JSON -> (context, {name: (ns per iteration, stddev ns or None)}), aggregates of repetitions are skipped"""
+    with open(path) as f:
+        data = json.load(f)
+    results = {}
+    for b in data["benchmarks"]:
+        if b.get("run_type", "iteration") != "iteration":
+            continue
+        unit = UNITS[b.get("time_unit", "ns")]
+        stddev = b.get("cpu_stddev") if metric == "cpu_time" else None
+        results[b["name"]] = (b[metric] * unit, stddev * unit if stddev is not None else None)
+    return data.get("context", {}), results
+
+
+def main(argv):
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("base")
+    parser.add_argument("new")
+    parser.add_argument("--threshold", type=float, default=30, help="percent")
+    parser.add_argument("--noise", type=float, default=2, help="times combined stddev of repetitions")
+    parser.add_argument("--metric", choices=("cpu_time", "real_time"), default="cpu_time")
+    args = parser.parse_args(argv[1:])
+
+    base_context, base = load(args.base, args.metric)
+    new_context, new = load(args.new, args.metric)
+    for key in HOST_KEYS:
+        if base_context.get(key) != new_context.get(key):
+            print("warning: %s differs: %s / %s" % (key, base_context.get(key), new_context.get(key)))
+    worse = 0
+    print("%-34s %12s %12s %8s %8s" % ("Benchmark", "base ns", "new ns", "change", "noise"))
+    for name in [n for n in base if n in new]:
+        (a, sa), (b, sb) = base[name], new[name]
+        change = (b - a) * 100.0 / a if a else 0.0
+        noise = args.noise * math.hypot(sa, sb) * 100.0 / a if a and sa is not None and sb is not None else 0.0
+        bad = change > args.threshold and change > noise
+        worse += bad
+        print("%-34s %12.1f %12.1f %+7.1f%% %7.1f%%%s" % (name, a, b, change, noise, "  REGRESSION" if bad else ""))
+    for name in [n for n in base if n not in new]:
+        print("%-34s missing in %s" % (name, args.new))
+    for name in [n for n in new if n not in base]:
+        print("%-34s new, not in %s" % (name, args.base))
+    if worse:
+        print("%d of %d benchmarks slower by more than %g%% and the noise" % (worse, len(set(base) & set(new)), args.threshold))
+    return 1 if worse else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
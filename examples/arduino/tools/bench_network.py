@@ -0,0 +1,217 @@
+#!/usr/bin/env python3
+"""
+Network-profile benchmark of ToneIotClient: runs bench/bench_network.cpp
+(env bench_network) over shaped links and writes JSON results.
+
+    bench_network.py run --console /dev/ttyUSB0 --modem /dev/ttyUSB1 [--out bench.json]
+                         [--profiles edge,gprs,badcell] [--latency 100,300]
+                         [--bandwidth 40000] [--loss 0,0.02] [--timeout 900]
+    bench_network.py run --exec .pio/build/bench_network/program --link /tmp/ttySIM800 ...
+    bench_network.py compare base.json new.json [--threshold 10]
+
+For every combination of profile and overrides the server stand-in and
+the SIM800 emulator are started, the device is reset through DTR/RTS of
+the console (or --exec is started) and BENCH lines are collected until
+"done". The board is wired with SerialAT to the USB-serial adapter
+--modem; --link is the pty for a host build of the sketch.
+
+compare matches runs by link parameters and exits 1 when a metric gets
+worse by more than threshold percent.
+"""
+
+import argparse
+import asyncio
+import itertools
+import json
+import subprocess
+import sys
+import time
+
+import sim800_emulator
+import toneiot_server
+
+BENCH_FUNCTION_DROP = 0x3FF0
+
+# metrics compared, True - higher is better
+METRICS = {
+    "connect": {"p50_ms": False, "p90_ms": False},
+    "request": {"p50_ms": False, "p90_ms": False, "p99_ms": False},
+    "throughput": {"payload_Bps": True, "wire_per_payload": False},
+    "recovery": {"p50_ms": False, "max_ms": False},
+}
+
+
+class BenchServer(toneiot_server.Server):
+    """closes the connection on BENCH_FUNCTION_DROP"""
+
+    def on_function(self, session, msg_id, function, data):
+        if function == BENCH_FUNCTION_DROP:
+            session.writer.close()
+
+
+class Console:
+    """BENCH lines of device: serial console with reset or started process"""
+
+    def __init__(self, args):
+        self.args = args
+        self.process = None
+        self.serial = None
+
+    def start(self):
+        if self.args.exec:
+            self.process = subprocess.Popen(self.args.exec, shell=True, stdout=subprocess.PIPE)
+            return
+        import serial  # pyserial, only for boards
+        self.serial = serial.Serial(self.args.console, 115200, timeout=1)
+        # same reset sequence as esptool: EN low through RTS, IO0 high through DTR
+        self.serial.dtr = False
+        self.serial.rts = True
+        time.sleep(0.1)
+        self.serial.rts = False
+
+    def readline(self):
+        if self.process is not None:
+            return self.process.stdout.readline().decode(errors="replace")
+        return self.serial.readline().decode(errors="replace")
+
+    def stop(self):
+        if self.process is not None:
+            self.process.kill()
+            self.process.wait()
+        if self.serial is not None:
+            self.serial.close()
+
+
+def collect(console, timeout):
+    """results of one run {scenario: {...}}, blocking"""
+    results = {}
+    end = time.monotonic() + timeout
+    while time.monotonic() < end:
+        line = console.readline()
+        if not line:
+            if console.process is not None and console.process.poll() is not None:
+                break
+            continue
+        if not line.startswith("BENCH "):
+            continue
+        record = json.loads(line[6:])
+        if record.get("event") == "done":
+            return results
+        if "scenario" in record:
+            results[record.pop("scenario")] = record
+    results["timeout"] = True
+    return results
+
+
+async def run_one(args, profile):
+    server = BenchServer(args.verbose)
+    listener = await server.start("127.0.0.1", 0)
+    port = listener.sockets[0].getsockname()[1]
+    modem_args = argparse.Namespace(link=args.link, serial=args.modem, baud=args.baud,
+                                    seed=args.seed, verbose=args.verbose,
+                                    target=("127.0.0.1", port))
+    modem = sim800_emulator.Modem(modem_args, profile)
+    modem.start()
+    console = Console(args)
+    console.start()
+    try:
+        results = await asyncio.get_running_loop().run_in_executor(None, collect, console, args.timeout)
+    finally:
+        console.stop()
+        modem.close()
+        listener.close()
+    results["link"] = modem.stats()
+    return results
+
+
+def matrix(args):
+    """link parameters of every run"""
+    overrides = []
+    for key in ("latency", "jitter", "bandwidth", "loss"):
+        values = getattr(args, key)
+        overrides.append([(key, float(v)) for v in values.split(",")] if values else [None])
+    for name in args.profiles.split(","):
+        for combo in itertools.product(*overrides):
+            profile = dict(sim800_emulator.PROFILES[name])
+            profile.update(item for item in combo if item is not None)
+            profile["name"] = name
+            yield profile
+
+
+def run(args):
+    try:
+        commit = subprocess.check_output(["git", "rev-parse", "--short", "HEAD"],
+                                         stderr=subprocess.DEVNULL).decode().strip()
+    except (OSError, subprocess.CalledProcessError):
+        commit = ""
+    report = {"commit": commit, "date": time.strftime("%Y-%m-%dT%H:%M:%S"), "runs": []}
+    for profile in matrix(args):
+        sys.stderr.write("run %s\n" % profile)
+        results = asyncio.run(run_one(args, profile))
+        report["runs"].append({"profile": profile, "results": results})
+        sys.stderr.write("  %s\n" % json.dumps(results))
+    with open(args.out, "w") as f:
+        json.dump(report, f, indent=2, sort_keys=True)
+    return 0
+
+
+def run_key(profile):
+    return tuple(sorted((k, v) for k, v in profile.items() if k != "csq"))
+
+
+def compare(args):
+    with open(args.base) as f:
+        base = {run_key(r["profile"]): r["results"] for r in json.load(f)["runs"]}
+    with open(args.new) as f:
+        new = {run_key(r["profile"]): r["results"] for r in json.load(f)["runs"]}
+    worse = 0
+    for key in sorted(set(base) & set(new), key=str):
+        name = dict(key)
+        print("%s latency=%g jitter=%g bandwidth=%g loss=%g" % (
+            name["name"], name["latency"], name["jitter"], name["bandwidth"], name["loss"]))
+        for scenario, metrics in METRICS.items():
+            for metric, higher in metrics.items():
+                a = base[key].get(scenario, {}).get(metric)
+                b = new[key].get(scenario, {}).get(metric)
+                if a is None or b is None:
+                    continue
+                change = (b - a) * 100.0 / a if a else 0.0
+                bad = (change < -args.threshold) if higher else (change > args.threshold)
+                worse += bad
+                print("  %-10s %-16s %12g %12g %+7.1f%%%s" % (
+                    scenario, metric, a, b, change, "  REGRESSION" if bad else ""))
+    return 1 if worse else 0
+
+
+def main(argv):
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    sub = parser.add_subparsers(dest="command", required=True)
+    p = sub.add_parser("run")
+    p.add_argument("--console", help="serial console of board")
+    p.add_argument("--modem", help="USB-serial adapter wired to SerialAT of board")
+    p.add_argument("--exec", help="host build of bench sketch instead of board")
+    p.add_argument("--link", default="/tmp/ttySIM800", help="pty symlink for --exec")
+    p.add_argument("--baud", type=int, default=115200)
+    p.add_argument("--profiles", default="edge,gprs,badcell")
+    p.add_argument("--latency")
+    p.add_argument("--jitter")
+    p.add_argument("--bandwidth")
+    p.add_argument("--loss")
+    p.add_argument("--seed", type=int, default=1)
+    p.add_argument("--timeout", type=float, default=900, help="s per run")
+    p.add_argument("--out", default="bench.json")
+    p.add_argument("-v", "--verbose", action="store_true")
+    p = sub.add_parser("compare")
+    p.add_argument("base")
+    p.add_argument("new")
+    p.add_argument("--threshold", type=float, default=10, help="percent")
+    args = parser.parse_args(argv[1:])
+    if args.command == "compare":
+        return compare(args)
+    if not args.exec and not (args.console and args.modem):
+        parser.error("run needs --console and --modem, or --exec")
+    return run(args)
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
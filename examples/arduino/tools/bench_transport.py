@@ -0,0 +1,256 @@
+#!/usr/bin/env python3
+"""
+Transport comparison of ToneIotClient: runs bench/bench_transport.cpp
+(env bench_transport) over TCP and over UDP datagrams (ToneIotUdpClient)
+through the same shaped link and prints time to first message and
+request latency side by side.
+
+    bench_transport.py --exec .pio/build/bench_transport/program
+                       [--profiles loopback,edge,gprs,badcell] [--latency ms]
+                       [--jitter ms] [--bandwidth bit/s] [--loss p]
+                       [--connects 20] [--requests 100] [--seed n] [--out transport.json]
+
+Link profiles are the ones of sim800_emulator.py. The TCP link keeps
+order and delays a lost segment by a retransmission, connect costs one
+round trip and a lost SYN RTO_MIN more. The UDP link delays every datagram
+on its own and drops lost ones, delivery is left to the client: QoS of the
+function and repeats of system frames by ToneIotUdpClient.
+"""
+
+import argparse
+import asyncio
+import json
+import random
+import sys
+
+import bench_network
+import sim800_emulator
+import toneiot_server
+
+METRICS = ("p50_ms", "p90_ms", "p99_ms", "max_ms", "fail")
+
+
+class TcpProxy:
+    """TCP connections of device bridged to target through sim800_emulator.Link"""
+
+    def __init__(self, profile, rng, target):
+        self.profile = profile
+        self.rng = rng
+        self.target = target
+        self.lost = 0
+        self.links = []
+
+    async def start(self):
+        return await asyncio.start_server(self.accept, "127.0.0.1", 0)
+
+    async def accept(self, reader, writer):
+        # handshake over the link, a lost SYN waits the retransmission; bytes
+        # of device leave after it
+        delay = 2 * self.profile["latency"] / 1000.0
+        while self.profile["loss"] and self.rng.random() < self.profile["loss"]:
+            self.lost += 1
+            delay += sim800_emulator.RTO_MIN
+        await asyncio.sleep(delay)
+        try:
+            target_reader, target_writer = await asyncio.open_connection(*self.target)
+        except OSError:
+            writer.close()
+            return
+
+        def uplink(data):
+            if data is None:
+                target_writer.close()
+            elif not target_writer.is_closing():
+                target_writer.write(data)
+
+        def downlink(data):
+            if data is None:
+                writer.close()
+            elif not writer.is_closing():
+                writer.write(data)
+
+        up = sim800_emulator.Link(self.profile, self.rng, uplink)
+        down = sim800_emulator.Link(self.profile, self.rng, downlink)
+        self.links += [up, down]
+        asyncio.ensure_future(self.pump(reader, up))
+        await self.pump(target_reader, down)
+
+    async def pump(self, reader, link):
+        while True:
+            try:
+                data = await reader.read(4096)
+            except ConnectionError:
+                data = b""
+            if not data:
+                break
+            link.send(data)
+        link.close()
+
+    def stats(self):
+        return {"bytes": sum(link.bytes for link in self.links),
+                "lost": self.lost + sum(link.lost for link in self.links)}
+
+
+class DatagramLink:
+    """one direction of shaped link for datagrams: lost ones are dropped, order is not kept"""
+
+    def __init__(self, profile, rng, deliver):
+        self.profile = profile
+        self.rng = rng
+        self.deliver = deliver
+        self.loop = asyncio.get_running_loop()
+        self.busy = 0.0         # end of serialization of last datagram
+        self.bytes = 0
+        self.lost = 0
+
+    def send(self, data):
+        p = self.profile
+        now = self.loop.time()
+        self.busy = max(self.busy, now)
+        if p["bandwidth"]:
+            self.busy += len(data) * 8.0 / p["bandwidth"]
+        self.bytes += len(data)
+        if p["loss"] and self.rng.random() < p["loss"]:
+            self.lost += 1
+            return
+        delay = (p["latency"] + self.rng.uniform(0, p["jitter"])) / 1000.0
+        self.loop.call_at(self.busy + delay, self.deliver, data)
+
+
+class Upstream(asyncio.DatagramProtocol):
+    """socket of one device address towards target"""
+
+    def __init__(self, down):
+        self.down = down
+
+    def datagram_received(self, data, addr):
+        self.down.send(data)
+
+
+class UdpProxy(asyncio.DatagramProtocol):
+    """datagrams of devices forwarded to target through DatagramLink"""
+
+    def __init__(self, profile, rng, target):
+        self.profile = profile
+        self.rng = rng
+        self.target = target
+        self.transport = None
+        self.peers = {}         # device address -> uplink DatagramLink
+        self.links = []
+
+    async def start(self):
+        transport, _ = await asyncio.get_running_loop().create_datagram_endpoint(
+            lambda: self, local_addr=("127.0.0.1", 0))
+        return transport
+
+    def connection_made(self, transport):
+        self.transport = transport
+
+    def datagram_received(self, data, addr):
+        if addr not in self.peers:
+            self.peers[addr] = self.open(addr)
+        self.peers[addr].send(data)
+
+    def open(self, addr):
+        state = {"transport": None, "pending": []}
+
+        def uplink(data):
+            if state["transport"] is None:
+                state["pending"].append(data)
+            else:
+                state["transport"].sendto(data)
+
+        async def connect():
+            state["transport"], _ = await asyncio.get_running_loop().create_datagram_endpoint(
+                lambda: Upstream(down), remote_addr=self.target)
+            for data in state["pending"]:
+                state["transport"].sendto(data)
+
+        up = DatagramLink(self.profile, self.rng, uplink)
+        down = DatagramLink(self.profile, self.rng, lambda data: self.transport.sendto(data, addr))
+        self.links += [up, down]
+        asyncio.ensure_future(connect())
+        return up
+
+    def stats(self):
+        return {"bytes": sum(link.bytes for link in self.links),
+                "lost": sum(link.lost for link in self.links)}
+
+
+async def run_one(args, profile):
+    server = toneiot_server.Server(args.verbose)
+    listener = await server.start("127.0.0.1", 0)
+    port = listener.sockets[0].getsockname()[1]
+    datagrams = await server.start_udp("127.0.0.1", port)
+    target = ("127.0.0.1", port)
+    tcp = TcpProxy(profile, random.Random(args.seed), target)
+    udp = UdpProxy(profile, random.Random(args.seed), target)
+    tcp_listener = await tcp.start()
+    udp_transport = await udp.start()
+    proxies = {"tcp": (tcp, tcp_listener.sockets[0].getsockname()[1]),
+               "udp": (udp, udp_transport.get_extra_info("sockname")[1])}
+    results = {}
+    try:
+        for transport, (proxy, proxy_port) in proxies.items():
+            command = "%s --%s 127.0.0.1:%d --connects %d --requests %d" % (
+                args.exec, transport, proxy_port, args.connects, args.requests)
+            console = bench_network.Console(argparse.Namespace(exec=command))
+            console.start()
+            try:
+                results[transport] = await asyncio.get_running_loop().run_in_executor(
+                    None, bench_network.collect, console, args.timeout)
+            finally:
+                console.stop()
+            results[transport]["link"] = proxy.stats()
+    finally:
+        tcp_listener.close()
+        udp_transport.close()
+        datagrams.close()
+        listener.close()
+    return results
+
+
+def report(profile, results, out=sys.stdout):
+    out.write("%s latency=%g jitter=%g bandwidth=%g loss=%g\n" % (
+        profile["name"], profile["latency"], profile["jitter"], profile["bandwidth"], profile["loss"]))
+    out.write("  %-8s %-8s %10s %10s %8s\n" % ("scenario", "metric", "tcp", "udp", "udp/tcp"))
+    for scenario in ("first", "request"):
+        for metric in METRICS:
+            a = results.get("tcp", {}).get(scenario, {}).get(metric)
+            b = results.get("udp", {}).get(scenario, {}).get(metric)
+            if a is None or b is None:
+                continue
+            ratio = "%8.2f" % (b / a) if a and metric != "fail" else "%8s" % "-"
+            out.write("  %-8s %-8s %10g %10g %s\n" % (scenario, metric, a, b, ratio))
+
+
+def main(argv):
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("--exec", required=True, help="host build of bench/bench_transport.cpp")
+    parser.add_argument("--profiles", default="loopback,edge,gprs,badcell")
+    parser.add_argument("--latency")
+    parser.add_argument("--jitter")
+    parser.add_argument("--bandwidth")
+    parser.add_argument("--loss")
+    parser.add_argument("--connects", type=int, default=20)
+    parser.add_argument("--requests", type=int, default=100)
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("--timeout", type=float, default=900, help="s per transport")
+    parser.add_argument("--out", help="JSON results")
+    parser.add_argument("-v", "--verbose", action="store_true")
+    args = parser.parse_args(argv[1:])
+
+    runs = []
+    for profile in bench_network.matrix(args):
+        sys.stderr.write("run %s\n" % profile)
+        results = asyncio.run(run_one(args, profile))
+        runs.append({"profile": profile, "results": results})
+        report(profile, results)
+    if args.out:
+        with open(args.out, "w") as f:
+            json.dump({"runs": runs}, f, indent=2, sort_keys=True)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
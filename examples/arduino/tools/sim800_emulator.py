@@ -0,0 +1,570 @@
+#!/usr/bin/env python3
+"""
+SIM800 modem emulator on a pty: implements the AT subset used by TinyGsm
+(SIM800, multi connection, AT+CIPRXGET) and by ToneIotSim800Client
+(single connection transparent mode), bridges every data connection to a
+local TCP endpoint through a shaped link.
+
+    sim800_emulator.py [--link /tmp/ttySIM800 | --serial /dev/ttyUSB1 [--baud 115200]]
+                       [--target 127.0.0.1:5000] [--profile gprs] [--latency ms]
+                       [--jitter ms] [--bandwidth bit/s] [--loss p] [--seed n] [-v]
+
+The device side opens --link as serial port, or a board is wired to the
+USB-serial adapter --serial instead of its SIM800. Link profiles model one-way
+latency, uniform jitter, bandwidth (serialization delay per direction)
+and loss. Connecting by domain costs one more round trip for DNS, the
+domain is resolved by AT+CDNSGIP to the target address. The link carries TCP, so a lost segment is not dropped but
+delayed by a retransmission, order of bytes is kept.
+"""
+
+import argparse
+import asyncio
+import os
+import random
+import re
+import sys
+import termios
+import tty
+
+PROFILES = {
+    #           one-way ms, jitter ms, bit/s,  loss,  CSQ
+    "loopback": dict(latency=0, jitter=0, bandwidth=0, loss=0.0, csq=31),
+    "edge":     dict(latency=150, jitter=50, bandwidth=200000, loss=0.005, csq=22),
+    "gprs":     dict(latency=300, jitter=100, bandwidth=40000, loss=0.01, csq=16),
+    "badcell":  dict(latency=800, jitter=600, bandwidth=10000, loss=0.08, csq=6),
+}
+
+SEGMENT = 536           # bytes per shaped segment, GPRS MSS
+RTO_MIN = 1.0           # s, retransmission delay of lost segment at least
+ESCAPE_GUARD = 0.5      # s, silence around "+++", device uses 1 s
+LOCAL_IP = "10.0.0.2"
+
+
+def is_ip(host):
+    parts = host.split(".")
+    return len(parts) == 4 and all(p.isdigit() and int(p) < 256 for p in parts)
+
+
+class Link:
+    """one direction of shaped link, deliver(data) is called in order, None - close"""
+
+    def __init__(self, profile, rng, deliver):
+        self.profile = profile
+        self.rng = rng
+        self.deliver = deliver
+        self.loop = asyncio.get_running_loop()
+        self.busy = 0.0         # end of serialization of last segment
+        self.last = 0.0         # delivery time of last segment
+        self.bytes = 0
+        self.segments = 0
+        self.lost = 0
+
+    def delay(self):
+        p = self.profile
+        delay = (p["latency"] + self.rng.uniform(0, p["jitter"])) / 1000.0
+        while p["loss"] and self.rng.random() < p["loss"]:
+            self.lost += 1
+            delay += max(RTO_MIN, 2 * p["latency"] / 1000.0)
+        return delay
+
+    def send(self, data):
+        now = self.loop.time()
+        bandwidth = self.profile["bandwidth"]
+        for pos in range(0, len(data), SEGMENT):
+            chunk = data[pos:pos + SEGMENT]
+            self.busy = max(self.busy, now)
+            if bandwidth:
+                self.busy += len(chunk) * 8.0 / bandwidth
+            self.last = max(self.busy + self.delay(), self.last)
+            self.loop.call_at(self.last, self.deliver, chunk)
+            self.bytes += len(chunk)
+            self.segments += 1
+
+    def close(self):
+        now = self.loop.time()
+        self.last = max(now + self.delay(), self.last)
+        self.loop.call_at(self.last, self.deliver, None)
+
+
+class Connection:
+    """data connection of modem bridged to target"""
+
+    def __init__(self, modem, mux, host, port):
+        self.modem = modem
+        self.mux = mux
+        self.host = host
+        self.port = port
+        self.writer = None
+        self.rx = bytearray()       # received, waiting AT+CIPRXGET or ATO
+        self.state = "CONNECTING"
+        self.up = Link(modem.profile, modem.rng, self.uplink)
+        self.down = Link(modem.profile, modem.rng, self.downlink)
+
+    async def open(self, target):
+        # TCP handshake over the radio takes one round trip, a domain one more for DNS
+        rtt = 2 * self.modem.profile["latency"] / 1000.0
+        await asyncio.sleep(rtt if is_ip(self.host) else 2 * rtt)
+        try:
+            reader, self.writer = await asyncio.open_connection(*target)
+        except OSError:
+            self.state = "CLOSED"
+            return False
+        self.state = "CONNECTED"
+        asyncio.ensure_future(self.pump(reader))
+        return True
+
+    async def pump(self, reader):
+        while True:
+            try:
+                data = await reader.read(4096)
+            except ConnectionError:
+                data = b""
+            if not data:
+                break
+            self.down.send(data)
+        self.down.close()
+
+    def uplink(self, data):
+        if data is not None and self.writer is not None and not self.writer.is_closing():
+            self.writer.write(data)
+
+    def downlink(self, data):
+        if self.state != "CONNECTED":
+            return
+        if data is None:
+            self.state = "CLOSED"
+            self.modem.closed(self)
+            return
+        self.modem.received(self, data)
+
+    def close(self):
+        self.state = "CLOSED"
+        if self.writer is not None:
+            self.writer.close()
+
+
+class Modem:
+
+    def __init__(self, args, profile):
+        self.args = args
+        self.profile = profile
+        self.rng = random.Random(args.seed)
+        self.target = args.target
+        self.history = []           # all connections, for stats
+        if args.serial:
+            self.master = os.open(args.serial, os.O_RDWR | os.O_NOCTTY)
+            self.slave = None
+            tty.setraw(self.master)
+            attr = termios.tcgetattr(self.master)
+            attr[4] = attr[5] = getattr(termios, "B%d" % args.baud)
+            termios.tcsetattr(self.master, termios.TCSANOW, attr)
+        else:
+            self.master, self.slave = os.openpty()
+            tty.setraw(self.slave)
+            tty.setraw(self.master)
+        self.reset()
+
+    def reset(self):
+        self.echo = True
+        self.mux = 0
+        self.transparent = 0
+        self.rxget = 0
+        self.qsend = 0
+        self.bearer = False
+        self.connections = {}
+        self.line = bytearray()
+        self.sending = None         # (connection, remaining bytes or None for Ctrl-Z)
+        self.send_data = bytearray()
+        self.skip_lf = False
+        self.data_mode = None       # connection in transparent data mode
+        self.plus = 0               # held "+" of escape
+        self.last_rx = 0.0
+
+    # ------------------------------------------------------------------ pty
+    def start(self):
+        self.loop = asyncio.get_running_loop()
+        name = os.ttyname(self.slave) if self.slave is not None else self.args.serial
+        if self.args.link and self.slave is not None:
+            if os.path.lexists(self.args.link):
+                os.unlink(self.args.link)
+            os.symlink(name, self.args.link)
+        sys.stderr.write("sim800 on %s -> %s, target %s:%d, %s\n" % (
+            self.args.link or name, name, self.target[0], self.target[1], self.profile))
+        self.loop.add_reader(self.master, self.on_pty)
+
+    def write(self, data):
+        if isinstance(data, str):
+            data = data.encode()
+        os.write(self.master, data)
+
+    def answer(self, *lines):
+        for line in lines:
+            self.write("\r\n%s\r\n" % line)
+
+    def log(self, text):
+        if self.args.verbose:
+            sys.stderr.write("sim800: %s\n" % text)
+
+    def on_pty(self):
+        try:
+            data = os.read(self.master, 4096)
+        except OSError:
+            return
+        now = self.loop.time()
+        silent = now - self.last_rx >= ESCAPE_GUARD
+        self.last_rx = now
+        if self.data_mode is not None:
+            self.on_data(data, silent, now)
+        else:
+            self.on_command(data)
+
+    # ------------------------------------------------------------ data mode
+    def on_data(self, data, silent, now):
+        conn = self.data_mode
+        # "+++" only after silence and followed by silence
+        if data.strip(b"+") == b"" and (silent or self.plus) and self.plus + len(data) <= 3:
+            self.plus += len(data)
+            if self.plus == 3:
+                self.loop.call_at(now + ESCAPE_GUARD, self.escape, now)
+            return
+        if self.plus:
+            conn.up.send(b"+" * self.plus)
+            self.plus = 0
+        conn.up.send(data)
+
+    def escape(self, time):
+        if self.plus != 3 or self.last_rx != time:
+            return
+        self.plus = 0
+        self.data_mode = None
+        self.log("escape to command mode")
+        self.answer("OK")
+
+    def received(self, conn, data):
+        if self.transparent:
+            if self.data_mode is conn:
+                self.write(data)
+            else:
+                conn.rx += data
+        elif self.rxget:
+            if not conn.rx:
+                self.answer("+CIPRXGET: 1" + (",%d" % conn.mux if self.mux else ""))
+            conn.rx += data
+        elif self.mux:
+            self.write("\r\n+RECEIVE,%d,%d:\r\n" % (conn.mux, len(data)))
+            self.write(data)
+        else:
+            self.write(data)
+
+    def closed(self, conn):
+        self.log("connection %d closed by server" % conn.mux)
+        if self.data_mode is conn:
+            self.data_mode = None
+        self.connections.pop(conn.mux, None)
+        if self.mux:
+            self.answer("%d, CLOSED" % conn.mux)
+        else:
+            self.answer("CLOSED")
+
+    # --------------------------------------------------------- command mode
+    def on_command(self, data):
+        for byte in data:
+            if self.sending is not None:
+                self.on_send_byte(byte)
+                continue
+            if byte == 0x0D:
+                line = self.line.decode(errors="replace").strip()
+                self.line.clear()
+                if self.echo:
+                    self.write(line + "\r")
+                if line:
+                    self.command(line)
+            elif byte != 0x0A:
+                self.line.append(byte)
+
+    def on_send_byte(self, byte):
+        conn, remaining = self.sending
+        # line end of AT+CIPSEND arrives before the prompt
+        if byte == 0x0A and not self.send_data and self.skip_lf:
+            self.skip_lf = False
+            return
+        self.skip_lf = False
+        if remaining is None:
+            if byte == 0x1B:
+                self.sending = None
+                self.send_data.clear()
+                self.answer("OK")
+                return
+            if byte != 0x1A:
+                self.send_data.append(byte)
+                return
+        else:
+            self.send_data.append(byte)
+            if len(self.send_data) < remaining:
+                return
+        data = bytes(self.send_data)
+        self.sending = None
+        self.send_data.clear()
+        conn.up.send(data)
+        if self.qsend:
+            self.answer("DATA ACCEPT:" + ("%d," % conn.mux if self.mux else "") + "%d" % len(data))
+        else:
+            self.answer(("%d, " % conn.mux if self.mux else "") + "SEND OK")
+
+    def connection(self, args, index=0):
+        mux = int(args[index]) if self.mux and len(args) > index and args[index] else 0
+        return mux, self.connections.get(mux)
+
+    def command(self, line):
+        self.log("AT> %s" % line)
+        upper = line.upper()
+        if not upper.startswith("AT"):
+            return self.answer("ERROR")
+        body = line[2:]
+        match = re.match(r"([+&]?[A-Za-z]+)(\?|=\?|=)?(.*)$", body)
+        if body == "":
+            return self.answer("OK")
+        if match is None:
+            return self.answer("OK")
+        name, op, rest = match.group(1).upper(), match.group(2) or "", match.group(3)
+        args = [a.strip().strip('"') for a in rest.split(",")] if rest else []
+        handler = getattr(self, "at_" + name.replace("+", "").replace("&", "and_"), None)
+        if handler is None:
+            # configuration commands the emulator does not model
+            return self.answer("OK")
+        handler(op, args)
+
+    def at_E(self, op, args):
+        self.echo = bool(args) and args[0] == "1"
+        self.answer("OK")
+
+    def at_I(self, op, args):
+        self.answer("SIM800 R14.18", "OK")
+
+    def at_O(self, op, args):
+        conn = self.connections.get(0)
+        if not self.transparent or conn is None or conn.state != "CONNECTED":
+            return self.answer("NO CARRIER")
+        self.answer("CONNECT")
+        self.data_mode = conn
+        if conn.rx:
+            self.write(bytes(conn.rx))
+            conn.rx.clear()
+
+    def at_GMM(self, op, args):
+        self.answer("SIMCOM_SIM800L", "OK")
+
+    def at_GSN(self, op, args):
+        self.answer("866000000000000", "OK")
+
+    def at_CFUN(self, op, args):
+        if op == "=" and len(args) > 1 and args[1] == "1":
+            for conn in list(self.connections.values()):
+                conn.close()
+            self.reset()
+            self.answer("OK")
+            self.loop.call_later(0.5, self.answer, "RDY", "+CFUN: 1", "+CPIN: READY", "Call Ready", "SMS Ready")
+            return
+        if op == "?":
+            return self.answer("+CFUN: 1", "OK")
+        self.answer("OK")
+
+    def at_CPIN(self, op, args):
+        self.answer("+CPIN: READY", "OK")
+
+    def at_CSQ(self, op, args):
+        self.answer("+CSQ: %d,0" % self.profile["csq"], "OK")
+
+    def at_CREG(self, op, args):
+        self.answer("+CREG: 0,1", "OK") if op == "?" else self.answer("OK")
+
+    def at_CGREG(self, op, args):
+        self.answer("+CGREG: 0,1", "OK") if op == "?" else self.answer("OK")
+
+    def at_CGATT(self, op, args):
+        self.answer("+CGATT: 1", "OK") if op == "?" else self.answer("OK")
+
+    def at_SAPBR(self, op, args):
+        if args[:2] == ["2", "1"]:
+            return self.answer('+SAPBR: 1,1,"%s"' % LOCAL_IP, "OK")
+        self.answer("OK")
+
+    def at_CIPMUX(self, op, args):
+        if op == "?":
+            return self.answer("+CIPMUX: %d" % self.mux, "OK")
+        if self.connections:
+            return self.answer("ERROR")
+        self.mux = int(args[0])
+        self.answer("OK")
+
+    def at_CIPMODE(self, op, args):
+        if op == "?":
+            return self.answer("+CIPMODE: %d" % self.transparent, "OK")
+        self.transparent = int(args[0])
+        self.answer("OK")
+
+    def at_CIPQSEND(self, op, args):
+        if op == "=":
+            self.qsend = int(args[0])
+        self.answer("OK")
+
+    def at_CIPRXGET(self, op, args):
+        if op != "=" or not args:
+            return self.answer("OK")
+        mode = int(args[0])
+        if mode in (0, 1):
+            self.rxget = mode
+            return self.answer("OK")
+        mux, conn = self.connection(args, 1)
+        if conn is None:
+            return self.answer("+CME ERROR: 3")
+        if mode == 4:
+            return self.answer("+CIPRXGET: 4," + ("%d," % mux if self.mux else "") + "%d" % len(conn.rx), "OK")
+        size = int(args[2 if self.mux else 1]) if len(args) > (2 if self.mux else 1) else 1460
+        if mode == 3:
+            size = min(size, 730)
+        data = bytes(conn.rx[:size])
+        del conn.rx[:len(data)]
+        head = "+CIPRXGET: %d," % mode + ("%d," % mux if self.mux else "") + "%d,%d" % (len(data), len(conn.rx))
+        self.write("\r\n%s\r\n" % head)
+        self.write(data.hex().upper() if mode == 3 else data)
+        self.answer("OK")
+
+    def at_CSTT(self, op, args):
+        self.answer("OK")
+
+    def at_CIICR(self, op, args):
+        self.bearer = True
+        self.loop.call_later(2 * self.profile["latency"] / 1000.0, self.answer, "OK")
+
+    def at_CIFSR(self, op, args):
+        self.answer(LOCAL_IP if self.bearer else "ERROR")
+
+    def at_CIPSHUT(self, op, args):
+        for conn in list(self.connections.values()):
+            conn.close()
+        self.connections.clear()
+        self.bearer = False
+        self.answer("SHUT OK")
+
+    def at_CIPSTATUS(self, op, args):
+        if op == "=":
+            mux, conn = self.connection(args)
+            state = conn.state if conn is not None else "INITIAL"
+            host, port = (conn.host, conn.port) if conn is not None else ("", "")
+            return self.answer('+CIPSTATUS: %d,0,"TCP","%s","%s","%s"' % (mux, host, port, state), "OK")
+        state = "CONNECT OK" if self.connections else ("IP STATUS" if self.bearer else "IP INITIAL")
+        self.answer("OK", "STATE: %s" % state)
+
+    def at_CDNSGIP(self, op, args):
+        if op != "=" or not args or not self.bearer:
+            return self.answer("ERROR")
+        self.answer("OK")
+        # every domain resolves to the bridged target, lookup takes one round trip
+        self.loop.call_later(2 * self.profile["latency"] / 1000.0, self.answer,
+                             '+CDNSGIP: 1,"%s","%s"' % (args[0], self.target[0] if is_ip(self.target[0]) else "127.0.0.1"))
+
+    def at_CIPSTART(self, op, args):
+        if self.mux:
+            mux, args = int(args[0]), args[1:]
+        else:
+            mux = 0
+        if len(args) < 3 or mux in self.connections or (self.transparent and self.mux):
+            return self.answer("ERROR")
+        conn = Connection(self, mux, args[1], args[2])
+        self.connections[mux] = conn
+        self.history.append(conn)
+        self.answer("OK")
+        asyncio.ensure_future(self.start_connection(conn))
+
+    async def start_connection(self, conn):
+        ok = await conn.open(self.target)
+        prefix = "%d, " % conn.mux if self.mux else ""
+        if not ok:
+            self.connections.pop(conn.mux, None)
+            return self.answer(prefix + "CONNECT FAIL")
+        if self.transparent:
+            self.answer("CONNECT")
+            self.data_mode = conn
+        else:
+            self.answer(prefix + "CONNECT OK")
+
+    def at_CIPSEND(self, op, args):
+        if op == "?":
+            return self.answer("+CIPSEND: 1460", "OK")
+        mux, conn = self.connection(args)
+        if conn is None or conn.state != "CONNECTED":
+            return self.answer("ERROR")
+        size = args[1 if self.mux else 0] if len(args) > (1 if self.mux else 0) else None
+        self.sending = (conn, int(size) if size else None)
+        self.skip_lf = True
+        self.write("\r\n> ")
+
+    def at_CIPCLOSE(self, op, args):
+        mux, conn = self.connection(args)
+        if conn is None:
+            return self.answer("ERROR")
+        conn.close()
+        self.connections.pop(mux, None)
+        self.answer(("%d, " % mux if self.mux else "") + "CLOSE OK")
+
+    def stats(self):
+        """link totals of all connections"""
+        return dict(connections=len(self.history),
+                    up=sum(c.up.bytes for c in self.history),
+                    down=sum(c.down.bytes for c in self.history),
+                    lost=sum(c.up.lost + c.down.lost for c in self.history))
+
+    def close(self):
+        for conn in self.connections.values():
+            conn.close()
+        self.loop.remove_reader(self.master)
+        os.close(self.master)
+        if self.slave is not None:
+            os.close(self.slave)
+        if self.args.link and self.slave is not None and os.path.islink(self.args.link):
+            os.unlink(self.args.link)
+
+
+async def run(args, profile):
+    modem = Modem(args, profile)
+    modem.start()
+    try:
+        await asyncio.Event().wait()
+    finally:
+        sys.stderr.write("sim800: %s\n" % modem.stats())
+        modem.close()
+
+
+def parse_target(text):
+    host, _, port = text.rpartition(":")
+    return host or "127.0.0.1", int(port)
+
+
+def main(argv):
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("--link", default="/tmp/ttySIM800", help="symlink to pty slave")
+    parser.add_argument("--serial", help="serial device instead of pty")
+    parser.add_argument("--baud", type=int, default=115200)
+    parser.add_argument("--target", type=parse_target, default=("127.0.0.1", 5000))
+    parser.add_argument("--profile", choices=sorted(PROFILES), default="gprs")
+    parser.add_argument("--latency", type=float, help="one-way ms")
+    parser.add_argument("--jitter", type=float, help="ms")
+    parser.add_argument("--bandwidth", type=float, help="bit/s, 0 - unlimited")
+    parser.add_argument("--loss", type=float, help="probability of segment loss")
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("-v", "--verbose", action="store_true")
+    args = parser.parse_args(argv[1:])
+    profile = dict(PROFILES[args.profile])
+    for key in ("latency", "jitter", "bandwidth", "loss"):
+        if getattr(args, key) is not None:
+            profile[key] = getattr(args, key)
+    try:
+        asyncio.run(run(args, profile))
+    except KeyboardInterrupt:
+        pass
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
@@ -0,0 +1,180 @@
+#!/usr/bin/env python3
+"""
+ToneIotDelta host tool: builds a delta patch between two firmware images
+and applies it the same way the device does (ToneIotDelta.cpp).
+
+    toneiot_delta.py diff  old.bin new.bin patch.tod
+    toneiot_delta.py apply old.bin patch.tod out.bin
+
+Patch format (little-endian):
+    header 20 bytes: magic "TOD2", source size, target size, crc32 source, crc32 target
+    COPY   - 0x01, varint zigzag offset from end of previous copy, varint length
+    INSERT - 0x02, varint length, data
+"""
+
+import struct
+import sys
+import zlib
+
+MAGIC = b"TOD2"
+HEADER_SIZE = 20
+OP_COPY = 1
+OP_INSERT = 2
+
+SEED = 16        # bytes hashed to find a match in the old image
+STRIDE = 4       # old image is indexed every STRIDE bytes
+MIN_COPY = 12    # shorter matches are inserted as data
+MIN_CONTINUE = 4 # match continuing the previous copy is cheaper
+
+
+def varint(value):
+    out = bytearray()
+    while True:
+        byte = value & 0x7F
+        value >>= 7
+        if value:
+            out.append(byte | 0x80)
+        else:
+            out.append(byte)
+            return bytes(out)
+
+
+def zigzag(value):
+    return (value << 1) if value >= 0 else ((-value << 1) - 1)
+
+
+def match_forward(old, new, src, dst):
+    """length of equal bytes old[src:] and new[dst:]"""
+    length = 0
+    limit = min(len(old) - src, len(new) - dst)
+    step = 64
+    while length < limit:
+        n = min(step, limit - length)
+        if old[src + length:src + length + n] == new[dst + length:dst + length + n]:
+            length += n
+            continue
+        while n and old[src + length] == new[dst + length]:
+            length += 1
+            n -= 1
+        break
+    return length
+
+
+def diff(old, new):
+    index = {}
+    for i in range(0, len(old) - SEED + 1, STRIDE):
+        index.setdefault(old[i:i + SEED], i)
+
+    patch = bytearray(MAGIC)
+    patch += struct.pack("<IIII", len(old), len(new), zlib.crc32(old) & 0xFFFFFFFF, zlib.crc32(new) & 0xFFFFFFFF)
+
+    last_src = 0     # end of previous copy in old image
+    literal = 0      # start of pending insert
+    dst = 0
+    while dst < len(new):
+        src, length = -1, 0
+
+        # the same alignment as the previous copy survives small edits
+        cont = last_src + (dst - literal)
+        if cont < len(old):
+            n = match_forward(old, new, cont, dst)
+            if n >= MIN_CONTINUE:
+                src, length = cont, n
+
+        if length < MIN_COPY:
+            hit = index.get(new[dst:dst + SEED])
+            if hit is not None:
+                n = match_forward(old, new, hit, dst)
+                # extend backward into pending insert
+                back = 0
+                while back < dst - literal and back < hit and old[hit - back - 1] == new[dst - back - 1]:
+                    back += 1
+                if n + back > length and n + back >= MIN_COPY:
+                    src, length = hit - back, n + back
+                    dst -= back
+
+        if length == 0 or (length < MIN_COPY and src != cont):
+            dst += 1
+            continue
+
+        if dst > literal:
+            patch.append(OP_INSERT)
+            patch += varint(dst - literal)
+            patch += new[literal:dst]
+        patch.append(OP_COPY)
+        patch += varint(zigzag(src - last_src))
+        patch += varint(length)
+        last_src = src + length
+        dst += length
+        literal = dst
+
+    if len(new) > literal:
+        patch.append(OP_INSERT)
+        patch += varint(len(new) - literal)
+        patch += new[literal:]
+    return bytes(patch)
+
+
+def read_varint(patch, pos):
+    value, shift = 0, 0
+    while True:
+        byte = patch[pos]
+        pos += 1
+        value |= (byte & 0x7F) << shift
+        shift += 7
+        if not byte & 0x80:
+            return value, pos
+
+
+def apply(old, patch):
+    if patch[:4] != MAGIC:
+        raise ValueError("bad magic")
+    source_size, target_size, source_crc, target_crc = struct.unpack_from("<IIII", patch, 4)
+    if source_size != len(old) or zlib.crc32(old) & 0xFFFFFFFF != source_crc:
+        raise ValueError("patch is made for another image")
+    out = bytearray()
+    pos = HEADER_SIZE
+    copy = 0
+    while len(out) < target_size:
+        op = patch[pos]
+        pos += 1
+        if op == OP_COPY:
+            value, pos = read_varint(patch, pos)
+            copy += (value >> 1) ^ -(value & 1)
+            length, pos = read_varint(patch, pos)
+            out += old[copy:copy + length]
+            copy += length
+        elif op == OP_INSERT:
+            length, pos = read_varint(patch, pos)
+            out += patch[pos:pos + length]
+            pos += length
+        else:
+            raise ValueError("bad opcode %d at %d" % (op, pos - 1))
+    if len(out) != target_size or zlib.crc32(out) & 0xFFFFFFFF != target_crc:
+        raise ValueError("crc32 mismatch")
+    return bytes(out)
+
+
+def main(argv):
+    if len(argv) != 5 or argv[1] not in ("diff", "apply"):
+        sys.stderr.write(__doc__)
+        return 2
+    with open(argv[2], "rb") as f:
+        old = f.read()
+    with open(argv[3], "rb") as f:
+        data = f.read()
+    if argv[1] == "diff":
+        out = diff(old, data)
+        if apply(old, out) != data:
+            raise SystemExit("patch verification failed")
+        sys.stderr.write("image %d bytes, patch %d bytes (%.1fx)\n"
+                         % (len(data), len(out), len(data) / max(len(out), 1)))
+    else:
+        out = apply(old, data)
+    with open(argv[4], "wb") as f:
+        f.write(out)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
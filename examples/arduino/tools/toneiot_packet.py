@@ -0,0 +1,199 @@
+#!/usr/bin/env python3
+"""
+ToneIotClient frame codec for host tools, same layout as ToneIotPacketView
+(include/ToneIotPacket.h). All numbers are little-endian.
+
+    toneiot_packet.py HEX    decode frames of a captured stream
+
+Frame: id 8 bytes, msgId u16, function u16, datalen u16, data
+INIT data of device: format u8, id 8 bytes, device type u8, version major u8,
+version minor u8, date 12 bytes (__DATE__ and terminator), keepAlive u16,
+[credit], set of functions until the end
+INIT answer of server: format u8, [credit], set of enabled functions;
+empty - all enabled, no flow control
+Set of functions: FUNCTIONS_LIST - u16 numbers, ascending; FUNCTIONS_BITMAP - base u16,
+bits u16, bitmap, bit n is function base + n
+Credit, present with INIT_FLAG_CREDIT in format: frames u16, bytes u32 -
+limits of the frame and byte counters of functions above 15 the peer may
+send, counted from INIT and wrapping. Updates follow data of ACK, ERROR
+(after the error code) and KEEPALIVE.
+"""
+
+import struct
+import sys
+
+HEADER = struct.Struct("<8sHHH")
+HEADER_SIZE = HEADER.size  # 14
+
+INIT = struct.Struct("<B8sBBB12sH")
+INIT_SIZE = INIT.size      # 26
+
+FUNCTION_SYS_INIT = 0
+FUNCTION_SYS_ACK = 1
+FUNCTION_SYS_ERROR = 2
+FUNCTION_SYS_KEEPALIVE = 3
+FUNCTION_SYS_OTA = 4
+FUNCTION_SYS_DISCONNECT = 15
+
+FUNCTIONS_LIST = 0
+FUNCTIONS_BITMAP = 1
+BITMAP = struct.Struct("<HH")
+FORMAT_MASK = 0x7F
+INIT_FLAG_CREDIT = 0x80
+CREDIT = struct.Struct("<HI")
+
+FUNCTION_FLAG_DUP = 0x8000
+FUNCTION_FLAG_ONCE = 0x4000
+FUNCTION_MASK = 0x3FFF
+
+
+def pack(device, msg_id, function, data=b""):
+    return HEADER.pack(device, msg_id & 0xFFFF, function, len(data)) + data
+
+
+def unpack(frame):
+    """frame -> (id, msgId, function, data), raises ValueError on short frame"""
+    if len(frame) < HEADER_SIZE:
+        raise ValueError("frame shorter than header")
+    device, msg_id, function, length = HEADER.unpack_from(frame)
+    if len(frame) < HEADER_SIZE + length:
+        raise ValueError("frame shorter than datalen %d" % length)
+    return device, msg_id, function, bytes(frame[HEADER_SIZE:HEADER_SIZE + length])
+
+
+def pack_error(code):
+    """data of FUNCTION_SYS_ERROR"""
+    return struct.pack("<H", code & 0xFFFF)
+
+
+def unpack_error(data):
+    return struct.unpack_from("<H", data)[0] if len(data) >= 2 else 0
+
+
+def pack_functions(functions):
+    """set of functions in the smaller format as ToneIotClient::writeFunctions() -> (format, bytes)"""
+    functions = sorted(set(functions))
+    if not functions:
+        return FUNCTIONS_LIST, b""
+    first, last = functions[0], functions[-1]
+    if BITMAP.size + (last - first) // 8 + 1 <= 2 * len(functions):
+        bitmap = bytearray((last - first) // 8 + 1)
+        for f in functions:
+            bitmap[(f - first) // 8] |= 1 << ((f - first) % 8)
+        return FUNCTIONS_BITMAP, BITMAP.pack(first, last - first + 1) + bytes(bitmap)
+    return FUNCTIONS_LIST, struct.pack("<%dH" % len(functions), *functions)
+
+
+def unpack_functions(fmt, data):
+    """set of functions -> sorted list, raises ValueError on unknown format"""
+    if fmt == FUNCTIONS_LIST:
+        return sorted(struct.unpack_from("<%dH" % (len(data) // 2), data))
+    if fmt == FUNCTIONS_BITMAP:
+        if len(data) < BITMAP.size:
+            return []
+        base, bits = BITMAP.unpack_from(data)
+        bitmap = data[BITMAP.size:]
+        return [base + n for n in range(min(bits, 8 * len(bitmap))) if bitmap[n // 8] & (1 << (n % 8))]
+    raise ValueError("unknown functions format %d" % fmt)
+
+
+def pack_credit(frames, size):
+    return CREDIT.pack(frames & 0xFFFF, size & 0xFFFFFFFF)
+
+
+def unpack_credit(function, data):
+    """credit after data of ACK/ERROR/KEEPALIVE -> (frames, bytes), None - absent"""
+    offset = 2 if function == FUNCTION_SYS_ERROR else 0
+    if function not in (FUNCTION_SYS_ACK, FUNCTION_SYS_ERROR, FUNCTION_SYS_KEEPALIVE):
+        return None
+    if len(data) < offset + CREDIT.size:
+        return None
+    return CREDIT.unpack_from(data, offset)
+
+
+def pack_init(device, device_type, major, minor, date, keep_alive, functions=(), credit=None):
+    """INIT data as sent by ToneIotClient::sendFunctionInit()"""
+    date = date.encode()[:11].ljust(12, b"\0")
+    fmt, data = pack_functions(functions)
+    if credit is not None:
+        fmt |= INIT_FLAG_CREDIT
+        data = pack_credit(*credit) + data
+    return INIT.pack(fmt, device, device_type, major, minor, date, keep_alive) + data
+
+
+def pack_init_answer(enabled=None, credit=None):
+    """INIT answer of server, None - all functions enabled without flow control"""
+    if enabled is None:
+        return b""
+    fmt, data = pack_functions(enabled)
+    if credit is not None:
+        fmt |= INIT_FLAG_CREDIT
+        data = pack_credit(*credit) + data
+    return bytes([fmt]) + data
+
+
+def unpack_init_answer(data):
+    """INIT answer -> (enabled functions, credit), None - all / no flow control"""
+    if not data:
+        return None, None
+    offset, credit = 1, None
+    if data[0] & INIT_FLAG_CREDIT and len(data) >= 1 + CREDIT.size:
+        credit = CREDIT.unpack_from(data, 1)
+        offset += CREDIT.size
+    return unpack_functions(data[0] & FORMAT_MASK, data[offset:]), credit
+
+
+def unpack_init(data):
+    """INIT data -> dict, raises ValueError on short data"""
+    if len(data) < INIT_SIZE:
+        raise ValueError("INIT shorter than %d bytes" % INIT_SIZE)
+    fmt, device, device_type, major, minor, date, keep_alive = INIT.unpack_from(data)
+    offset, credit = INIT_SIZE, None
+    if fmt & INIT_FLAG_CREDIT:
+        if len(data) < INIT_SIZE + CREDIT.size:
+            raise ValueError("INIT shorter than credit")
+        credit = CREDIT.unpack_from(data, INIT_SIZE)
+        offset += CREDIT.size
+    return {
+        "format": fmt & FORMAT_MASK,
+        "credit": credit,
+        "id": device,
+        "type": device_type,
+        "version": (major, minor),
+        "date": date.split(b"\0")[0].decode("ascii", "replace"),
+        "keepAlive": keep_alive,
+        "functions": unpack_functions(fmt & FORMAT_MASK, data[offset:]),
+    }
+
+
+def frames(stream):
+    """split captured stream into frames, incomplete tail is left"""
+    pos = 0
+    while len(stream) - pos >= HEADER_SIZE:
+        length = HEADER.unpack_from(stream, pos)[3]
+        if len(stream) - pos < HEADER_SIZE + length:
+            break
+        yield unpack(stream[pos:pos + HEADER_SIZE + length])
+        pos += HEADER_SIZE + length
+
+
+def main(argv):
+    if len(argv) != 2:
+        sys.stderr.write(__doc__)
+        return 2
+    for device, msg_id, function, data in frames(bytes.fromhex(argv[1])):
+        line = "%s msgId=%d function=%#06x len=%d" % (device.hex(), msg_id, function, len(data))
+        if function & FUNCTION_MASK == FUNCTION_SYS_INIT and len(data) >= INIT_SIZE:
+            line += " %s" % unpack_init(data)
+        elif function & FUNCTION_MASK == FUNCTION_SYS_INIT:
+            line += " enabled=%s credit=%s" % unpack_init_answer(data)
+        elif function & FUNCTION_MASK == FUNCTION_SYS_ERROR:
+            line += " error=%d" % unpack_error(data)
+        if unpack_credit(function & FUNCTION_MASK, data) is not None:
+            line += " credit=%s" % (unpack_credit(function & FUNCTION_MASK, data),)
+        print(line)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
@@ -0,0 +1,123 @@
+#!/usr/bin/env python3
+"""
+ToneIotProfile host tool: renders cycle counters of library hot paths
+(include/ToneIotProfile.h, build flag TOIP_PROFILE) as a sorted report.
+
+    toneiot_profile.py log serial.log|-  [--sort total] [--hz 240000000]
+    toneiot_profile.py decode table.bin|HEX [--sort total] [--hz 240000000]
+
+log reads the last table printed by ToneIotProfile::print() from a serial
+log ("TOIP ..." lines), decode reads the table sent by
+ToneIotClient::sendProfile(), also printed by toneiot_server.py --profile.
+
+Table format (little-endian):
+    version u8, cycles per second u32 (0 - unknown), scope count u8,
+    for every scope: id u8, calls u32, total cycles u64, max cycles u64
+Version 1 tables with max cycles u32 are read too. Scopes are inclusive, times in us are shown when the rate is known
+(CCOUNT of ESP32 runs at CPU frequency, TSC of host needs --hz).
+"""
+
+import argparse
+import re
+import struct
+import sys
+
+HEADER = struct.Struct("<BIB")
+# scope by version of table, max cycles is u64 since version 2
+SCOPES_BY_VERSION = {1: struct.Struct("<BIQI"), 2: struct.Struct("<BIQQ")}
+
+# same order as TOIP_SCOPE
+SCOPES = ["readPacket", "writePacket", "callFunction", "tokenParse", "connect"]
+
+SORT = {
+    "total": lambda s: s["total"],
+    "avg": lambda s: s["total"] / s["calls"] if s["calls"] else 0,
+    "max": lambda s: s["max"],
+    "calls": lambda s: s["calls"],
+    "name": None,
+}
+
+LINE_HEADER = re.compile(r"TOIP hz=(\d+) scopes=(\d+)")
+LINE_SCOPE = re.compile(r"TOIP (\w+) calls=(\d+) total=(\d+) max=(\d+)")
+
+
+def decode(data):
+    """table -> (hz, [scope dict]), raises ValueError on bad data"""
+    if len(data) < HEADER.size:
+        raise ValueError("table shorter than header")
+    version, hz, count = HEADER.unpack_from(data)
+    if version not in SCOPES_BY_VERSION:
+        raise ValueError("unknown version %d" % version)
+    scope = SCOPES_BY_VERSION[version]
+    if len(data) < HEADER.size + count * scope.size:
+        raise ValueError("table shorter than %d scopes" % count)
+    scopes = []
+    for i in range(count):
+        sid, calls, total, longest = scope.unpack_from(data, HEADER.size + i * scope.size)
+        name = SCOPES[sid] if sid < len(SCOPES) else "scope%d" % sid
+        scopes.append({"name": name, "calls": calls, "total": total, "max": longest})
+    return hz, scopes
+
+
+def parse_log(lines):
+    """serial log -> (hz, [scope dict]) of the last table, None - no table"""
+    table = None
+    for line in lines:
+        m = LINE_HEADER.search(line)
+        if m:
+            table = (int(m.group(1)), [])
+            continue
+        m = LINE_SCOPE.search(line)
+        if m and table is not None:
+            table[1].append({"name": m.group(1), "calls": int(m.group(2)),
+                             "total": int(m.group(3)), "max": int(m.group(4))})
+    return table
+
+
+def report(hz, scopes, sort="total", out=sys.stdout):
+    key = SORT[sort]
+    scopes = sorted(scopes, key=key, reverse=True) if key else sorted(scopes, key=lambda s: s["name"])
+    # inclusive scopes overlap, share is of the sum
+    grand = sum(s["total"] for s in scopes) or 1
+    out.write("%-14s %10s %16s %12s %12s %7s" % ("scope", "calls", "total cyc", "avg cyc", "max cyc", "share"))
+    out.write("%12s %12s\n" % ("avg us", "max us") if hz else "\n")
+    for s in scopes:
+        avg = s["total"] / s["calls"] if s["calls"] else 0
+        out.write("%-14s %10d %16d %12.0f %12d %6.1f%%" % (
+            s["name"], s["calls"], s["total"], avg, s["max"], s["total"] * 100.0 / grand))
+        out.write("%12.2f %12.2f\n" % (avg * 1e6 / hz, s["max"] * 1e6 / hz) if hz else "\n")
+
+
+def read_table(arg):
+    try:
+        return bytes.fromhex(arg)
+    except ValueError:
+        with open(arg, "rb") as f:
+            return f.read()
+
+
+def main(argv):
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    sub = parser.add_subparsers(dest="command", required=True)
+    for name in ("log", "decode"):
+        p = sub.add_parser(name)
+        p.add_argument("input")
+        p.add_argument("--sort", choices=sorted(SORT), default="total")
+        p.add_argument("--hz", type=int, help="cycles per second, overrides the table")
+    args = parser.parse_args(argv[1:])
+
+    if args.command == "log":
+        f = sys.stdin if args.input == "-" else open(args.input, errors="replace")
+        table = parse_log(f)
+        if table is None:
+            sys.stderr.write("no TOIP table in %s\n" % args.input)
+            return 1
+    else:
+        table = decode(read_table(args.input))
+    hz, scopes = table
+    report(args.hz or hz, scopes, args.sort)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
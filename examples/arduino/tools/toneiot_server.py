@@ -0,0 +1,344 @@
+#!/usr/bin/env python3
+"""
+Tone iot server stand-in: speaks the ToneIotClient frame protocol over TCP,
+answers INIT, acknowledges functions and keep alive, drops exactly-once
+duplicates by msgId. Used as target of sim800_emulator.py and benchmarks.
+
+    toneiot_server.py [--host 127.0.0.1] [--port 5000] [--udp] [--telemetry FUNCTION] [--profile FUNCTION]
+                      [--disable FUNCTION ...] [--credit FRAMES:BYTES | --no-credit] [-v]
+
+--telemetry prints samples of ToneIotTelemetry batches sent with FUNCTION.
+--profile prints ToneIotProfile tables sent with FUNCTION by sendProfile().
+INIT answer enables the advertised functions except --disable ones.
+Server.multicast() writes one frame with a group id to every session,
+devices subscribed with addGroup() receive it, the others skip it.
+--udp also listens on UDP port --port for ToneIotUdpClient: one frame per
+datagram, a session per remote address; INIT repeated before any other
+frame gets the same answer again.
+Device announcing credit in INIT gets credit of the server, updated in every
+ACK; server-initiated functions wait for credit of the device.
+
+Frame (little-endian): id 8 bytes, msgId u16, function u16, datalen u16, data,
+codec in toneiot_packet.py
+"""
+
+import argparse
+import asyncio
+import collections
+import sys
+import time
+
+import toneiot_packet
+import toneiot_profile
+import toneiot_telemetry
+from toneiot_packet import (HEADER, pack, FUNCTION_SYS_INIT, FUNCTION_SYS_ACK, FUNCTION_SYS_ERROR,
+                            FUNCTION_SYS_KEEPALIVE, FUNCTION_SYS_OTA, FUNCTION_SYS_DISCONNECT,
+                            FUNCTION_FLAG_DUP, FUNCTION_FLAG_ONCE, FUNCTION_MASK)
+
+ONCE_HISTORY = 1024  # msgIds of exactly-once packets remembered per device
+CREDIT = (8, 4096)   # frames, bytes a device may send ahead of ACKs
+
+
+async def read_frame(reader):
+    """returns (id, msgId, function, data), raises IncompleteReadError on close"""
+    header = await reader.readexactly(HEADER.size)
+    device, msg_id, function, length = HEADER.unpack(header)
+    data = await reader.readexactly(length) if length else b""
+    return device, msg_id, function, data
+
+
+class Session:
+    """one device connection"""
+
+    def __init__(self, server, reader, writer):
+        self.server = server
+        self.reader = reader
+        self.writer = writer
+        self.device = None
+        self.msg_id = 0
+        self.init = None        # parsed INIT data
+        self.init_raw = None    # INIT data and answer, a repeated INIT is answered again
+        self.init_answer = None
+        self.after_init = 0     # frames received since INIT
+        self.once = server.once
+        self.flow = False       # device announced credit, answers carry ours
+        self.rx = [0, 0]        # frames, bytes of device functions above 15
+        self.given = None       # credit given to device
+        self.tx = [0, 0]        # frames, bytes sent to device
+        self.limit = None       # credit of device, None - not paced
+        self.waiting = collections.deque()   # calls without credit of device
+        self.stats = {"frames": 0, "bytes": 0, "duplicates": 0, "overruns": 0, "stalls": 0,
+                      "connected": time.monotonic()}
+
+    def send(self, msg_id, function, data=b""):
+        self.writer.write(pack(self.device, msg_id, function, data))
+
+    def answer(self, msg_id, function, data=b""):
+        """ACK/ERROR with credit when the device paces itself"""
+        if self.flow and self.server.credit:
+            self.given = ((self.rx[0] + self.server.credit[0]) & 0xFFFF,
+                          (self.rx[1] + self.server.credit[1]) & 0xFFFFFFFF)
+            data += toneiot_packet.pack_credit(*self.given)
+        self.send(msg_id, function, data)
+
+    def call(self, function, data=b""):
+        """server-initiated function, own msgId sequence, waits for credit of device"""
+        self.msg_id = (self.msg_id + 1) & 0xFFFF
+        self.waiting.append((self.msg_id, function, data))
+        self.flush()
+        return self.msg_id
+
+    def flush(self):
+        while self.waiting:
+            msg_id, function, data = self.waiting[0]
+            size = HEADER.size + len(data)
+            if self.limit is not None and function & FUNCTION_MASK > FUNCTION_SYS_DISCONNECT:
+                if (self.limit[0] - self.tx[0]) & 0xFFFF in range(1, 0x8000) and \
+                        (self.limit[1] - self.tx[1] - size) & 0xFFFFFFFF < 0x80000000:
+                    self.tx = [(self.tx[0] + 1) & 0xFFFF, (self.tx[1] + size) & 0xFFFFFFFF]
+                else:
+                    self.stats["stalls"] += 1
+                    return
+            self.waiting.popleft()
+            self.send(msg_id, function, data)
+
+    def take_credit(self, number, data):
+        credit = toneiot_packet.unpack_credit(number, data)
+        if credit is None or self.limit is None:
+            return
+        # stale update does not lower the credit
+        if (credit[0] - self.limit[0]) & 0xFFFF < 0x8000:
+            self.limit[0] = credit[0]
+        if (credit[1] - self.limit[1]) & 0xFFFFFFFF < 0x80000000:
+            self.limit[1] = credit[1]
+        self.flush()
+
+    def receive(self, device, msg_id, function, data):
+        """frame from device, False - session ends"""
+        self.stats["frames"] += 1
+        self.stats["bytes"] += HEADER.size + len(data)
+        if self.device is None:
+            self.device = device
+        return self.handle(msg_id, function, data)
+
+    async def run(self):
+        try:
+            while True:
+                if not self.receive(*await read_frame(self.reader)):
+                    break
+                await self.writer.drain()
+        except (asyncio.IncompleteReadError, ConnectionError):
+            pass
+        finally:
+            self.writer.close()
+            self.server.log("close %s %s" % (self.device.hex() if self.device else "-", self.stats))
+
+    def handle(self, msg_id, function, data):
+        number = function & FUNCTION_MASK
+        self.server.log("rx msgId=%d function=%#06x len=%d" % (msg_id, function, len(data)))
+        if number == FUNCTION_SYS_INIT and data == self.init_raw and self.after_init == 0:
+            # answer lost on datagram link, counters of the session are kept
+            self.send(0, FUNCTION_SYS_INIT, self.init_answer)
+            return True
+        self.after_init += 1
+        if number == FUNCTION_SYS_INIT:
+            self.init_raw, self.after_init = data, 0
+            try:
+                self.init = toneiot_packet.unpack_init(data)
+                self.server.log("init %s" % self.init)
+            except ValueError as e:
+                self.server.log("init %s" % e)
+            enabled = self.server.on_init(self, self.init)
+            credit = None
+            self.rx, self.tx = [0, 0], [0, 0]
+            # both sides pace only when both announce credit
+            if self.server.credit and self.init is not None and self.init["credit"] is not None:
+                self.flow = True
+                self.limit = list(self.init["credit"])
+                credit = self.given = self.server.credit
+            self.init_answer = toneiot_packet.pack_init_answer(enabled, credit)
+            self.send(0, FUNCTION_SYS_INIT, self.init_answer)
+            return True
+        self.take_credit(number, data)
+        if number in (FUNCTION_SYS_ACK, FUNCTION_SYS_ERROR):
+            self.server.on_answer(self, msg_id, number, data)
+            return True
+        if number == FUNCTION_SYS_DISCONNECT:
+            self.answer(msg_id, FUNCTION_SYS_ACK)
+            return False
+        if number > FUNCTION_SYS_DISCONNECT and not function & FUNCTION_FLAG_DUP:
+            if self.given is not None and (self.rx[0] - self.given[0]) & 0xFFFF < 0x8000:
+                self.stats["overruns"] += 1
+            self.rx = [(self.rx[0] + 1) & 0xFFFF, (self.rx[1] + HEADER.size + len(data)) & 0xFFFFFFFF]
+        if function & FUNCTION_FLAG_ONCE:
+            key = (self.device, msg_id)
+            if key in self.once:
+                self.stats["duplicates"] += 1
+                self.answer(msg_id, FUNCTION_SYS_ACK)
+                return True
+            self.once[key] = True
+            while len(self.once) > ONCE_HISTORY:
+                self.once.pop(next(iter(self.once)))
+        if number != FUNCTION_SYS_KEEPALIVE:
+            self.server.on_function(self, msg_id, number, data)
+        self.answer(msg_id, FUNCTION_SYS_ACK)
+        return True
+
+
+class DatagramWriter:
+    """writer of Session over UDP, every write is one frame"""
+
+    def __init__(self, endpoint, addr):
+        self.endpoint = endpoint
+        self.addr = addr
+        self.closed = False
+
+    def write(self, frame):
+        if not self.closed:
+            self.endpoint.transport.sendto(frame, self.addr)
+
+    async def drain(self):
+        pass
+
+    def is_closing(self):
+        return self.closed
+
+    def close(self):
+        self.closed = True
+        session = self.endpoint.sessions.pop(self.addr, None)
+        if session is not None and session in self.endpoint.server.sessions:
+            self.endpoint.server.sessions.remove(session)
+
+
+class DatagramEndpoint(asyncio.DatagramProtocol):
+    """UDP port of server, sessions by remote address"""
+
+    def __init__(self, server):
+        self.server = server
+        self.transport = None
+        self.sessions = {}
+
+    def connection_made(self, transport):
+        self.transport = transport
+
+    def datagram_received(self, datagram, addr):
+        try:
+            frame = toneiot_packet.unpack(datagram)
+        except ValueError:
+            return
+        # one frame per datagram
+        if len(datagram) != HEADER.size + len(frame[3]):
+            return
+        session = self.sessions.get(addr)
+        if session is None:
+            session = self.sessions[addr] = Session(self.server, None, DatagramWriter(self, addr))
+            self.server.sessions.append(session)
+        if not session.receive(*frame):
+            session.writer.close()
+            self.server.log("close %s %s" % (session.device.hex() if session.device else "-", session.stats))
+
+
+class Server:
+    """override on_function/on_answer to script behaviour"""
+
+    def __init__(self, verbose=False, telemetry=None, disabled=(), credit=CREDIT, profile=None):
+        self.verbose = verbose
+        self.credit = credit         # (frames, bytes) given to devices, None - no flow control
+        self.telemetry = telemetry   # function of telemetry batches
+        self.profile = profile       # function of profile tables
+        self.disabled = set(disabled)   # functions not enabled by INIT answer
+        self.once = {}          # shared by sessions, device reconnects keep dedup
+        self.groups = {}        # group id -> last msgId of group sequence
+        self.sessions = []
+
+    def log(self, text):
+        if self.verbose:
+            sys.stderr.write("server: %s\n" % text)
+
+    def on_init(self, session, init):
+        """functions enabled for the session, None - all"""
+        if init is None:
+            return None
+        return [f for f in init["functions"] if f not in self.disabled]
+
+    def on_function(self, session, msg_id, function, data):
+        if function == self.telemetry:
+            self.on_telemetry(session, toneiot_telemetry.decode(data))
+        elif function == self.profile:
+            self.on_profile(session, *toneiot_profile.decode(data))
+
+    def on_telemetry(self, session, channels):
+        """channels {id: (type, [(time ms, value)])}"""
+        for cid, (kind, samples) in channels.items():
+            for time_ms, value in samples:
+                print("%s %d %d %s" % (session.device.hex(), cid, time_ms, value))
+
+    def on_profile(self, session, hz, scopes):
+        print("%s profile" % session.device.hex())
+        toneiot_profile.report(hz, scopes)
+        sys.stdout.flush()
+
+    def on_answer(self, session, msg_id, function, data):
+        pass
+
+    def multicast(self, group, function, data=b""):
+        """one frame of user function for group id to all sessions, outside flow control"""
+        msg_id = self.groups[group] = (self.groups.get(group, 0) + 1) & 0xFFFF
+        frame = pack(group, msg_id, function, data)
+        for session in self.sessions:
+            if session.device is not None:
+                session.writer.write(frame)
+        return msg_id
+
+    async def accept(self, reader, writer):
+        session = Session(self, reader, writer)
+        self.sessions.append(session)
+        try:
+            await session.run()
+        finally:
+            self.sessions.remove(session)
+
+    async def start(self, host, port):
+        return await asyncio.start_server(self.accept, host, port)
+
+    async def start_udp(self, host, port):
+        """UDP endpoint of ToneIotUdpClient, returns transport"""
+        transport, _ = await asyncio.get_running_loop().create_datagram_endpoint(
+            lambda: DatagramEndpoint(self), local_addr=(host, port))
+        return transport
+
+
+async def serve(args):
+    server = Server(args.verbose, args.telemetry, args.disable, None if args.no_credit else args.credit,
+                    args.profile)
+    listener = await server.start(args.host, args.port)
+    if args.udp:
+        await server.start_udp(args.host, args.port)
+    sys.stderr.write("listening %s:%d%s\n" % (args.host, args.port, " tcp+udp" if args.udp else ""))
+    async with listener:
+        await listener.serve_forever()
+
+
+def main(argv):
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("--host", default="127.0.0.1")
+    parser.add_argument("--port", type=int, default=5000)
+    parser.add_argument("--udp", action="store_true", help="also listen on UDP port")
+    parser.add_argument("--telemetry", type=lambda v: int(v, 0), help="function of telemetry batches")
+    parser.add_argument("--profile", type=lambda v: int(v, 0), help="function of profile tables")
+    parser.add_argument("--disable", type=lambda v: int(v, 0), action="append", default=[],
+                        help="function not enabled by INIT answer")
+    parser.add_argument("--credit", type=lambda v: tuple(int(x, 0) for x in v.split(":")), default=CREDIT,
+                        help="credit given to device, FRAMES:BYTES")
+    parser.add_argument("--no-credit", action="store_true", help="answer INIT without flow control")
+    parser.add_argument("-v", "--verbose", action="store_true")
+    args = parser.parse_args(argv[1:])
+    try:
+        asyncio.run(serve(args))
+    except KeyboardInterrupt:
+        pass
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
@@ -0,0 +1,221 @@
+#!/usr/bin/env python3
+"""
+ToneIotTelemetry host tool: decodes telemetry batches the same way they
+are encoded by the device (ToneIotTelemetry.cpp) and measures compression.
+
+    toneiot_telemetry.py decode batch.bin|HEX
+    toneiot_telemetry.py ratio [--samples 600] [--period 1000] [--jitter 0]
+
+Batch format (little-endian):
+    version u8, channel count u8, then for every channel:
+    id u8, type u8, varint count, varint time of first sample ms,
+    first value (INT - varint zigzag, FLOAT - f32),
+    next samples: varint zigzag delta-of-delta of time (delta for second),
+    value INT - varint zigzag delta, FLOAT - varint (xor >> tz) << 5 | tz
+
+ratio compares a batch against one raw frame per sample (14 bytes header
++ u32 time + 4 bytes value) for slowly varying signals.
+"""
+
+import argparse
+import math
+import random
+import struct
+import sys
+
+VERSION = 1
+TYPE_INT = 0
+TYPE_FLOAT = 1
+
+FRAME_SIZE = 240      # TOIT_FRAME_SIZE
+CHANNEL_HEADER = 16   # TOIT_CHANNEL_HEADER
+SAMPLE_MAX = 11       # TOIT_SAMPLE_MAX
+FRAME_HEADER = 14     # ToneIotClient packet header
+
+
+def varint(value):
+    out = bytearray()
+    while True:
+        byte = value & 0x7F
+        value >>= 7
+        if value:
+            out.append(byte | 0x80)
+        else:
+            out.append(byte)
+            return bytes(out)
+
+
+def read_varint(data, pos):
+    value = 0
+    shift = 0
+    while True:
+        byte = data[pos]
+        pos += 1
+        value |= (byte & 0x7F) << shift
+        shift += 7
+        if not byte & 0x80:
+            return value, pos
+
+
+def zigzag(value):
+    return ((value << 1) ^ (value >> 31)) & 0xFFFFFFFF
+
+
+def unzigzag(value):
+    return (value >> 1) ^ -(value & 1)
+
+
+def s32(value):
+    value &= 0xFFFFFFFF
+    return value - (1 << 32) if value & 0x80000000 else value
+
+
+def f32_bits(value):
+    return struct.unpack("<I", struct.pack("<f", value))[0]
+
+
+def bits_f32(bits):
+    return struct.unpack("<f", struct.pack("<I", bits))[0]
+
+
+def encode_value(kind, value, last):
+    if kind == TYPE_INT:
+        return varint(zigzag(s32(value - last)))
+    x = value ^ last
+    if x == 0:
+        return varint(0)
+    trailing = 0
+    while not x & 1:
+        x >>= 1
+        trailing += 1
+    return varint((x << 5) | trailing)
+
+
+def encode(channels):
+    """channels {id: (type, [(time ms, value)])} -> batch, like the device
+    without the frame size limit"""
+    out = bytearray([VERSION, 0])
+    for cid, (kind, samples) in channels.items():
+        if not samples:
+            continue
+        values = [f32_bits(v) if kind == TYPE_FLOAT else v & 0xFFFFFFFF for _, v in samples]
+        time0 = samples[0][0] & 0xFFFFFFFF
+        out += bytes([cid, kind]) + varint(len(samples)) + varint(time0)
+        out += struct.pack("<I", values[0]) if kind == TYPE_FLOAT else varint(zigzag(s32(values[0])))
+        last_time, last_delta, last = time0, 0, values[0]
+        for (time, _), value in zip(samples[1:], values[1:]):
+            delta = s32(time - last_time)
+            out += varint(zigzag(s32(delta - last_delta)))
+            out += encode_value(kind, value, last)
+            last_time, last_delta, last = time & 0xFFFFFFFF, delta, value
+        out[1] += 1
+    return bytes(out)
+
+
+def decode(data):
+    """batch -> {id: (type, [(time ms, value)])}"""
+    if len(data) < 2 or data[0] != VERSION:
+        raise ValueError("not a telemetry batch version %d" % VERSION)
+    channels = {}
+    pos = 2
+    for _ in range(data[1]):
+        cid, kind = data[pos], data[pos + 1]
+        count, pos = read_varint(data, pos + 2)
+        time, pos = read_varint(data, pos)
+        if kind == TYPE_FLOAT:
+            value = struct.unpack_from("<I", data, pos)[0]
+            pos += 4
+        else:
+            raw, pos = read_varint(data, pos)
+            value = unzigzag(raw) & 0xFFFFFFFF
+        samples = [(time, value)]
+        delta = 0
+        for _ in range(count - 1):
+            raw, pos = read_varint(data, pos)
+            delta = s32(delta + unzigzag(raw))
+            time = (time + delta) & 0xFFFFFFFF
+            raw, pos = read_varint(data, pos)
+            if kind == TYPE_FLOAT:
+                value ^= (raw >> 5) << (raw & 0x1F) if raw else 0
+            else:
+                value = (value + unzigzag(raw)) & 0xFFFFFFFF
+            samples.append((time, value))
+        if kind == TYPE_FLOAT:
+            samples = [(t, bits_f32(v)) for t, v in samples]
+        else:
+            samples = [(t, s32(v)) for t, v in samples]
+        channels[cid] = (kind, samples)
+    if pos != len(data):
+        raise ValueError("%d bytes after last channel" % (len(data) - pos))
+    return channels
+
+
+def batches(samples, kind):
+    """split one channel the way the device does: a batch is sent when the
+    next sample may not fit"""
+    size, start = 2 + CHANNEL_HEADER, 0
+    for i in range(1, len(samples)):
+        if size + SAMPLE_MAX > FRAME_SIZE:
+            yield samples[start:i]
+            size, start = 2 + CHANNEL_HEADER, i
+        size += len(encode({0: (kind, samples[i - 1:i + 1])})) - len(encode({0: (kind, samples[i - 1:i])}))
+    yield samples[start:]
+
+
+def signal(args, kind):
+    rnd = random.Random(args.seed)
+    time = 0
+    out = []
+    for i in range(args.samples):
+        time += args.period + (rnd.randint(-args.jitter, args.jitter) if args.jitter else 0)
+        if kind == TYPE_FLOAT:
+            value = round(20.0 + 2.0 * math.sin(i / 300.0), 1)  # temperature 0.1 resolution
+        else:
+            value = 3300 + int(20 * math.sin(i / 100.0)) + rnd.randint(-2, 2)  # battery mV
+        out.append((time, value))
+    return out
+
+
+def ratio(args):
+    for kind, name in ((TYPE_INT, "int"), (TYPE_FLOAT, "float")):
+        samples = signal(args, kind)
+        raw = len(samples) * (FRAME_HEADER + 8)
+        wire = 0
+        for part in batches(samples, kind):
+            batch = encode({1: (kind, part)})
+            got = decode(batch)[1][1]
+            if [t for t, _ in got] != [t for t, _ in part] or \
+                    any(abs(a - b) > 1e-3 for (_, a), (_, b) in zip(got, part)):
+                raise AssertionError("decode mismatch")
+            wire += FRAME_HEADER + len(batch)
+        print("%-5s samples=%d raw=%d batched=%d ratio=%.1f bytes/sample=%.2f" % (
+            name, len(samples), raw, wire, raw / float(wire), wire / float(len(samples))))
+    return 0
+
+
+def main(argv):
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    sub = parser.add_subparsers(dest="command", required=True)
+    p = sub.add_parser("decode")
+    p.add_argument("batch", help="file or hex string")
+    p = sub.add_parser("ratio")
+    p.add_argument("--samples", type=int, default=600)
+    p.add_argument("--period", type=int, default=1000, help="ms")
+    p.add_argument("--jitter", type=int, default=0, help="ms")
+    p.add_argument("--seed", type=int, default=1)
+    args = parser.parse_args(argv[1:])
+    if args.command == "ratio":
+        return ratio(args)
+    try:
+        with open(args.batch, "rb") as f:
+            data = f.read()
+    except OSError:
+        data = bytes.fromhex(args.batch)
+    for cid, (kind, samples) in decode(data).items():
+        for time, value in samples:
+            print("%d %d %s" % (cid, time, value))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))